@@ -0,0 +1,158 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Random record reads three ways: blocking pread from a pool of threads, and
+// DataFile::async_read_record from coroutines on the io_uring and thread pool engines.
+// The file's pages are dropped from the page cache before each run.
+//
+// Usage: pentaledger_bench_async_io [--records N] [--length BYTES] [--reads N]
+//                                   [--depth N] [--threads N]
+//   defaults: 65,536 records of 4096 bytes, 200,000 reads, 128 outstanding reads,
+//   8 blocking threads
+
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/io_engine.hpp"
+#include "bench_util.hpp"
+#include <atomic>
+#include <filesystem>
+#include <latch>
+#include <random>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+RPTR random_record(std::mt19937_64& rng, uint64_t records) {
+    return 1 + rng() % records;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 65536);
+    const uint32_t length = static_cast<uint32_t>(option(argc, argv, "--length", 4096));
+    const uint64_t reads = option(argc, argv, "--reads", 200'000);
+    const unsigned depth = static_cast<unsigned>(option(argc, argv, "--depth", 128));
+    const unsigned threads = static_cast<unsigned>(option(argc, argv, "--threads", 8));
+    const std::string path = "bench_async_io.dat";
+
+    std::printf("%llu records of %u bytes, %llu random reads\n",
+                static_cast<unsigned long long>(records), length, static_cast<unsigned long long>(reads));
+
+    {
+        DataFile df = DataFile::create(path, length);
+        const size_t batch = 256;
+        std::vector<uint8_t> data(batch * length, 0x5A);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+        df.flush();
+        df.close();
+    }
+
+    {
+        PosixFile file;
+        file.open(path, O_RDONLY);
+        drop_cache(path);
+        std::atomic<uint64_t> next{0};
+        Stopwatch sw;
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t) {
+            pool.emplace_back([&, t] {
+                std::mt19937_64 rng(t);
+                std::vector<uint8_t> buffer(length);
+                while (next.fetch_add(1) < reads) {
+                    file.read_exact(buffer.data(), length, PLDB_V3_HEADER_SIZE + (random_record(rng, records) - 1) * length);
+                }
+            });
+        }
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        std::string label = "pread, " + std::to_string(threads) + " threads";
+        report(label.c_str(), reads, reads * length, sw.seconds());
+    }
+
+    for (bool thread_pool : {false, true}) {
+        IoEngineOptions engine_options;
+        engine_options.force_thread_pool = thread_pool;
+        engine_options.threads = threads;
+        engine_options.queue_depth = depth;
+        std::unique_ptr<IoEngine> engine = IoEngine::create(engine_options);
+        if (!thread_pool && std::string(engine->name()) != "io_uring") {
+            std::printf("io_uring not available\n");
+            continue;
+        }
+
+        DataFileOptions options;
+        options.io_engine = engine.get();
+        DataFile df = DataFile::open(path, options);
+        drop_cache(path);
+
+        // depth coroutines, each reading its share one record at a time
+        std::atomic<uint64_t> next{0};
+        std::latch finished(depth);
+        std::vector<std::vector<uint8_t>> buffers(depth, std::vector<uint8_t>(length));
+        auto reader = [&](unsigned id) -> Task {
+            std::mt19937_64 rng(id);
+            while (next.fetch_add(1) < reads) {
+                co_await df.async_read_record(random_record(rng, records), buffers[id].data());
+            }
+            finished.count_down();
+        };
+
+        Stopwatch sw;
+        {
+            IoEngine::Batch batch(*engine);
+            for (unsigned i = 0; i < depth; ++i) {
+                reader(i);
+            }
+        }
+        finished.wait();
+        std::string label = std::string(engine->name()) + ", " + std::to_string(depth) + " in flight";
+        report(label.c_str(), reads, reads * length, sw.seconds());
+        df.close();
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
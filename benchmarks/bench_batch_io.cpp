@@ -0,0 +1,142 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares per-record read_record/write_record against the batched
+// read_records/write_records API.
+//
+// Usage: pentaledger_bench_batch_io [--records N] [--length BYTES] [--batch N]
+//   defaults: 10,000,000 records of 64 bytes, batches of 256
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 10'000'000);
+    const uint32_t length = static_cast<uint32_t>(option(argc, argv, "--length", 64));
+    const size_t batch = static_cast<size_t>(option(argc, argv, "--batch", 256));
+    const std::string path = "bench_batch_io.dat";
+
+    std::printf("%llu records of %u bytes, batches of %zu\n",
+                static_cast<unsigned long long>(records), length, batch);
+
+    // Lay out a file of the requested size directly: an empty data file, extended with
+    // zero records and with next_record patched in its header.
+    {
+        DataFile df = DataFile::create(path, length);
+        df.close();
+
+        DataFileHeader header;
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        header.next_record = records + 1;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+        std::filesystem::resize_file(path, sizeof(header) + records * length);
+    }
+
+    DataFile df = DataFile::open(path);
+    std::vector<uint8_t> buffer(batch * length, 0x5A);
+    std::vector<RPTR> numbers(batch);
+    std::vector<ErrorCode> status(batch);
+
+    {
+        Stopwatch sw;
+        for (uint64_t r = 1; r <= records; ++r) {
+            df.write_record(r, buffer.data());
+        }
+        report("write_record (sequential)", records, records * length, sw.seconds());
+    }
+
+    {
+        Stopwatch sw;
+        for (uint64_t first = 1; first <= records; first += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - first + 1));
+            for (size_t i = 0; i < n; ++i) {
+                numbers[i] = first + i;
+            }
+            df.write_records(std::span<const RPTR>(numbers.data(), n), buffer.data(), std::span<ErrorCode>(status.data(), n));
+        }
+        report("write_records (sequential)", records, records * length, sw.seconds());
+    }
+
+    {
+        Stopwatch sw;
+        for (uint64_t r = 1; r <= records; ++r) {
+            df.read_record(r, buffer.data());
+        }
+        report("read_record (sequential)", records, records * length, sw.seconds());
+    }
+
+    {
+        Stopwatch sw;
+        for (uint64_t first = 1; first <= records; first += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - first + 1));
+            for (size_t i = 0; i < n; ++i) {
+                numbers[i] = first + i;
+            }
+            df.read_records(std::span<const RPTR>(numbers.data(), n), buffer.data(), std::span<ErrorCode>(status.data(), n));
+        }
+        report("read_records (sequential)", records, records * length, sw.seconds());
+    }
+
+    // Clustered random access: each batch picks records from a window twice its size,
+    // in random order, so some but not all of them merge into runs.
+    std::mt19937_64 rng(42);
+    const uint64_t lookups = std::min<uint64_t>(records, 1'000'000);
+    const uint64_t window = batch * 2;
+    std::vector<RPTR> random_numbers(lookups);
+    for (uint64_t i = 0; i < lookups; i += batch) {
+        uint64_t base = 1 + rng() % (records - std::min(records, window) + 1);
+        for (uint64_t j = i; j < std::min(lookups, i + batch); ++j) {
+            random_numbers[j] = base + rng() % std::min(records, window);
+        }
+    }
+
+    {
+        Stopwatch sw;
+        for (RPTR r : random_numbers) {
+            df.read_record(r, buffer.data());
+        }
+        report("read_record (clustered)", lookups, lookups * length, sw.seconds());
+    }
+
+    {
+        Stopwatch sw;
+        for (uint64_t i = 0; i < lookups; i += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, lookups - i));
+            df.read_records(std::span<const RPTR>(random_numbers.data() + i, n), buffer.data(), std::span<ErrorCode>(status.data(), n));
+        }
+        report("read_records (clustered)", lookups, lookups * length, sw.seconds());
+    }
+
+    df.close();
+    std::filesystem::remove(path);
+    return 0;
+}
+
@@ -0,0 +1,156 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Point lookups through a BTreeFile index against a full scan of the DataFile it indexes.
+// --records trips are written with an 8-byte id key, inserted into the index in random
+// order, then --lookups random ids are found through the index; a handful are also found
+// by scanning the data file, the fallback without an index.  The lookups are repeated with
+// the non-leaf levels pinned in memory (BTreeFileOptions::pin_upper_levels).  Finally half
+// of the keys are deleted, which merges nodes back together.
+//
+// Usage: pentaledger_bench_btree [--records N] [--lookups N] [--scans N]
+//   defaults: 2,000,000 records, 1,000,000 lookups, 5 scans
+
+#include "pentaledger/btree_file.hpp"
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+constexpr uint32_t LENGTH = 64;
+
+// Big-endian, so that keys sort as the ids do
+void make_key(uint64_t id, char* key) {
+    for (int i = 0; i < 8; ++i) {
+        key[i] = static_cast<char>(id >> (56 - 8 * i));
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = std::max<uint64_t>(option(argc, argv, "--records", 2'000'000), 1);
+    const uint64_t lookups = option(argc, argv, "--lookups", 1'000'000);
+    const uint64_t scans = option(argc, argv, "--scans", 5);
+    const std::string data_path = "bench_btree.dat";
+    const std::string index_path = "bench_btree.btree";
+
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> ids(records);
+    std::iota(ids.begin(), ids.end(), 1);
+    std::shuffle(ids.begin(), ids.end(), rng);
+
+    DataFile df = DataFile::create(data_path, LENGTH);
+    {
+        std::vector<uint8_t> data(LENGTH, 1);
+        for (uint64_t id = 1; id <= records; ++id) {
+            std::memcpy(data.data(), &id, sizeof(id));
+            df.new_record(data.data());
+        }
+        df.flush();
+    }
+
+    BTreeFile btf = BTreeFile::create(index_path, 8);
+    std::printf("%llu records, %d keys per node\n", static_cast<unsigned long long>(records), btf.max_key_per_node());
+    char key[8];
+    {
+        Stopwatch sw;
+        for (uint64_t id : ids) {
+            make_key(id, key);
+            btf.insert_key(key, id);
+        }
+        btf.flush();
+        report("insert", records, records * 8, sw.seconds());
+    }
+
+    std::uniform_int_distribution<uint64_t> any(1, records);
+    std::vector<uint8_t> buffer(LENGTH);
+    auto indexed_lookups = [&](const char* label) {
+        Stopwatch sw;
+        for (uint64_t i = 0; i < lookups; ++i) {
+            uint64_t id = any(rng);
+            make_key(id, key);
+            df.read_record(btf.locate(key), buffer.data());
+            uint64_t found;
+            std::memcpy(&found, buffer.data(), sizeof(found));
+            if (found != id) {
+                std::printf("index lookup of %llu found %llu\n", static_cast<unsigned long long>(id), static_cast<unsigned long long>(found));
+                return 1;
+            }
+        }
+        double seconds = sw.seconds();
+        report(label, lookups, lookups * LENGTH, seconds);
+        std::printf("  %.2f us per lookup\n", seconds * 1e6 / static_cast<double>(std::max<uint64_t>(lookups, 1)));
+        return 0;
+    };
+    if (indexed_lookups("index lookup") != 0) {
+        return 1;
+    }
+
+    // Again with the non-leaf levels in memory, so that each lookup reads only its leaf
+    BTreeFileOptions pinned;
+    pinned.pin_upper_levels = true;
+    btf.close();
+    btf = BTreeFile::open(index_path, pinned);
+    std::printf("%zu non-leaf nodes pinned in %.1f MB\n", btf.pinned_nodes(),
+                static_cast<double>(btf.pinned_memory()) / (1024.0 * 1024.0));
+    if (indexed_lookups("index lookup, pinned") != 0) {
+        return 1;
+    }
+    {
+        Stopwatch sw;
+        for (uint64_t i = 0; i < scans; ++i) {
+            uint64_t id = any(rng);
+            for (std::span<const uint8_t> record : df.scan()) {
+                uint64_t found;
+                std::memcpy(&found, record.data(), sizeof(found));
+                if (found == id) {
+                    break;
+                }
+            }
+        }
+        double seconds = sw.seconds();
+        report("scan lookup", scans, scans * records * LENGTH / 2, seconds);
+        std::printf("  %.0f us per lookup\n", seconds * 1e6 / static_cast<double>(std::max<uint64_t>(scans, 1)));
+    }
+    {
+        Stopwatch sw;
+        for (uint64_t i = 0; i < records / 2; ++i) {
+            make_key(ids[i], key);
+            btf.delete_key(key);
+        }
+        btf.flush();
+        report("delete", records / 2, records / 2 * 8, sw.seconds());
+    }
+
+    btf.close();
+    df.close();
+    std::filesystem::remove(data_path);
+    std::filesystem::remove(index_path);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Builds an index of --keys 8-byte keys three ways: with insert_key() in random order (on
+// the first --inserts keys only, as it is far slower), with a BTreeBuilder fed the keys in
+// order, and with a BTreeBuilder fed them shuffled, which sorts them externally in runs of
+// --memory MiB.  Each built index is spot-checked with locate().
+//
+// Usage: pentaledger_bench_btree_build [--keys N] [--inserts N] [--memory MIB] [--fill PERCENT]
+//   defaults: 10,000,000 keys, 1,000,000 inserts, 64 MiB, 100% fill
+
+#include "pentaledger/btree_builder.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+// Big-endian, so that keys sort as the ids do
+void make_key(uint64_t id, char* key) {
+    for (int i = 0; i < 8; ++i) {
+        key[i] = static_cast<char>(id >> (56 - 8 * i));
+    }
+}
+
+bool spot_check(BTreeFile& btf, uint64_t keys, std::mt19937_64& rng) {
+    std::uniform_int_distribution<uint64_t> any(1, keys);
+    char key[8];
+    for (int i = 0; i < 10'000; ++i) {
+        uint64_t id = any(rng);
+        make_key(id, key);
+        if (btf.locate(key) != id) {
+            std::printf("lookup of %llu failed\n", static_cast<unsigned long long>(id));
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t keys = std::max<uint64_t>(option(argc, argv, "--keys", 10'000'000), 1);
+    const uint64_t inserts = std::clamp<uint64_t>(option(argc, argv, "--inserts", 1'000'000), 1, keys);
+    const uint64_t memory = option(argc, argv, "--memory", 64) * 1024 * 1024;
+    const double fill = static_cast<double>(option(argc, argv, "--fill", 100)) / 100.0;
+    const std::string path = "bench_btree_build.btree";
+
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> ids(keys);
+    std::iota(ids.begin(), ids.end(), 1);
+    std::vector<uint64_t> shuffled = ids;
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+    BTreeBuildOptions options;
+    options.fill_factor = fill;
+    options.memory_limit = memory;
+    std::printf("%llu keys, %.0f%% fill, %.0f MiB to sort in\n", static_cast<unsigned long long>(keys),
+                fill * 100.0, static_cast<double>(memory) / (1024.0 * 1024.0));
+
+    char key[8];
+    {
+        BTreeFile btf = BTreeFile::create(path, 8);
+        std::vector<uint64_t> some(shuffled.begin(), shuffled.begin() + static_cast<std::ptrdiff_t>(inserts));
+        Stopwatch sw;
+        for (uint64_t id : some) {
+            make_key(id, key);
+            btf.insert_key(key, id);
+        }
+        btf.flush();
+        double seconds = sw.seconds();
+        report("insert_key, random order", inserts, inserts * 8, seconds);
+        std::printf("  %.1f s projected for all keys\n", seconds * static_cast<double>(keys) / static_cast<double>(inserts));
+    }
+
+    for (bool in_order : {true, false}) {
+        BTreeFile btf = BTreeFile::create(path, 8);
+        Stopwatch sw;
+        BTreeBuilder builder(btf, options);
+        for (uint64_t id : in_order ? ids : shuffled) {
+            make_key(id, key);
+            builder.add(key, id);
+        }
+        builder.finish();
+        btf.flush();
+        report(in_order ? "builder, sorted input" : "builder, shuffled input", keys, keys * 8, sw.seconds());
+        if (!in_order) {
+            std::printf("  %zu sorted runs\n", builder.runs());
+        }
+        if (!spot_check(btf, keys, rng)) {
+            return 1;
+        }
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
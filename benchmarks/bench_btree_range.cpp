@@ -0,0 +1,148 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Date-range queries over a BTreeFile of trips keyed by (vehicle, day): all the trips of
+// one vehicle over --span days.  Each query is answered with a BTreeCursor, which descends
+// once and then walks the leaves, and again with a locate() per day of the range.  Then
+// the whole index is walked forwards and backwards with a cursor, after dropping it from
+// the page cache, which is where prefetching the next leaf pays off.
+//
+// Usage: pentaledger_bench_btree_range [--vehicles N] [--days N] [--queries N] [--span DAYS]
+//   defaults: 1,000 vehicles over 2,000 days (2,000,000 keys), 10,000 queries of 90 days
+
+#include "pentaledger/btree_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+constexpr int KEY_LENGTH = 8;
+
+// Vehicle then day, both big-endian, so that keys sort by vehicle and then by date
+void make_key(uint32_t vehicle, uint32_t day, char* key) {
+    for (int i = 0; i < 4; ++i) {
+        key[i] = static_cast<char>(vehicle >> (24 - 8 * i));
+        key[4 + i] = static_cast<char>(day >> (24 - 8 * i));
+    }
+}
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint32_t vehicles = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--vehicles", 1000), 1));
+    const uint32_t days = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--days", 2000), 1));
+    const uint64_t queries = option(argc, argv, "--queries", 10'000);
+    const uint32_t span = static_cast<uint32_t>(std::clamp<uint64_t>(option(argc, argv, "--span", 90), 1, days));
+    const uint64_t keys = static_cast<uint64_t>(vehicles) * days;
+    const std::string path = "bench_btree_range.btree";
+
+    BTreeFile btf = BTreeFile::create(path, KEY_LENGTH);
+    {
+        std::vector<char> sorted(keys * KEY_LENGTH);
+        std::vector<RPTR> records(keys);
+        for (uint64_t i = 0; i < keys; ++i) {
+            make_key(static_cast<uint32_t>(i / days), static_cast<uint32_t>(i % days), sorted.data() + i * KEY_LENGTH);
+            records[i] = i + 1;
+        }
+        btf.build(sorted.data(), records);
+        btf.flush();
+    }
+    std::printf("%llu trips (%u vehicles over %u days), %llu queries of %u days\n",
+                static_cast<unsigned long long>(keys), vehicles, days,
+                static_cast<unsigned long long>(queries), span);
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint32_t> any_vehicle(0, vehicles - 1);
+    std::uniform_int_distribution<uint32_t> any_start(0, days - span);
+    std::vector<std::pair<uint32_t, uint32_t>> ranges(queries);
+    for (auto& range : ranges) {
+        range = {any_vehicle(rng), any_start(rng)};
+    }
+
+    char from[KEY_LENGTH];
+    char to[KEY_LENGTH];
+    uint64_t expected = 0;
+    {
+        Stopwatch sw;
+        BTreeCursor cursor = btf.cursor();
+        for (auto [vehicle, start] : ranges) {
+            make_key(vehicle, start, from);
+            make_key(vehicle, start + span, to);
+            for (cursor.lower_bound(from); cursor.valid() && std::memcmp(cursor.key(), to, KEY_LENGTH) < 0; cursor.next()) {
+                expected += cursor.record();
+            }
+        }
+        double seconds = sw.seconds();
+        report("range, cursor", queries * span, queries * span * KEY_LENGTH, seconds);
+        std::printf("  %.2f us per query\n", seconds * 1e6 / static_cast<double>(std::max<uint64_t>(queries, 1)));
+    }
+    {
+        Stopwatch sw;
+        uint64_t sum = 0;
+        for (auto [vehicle, start] : ranges) {
+            for (uint32_t day = start; day < start + span; ++day) {
+                make_key(vehicle, day, from);
+                sum += btf.locate(from);
+            }
+        }
+        double seconds = sw.seconds();
+        report("range, locate per day", queries * span, queries * span * KEY_LENGTH, seconds);
+        std::printf("  %.2f us per query\n", seconds * 1e6 / static_cast<double>(std::max<uint64_t>(queries, 1)));
+        if (sum != expected) {
+            std::printf("checksum mismatch: %llu != %llu\n",
+                        static_cast<unsigned long long>(sum), static_cast<unsigned long long>(expected));
+            return 1;
+        }
+    }
+
+    // Whole-index walks from a cold page cache
+    for (bool forward : {true, false}) {
+        drop_cache(path);
+        Stopwatch sw;
+        BTreeCursor cursor = btf.cursor();
+        uint64_t seen = 0;
+        for (bool more = forward ? cursor.first() : cursor.last(); more; more = forward ? cursor.next() : cursor.prev()) {
+            ++seen;
+        }
+        report(forward ? "cold walk, forward" : "cold walk, reverse", seen, seen * KEY_LENGTH, sw.seconds());
+        if (seen != keys) {
+            std::printf("walk saw %llu keys\n", static_cast<unsigned long long>(seen));
+            return 1;
+        }
+    }
+
+    btf.close();
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Bulk-loads a generated CSV file of trips (id:int64, miles:double, started:int64,
+// category:string:16) with BulkLoader, on one parser thread and on --threads, then again
+// building a B-tree index on the id column.  For comparison, the same records are written
+// one at a time with DataFile::new_record(), already converted, which is the write path a
+// loader without append_records() would take.  The target is millions of records per second.
+//
+// Usage: pentaledger_bench_bulk_load [--records N] [--threads N]
+//   defaults: 5,000,000 records, one parser thread per core
+
+#include "pentaledger/bulk_loader.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/btree_file.hpp"
+#include "bench_util.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+const char* COLUMNS = "id:int64,miles:double,started:int64,category:string:16";
+const std::string INPUT_PATH = "bench_bulk_load.csv";
+const std::string DATA_PATH = "bench_bulk_load.dat";
+const std::string INDEX_PATH = "bench_bulk_load.btree";
+
+uint64_t generate(uint64_t records) {
+    static const char* categories[] = {"business", "commute", "medical", "charity", "personal"};
+    std::mt19937_64 rng(42);
+    std::ofstream out(INPUT_PATH, std::ios::binary);
+    std::string line = "id,miles,started,category\n";
+    out << line;
+    uint64_t bytes = line.size();
+    for (uint64_t i = 1; i <= records; ++i) {
+        // Ids shuffled, so that the index build has to sort
+        uint64_t id = (i * 2654435761u) % (records * 4);
+        line = std::to_string(id) + "," + std::to_string(rng() % 50000 / 100.0) + "," +
+               std::to_string(1700000000 + i * 60) + "," + categories[rng() % 5] + "\n";
+        out << line;
+        bytes += line.size();
+    }
+    return bytes;
+}
+
+void load(const char* label, unsigned threads, bool index) {
+    std::filesystem::remove(DATA_PATH);
+    std::filesystem::remove(INDEX_PATH);
+    BulkLoadOptions options;
+    options.threads = threads;
+    options.key_column = index ? 0 : -1;
+    BulkLoader loader(parse_load_columns(COLUMNS), options);
+    DataFile df = DataFile::create(DATA_PATH, loader.record_length());
+    Stopwatch sw;
+    BulkLoadResult result;
+    if (index) {
+        BTreeFile btf = BTreeFile::create(INDEX_PATH, 8);
+        result = loader.load(INPUT_PATH, df, &btf);
+        btf.close();
+    } else {
+        result = loader.load(INPUT_PATH, df);
+    }
+    df.close();
+    report(label, result.records, result.bytes_read, sw.seconds());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 5'000'000);
+    const unsigned threads = static_cast<unsigned>(option(argc, argv, "--threads", std::max(1u, std::thread::hardware_concurrency())));
+
+    uint64_t bytes = generate(records);
+    std::printf("%llu records, %.1f MB of CSV, %u parser threads\n",
+                static_cast<unsigned long long>(records), static_cast<double>(bytes) / (1024.0 * 1024.0), threads);
+
+    {
+        BulkLoader loader(parse_load_columns(COLUMNS));
+        std::vector<uint8_t> data(loader.record_length(), 1);
+        std::filesystem::remove(DATA_PATH);
+        DataFile df = DataFile::create(DATA_PATH, loader.record_length());
+        Stopwatch sw;
+        for (uint64_t i = 1; i <= records; ++i) {
+            std::memcpy(data.data(), &i, sizeof(i));
+            df.new_record(data.data());
+        }
+        df.close();
+        report("new_record loop (no parsing)", records, records * loader.record_length(), sw.seconds());
+    }
+
+    load("bulk load, 1 thread", 1, false);
+    load("bulk load", threads, false);
+    load("bulk load + index", threads, true);
+
+    std::filesystem::remove(INPUT_PATH);
+    std::filesystem::remove(DATA_PATH);
+    std::filesystem::remove(INDEX_PATH);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Measures what record checksums cost on the read path.  Two files hold the same
+// records, one created with record_checksums; each is read with random read_record()
+// calls and a full scan warm in the page cache, which exposes the CPU cost of the
+// checksum, then with a scan after the file is dropped from the cache (POSIX_FADV_DONTNEED),
+// where the cost is mostly hidden behind the reads.  The raw crc32c() rate is printed
+// first, hardware and slice-by-8.
+//
+// Usage: pentaledger_bench_checksums [--records N] [--length BYTES] [--reads N]
+//   defaults: 2,000,000 records of 128 bytes, 2,000,000 random reads
+
+#include "pentaledger/crc32c.hpp"
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+uint64_t scan_ids(DataFile& df) {
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        uint64_t id;
+        std::memcpy(&id, record.data(), sizeof(id));
+        sum += id;
+    }
+    return sum;
+}
+
+void write_file(const std::string& path, uint64_t records, uint32_t length, bool checksums) {
+    DataFileOptions options;
+    options.record_checksums = checksums;
+    DataFile df = DataFile::create(path, length, options);
+
+    const size_t batch = 4096;
+    std::vector<uint8_t> data(batch * length);
+    std::vector<RPTR> numbers(batch);
+    for (uint64_t done = 0; done < records; done += batch) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t id = done + i + 1;
+            std::memcpy(data.data() + i * length, &id, sizeof(id));
+        }
+        df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+    }
+    df.flush();
+}
+
+// Random point reads, then a scan; returns the sum of the ids seen, to compare files
+uint64_t read_file(const char* label, const std::string& path, uint64_t records, uint32_t length, uint64_t reads) {
+    DataFile df = DataFile::open(path);
+    std::mt19937_64 rng(11);
+    std::vector<uint8_t> buffer(length);
+    uint64_t sum = 0;
+
+    // One untimed scan brings the file into the page cache
+    for (std::span<const uint8_t> record : df.scan()) {
+        sum += record[0];
+    }
+
+    std::string name = std::string(label) + " read_record";
+    Stopwatch sw;
+    for (uint64_t i = 0; i < reads; ++i) {
+        df.read_record(rng() % records + 1, buffer.data());
+        sum += buffer[0];
+    }
+    report(name.c_str(), reads, reads * length, sw.seconds());
+
+    name = std::string(label) + " scan";
+    sw = Stopwatch();
+    sum += scan_ids(df);
+    report(name.c_str(), records, records * length, sw.seconds());
+
+    name = std::string(label) + " cold scan";
+    drop_cache(path);
+    sw = Stopwatch();
+    sum += scan_ids(df);
+    report(name.c_str(), records, records * length, sw.seconds());
+    return sum;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 2'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), 8));
+    const uint64_t reads = option(argc, argv, "--reads", 2'000'000);
+    const std::string plain_path = "bench_checksums_plain.dat";
+    const std::string checked_path = "bench_checksums_crc.dat";
+
+    {
+        std::vector<uint8_t> data(64 * 1024 * 1024, 0x5a);
+        uint32_t crc = 0;
+        Stopwatch sw;
+        crc ^= crc32c(data.data(), data.size());
+        report(crc32c_hardware() ? "crc32c (sse4.2)" : "crc32c (slice-by-8)", 1, data.size(), sw.seconds());
+        sw = Stopwatch();
+        crc ^= crc32c_portable(data.data(), data.size());
+        report("crc32c_portable", 1, data.size(), sw.seconds());
+        if (crc != 0) {
+            std::printf("crc32c implementations disagree\n");
+            return 1;
+        }
+    }
+
+    std::printf("%llu records of %u bytes (%.1f MB)\n", static_cast<unsigned long long>(records), length,
+                static_cast<double>(records * length) / (1024.0 * 1024.0));
+    write_file(plain_path, records, length, false);
+    write_file(checked_path, records, length, true);
+
+    uint64_t plain = read_file("plain", plain_path, records, length, reads);
+    uint64_t checked = read_file("checksummed", checked_path, records, length, reads);
+
+    std::filesystem::remove(plain_path);
+    std::filesystem::remove(checked_path);
+    if (plain != checked) {
+        std::printf("files differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Measures DataFile::compact() on a file with --dead percent of its records deleted at
+// random, and the full scan of the file before and after.  Compaction runs in slices of
+// --slice microseconds, as it would beside a live workload.  The first slice, which loads
+// and sorts the free list, is reported apart from the longest of the rest.
+//
+// Usage: pentaledger_bench_compaction [--records N] [--length BYTES] [--dead PERCENT] [--slice US]
+//   defaults: 2,000,000 records of 128 bytes, 40% dead, 5 ms slices
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+uint64_t scan_all(DataFile& df, const char* label) {
+    Stopwatch sw;
+    uint64_t live = 0;
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        sum += record[0];
+        ++live;
+    }
+    report(label, live, df.next_record() * df.record_length(), sw.seconds());
+    if (sum == 0 && live != 0) {
+        std::printf("unexpected record contents\n");
+    }
+    return live;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 2'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), sizeof(RPTR)));
+    const uint64_t dead = std::min<uint64_t>(option(argc, argv, "--dead", 40), 100);
+    const std::chrono::microseconds slice_budget(option(argc, argv, "--slice", 5000));
+    const std::string path = "bench_compaction.dat";
+
+    DataFile df = DataFile::create(path, length);
+    {
+        const size_t batch = 4096;
+        std::vector<uint8_t> data(batch * length, 0x5A);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+    }
+    std::vector<RPTR> victims(records);
+    std::iota(victims.begin(), victims.end(), RPTR{1});
+    std::shuffle(victims.begin(), victims.end(), std::mt19937_64(42));
+    victims.resize(records * dead / 100);
+    for (RPTR n : victims) {
+        df.delete_record(n);
+    }
+    df.flush();
+
+    std::printf("%llu records of %u bytes, %llu deleted, file %.1f MB\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<unsigned long long>(victims.size()),
+                static_cast<double>(std::filesystem::file_size(path)) / (1024.0 * 1024.0));
+
+    const uint64_t live_before = scan_all(df, "scan before");
+
+    CompactionOptions slice;
+    slice.time_budget = slice_budget;
+    uint64_t moves = 0;
+    uint64_t slices = 0;
+    double first = 0;
+    double longest = 0;
+    Stopwatch total;
+    for (CompactionResult result; !result.complete; ++slices) {
+        Stopwatch sw;
+        result = df.compact(slice);
+        if (slices == 0) {
+            first = sw.seconds();
+        } else {
+            longest = std::max(longest, sw.seconds());
+        }
+        moves += result.moves.size();
+    }
+    df.flush();
+    report("compact (moves)", moves, moves * length, total.seconds());
+    std::printf("%llu slices, first %.2f ms, longest of the rest %.2f ms, file %.1f MB\n",
+                static_cast<unsigned long long>(slices), first * 1000.0, longest * 1000.0,
+                static_cast<double>(std::filesystem::file_size(path)) / (1024.0 * 1024.0));
+
+    const uint64_t live_after = scan_all(df, "scan after");
+    df.close();
+    std::filesystem::remove(path);
+    if (live_after != live_before) {
+        std::printf("record count mismatch: %llu != %llu\n",
+                    static_cast<unsigned long long>(live_after), static_cast<unsigned long long>(live_before));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares a plain DataFile against a compressed one (DataFileOptions::compressed) on
+// ledger-like records: an id, an amount, a category code from a short list, and zero
+// padding.  Reports the size on disk, then a cold-cache scan and random read_record()
+// calls on each file.
+//
+// Usage: pentaledger_bench_compression [--records N] [--length BYTES] [--page BYTES]
+//   defaults: 4,000,000 records of 96 bytes, 64 KiB compressed pages
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+void fill(const std::string& path, uint64_t records, uint32_t length, const DataFileOptions& options) {
+    static const char* categories[] = {"FUEL", "TOLL", "MEAL", "LODGING", "PARKING", "AIRFARE"};
+    DataFile df = DataFile::create(path, length, options);
+    const size_t batch = 4096;
+    std::vector<uint8_t> data(batch * length);
+    std::vector<RPTR> numbers(batch);
+    std::mt19937_64 rng(42);
+    for (uint64_t done = 0; done < records; done += batch) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+        std::fill(data.begin(), data.end(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t* record = data.data() + i * length;
+            uint64_t id = done + i + 1;
+            uint32_t cents = static_cast<uint32_t>(rng() % 100000);
+            std::memcpy(record, &id, sizeof(id));
+            std::memcpy(record + 8, &cents, std::min<size_t>(sizeof(cents), length - 8));
+            if (length >= 32) {
+                std::strncpy(reinterpret_cast<char*>(record + 16), categories[rng() % 6], 16);
+            }
+        }
+        df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+    }
+    df.flush();
+}
+
+uint64_t scan(const std::string& path, const char* label, uint64_t records, uint32_t length) {
+    DataFile df = DataFile::open(path);
+    drop_cache(path);
+    Stopwatch sw;
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        uint64_t id;
+        std::memcpy(&id, record.data(), sizeof(id));
+        sum += id;
+    }
+    report(label, records, records * length, sw.seconds());
+    return sum;
+}
+
+void random_reads(const std::string& path, const char* label, uint64_t records, uint32_t length, uint64_t reads) {
+    DataFile df = DataFile::open(path);
+    std::vector<uint8_t> buffer(length);
+    std::mt19937_64 rng(7);
+    Stopwatch sw;
+    for (uint64_t i = 0; i < reads; ++i) {
+        df.read_record(1 + rng() % records, buffer.data());
+    }
+    report(label, reads, reads * length, sw.seconds());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 4'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 96), 16));
+    const uint32_t page = static_cast<uint32_t>(option(argc, argv, "--page", 64 * 1024));
+    const std::string plain_path = "bench_compression_plain.dat";
+    const std::string packed_path = "bench_compression_packed.dat";
+
+    DataFileOptions packed;
+    packed.compressed = true;
+    packed.compressed_page_size = page;
+
+    {
+        Stopwatch sw;
+        fill(plain_path, records, length, {});
+        report("load plain", records, records * length, sw.seconds());
+    }
+    {
+        Stopwatch sw;
+        fill(packed_path, records, length, packed);
+        report("load compressed", records, records * length, sw.seconds());
+    }
+
+    uint64_t plain_size = std::filesystem::file_size(plain_path);
+    uint64_t packed_size = std::filesystem::file_size(packed_path);
+    std::printf("%llu records of %u bytes: %.1f MB plain, %.1f MB compressed (%.2fx)\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<double>(plain_size) / (1024.0 * 1024.0), static_cast<double>(packed_size) / (1024.0 * 1024.0),
+                static_cast<double>(plain_size) / static_cast<double>(packed_size));
+
+    uint64_t expected = scan(plain_path, "cold scan plain", records, length);
+    if (scan(packed_path, "cold scan compressed", records, length) != expected) {
+        std::printf("checksum mismatch\n");
+        return 1;
+    }
+
+    random_reads(plain_path, "read_record plain", records, length, 50000);
+    random_reads(packed_path, "read_record compressed", records, length, 50000);
+
+    std::filesystem::remove(plain_path);
+    std::filesystem::remove(packed_path);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Scaling of a concurrent DataFile (DataFileOptions::concurrent) across threads.  Each
+// thread count runs the same total number of random read_record() calls, split evenly
+// between the threads, against a file warm in the page cache; then the same for
+// write_record() on records owned by each thread.  Reads take no locks, so read throughput
+// should grow with the thread count up to the number of cores.
+//
+// Usage: pentaledger_bench_concurrency [--records N] [--length BYTES] [--ops N] [--threads N]
+//   defaults: 1,000,000 records of 128 bytes, 4,000,000 operations, up to 16 threads
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+// Run body(thread, operations) on each of threads threads and return the elapsed seconds
+template <class Body>
+double run_threads(unsigned threads, uint64_t operations, Body body) {
+    std::vector<std::thread> workers;
+    std::atomic<bool> go{false};
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            body(t, operations / threads);
+        });
+    }
+    Stopwatch sw;
+    go.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return sw.seconds();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 1'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), 8));
+    const uint64_t operations = option(argc, argv, "--ops", 4'000'000);
+    const unsigned max_threads = static_cast<unsigned>(option(argc, argv, "--threads", 16));
+    const std::string path = "bench_concurrency.dat";
+
+    DataFileOptions options;
+    options.concurrent = true;
+    DataFile df = DataFile::create(path, length, options);
+    {
+        const size_t batch = 4096;
+        std::vector<uint8_t> data(batch * length, 0x5a);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+        df.flush();
+        for (std::span<const uint8_t> record : df.scan()) {
+            (void)record;
+        }
+    }
+
+    std::printf("%llu records of %u bytes, %llu operations per run, %u hardware threads\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<unsigned long long>(operations), std::thread::hardware_concurrency());
+
+    double single = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        double seconds = run_threads(threads, operations, [&](unsigned t, uint64_t count) {
+            std::mt19937_64 rng(t + 1);
+            std::vector<uint8_t> buffer(length);
+            for (uint64_t i = 0; i < count; ++i) {
+                df.read_record(rng() % records + 1, buffer.data());
+            }
+        });
+        single = threads == 1 ? seconds : single;
+        char label[64];
+        std::snprintf(label, sizeof(label), "read  %2u threads (%.1fx)", threads, single / seconds);
+        report(label, operations, operations * length, seconds);
+    }
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        double seconds = run_threads(threads, operations, [&](unsigned t, uint64_t count) {
+            // Thread t owns the records congruent to t modulo threads
+            std::mt19937_64 rng(t + 1);
+            std::vector<uint8_t> buffer(length, static_cast<uint8_t>(t));
+            const uint64_t owned = records / threads;
+            for (uint64_t i = 0; i < count; ++i) {
+                df.write_record((rng() % owned) * threads + t + 1, buffer.data());
+            }
+        });
+        single = threads == 1 ? seconds : single;
+        char label[64];
+        std::snprintf(label, sizeof(label), "write %2u threads (%.1fx)", threads, single / seconds);
+        report(label, operations, operations * length, seconds);
+    }
+
+    df.close();
+    std::filesystem::remove(path);
+    return 0;
+}
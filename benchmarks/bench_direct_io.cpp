@@ -0,0 +1,139 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares random record reads through the kernel page cache (pread, packed layout)
+// against direct I/O into a buffer pool of --cache MiB (block-aligned layout).  Reads are
+// skewed: --hot percent of them go to the first tenth of the file.  Both files are
+// dropped from the page cache before each pass, so each pass starts cold.
+//
+// Usage: pentaledger_bench_direct_io [--records N] [--length BYTES] [--reads N] [--cache MIB] [--hot PERCENT]
+//   defaults: 2,000,000 records of 128 bytes, 1,000,000 reads, 64 MiB pool, 90% hot
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+void fill(DataFile& df, uint64_t records, uint32_t length) {
+    const size_t batch = 4096;
+    std::vector<uint8_t> data(batch * length);
+    std::vector<RPTR> numbers(batch);
+    for (uint64_t done = 0; done < records; done += batch) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+        for (size_t i = 0; i < n; ++i) {
+            std::memset(data.data() + i * length, static_cast<int>((done + i) % 255 + 1), length);
+        }
+        df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+    }
+    df.flush();
+}
+
+uint64_t random_reads(DataFile& df, const std::vector<RPTR>& order, const char* label) {
+    std::vector<uint8_t> buffer(df.record_length());
+    Stopwatch sw;
+    uint64_t sum = 0;
+    for (RPTR record : order) {
+        df.read_record(record, buffer.data());
+        sum += buffer[0];
+    }
+    report(label, order.size(), order.size() * df.record_length(), sw.seconds());
+    return sum;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 2'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), sizeof(RPTR)));
+    const uint64_t reads = option(argc, argv, "--reads", 1'000'000);
+    const uint64_t cache = option(argc, argv, "--cache", 64) * 1024 * 1024;
+    const uint64_t hot = std::min<uint64_t>(option(argc, argv, "--hot", 90), 100);
+    const std::string buffered_path = "bench_direct_io_buffered.dat";
+    const std::string direct_path = "bench_direct_io_direct.dat";
+
+    std::printf("%llu records of %u bytes (%.1f MB), %llu reads, %.0f MiB pool\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<double>(records * length) / (1024.0 * 1024.0),
+                static_cast<unsigned long long>(reads), static_cast<double>(cache) / (1024.0 * 1024.0));
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<RPTR> all(1, static_cast<RPTR>(records));
+    std::uniform_int_distribution<RPTR> hot_set(1, static_cast<RPTR>(std::max<uint64_t>(records / 10, 1)));
+    std::uniform_int_distribution<uint64_t> percent(0, 99);
+    std::vector<RPTR> order(reads);
+    for (RPTR& record : order) {
+        record = percent(rng) < hot ? hot_set(rng) : all(rng);
+    }
+
+    uint64_t expected = 0;
+    {
+        DataFile df = DataFile::create(buffered_path, length);
+        fill(df, records, length);
+        df.close();
+        drop_cache(buffered_path);
+        df = DataFile::open(buffered_path);
+        expected = random_reads(df, order, "buffered pread");
+    }
+
+    BufferPool pool(cache);
+    DataFileOptions options;
+    options.buffer_pool = &pool;
+    options.direct_io = true;
+    try {
+        DataFile df = DataFile::create(direct_path, length, options);
+        fill(df, records, length);
+        df.close();
+        drop_cache(direct_path);
+        df = DataFile::open(direct_path, options);
+        BufferPool::Stats before = pool.stats();
+        uint64_t sum = random_reads(df, order, "direct + pool");
+        BufferPool::Stats after = pool.stats();
+        uint64_t hits = after.hits - before.hits;
+        uint64_t misses = after.misses - before.misses;
+        std::printf("pool hit rate %.1f%%\n",
+                    100.0 * static_cast<double>(hits) / static_cast<double>(std::max<uint64_t>(hits + misses, 1)));
+        if (sum != expected) {
+            std::printf("checksum mismatch: %llu != %llu\n",
+                        static_cast<unsigned long long>(sum), static_cast<unsigned long long>(expected));
+            return 1;
+        }
+    } catch (const DatabaseException& e) {
+        std::printf("direct I/O unavailable: %s\n", e.what());
+    }
+
+    std::filesystem::remove(buffered_path);
+    std::filesystem::remove(direct_path);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares appending records one at a time to a file that grows a write at a time
+// against one that grows in --extent MiB extents (DataFileOptions::growth_extent), then
+// scans each file cold.  Two files are appended to in turns, as two tables of a database
+// would be, which is what fragments a file that grows a record at a time.
+//
+// Usage: pentaledger_bench_growth [--records N] [--length BYTES] [--extent MIB]
+//   defaults: 2,000,000 records of 128 bytes per file, 64 MiB extents
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::fdatasync(file.fd());
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+void run(const char* append_label, const char* scan_label, uint64_t records, uint32_t length,
+         const DataFileOptions& options) {
+    const std::string paths[2] = {"bench_growth_a.dat", "bench_growth_b.dat"};
+    {
+        DataFile a = DataFile::create(paths[0], length, options);
+        DataFile b = DataFile::create(paths[1], length, options);
+        std::vector<uint8_t> data(length);
+        Stopwatch sw;
+        for (uint64_t i = 0; i < records; ++i) {
+            std::memset(data.data(), static_cast<int>(i % 255 + 1), length);
+            a.new_record(data.data());
+            b.new_record(data.data());
+        }
+        a.flush();
+        b.flush();
+        report(append_label, 2 * records, 2 * records * length, sw.seconds());
+    }
+
+    drop_cache(paths[0]);
+    DataFile df = DataFile::open(paths[0]);
+    Stopwatch sw;
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        sum += record[0];
+    }
+    report(scan_label, records, records * length, sw.seconds());
+    if (sum == 0 && records != 0) {
+        std::printf("unexpected record contents\n");
+    }
+    df.close();
+
+    std::filesystem::remove(paths[0]);
+    std::filesystem::remove(paths[1]);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 2'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), sizeof(RPTR)));
+    const uint64_t extent = option(argc, argv, "--extent", 64) * 1024 * 1024;
+
+    std::printf("2 files of %llu records of %u bytes (%.1f MB each), %.0f MiB extents\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<double>(records * length) / (1024.0 * 1024.0),
+                static_cast<double>(extent) / (1024.0 * 1024.0));
+
+    run("append, write at a time", "scan", records, length, DataFileOptions{});
+
+    DataFileOptions options;
+    options.growth_extent = extent;
+    options.trim_on_close = true;
+    run("append, extents", "scan", records, length, options);
+    return 0;
+}
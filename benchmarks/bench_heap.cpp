@@ -0,0 +1,163 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Variable-length records in a HeapFile against the same records padded to the longest
+// in a DataFile.  Each record is a GPS route of 16-byte points behind a 4-byte count; the
+// point counts are skewed so that the average route is about a sixth of the longest.
+// Reports the size of each file against the payload, then insert, random read and scan
+// throughput.
+//
+// Usage: pentaledger_bench_heap [--records N] [--max-points N] [--reads N]
+//   defaults: 200,000 routes of up to 1,024 points, 200,000 random reads
+
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/heap_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+constexpr uint32_t POINT_SIZE = 16;
+
+// A route of points points, prefixed with its point count
+void make_route(uint32_t points, uint32_t seed, std::vector<uint8_t>& route) {
+    route.resize(sizeof(points) + static_cast<size_t>(points) * POINT_SIZE);
+    std::memcpy(route.data(), &points, sizeof(points));
+    for (size_t i = sizeof(points); i < route.size(); ++i) {
+        route[i] = static_cast<uint8_t>(seed + i);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 200'000);
+    const uint32_t max_points = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--max-points", 1024), 1));
+    const uint64_t reads = option(argc, argv, "--reads", 200'000);
+    const std::string heap_path = "bench_heap.dat";
+    const std::string padded_path = "bench_heap_padded.dat";
+    const uint32_t padded_length = sizeof(uint32_t) + max_points * POINT_SIZE;
+
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<uint32_t> points(records);
+    uint64_t payload = 0;
+    for (uint32_t& p : points) {
+        p = 1 + static_cast<uint32_t>(std::pow(unit(rng), 5.0) * (max_points - 1));
+        payload += sizeof(uint32_t) + static_cast<uint64_t>(p) * POINT_SIZE;
+    }
+
+    std::printf("%llu routes, %.1f MB of payload, longest %u bytes\n", static_cast<unsigned long long>(records),
+                static_cast<double>(payload) / (1024.0 * 1024.0), padded_length);
+
+    std::vector<RPTR> heap_numbers(records);
+    std::vector<RPTR> padded_numbers(records);
+    std::vector<uint8_t> route;
+    std::vector<uint8_t> padded(padded_length);
+    {
+        HeapFile hf = HeapFile::create(heap_path);
+        Stopwatch sw;
+        for (uint64_t i = 0; i < records; ++i) {
+            make_route(points[i], static_cast<uint32_t>(i), route);
+            heap_numbers[i] = hf.new_record(route.data(), static_cast<uint32_t>(route.size()));
+        }
+        hf.flush();
+        report("heap insert", records, payload, sw.seconds());
+    }
+    {
+        DataFile df = DataFile::create(padded_path, padded_length);
+        Stopwatch sw;
+        for (uint64_t i = 0; i < records; ++i) {
+            make_route(points[i], static_cast<uint32_t>(i), route);
+            std::copy(route.begin(), route.end(), padded.begin());
+            std::fill(padded.begin() + static_cast<ptrdiff_t>(route.size()), padded.end(), 0);
+            padded_numbers[i] = df.new_record(padded.data());
+        }
+        df.flush();
+        report("padded insert", records, payload, sw.seconds());
+    }
+
+    const uint64_t heap_size = std::filesystem::file_size(heap_path);
+    const uint64_t padded_size = std::filesystem::file_size(padded_path);
+    std::printf("heap file   %8.1f MB (%.2fx payload)\n", static_cast<double>(heap_size) / (1024.0 * 1024.0),
+                static_cast<double>(heap_size) / static_cast<double>(payload));
+    std::printf("padded file %8.1f MB (%.2fx payload)\n", static_cast<double>(padded_size) / (1024.0 * 1024.0),
+                static_cast<double>(padded_size) / static_cast<double>(payload));
+
+    {
+        HeapFile hf = HeapFile::open(heap_path);
+        std::mt19937_64 pick(2);
+        uint64_t bytes = 0;
+        Stopwatch sw;
+        for (uint64_t i = 0; i < reads; ++i) {
+            hf.read_record(heap_numbers[pick() % records], route);
+            bytes += route.size();
+        }
+        report("heap random read", reads, bytes, sw.seconds());
+    }
+    {
+        DataFile df = DataFile::open(padded_path);
+        std::mt19937_64 pick(2);
+        uint64_t bytes = 0;
+        Stopwatch sw;
+        for (uint64_t i = 0; i < reads; ++i) {
+            uint64_t n = pick() % records;
+            df.read_record(padded_numbers[n], padded.data());
+            bytes += sizeof(uint32_t) + static_cast<uint64_t>(points[n]) * POINT_SIZE;
+        }
+        report("padded random read", reads, bytes, sw.seconds());
+    }
+
+    {
+        HeapFile hf = HeapFile::open(heap_path);
+        uint64_t total = 0;
+        Stopwatch sw;
+        for (std::span<const uint8_t> record : hf.scan()) {
+            uint32_t p;
+            std::memcpy(&p, record.data(), sizeof(p));
+            total += p;
+        }
+        report("heap scan", records, payload, sw.seconds());
+        std::printf("  %llu points\n", static_cast<unsigned long long>(total));
+    }
+    {
+        DataFile df = DataFile::open(padded_path);
+        uint64_t total = 0;
+        Stopwatch sw;
+        for (std::span<const uint8_t> record : df.scan()) {
+            uint32_t p;
+            std::memcpy(&p, record.data(), sizeof(p));
+            total += p;
+        }
+        report("padded scan", records, payload, sw.seconds());
+        std::printf("  %llu points\n", static_cast<unsigned long long>(total));
+    }
+
+    std::filesystem::remove(heap_path);
+    std::filesystem::remove(padded_path);
+    return 0;
+}
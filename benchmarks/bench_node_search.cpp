@@ -0,0 +1,94 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Cost of searching one full B-tree node, for each key length a BTreeFile allows from
+// 4 to MAX_KEY_LENGTH bytes: node_lower_bound(), which compares 4- and 8-byte keys with
+// the SIMD kernel picked for this CPU, against a binary search with memcmp.  Nodes are
+// filled with sorted random keys and searched for random keys, from a set of nodes too
+// large to stay in L1.
+//
+// Usage: pentaledger_bench_node_search [--searches N] [--nodes N]
+//   defaults: 20,000,000 searches over 4,096 nodes
+
+#include "pentaledger/btree_file.hpp"
+#include "pentaledger/node_search.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+int main(int argc, char* argv[]) {
+    const uint64_t searches = option(argc, argv, "--searches", 20'000'000);
+    const size_t node_count = static_cast<size_t>(std::max<uint64_t>(option(argc, argv, "--nodes", 4096), 1));
+    std::printf("%llu searches over %zu nodes, %s kernel\n",
+                static_cast<unsigned long long>(searches), node_count, node_search_kernel());
+
+    std::mt19937_64 rng(42);
+    for (size_t key_length : {4, 8, 12, 16, 20, 32, 48, 64, MAX_KEY_LENGTH}) {
+        const size_t stride = key_length + ADR;
+        const int count = static_cast<int>(sizeof(BTreeNode::keyspace) / stride);
+        std::vector<BTreeNode> nodes(node_count);
+        for (BTreeNode& node : nodes) {
+            std::vector<std::string> keys(count, std::string(key_length, '\0'));
+            for (std::string& key : keys) {
+                for (char& c : key) {
+                    c = static_cast<char>(rng());
+                }
+            }
+            std::sort(keys.begin(), keys.end());
+            node.key_count = count;
+            for (int i = 0; i < count; ++i) {
+                std::memcpy(node.keyspace + i * stride, keys[i].data(), key_length);
+            }
+        }
+        const size_t target_count = 1024;
+        std::string targets(target_count * key_length, '\0');
+        for (char& c : targets) {
+            c = static_cast<char>(rng());
+        }
+
+        auto run = [&](const char* method, auto search) {
+            char label[64];
+            std::snprintf(label, sizeof(label), "%2zu-byte keys x%-2d, %s", key_length, count, method);
+            Stopwatch sw;
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < searches; ++i) {
+                const BTreeNode& node = nodes[(i * 2654435761u) % node_count];
+                sum += search(node.keyspace, count, key_length, stride, targets.data() + i % target_count * key_length);
+            }
+            double seconds = sw.seconds();
+            report(label, searches, 0, seconds);
+            std::printf("  %.1f ns per node%s\n", seconds * 1e9 / static_cast<double>(std::max<uint64_t>(searches, 1)),
+                        sum == 0 ? " (no keys below any target)" : "");
+            return sum;
+        };
+        uint64_t fast = run("kernel", node_lower_bound);
+        uint64_t portable = run("memcmp", node_lower_bound_portable);
+        if (fast != portable) {
+            std::printf("result mismatch: %llu != %llu\n", static_cast<unsigned long long>(fast), static_cast<unsigned long long>(portable));
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares the row layout (DataFile::scan) against the PAX layout (PaxFile::scan_columns)
+// for an aggregate over three of the columns of a wide record.  Records have --columns
+// 8-byte integer columns; the aggregate sums columns 0, 1 and the last one.  Both files
+// are dropped from the page cache (POSIX_FADV_DONTNEED) before each pass.
+//
+// Usage: pentaledger_bench_pax [--records N] [--columns N] [--page BYTES]
+//   defaults: 2,000,000 records of 16 columns, 256 KiB PAX pages
+
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/pax_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 2'000'000);
+    const uint32_t columns = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--columns", 16), 3));
+    const uint32_t page = static_cast<uint32_t>(option(argc, argv, "--page", 256 * 1024));
+    const uint32_t length = columns * sizeof(uint64_t);
+    const std::string row_path = "bench_pax_rows.dat";
+    const std::string pax_path = "bench_pax_columns.dat";
+    const std::array<uint32_t, 3> projection = {0, 1, columns - 1};
+    const uint64_t useful = records * projection.size() * sizeof(uint64_t);
+
+    std::printf("%llu records of %u columns (%.1f MB), aggregate over 3 columns (%.1f MB)\n",
+                static_cast<unsigned long long>(records), columns,
+                static_cast<double>(records * length) / (1024.0 * 1024.0),
+                static_cast<double>(useful) / (1024.0 * 1024.0));
+
+    {
+        DataFile df = DataFile::create(row_path, length);
+        std::vector<uint32_t> sizes(columns, sizeof(uint64_t));
+        PaxFileOptions options;
+        options.page_size = page;
+        PaxFile pf = PaxFile::create(pax_path, sizes, options);
+
+        const size_t batch = 4096;
+        std::vector<uint8_t> data(batch * length);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            for (size_t i = 0; i < n; ++i) {
+                for (uint32_t c = 0; c < columns; ++c) {
+                    uint64_t value = (done + i + 1) * (c + 1);
+                    std::memcpy(data.data() + i * length + c * sizeof(value), &value, sizeof(value));
+                }
+                pf.new_record(data.data() + i * length);
+            }
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+        df.flush();
+        pf.flush();
+    }
+
+    uint64_t expected = 0;
+
+    {
+        DataFile df = DataFile::open(row_path);
+        drop_cache(row_path);
+        Stopwatch sw;
+        uint64_t sum = 0;
+        for (std::span<const uint8_t> record : df.scan()) {
+            for (uint32_t c : projection) {
+                uint64_t value;
+                std::memcpy(&value, record.data() + c * sizeof(value), sizeof(value));
+                sum += value;
+            }
+        }
+        report("row scan", records, records * length, sw.seconds());
+        expected = sum;
+    }
+
+    {
+        PaxFile pf = PaxFile::open(pax_path);
+        drop_cache(pax_path);
+        Stopwatch sw;
+        uint64_t sum = 0;
+        for (const PaxBatch& batch : pf.scan_columns(projection)) {
+            for (size_t i = 0; i < projection.size(); ++i) {
+                for (uint32_t row = 0; row < batch.size(); ++row) {
+                    if (batch.live(row)) {
+                        sum += batch.value<uint64_t>(i, row);
+                    }
+                }
+            }
+        }
+        report("pax column scan", records, useful, sw.seconds());
+        if (sum != expected) {
+            std::printf("checksum mismatch: %llu != %llu\n",
+                        static_cast<unsigned long long>(sum), static_cast<unsigned long long>(expected));
+            return 1;
+        }
+    }
+
+    std::filesystem::remove(row_path);
+    std::filesystem::remove(pax_path);
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares a read_record() loop against DataFile::scan() for a full pass over a file,
+// summing the first 8 bytes of every record.  The file's pages are dropped from the
+// page cache (POSIX_FADV_DONTNEED) before each pass, so both start cold.
+//
+// Usage: pentaledger_bench_scan [--records N] [--length BYTES] [--block BYTES]
+//   defaults: 10,000,000 records of 64 bytes, 1 MiB scan blocks
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+void drop_cache(const std::string& path) {
+    PosixFile file;
+    if (file.open(path, O_RDONLY)) {
+        ::posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 10'000'000);
+    const uint32_t length = static_cast<uint32_t>(option(argc, argv, "--length", 64));
+    const size_t block = static_cast<size_t>(option(argc, argv, "--block", 1024 * 1024));
+    const std::string path = "bench_scan.dat";
+    const uint64_t bytes = records * length;
+
+    std::printf("%llu records of %u bytes (%.1f MB), %zu byte scan blocks\n",
+                static_cast<unsigned long long>(records), length,
+                static_cast<double>(bytes) / (1024.0 * 1024.0), block);
+
+    {
+        DataFile df = DataFile::create(path, length);
+        const size_t batch = 4096;
+        std::vector<uint8_t> data(batch * length);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t value = done + i + 1;
+                std::memcpy(data.data() + i * length, &value, std::min<size_t>(sizeof(value), length));
+            }
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+        df.flush();
+        df.close();
+    }
+
+    DataFile df = DataFile::open(path);
+    std::vector<uint8_t> buffer(length);
+    uint64_t expected = 0;
+
+    {
+        drop_cache(path);
+        Stopwatch sw;
+        uint64_t sum = 0;
+        for (uint64_t r = 1; r <= records; ++r) {
+            df.read_record(r, buffer.data());
+            uint64_t value = 0;
+            std::memcpy(&value, buffer.data(), std::min<size_t>(sizeof(value), length));
+            sum += value;
+        }
+        report("read_record loop", records, bytes, sw.seconds());
+        expected = sum;
+    }
+
+    {
+        drop_cache(path);
+        Stopwatch sw;
+        uint64_t sum = 0;
+        ScanOptions options;
+        options.block_size = block;
+        for (std::span<const uint8_t> record : df.scan(options)) {
+            uint64_t value = 0;
+            std::memcpy(&value, record.data(), std::min<size_t>(sizeof(value), length));
+            sum += value;
+        }
+        report("scan", records, bytes, sw.seconds());
+        if (sum != expected) {
+            std::printf("checksum mismatch: %llu != %llu\n",
+                        static_cast<unsigned long long>(sum), static_cast<unsigned long long>(expected));
+            return 1;
+        }
+    }
+
+    df.close();
+    std::filesystem::remove(path);
+    return 0;
+}
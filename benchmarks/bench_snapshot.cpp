@@ -0,0 +1,136 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Cost of MVCC snapshots (DataFileOptions::versioned).  Measures random write_record()
+// throughput with no snapshot open and with one open (each write then keeps the record
+// it overwrites), and a full scan of the file through a snapshot, alone and while another
+// thread keeps writing.  The file is warm in the page cache.
+//
+// Usage: pentaledger_bench_snapshot [--records N] [--length BYTES] [--writes N]
+//   defaults: 1,000,000 records of 128 bytes, 500,000 writes per run
+
+#include "pentaledger/data_file.hpp"
+#include "bench_util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+using namespace pentaledger::bench;
+
+namespace {
+
+double random_writes(DataFile& df, uint64_t records, uint64_t writes, uint32_t length) {
+    std::mt19937_64 rng(1);
+    std::vector<uint8_t> buffer(length, 0x33);
+    Stopwatch sw;
+    for (uint64_t i = 0; i < writes; ++i) {
+        df.write_record(rng() % records + 1, buffer.data());
+    }
+    return sw.seconds();
+}
+
+uint64_t scan_count(RecordScan& scan) {
+    uint64_t count = 0;
+    for (std::span<const uint8_t> record : scan) {
+        count += record[0] != 0;
+    }
+    return count;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const uint64_t records = option(argc, argv, "--records", 1'000'000);
+    const uint32_t length = static_cast<uint32_t>(std::max<uint64_t>(option(argc, argv, "--length", 128), 8));
+    const uint64_t writes = option(argc, argv, "--writes", 500'000);
+    const std::string path = "bench_snapshot.dat";
+
+    DataFileOptions options;
+    options.concurrent = true;
+    options.versioned = true;
+    DataFile df = DataFile::create(path, length, options);
+    {
+        const size_t batch = 4096;
+        std::vector<uint8_t> data(batch * length, 0x5a);
+        std::vector<RPTR> numbers(batch);
+        for (uint64_t done = 0; done < records; done += batch) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(batch, records - done));
+            df.new_records(std::span<RPTR>(numbers.data(), n), data.data());
+        }
+        df.flush();
+        RecordScan warm = df.scan();
+        scan_count(warm);
+    }
+
+    std::printf("%llu records of %u bytes, %llu writes per run\n",
+                static_cast<unsigned long long>(records), length, static_cast<unsigned long long>(writes));
+
+    report("write, no snapshot", writes, writes * length, random_writes(df, records, writes, length));
+    {
+        Snapshot snap = df.snapshot();
+        report("write, snapshot open", writes, writes * length, random_writes(df, records, writes, length));
+        VersionStats stats = df.version_stats();
+        std::printf("  %llu versions kept (%.1f MB)\n", static_cast<unsigned long long>(stats.versions),
+                    static_cast<double>(stats.bytes) / (1024.0 * 1024.0));
+    }
+
+    {
+        Stopwatch sw;
+        RecordScan scan = df.scan();
+        scan_count(scan);
+        report("scan", records, records * length, sw.seconds());
+    }
+    {
+        Snapshot snap = df.snapshot();
+        Stopwatch sw;
+        RecordScan scan = snap.scan();
+        scan_count(scan);
+        report("snapshot scan, idle", records, records * length, sw.seconds());
+    }
+    {
+        Snapshot snap = df.snapshot();
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> written{0};
+        std::thread writer([&] {
+            std::mt19937_64 rng(2);
+            std::vector<uint8_t> buffer(length, 0x44);
+            while (!stop.load(std::memory_order_relaxed)) {
+                df.write_record(rng() % records + 1, buffer.data());
+                written.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        Stopwatch sw;
+        RecordScan scan = snap.scan();
+        uint64_t seen = scan_count(scan);
+        double seconds = sw.seconds();
+        stop = true;
+        writer.join();
+        report("snapshot scan, writer busy", records, records * length, seconds);
+        std::printf("  %llu concurrent writes, %llu records seen\n",
+                    static_cast<unsigned long long>(written.load()), static_cast<unsigned long long>(seen));
+    }
+
+    df.close();
+    std::filesystem::remove(path);
+    return 0;
+}
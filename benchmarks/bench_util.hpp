@@ -0,0 +1,61 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace pentaledger::bench {
+
+//! \brief Wall-clock stopwatch started on construction
+class Stopwatch {
+public:
+    Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+//! \brief Value of a "--name value" command line option, or fallback if absent
+inline uint64_t option(int argc, char* argv[], const std::string& name, uint64_t fallback) {
+    for (int i = 1; i < argc - 1; ++i) {
+        if (name == argv[i]) {
+            return std::strtoull(argv[i + 1], nullptr, 10);
+        }
+    }
+    return fallback;
+}
+
+//! \brief Print one result line: label, operations per second and MB/s
+inline void report(const char* label, uint64_t operations, uint64_t bytes, double seconds) {
+    std::printf("%-28s %12.0f ops/s %10.1f MB/s %8.3f s\n", label,
+                static_cast<double>(operations) / seconds,
+                static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds, seconds);
+}
+
+} // namespace pentaledger::bench
+
@@ -0,0 +1,179 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include "record_pointer.hpp"
+#include "btree_file.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace pentaledger {
+
+//! \brief Options for building a B-tree with BTreeBuilder
+struct BTreeBuildOptions {
+    //! \brief Fraction of max_key_per_node() entries each node is filled with, from 0.5 to 1
+    //! \details Below 1 leaves room in every node, so that keys inserted later split fewer of them.
+    double fill_factor = 1.0;
+
+    //! \brief Bytes of keys held in memory while sorting input that is not in order
+    //! \details Input past this is sorted a buffer at a time into runs on disk, which are
+    //! merged as the tree is written.  Also bounds the read buffers of the merge.
+    size_t memory_limit = 256 * 1024 * 1024;
+
+    //! \brief Directory for the sorted runs; the index file's directory when empty
+    std::string temp_directory;
+};
+
+//! \brief Builds an empty BTreeFile bottom-up from a stream of (key, record) pairs
+//! \details Pairs that arrive in key order go straight into leaves, which are filled to
+//! the fill factor and written in file order; a node of each level above is kept open and
+//! written when it fills, so memory does not grow with the tree.  The last two nodes of a
+//! level are held back until finish(), which evens them out so that neither is less than
+//! half full.
+//!
+//! The first pair out of order switches to an external merge sort: pairs are gathered into
+//! buffers of BTreeBuildOptions::memory_limit, each sorted and written to a run file, and
+//! finish() merges the runs (in more than one pass if there are too many to merge at once)
+//! into the leaves.  Keys already written to leaves are read back into the first run.
+//!
+//! Equal keys keep the order in which they were added, and mark the tree as holding them
+//! (BTREE_DUPLICATE_KEYS), so that lookups find the first of a run that spans leaves.  An
+//! older file, with a single header, cannot record that: equal keys throw
+//! DatabaseException(DUPLICATE_KEY) instead.
+//!
+//! Nothing is visible in the tree until finish() sets its root.  A builder dropped before
+//! then leaves the tree empty; the nodes it wrote are reused by the next build.
+//!
+//! \code
+//! BTreeBuilder builder(index);
+//! for (...) { builder.add(key, record); }
+//! builder.finish();
+//! \endcode
+//!
+//! \note Not copyable or movable.  The tree must not be used until finish() returns.
+class BTreeBuilder {
+public:
+    //! \brief Start building tree, which must be empty
+    //! \details Throws DatabaseException(INVALID_ARGUMENT) if the tree has keys or the fill
+    //! factor is out of range.
+    explicit BTreeBuilder(BTreeFile& tree, const BTreeBuildOptions& options = {});
+
+    BTreeBuilder(const BTreeBuilder&) = delete;
+    BTreeBuilder& operator=(const BTreeBuilder&) = delete;
+
+    //! \brief Removes any run files left
+    ~BTreeBuilder();
+
+    //! \brief Add a pair
+    //! \param key key_length() bytes of the tree
+    void add(const char* key, RPTR record);
+
+    //! \brief Add records.size() pairs, their keys back to back
+    void add(const char* keys, std::span<const RPTR> records);
+
+    //! \brief Write the rest of the tree and make it the tree's contents
+    //! \return Keys in the tree
+    uint64_t finish();
+
+    //! \brief Sorted runs written to disk so far; 0 while the input has been in order
+    size_t runs() const { return runs_written_; }
+
+private:
+    //! \brief The nodes of one level not yet written: at most the last two
+    struct Level {
+        //! Entries of the open node and of the full one before it, as in keyspace; a
+        //! non-leaf node's first entry holds its lowest key and key0
+        std::vector<char> previous;
+        std::vector<char> current;
+        RPTR before_previous_ptr = 0;
+        RPTR previous_ptr = 0;
+        RPTR current_ptr = 0;
+        RPTR first_ptr = 0;
+        uint64_t nodes = 0;
+    };
+
+    //! \brief Add an entry, in key order, to the open node of a level
+    //! \return The node that took it
+    RPTR append(size_t level, const char* key, RPTR rptr);
+
+    //! \brief Write a node of a level given its entries, first adding it to its parent level
+    //! unless it is the root
+    //! \param adopt Point its children at it, after entries were moved between two nodes
+    void write(size_t level, const std::vector<char>& entries, RPTR node_ptr, RPTR left, RPTR right, bool root, bool adopt);
+
+    //! \brief The next node of the file, growing it if needed
+    RPTR allocate();
+
+    //! \brief Entries a node of the level is filled with, the most it can hold, and the
+    //! fewest it may be left with; a non-leaf node counts key0 as an entry
+    size_t capacity(size_t level) const;
+    size_t maximum(size_t level) const;
+    size_t minimum(size_t level) const;
+
+    //! \brief Sort buffer_ by key, keeping the order of equal keys
+    void sort_buffer();
+
+    //! \brief Stream pairs in key order into the leaves
+    void emit(const char* entries, size_t count);
+
+    //! \brief Sort buffer_ and write it as a run
+    void spill();
+
+    //! \brief Move the pairs already in leaves into the first run and start the tree over
+    void unwind();
+
+    //! \brief Merge runs into one, or into the leaves when output is null
+    void merge(const std::vector<std::string>& runs, const std::string* output);
+
+    //! \brief Path for a new run file
+    std::string run_path();
+
+    BTreeFile& tree_;
+    BTreeBuildOptions options_;
+    size_t key_length_;
+    size_t entry_size_;
+    size_t max_keys_;
+    //! Pairs waiting to be streamed or sorted, back to back
+    std::vector<char> buffer_;
+    size_t buffer_capacity_;
+    //! Key of the last pair added
+    std::vector<char> last_key_;
+    bool have_last_ = false;
+    bool sorted_ = true;
+    //! Pairs streamed into the leaves
+    uint64_t emitted_ = 0;
+    //! Key of the last pair streamed into the leaves, and whether any two were equal
+    std::vector<char> last_emitted_;
+    bool duplicates_ = false;
+    //! Leaves first; a deque, so that adding a level leaves references to the others valid
+    std::deque<Level> levels_;
+    //! Next node to use; nodes from 1 up are overwritten
+    RPTR next_ptr_ = 1;
+    std::vector<std::string> runs_;
+    size_t runs_written_ = 0;
+    bool finished_ = false;
+};
+
+} // namespace pentaledger
@@ -22,15 +22,130 @@
 #include "types.hpp"
 #include "record_pointer.hpp"
 #include "btree_file_header.hpp"
+#include "posix_file.hpp"
+#include "buffer_pool.hpp"
+#include "write_ahead_log.hpp"
 #include <string>
-#include <fstream>
 #include <cstdint>
 #include <cstddef>
+#include <span>
+#include <unordered_map>
+#include <vector>
 
 namespace pentaledger {
 
-// Invalid record pointer constant
-constexpr RPTR INVALID_RPTR = 0xFFFFFFFFFFFFFFFFULL;
+//! \brief Options chosen when a B-tree file is created or opened
+struct BTreeFileOptions {
+    //! \brief Cache the file's nodes in this pool, e.g. &BufferPool::shared()
+    //! \details Dirty pages are written back on flush() and close().
+    BufferPool* buffer_pool = nullptr;
+
+    //! \brief Log every write to this write-ahead log before making it
+    //! \details The log is replayed into the file when it is opened.
+    WriteAheadLog* wal = nullptr;
+
+    //! \brief Verify the checksum of every node read
+    //! \details A mismatch throws DatabaseException(FILE_CORRUPTED).  The header is always
+    //! verified when the file is opened.
+    bool verify_checksums = true;
+
+    //! \brief Bypass the kernel page cache (O_DIRECT) and cache nodes in buffer_pool instead
+    //! \details BufferPool::shared() is used when buffer_pool is not set.  A file created
+    //! this way gets the block-aligned layout (BTREE_BLOCK_ALIGNED), in which no node
+    //! straddles two pages.  Throws DatabaseException(INVALID_ARGUMENT) if the file system
+    //! does not support it.
+    bool direct_io = false;
+
+    //! \brief Grow the file in extents of this many bytes, allocated ahead with fallocate()
+    //! \details 0 extends the file a node at a time.  The header records the number of
+    //! nodes, so the unused rest of the last extent is ignored when the file is opened.
+    uint64_t growth_extent = 0;
+
+    //! \brief Give back the unused rest of the last extent on close()
+    bool trim_on_close = false;
+
+    //! \brief Keep every non-leaf node in memory
+    //! \details The non-leaf levels are read when the file is opened and kept up to date as
+    //! nodes are written, so a lookup walks them without I/O and reads only its leaf.  They
+    //! are a small fraction of the tree: about one node in max_key_per_node().  See
+    //! BTreeFile::pinned_memory().
+    bool pin_upper_levels = false;
+};
+
+class BTreeFile;
+
+//! \brief A position among the keys of a BTreeFile, moved in key order either way
+//! \details Obtained from BTreeFile::cursor(), unpositioned.  A seek descends from the
+//! root once; next() and prev() then walk the current leaf and follow the sibling links
+//! from one leaf to the next, reading one node per leaf.  On entering a leaf the cursor
+//! asks the kernel to start reading the next leaf in the direction it is moving, so that
+//! read overlaps with working through this one.
+//!
+//! Equal keys (see BTREE_DUPLICATE_KEYS) are visited in the order they were built in, and
+//! a seek lands on the first of them.
+//!
+//! Past either end the cursor is not valid(), but still remembers the end it is at: prev()
+//! from past the last key moves to the last key, next() from before the first key to the
+//! first.  Writing to the tree invalidates the cursor until it is positioned again.
+//!
+//! \code
+//! BTreeCursor cursor = index.cursor();
+//! for (cursor.lower_bound(from); cursor.valid() && std::memcmp(cursor.key(), to, n) < 0; cursor.next()) { ... }
+//! \endcode
+class BTreeCursor {
+public:
+    //! \brief Move to the first key not below key
+    //! \return Whether that key is key itself
+    bool seek(const char* key);
+
+    //! \brief Move to the first key not below key
+    //! \return valid()
+    bool lower_bound(const char* key);
+
+    //! \brief Move to the first key above key
+    //! \return valid()
+    bool upper_bound(const char* key);
+
+    //! \brief Move to the lowest key in the tree
+    //! \return valid(); false if the tree is empty
+    bool first();
+
+    //! \brief Move to the highest key in the tree
+    //! \return valid(); false if the tree is empty
+    bool last();
+
+    //! \brief Move to the next key up
+    //! \return valid(); false once past the last key
+    bool next();
+
+    //! \brief Move to the next key down
+    //! \return valid(); false once before the first key
+    bool prev();
+
+    //! \brief Whether the cursor is at a key
+    bool valid() const { return index_ >= 0 && index_ < leaf_.key_count; }
+
+    //! \brief The key at the cursor, key_length() bytes; the cursor must be valid()
+    const char* key() const;
+
+    //! \brief The record the key at the cursor points to; the cursor must be valid()
+    RPTR record() const;
+
+private:
+    friend class BTreeFile;
+    explicit BTreeCursor(BTreeFile& file);
+
+    //! \brief Make node_ptr the current leaf, and prefetch its sibling in the direction given
+    //! \details node_ptr 0 leaves the cursor unpositioned, as over an empty tree.
+    void enter(RPTR node_ptr, bool forward);
+
+    BTreeFile* file_;
+    BTreeNode leaf_{};
+    //! Current leaf; 0 if the cursor has not been positioned or the tree is empty
+    RPTR leaf_ptr_ = 0;
+    //! Entry of the current leaf: -1 before the first key, key_count past the last
+    int index_ = 0;
+};
 
 //! \brief B-tree file class
 //! \details This class provides a way to create, open, and manage a B-tree index file.
@@ -38,12 +153,18 @@ constexpr RPTR INVALID_RPTR = 0xFFFFFFFFFFFFFFFFULL;
 //! This class maintains a B-tree index structure stored in a file. Each node is a fixed size
 //! defined by the NODE constant in btree_file_header.hpp.
 //!
+//! The tree is a B+tree of keys of key_length() bytes, compared with memcmp, each pointing
+//! at a record.  locate(), insert_key() and delete_key() read one node per level; splits
+//! and merges keep every node but the root at least half full.  insert_key() keeps keys
+//! unique, but build() and BTreeBuilder may add equal ones (BTREE_DUPLICATE_KEYS); lookups
+//! then find the first of them, reading at most one more leaf.
+//!
 //! \note This class is not: thread-safe, copyable, movable, constructible, or destructible.
 class BTreeFile {
 public:
     // Open or create a B-tree file
-    static BTreeFile create(const std::string& path, int key_length);
-    static BTreeFile open(const std::string& path);
+    static BTreeFile create(const std::string& path, int key_length, const BTreeFileOptions& options = {});
+    static BTreeFile open(const std::string& path, const BTreeFileOptions& options = {});
     
     // Non-copyable, movable
     BTreeFile(const BTreeFile&) = delete;
@@ -73,11 +194,19 @@ public:
     int max_key_per_node() const { return header_.max_key_per_node; }
     RPTR leftmost_node() const { return header_.leftmost_node; }
     RPTR rightmost_node() const { return header_.rightmost_node; }
+    //! \brief Flags of the header copies, e.g. BTREE_DUPLICATE_KEYS; 0 for older files
+    uint32_t header_flags() const { return header_flags_; }
     
     //! \brief Flush all writes to disk
-    //! \details Flushes all writes to disk
+    //! \details Writes the header if it changed and any cached nodes, then forces the file to
+    //! stable storage
     void flush();
     
+    //! \brief Make every write so far durable
+    //! \details With a write-ahead log, waits for the log to be synced through this file's
+    //! last write; without one this is flush().
+    void commit();
+    
     //! \brief Dump the file header information
     //! \details Prints the file header information to stdout in a human-readable format
     void dump_header() const;
@@ -87,11 +216,56 @@ public:
     
     bool is_open() const { return file_.is_open(); }
     
+    //! \brief Non-leaf nodes held in memory (BTreeFileOptions::pin_upper_levels)
+    size_t pinned_nodes() const { return pinned_.size(); }
+    
+    //! \brief Bytes of memory the pinned nodes take, bookkeeping included
+    size_t pinned_memory() const;
+    
     //! \brief Locate a key in the B-tree
     //! \param key Pointer to the key to search for
     //! \return The record pointer (RPTR) associated with the key, or INVALID_RPTR if not found
-    //! \details Searches the B-tree for the given key and returns the associated record pointer
+    //! \details Searches the B-tree for the given key and returns the associated record pointer.
+    //! Keys compare as key_length() bytes with memcmp.  Of equal keys, the first is found.
     RPTR locate(const char* key);
+    
+    //! \brief Add a key to the tree
+    //! \param key key_length() bytes
+    //! \param record The record the key points to
+    //! \details A full node is split in two and the lowest key of the new right half is
+    //! added to its parent, which may split in turn; a split root raises a new one above it.
+    //! Throws DatabaseException(DUPLICATE_KEY) if the key is already in the tree.
+    void insert_key(const char* key, RPTR record);
+    
+    //! \brief Remove a key from the tree
+    //! \details A node left less than half full borrows entries from a sibling under the
+    //! same parent, or is merged with it if together they fit in one node; merging removes
+    //! an entry from the parent, which may be rebalanced in turn.  Nodes freed by merges
+    //! are kept on a chain headed by the header's raised_node and reused before the file
+    //! grows.  Of equal keys, the first is removed.  Throws DatabaseException(KEY_NOT_FOUND)
+    //! if the key is not in the tree.
+    void delete_key(const char* key);
+    
+    //! \brief Build the tree bottom-up from keys in ascending order
+    //! \param keys records.size() keys of key_length() bytes each, back to back, in memcmp order
+    //! \param records The record each key points to
+    //! \details The tree must be empty; nodes left in the file by deleted keys are reused.  The leaves are filled and written left to right, then
+    //! each level of non-leaf nodes above them, so every level is contiguous in the file and
+    //! nodes are only ever appended.  Throws DatabaseException(INVALID_ARGUMENT) if the tree is
+    //! not empty or the keys are out of order.
+    //!
+    //! Equal keys are kept in the order given, and mark the tree as holding them
+    //! (BTREE_DUPLICATE_KEYS); an older file, with a single header, throws
+    //! DatabaseException(DUPLICATE_KEY) for them instead.
+    //!
+    //! A leaf holds (key, record) entries.  A non-leaf node holds its first child in key0 and
+    //! (separator, child) entries, the separator being the lowest key under that child.
+    //!
+    //! For keys streamed in, more than fit in memory, or not in order, see BTreeBuilder.
+    void build(const char* keys, std::span<const RPTR> records);
+
+    //! \brief A cursor over the keys in order, not yet positioned; see BTreeCursor
+    BTreeCursor cursor();
 
 protected:
     //! \brief Calculate the file offset for a given node pointer
@@ -103,31 +277,150 @@ protected:
     //! \param path The path to the B-tree file
     //! \param key_length The length of each key in the B-tree
     //! \details Initializes the B-tree file by creating a new file and writing the header to it
-    void initialize(const std::string& path, int key_length);
+    void initialize(const std::string& path, int key_length, const BTreeFileOptions& options = {});
 
 private:
+    friend class BTreeCursor;
+    friend class BTreeBuilder;
+
     BTreeFile() = default;
-    
+
     //! \brief Load the B-tree file
     //! \param path The path to the B-tree file
     //! \details Loads the B-tree file by opening the file and reading the header from it
-    void load(const std::string& path);
+    void load(const std::string& path, const BTreeFileOptions& options);
+
+    //! \brief Set up the I/O mode selected by options once the file is open
+    void attach(const BTreeFileOptions& options);
+
+    //! \brief Replay the write-ahead log into the freshly opened file
+    void recover();
+
+    //! \brief Set header_size_, the block layout and max_keys_ from the header
+    void compute_layout();
+
+    //! \brief A non-leaf node on the way down to a leaf, and the child taken from it
+    struct PathStep {
+        RPTR node;
+        //! -1 for key0, otherwise the entry holding the child
+        int child;
+    };
+
+    //! \brief Follow key from the root, which must exist, down to a leaf
+    //! \param path If not null, receives the non-leaf nodes passed, root first
+    //! \param node Receives the leaf
+    //! \param leftmost Take the leftmost child the key could be under, passing separators
+    //! equal to it, rather than the rightmost
+    //! \return The leaf's node pointer
+    RPTR descend(const char* key, std::vector<PathStep>* path, BTreeNode& node, bool leftmost = false);
+
+    //! \brief Find the first entry not below key: its leaf, and its index there
+    //! \details descend() then a search of the leaf, unless the tree may hold equal keys
+    //! (BTREE_DUPLICATE_KEYS): then the descent is leftmost, and steps right along the
+    //! leaves if the key is above all of the leaf's, rebuilding path from parent links.
+    RPTR find_leaf(const char* key, std::vector<PathStep>* path, BTreeNode& node, int& index);
+
+    //! \brief Fill path with the non-leaf nodes above a node, root first, from parent links
+    void path_to(RPTR node_ptr, const BTreeNode& node, std::vector<PathStep>& path);
+
+    //! \brief Start reading a node into the page cache, without waiting for it
+    void prefetch_node(RPTR node_ptr);
+
+    //! \brief Add an entry at index of node, splitting up the path as far as needed
+    void insert_entry(std::vector<PathStep>& path, RPTR node_ptr, BTreeNode& node, int index, const char* key, RPTR rptr);
+
+    //! \brief Write node after entries were removed from it, borrowing or merging up the path
+    //! while it is less than half full
+    void rebalance(std::vector<PathStep>& path, RPTR node_ptr, BTreeNode& node);
+
+    //! \brief Point the children of a non-leaf node at it as their parent
+    void adopt(const BTreeNode& node, RPTR node_ptr);
+
+    //! \brief Node pointer for a new node: a released one, or the next one in the file
+    //! \details A node past the end of the file must be written before the next allocation.
+    RPTR allocate_node();
+
+    //! \brief Put a node no longer in the tree on the released chain
+    void release_node(RPTR node_ptr);
+
+    //! \brief Read the non-leaf levels into memory, top down
+    void pin_upper_levels();
+
+    //! \brief Keep the pinned copy of a node just written current: pin it if it is a non-leaf
+    //! node, drop it otherwise
+    void update_pinned(RPTR node_ptr, const BTreeNode& node);
+
+    //! \brief A non-leaf node held in memory: its entries fill slot of pinned_entries_
+    struct PinnedNode {
+        RPTR key0;
+        int key_count;
+        uint32_t slot;
+    };
+
+    //! \brief Allocate the file up to at least end, a growth extent at a time
+    void reserve(uint64_t end);
+
+    //! \brief Read raw bytes from the file, through the buffer pool if one is attached
+    void read_at(uint64_t offset, void* buffer, size_t length);
+
+    //! \brief Write raw bytes to the file, through the buffer pool if one is attached
+    void write_at(uint64_t offset, const void* buffer, size_t length);
 
     //! \brief Read the header from the file
     //! \details Reads the header from the file into the header_ member variable
     void read_header();
     
-    //! \brief Write the header to the file
-    //! \details Writes the header_ member variable to the file
+    //! \brief Write the header to the file, if it changed since it was last written
+    //! \details A file with header copies takes the next sequence number and writes the copy
+    //! it selects, leaving the other one as it was.
     void write_header();
     
-    std::fstream file_;
+    PosixFile file_;
     std::string file_path_;
     BTreeHeader header_;
+    BTreeFileOptions options_;
+    BufferPool::FileId pool_file_ = 0;
+    uint64_t wal_key_ = 0;
+    WriteAheadLog::Lsn last_lsn_ = 0;
     RPTR next_node_ptr_;
-    static constexpr size_t HEADER_SIZE = sizeof(BTreeHeader);
+    //! Size of the file on disk, when it has been allocated past the last node
+    uint64_t allocated_end_ = 0;
+    //! Bytes before the first node: BTREE_HEADER_SIZE, BTREE_BLOCK_SIZE for a block-aligned
+    //! file, or sizeof(BTreeHeader) for older files
+    size_t header_size_ = BTREE_HEADER_SIZE;
+    //! Sequence number of the last header copy written; 0 for older files, which have none
+    uint32_t header_sequence_ = 0;
+    //! Whether header_ has changed since it was written
+    bool header_dirty_ = false;
+    //! Flags of the header copies (BTREE_BLOCK_ALIGNED); 0 for older files
+    uint32_t header_flags_ = 0;
+    //! Block-aligned layout: nodes per block; 0 when nodes are packed back to back
+    uint32_t nodes_per_block_ = 0;
+    //! Entries a node holds: max_key_per_node, limited to what keyspace has room for
+    int max_keys_ = 0;
+    //! Pinned non-leaf nodes by node pointer
+    std::unordered_map<RPTR, PinnedNode> pinned_;
+    //! Entries of the pinned nodes as in keyspace, in slots of max_keys_ entries
+    std::vector<char> pinned_entries_;
+    //! Slots of pinned_entries_ no longer in use
+    std::vector<uint32_t> free_slots_;
     static constexpr size_t NODE_SIZE = sizeof(BTreeNode);
 };
 
+//! \brief CRC32C of a node, taking its checksum field as zero
+uint32_t btree_node_checksum(const BTreeNode& node);
+
+//! \brief CRC32C of a B-tree header, taking its checksum field as zero
+uint32_t btree_header_checksum(const BTreeHeader& header);
+
+//! \brief CRC32C of a B-tree header copy, taking its header's checksum field as zero
+uint32_t btree_header_copy_checksum(const BTreeHeaderCopy& copy);
+
+//! \brief Pick the current header of a file with header copies
+//! \param copies The BTREE_HEADER_COPIES copies read from the start of the file
+//! \param got Bytes of them actually read
+//! \return Index of the valid copy with the later sequence number, or -1 if there is none
+int current_btree_header(const BTreeHeaderCopy* copies, size_t got);
+
 } // namespace pentaledger
 
@@ -28,9 +28,14 @@ namespace pentaledger
 #define MAX_KEY_LENGTH 80
 #define ADR sizeof(RPTR)
 
+    // Nodes and the header carry a CRC32C of themselves, computed with the checksum field
+    // zeroed.  The field occupies what was alignment padding, so the layout is unchanged;
+    // a checksum of zero means none was written (files from before checksums).
+
     struct BTreeNode
     {
         int nonleaf;
+        uint32_t checksum;
         RPTR parent_node;
         RPTR left_sibling;
         RPTR right_sibling;
@@ -40,6 +45,10 @@ namespace pentaledger
         char spil[MAX_KEY_LENGTH];
     };
 
+    // raised_node heads the chain of nodes released when the tree shrinks, linked through
+    // right_sibling; 0 if there are none.  A B+tree: leaves hold (key, record) entries and
+    // are linked left to right from leftmost_node; a non-leaf node has its first child in
+    // key0 and (key, child) entries, each key the lowest under that child.
     struct BTreeHeader
     {
         RPTR root_node;
@@ -47,8 +56,47 @@ namespace pentaledger
         int max_key_per_node;
         RPTR raised_node;
         int locked;
+        uint32_t checksum;
         RPTR leftmost_node;
         RPTR rightmost_node;
     };
 
+    // "PLBT" as a 32-bit value (little-endian)
+    constexpr uint32_t PLBT_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('B' << 16) | ('T' << 24));
+
+    // Files created since header copies were introduced start with BTREE_HEADER_COPIES
+    // copies of the header, written alternately; the valid copy with the later sequence
+    // number is current.  In a copy the header checksum also covers the fields after the
+    // header.  next_node is one past the last node written: a file may be allocated past
+    // it (BTreeFileOptions::growth_extent).  Older files start with a single BTreeHeader
+    // and end with their last node.
+    struct BTreeHeaderCopy
+    {
+        BTreeHeader header;
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t flags;
+        uint32_t reserved;
+        RPTR next_node;
+    };
+
+    constexpr uint32_t BTREE_HEADER_COPIES = 2;
+    constexpr size_t BTREE_HEADER_SIZE = BTREE_HEADER_COPIES * sizeof(BTreeHeaderCopy);
+
+    // BTreeHeaderCopy::flags: block-aligned layout, for direct I/O.  The header copies take
+    // a whole BTREE_BLOCK_SIZE block, and each block after it holds as many whole nodes as
+    // fit, then padding.
+    constexpr uint32_t BTREE_BLOCK_ALIGNED = 1u << 0;
+    constexpr uint32_t BTREE_BLOCK_SIZE = 4096;
+
+    // BTreeHeaderCopy::flags: the tree may hold equal keys, from BTreeFile::build() or
+    // BTreeBuilder.  A run of them can then straddle nodes, with a separator equal to the key
+    // and more of it to the left, so a search takes the leftmost child the key could be
+    // under and walks right along the leaves.  Older files, with a single header, never do.
+    constexpr uint32_t BTREE_DUPLICATE_KEYS = 1u << 1;
+
+    static_assert(sizeof(BTreeNode) == 384, "BTreeNode layout changed");
+    static_assert(sizeof(BTreeHeader) == 48, "BTreeHeader layout changed");
+    static_assert(sizeof(BTreeHeaderCopy) == 72, "BTreeHeaderCopy layout changed");
+
 } // namespace pentaledger
\ No newline at end of file
@@ -0,0 +1,243 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pentaledger {
+
+class BufferPool;
+
+//! \brief A pinned page in a BufferPool
+//! \details The page cannot be evicted while a handle to it exists.  Call mark_dirty()
+//! after modifying data() so the page is written back on flush or eviction.  Writing
+//! through a handle does not grow the file: only bytes below BufferPool::file_size()
+//! are written back.  Use BufferPool::write() to append.
+class PageHandle {
+public:
+    PageHandle() = default;
+
+    // Non-copyable, movable
+    PageHandle(const PageHandle&) = delete;
+    PageHandle& operator=(const PageHandle&) = delete;
+    PageHandle(PageHandle&& other) noexcept;
+    PageHandle& operator=(PageHandle&& other) noexcept;
+
+    ~PageHandle();
+
+    //! \brief The PAGE_SIZE bytes of the page
+    uint8_t* data() const { return data_; }
+    PageId page() const { return page_; }
+    bool valid() const { return pool_ != nullptr; }
+
+    //! \brief Mark the page as modified
+    void mark_dirty();
+
+    //! \brief Unpin the page early; the handle becomes invalid
+    void release();
+
+private:
+    friend class BufferPool;
+    PageHandle(BufferPool* pool, size_t frame, uint8_t* data, PageId page)
+        : pool_(pool), frame_(frame), data_(data), page_(page) {}
+
+    BufferPool* pool_ = nullptr;
+    size_t frame_ = 0;
+    uint8_t* data_ = nullptr;
+    PageId page_ = INVALID_PAGE_ID;
+};
+
+//! \brief Page cache shared by data and index files
+//! \details Caches PAGE_SIZE pages of registered files, keyed by (file, page number), up to
+//! a byte budget.  Pages are evicted with the CLOCK (second chance) algorithm; pinned pages
+//! are never evicted.  Modified pages are written back when evicted or when their file is
+//! flushed or unregistered.
+//!
+//! A file must do all of its I/O through the pool while it is registered, otherwise the
+//! cached pages and the file go out of step.
+//!
+//! Pages are read and written back without the pool lock held, so a miss or an eviction
+//! stalls only the threads that want that page: pinning a page waits while it is loaded or
+//! written back.  A page changed through a handle while flush() writes it stays dirty.
+//!
+//! \note This class is thread-safe.  It is not copyable or movable.
+class BufferPool {
+public:
+    //! \brief Identifies a file registered with the pool
+    using FileId = uint32_t;
+
+    //! \brief Counters describing pool activity
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t write_backs = 0;
+        size_t capacity_pages = 0;
+        size_t resident_pages = 0;
+    };
+
+    //! \brief Default byte budget of the shared pool
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+    //! \brief Create a pool
+    //! \param capacity_bytes Byte budget; rounded down to whole pages, minimum one page
+    explicit BufferPool(size_t capacity_bytes);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool();
+
+    //! \brief The process-wide pool
+    //! \details Created on first use with DEFAULT_CAPACITY; use set_capacity() to change the budget.
+    static BufferPool& shared();
+
+    //! \brief Register an open file with the pool
+    //! \param fd The file descriptor used to load and write back pages
+    //! \param direct The descriptor bypasses the page cache (see PosixFile::set_direct): pages
+    //! are then loaded and written back whole, and a write-back past the logical end of the
+    //! file is trimmed off again
+    //! \return The id used to address the file's pages
+    FileId register_file(int fd, bool direct = false);
+
+    //! \brief Write back and drop every cached page of a file
+    //! \details The file must have no pinned pages.
+    void unregister_file(FileId file);
+
+    //! \brief Pin a page, loading it if it is not resident
+    //! \details Throws DatabaseException(INSUFFICIENT_SPACE) if every frame is pinned.
+    PageHandle fetch(FileId file, PageId page);
+
+    //! \brief Copy bytes out of the cached file, pinning each page only for the copy
+    void read(FileId file, uint64_t offset, void* buffer, size_t length);
+
+    //! \brief Copy bytes into the cached file and mark the pages dirty
+    //! \details Pages that are overwritten completely are not read from disk first.
+    void write(FileId file, uint64_t offset, const void* buffer, size_t length);
+
+    //! \brief Write back every dirty page of a file
+    void flush(FileId file);
+
+    //! \brief Cut a file to size bytes
+    //! \details Drops the cached pages past the new end, zeroes the tail of the one it falls
+    //! in, and truncates the file.  No page past the new end may be pinned.
+    void truncate(FileId file, uint64_t size);
+
+    //! \brief Note that a file has been allocated on disk up to size bytes (see
+    //! PosixFile::allocate); a direct write-back then leaves that much of it in place
+    void reserve(FileId file, uint64_t size);
+
+    //! \brief Write back every dirty page in the pool
+    void flush_all();
+
+    //! \brief Logical size of a registered file, including writes not yet written back
+    uint64_t file_size(FileId file) const;
+
+    //! \brief Change the byte budget, evicting unpinned pages if it shrinks
+    void set_capacity(size_t capacity_bytes);
+
+    size_t capacity() const;
+    Stats stats() const;
+
+private:
+    friend class PageHandle;
+
+    struct FreeDeleter {
+        void operator()(uint8_t* p) const { std::free(p); }
+    };
+
+    struct Frame {
+        //! PAGE_SIZE bytes, PAGE_SIZE aligned, as direct I/O requires
+        std::unique_ptr<uint8_t, FreeDeleter> data;
+        FileId file = 0;
+        PageId page = INVALID_PAGE_ID;
+        uint32_t pin_count = 0;
+        bool dirty = false;
+        bool referenced = false;
+        //! Being read from disk, without mutex_; pinning the page waits until it is done
+        bool loading = false;
+        //! Being written back, without mutex_; pinning the page waits, and the frame cannot be
+        //! evicted, until it is done
+        bool writing = false;
+    };
+
+    struct FileEntry {
+        int fd = -1;
+        uint64_t size = 0;
+        bool direct = false;
+        //! Bytes of the file on disk, which may run past size
+        uint64_t allocated = 0;
+    };
+
+    static uint64_t page_key(FileId file, PageId page) {
+        return (static_cast<uint64_t>(file) << 32) | page;
+    }
+
+    //! \brief Pin a page; load selects whether a miss reads the page from disk
+    //! \details lock holds mutex_, and is released while the page is read.
+    size_t pin(std::unique_lock<std::mutex>& lock, FileId file, PageId page, bool load);
+
+    //! \brief Find a frame for a new page, allocating or evicting as needed
+    //! \details lock holds mutex_, and is released while a dirty victim is written back.
+    size_t acquire_frame(std::unique_lock<std::mutex>& lock);
+
+    //! \brief Allocate the memory of a frame
+    static std::unique_ptr<uint8_t, FreeDeleter> allocate_page();
+
+    //! \brief Write a dirty frame back to its file
+    //! \details lock holds mutex_, and is released for the write; the frame must not be
+    //! loading or writing.  On return the frame is still resident, but may be dirty again if
+    //! it was pinned throughout.
+    void write_back(std::unique_lock<std::mutex>& lock, size_t index);
+
+    //! \brief Wait until a frame is neither loading nor writing
+    void wait_for_io(std::unique_lock<std::mutex>& lock, size_t index);
+
+    //! \brief Drop the page held by an unpinned, idle frame; mutex_ must be held
+    //! \details Does no I/O: changes to a dirty page are lost, so write it back first.
+    void evict_locked(size_t index);
+
+    void unpin(size_t frame);
+    void mark_dirty(size_t frame);
+
+    mutable std::mutex mutex_;
+    //! Signalled whenever a frame stops loading or writing
+    std::condition_variable io_done_;
+    std::vector<Frame> frames_;
+    std::vector<size_t> free_frames_;
+    std::unordered_map<uint64_t, size_t> page_table_;
+    std::unordered_map<FileId, FileEntry> files_;
+    FileId next_file_id_ = 1;
+    size_t capacity_pages_;
+    size_t allocated_pages_ = 0;
+    size_t clock_hand_ = 0;
+    Stats stats_;
+};
+
+} // namespace pentaledger
+
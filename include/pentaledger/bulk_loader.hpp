@@ -0,0 +1,139 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include "record_pointer.hpp"
+#include "btree_builder.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pentaledger {
+
+class DataFile;
+class BTreeFile;
+
+//! \brief Text formats the bulk loader reads
+enum class LoadFormat {
+    CSV,    //!< One record per line, fields split on BulkLoadOptions::delimiter
+    NDJSON  //!< One flat JSON object per line, fields found by column name
+};
+
+//! \brief One field of the records being loaded
+//! \details Fields are packed back to back in column order, as in a Schema.  A STRING is
+//! stored NUL-padded to size bytes; a longer value is an error.  BLOB is not supported.
+struct LoadColumn {
+    std::string name;
+    FieldType type = FieldType::INT64;
+    //! Bytes the field occupies; only read for STRING
+    uint32_t size = 0;
+
+    //! \brief Bytes the field occupies in a record
+    uint32_t width() const;
+};
+
+//! \brief Parse a column list such as "id:int64,miles:double,category:string:24"
+//! \details Types are int32, int64, float, double and string:N.  Throws
+//! DatabaseException(INVALID_SCHEMA) for a malformed list.
+std::vector<LoadColumn> parse_load_columns(std::string_view spec);
+
+//! \brief How a bulk load reads its input
+struct BulkLoadOptions {
+    LoadFormat format = LoadFormat::CSV;
+
+    //! \brief Field separator of CSV input
+    char delimiter = ',';
+
+    //! \brief Whether the first line of CSV input names the columns, and is skipped
+    bool header_row = true;
+
+    //! \brief Parser threads; 0 for one per hardware thread
+    unsigned threads = 0;
+
+    //! \brief Bytes of input handed to a parser at a time
+    //! \details Chunks are cut at line ends, so a line longer than this is read whole.
+    size_t chunk_size = 4 * 1024 * 1024;
+
+    //! \brief Column whose values key the index built by BulkLoader::load(); -1 for none
+    int key_column = -1;
+
+    //! \brief How the index is built, e.g. the memory its keys may be sorted in
+    BTreeBuildOptions index_build;
+};
+
+//! \brief What a bulk load did
+struct BulkLoadResult {
+    uint64_t records = 0;
+    //! Number of the first record loaded; the others follow it in input order
+    RPTR first_record = 0;
+    uint64_t bytes_read = 0;
+};
+
+//! \brief Encode a field of a record as an index key that sorts in memcmp order
+//! \param field The field as stored in the record
+//! \param key Receives column.width() bytes
+//! \details Integers are stored big-endian with the sign bit flipped, floating point values
+//! likewise with negative values inverted, and strings as they are.
+void encode_index_key(const LoadColumn& column, const uint8_t* field, uint8_t* key);
+
+//! \brief Loads CSV or NDJSON text into a DataFile, and optionally indexes it
+//! \details Built for throughput: the input is read in large chunks cut at line ends, and
+//! a pool of threads parses chunks into fixed-length records while the calling thread
+//! appends finished chunks, in input order, past the end of the file with
+//! DataFile::append_records().  Deleted records are not reused, and the file header is
+//! written once per chunk rather than once per record.
+//!
+//! If an index is given, the key column of every record is handed to a BTreeBuilder as
+//! each chunk is appended.  Keys that arrive in order are written straight into the leaves;
+//! otherwise they are sorted in runs of BulkLoadOptions::index_build.memory_limit and
+//! merged, so the index is written bottom-up in one pass in bounded memory.
+//!
+//! Lines that are empty are skipped.  Quoted CSV fields may contain the delimiter and
+//! doubled quotes but not line breaks.  A record whose bytes are all zero reads back as
+//! deleted, as with DataFile::new_record().
+//!
+//! Errors in the input throw DatabaseException(INVALID_ARGUMENT) naming the line.  Records
+//! of the chunks before it have been written by then.
+class BulkLoader {
+public:
+    //! \brief Throws DatabaseException(INVALID_SCHEMA) for an empty or unsupported column list
+    explicit BulkLoader(std::vector<LoadColumn> columns, const BulkLoadOptions& options = {});
+
+    //! \brief Load the file at input_path into file, and build index if given
+    //! \param file Its record length must be record_length()
+    //! \param index An empty tree whose key length is the width of the key column
+    BulkLoadResult load(const std::string& input_path, DataFile& file, BTreeFile* index = nullptr);
+
+    //! \brief Bytes per record: the widths of the columns added up
+    uint32_t record_length() const { return record_length_; }
+
+    const std::vector<LoadColumn>& columns() const { return columns_; }
+
+private:
+    std::vector<LoadColumn> columns_;
+    std::vector<uint32_t> offsets_;
+    BulkLoadOptions options_;
+    uint32_t record_length_ = 0;
+};
+
+} // namespace pentaledger
@@ -0,0 +1,134 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "compressed_file_header.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace pentaledger {
+
+//! \brief Byte-addressed file stored as independently compressed pages
+//! \details Backs DataFileOptions::compressed.  Reads and writes address the uncompressed
+//! contents; underneath, each page of page_size bytes is compressed with lz_compress() and
+//! stored as an extent that the page table points to.  A few decompressed pages are kept
+//! in memory, and writes go into them and are compressed when the page is evicted or the
+//! file is flushed.
+//!
+//! The header, the page table and each extent carry a CRC32C, checked whenever they are
+//! read.
+//!
+//! A page that no longer fits its extent when rewritten moves to the end of the file, and
+//! its old extent is not reused.  Files that are rewritten heavily grow accordingly.
+//!
+//! \note This class is not thread-safe.  It is movable but not copyable.  It works on a
+//! descriptor owned by the caller, which must stay open while this is attached.
+class CompressedFile {
+public:
+    CompressedFile() = default;
+
+    // Non-copyable, movable
+    CompressedFile(const CompressedFile&) = delete;
+    CompressedFile& operator=(const CompressedFile&) = delete;
+    CompressedFile(CompressedFile&& other) noexcept;
+    CompressedFile& operator=(CompressedFile&& other) noexcept;
+
+    //! \brief Format an empty file as a compressed file and attach to it
+    //! \param page_size Uncompressed bytes per page
+    //! \param cache_pages Decompressed pages kept in memory
+    void create(int fd, uint32_t page_size, uint32_t cache_pages);
+
+    //! \brief Attach to an existing compressed file
+    void open(int fd, uint32_t cache_pages);
+
+    //! \brief Whether the file starts with a compressed file header
+    static bool is_compressed(int fd);
+
+    //! \brief Read up to length bytes of the contents at the given offset
+    //! \return The number of bytes read; less than length only at the end of the contents
+    size_t read_at(void* buffer, size_t length, uint64_t offset);
+
+    //! \brief Read exactly length bytes; throws DatabaseException past the end of the contents
+    void read_exact(void* buffer, size_t length, uint64_t offset);
+
+    //! \brief Write length bytes at the given offset, extending the contents if needed
+    void write_exact(const void* buffer, size_t length, uint64_t offset);
+
+    //! \brief Compress and store every modified page, then the page table and header
+    //! \details Does not sync the descriptor.
+    void flush();
+
+    //! \brief Flush and detach from the descriptor
+    void close();
+
+    bool is_open() const { return fd_ >= 0; }
+    uint32_t page_size() const { return header_.page_size; }
+
+    //! \brief Size of the uncompressed contents
+    uint64_t size() const { return header_.logical_size; }
+
+    //! \brief Bytes the file occupies on disk, as of the last flush
+    uint64_t stored_size() const { return header_.allocated_end; }
+
+private:
+    struct Frame {
+        uint64_t page = 0;
+        std::unique_ptr<uint8_t[]> data;
+        bool dirty = false;
+        uint64_t last_use = 0;
+    };
+
+    //! \brief The cached copy of a page, loading it (unless it is about to be overwritten
+    //! entirely) and evicting the least recently used page if the cache is full
+    Frame& fetch(uint64_t page, bool overwrite);
+
+    //! \brief Decompress a page from its extent
+    void load(uint64_t page, uint8_t* data);
+
+    //! \brief Compress a page into its extent, moving it if it outgrew the extent
+    void store(uint64_t page, const uint8_t* data);
+
+    //! \brief Reserve bytes at the end of the file
+    uint64_t allocate(uint64_t bytes);
+
+    void attach(int fd, uint32_t cache_pages);
+    void write_header();
+
+    int fd_ = -1;
+    CompressedFileHeader header_{};
+    std::vector<CompressedPageEntry> table_;
+    bool table_dirty_ = false;
+    //! Set by writes, so that flushing a file that was only read writes nothing
+    bool header_dirty_ = false;
+    std::vector<Frame> frames_;
+    std::unordered_map<uint64_t, size_t> cached_;
+    uint32_t cache_pages_ = 0;
+    uint64_t clock_ = 0;
+    //! Compressed bytes of one page in transit
+    std::vector<uint8_t> scratch_;
+};
+
+//! \brief CRC32C of a compressed file header, taking its checksum field as zero
+uint32_t compressed_header_checksum(const CompressedFileHeader& header);
+
+} // namespace pentaledger
@@ -0,0 +1,87 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace pentaledger {
+// Magic number constant: "PLCZ" as a 32-bit value (little-endian)
+constexpr uint32_t PLCZ_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('C' << 16) | ('Z' << 24));
+
+// File format version
+// Version 2 adds checksums of the header, the page table and every extent
+constexpr uint32_t PLCZ_VERSION = 2;
+
+//! \brief Compressed file header structure
+//! \details Written at the beginning of a compressed file, which reserves PAGE_SIZE bytes
+//! for it.  The logical contents of the file are divided into pages of page_size bytes;
+//! each page is stored as a compressed extent somewhere after the header, found through
+//! the page table.
+struct CompressedFileHeader {
+    //! \brief Magic number to identify the file.  Should be PLCZ_MAGIC.
+    uint32_t magic_number;
+
+    //! \brief File format version.  Should be PLCZ_VERSION.
+    uint32_t version;
+
+    //! \brief Uncompressed bytes per page
+    uint32_t page_size;
+
+    //! \brief Number of entries in the page table
+    uint32_t page_count;
+
+    //! \brief Size of the uncompressed contents in bytes
+    uint64_t logical_size;
+
+    //! \brief File offset of the page table
+    uint64_t table_offset;
+
+    //! \brief Bytes reserved for the page table at table_offset
+    uint64_t table_capacity;
+
+    //! \brief End of the last extent; new extents are allocated here
+    uint64_t allocated_end;
+
+    //! \brief CRC32C of the page_count entries of the page table
+    uint32_t table_checksum;
+
+    //! \brief CRC32C of the header with this field zeroed
+    uint32_t checksum;
+};
+
+//! \brief Page table entry: where one page is stored
+struct CompressedPageEntry {
+    //! \brief File offset of the extent
+    uint64_t offset;
+
+    //! \brief Stored bytes; 0 if the page has never been written (it reads as zeros), and
+    //! page_size if it is stored uncompressed
+    uint32_t length;
+
+    //! \brief Bytes reserved for the extent, so that a page can grow a little in place
+    uint32_t capacity;
+
+    //! \brief CRC32C of the length stored bytes
+    uint32_t checksum;
+
+    //! \brief Reserved; zero
+    uint32_t reserved;
+};
+}
@@ -0,0 +1,54 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pentaledger {
+
+//! \brief CRC-32C (Castagnoli) checksum
+//! \param data The bytes to checksum
+//! \param length Number of bytes
+//! \param crc A previous result, to extend a checksum over several buffers
+//! \return The checksum of the data, continued from crc
+//! \details Uses the SSE4.2 crc32 instruction when the CPU has it, and slice-by-8 tables
+//! otherwise; the choice is made once, at startup.
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+//! \brief crc32c() of count buffers of length bytes each, stride bytes apart
+//! \param crcs Receives the count checksums
+//! \details With the crc32 instruction the buffers are checksummed four at a time,
+//! interleaved, which hides the instruction's latency: several times faster than one
+//! crc32c() call per buffer when the buffers are short, as records are.
+void crc32c_many(const void* data, size_t length, size_t stride, size_t count, uint32_t* crcs);
+
+//! \brief crc32c() computed with the slice-by-8 tables regardless of the CPU
+uint32_t crc32c_portable(const void* data, size_t length, uint32_t crc = 0);
+
+//! \brief Whether crc32c() uses a hardware instruction
+bool crc32c_hardware();
+
+//! \brief crc32c() of a structure, taking its 4-byte checksum field as zero
+//! \param field_offset Offset of the checksum field within the length bytes at data
+uint32_t crc32c_excluding(const void* data, size_t length, size_t field_offset);
+
+} // namespace pentaledger
+
@@ -21,16 +21,136 @@
 
 #include "types.hpp"
 #include "record_pointer.hpp"
+#include "posix_file.hpp"
+#include "memory_map.hpp"
+#include "compressed_file.hpp"
+#include "buffer_pool.hpp"
+#include "write_ahead_log.hpp"
+#include "record_scan.hpp"
+#include "io_engine.hpp"
+#include "version_store.hpp"
 #include <string>
-#include <fstream>
+#include <span>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "data_file_header.hpp"
 
 namespace pentaledger {
 
-// Invalid record pointer constant
-constexpr RPTR INVALID_RPTR = 0xFFFFFFFFFFFFFFFFULL;
+//! \brief Options chosen when a data file is created or opened
+//! \details Three options fix the on-disk format when the file is created.  compressed and
+//! record_checksums are ignored by open(), which finds them in the file.  A file created
+//! with direct_io keeps the block-aligned layout however it is opened later, though direct
+//! I/O itself can be turned on or off on any open.  The rest can change every time the file
+//! is opened, except that a file written with a wal must be opened with it until the log
+//! is checkpointed.
+struct DataFileOptions {
+    //! \brief Memory-map the file
+    //! \details Records are read and written through a shared mapping of the file instead of
+    //! pread/pwrite, and DataFile::view_record() hands out zero-copy views of them.
+    bool memory_mapped = false;
+
+    //! \brief Cache the file's pages in this pool, e.g. &BufferPool::shared()
+    //! \details Cannot be combined with memory_mapped.  Dirty pages are written back on
+    //! flush() and close().
+    BufferPool* buffer_pool = nullptr;
+
+    //! \brief Log every write to this write-ahead log before making it
+    //! \details The log is replayed into the file when it is opened.  A file that has been
+    //! written with a log must keep being opened with it until the log is checkpointed.
+    WriteAheadLog* wal = nullptr;
+
+    //! \brief Engine for async_read_record() and async_write_record()
+    //! \details IoEngine::shared() when null.
+    IoEngine* io_engine = nullptr;
+
+    //! \brief Store the file as compressed pages; only used when the file is created
+    //! \details Records are grouped into pages of compressed_page_size bytes, each compressed
+    //! with the built-in LZ codec and found through a page table (see CompressedFile).  Reads
+    //! decompress through a cache of compressed_cache_pages pages.  Cannot be combined with
+    //! memory_mapped, buffer_pool or wal.  open() recognizes a compressed file by itself.
+    bool compressed = false;
+
+    //! \brief Uncompressed bytes per page of a compressed file
+    uint32_t compressed_page_size = 64 * 1024;
+
+    //! \brief Decompressed pages a compressed file keeps in memory
+    uint32_t compressed_cache_pages = 16;
+
+    //! \brief Store a CRC32C after each record; only used when the file is created
+    //! \details Each slot grows by four bytes.  Deleted slots are checksummed as well, so
+    //! that a Scrubber can verify every slot.
+    bool record_checksums = false;
+
+    //! \brief Verify record checksums when records are read, viewed or scanned
+    //! \details A mismatch throws DatabaseException(FILE_CORRUPTED), or is reported as that
+    //! status by read_records().  The header checksum is always verified.
+    bool verify_checksums = true;
+
+    //! \brief Share the DataFile between threads
+    //! \details Cannot be combined with memory_mapped or a compressed file, whose mapping
+    //! and page cache are not shared safely.  See DataFile for what may run concurrently.
+    bool concurrent = false;
+
+    //! \brief Keep superseded record versions for snapshot reads
+    //! \details Lets DataFile::snapshot() open consistent point-in-time views of the file.
+    //! Writes take a commit sequence number each and, while a snapshot is open, copy the
+    //! record they overwrite into memory first.  Asynchronous writes complete at the call.
+    bool versioned = false;
+
+    //! \brief Bypass the kernel page cache (O_DIRECT) and cache pages in buffer_pool instead
+    //! \details BufferPool::shared() is used when buffer_pool is not set, so the memory
+    //! spent on caching the file is what the pool is given.  A file created this way gets
+    //! the block-aligned layout (PLDB_BLOCK_ALIGNED), in which a record read is served by
+    //! a single page; files of either layout can be opened with or without direct I/O.
+    //! Cannot be combined with memory_mapped or a compressed file.  Throws
+    //! DatabaseException(INVALID_ARGUMENT) if the file system does not support it.
+    bool direct_io = false;
+
+    //! \brief Grow the file in extents of this many bytes, allocated ahead with fallocate()
+    //! \details 0 extends the file a write at a time.  With an extent, appends land in
+    //! space that is already allocated, so the file stays in a few large extents and an
+    //! append does not change its size on disk.  The header's next_record marks where the
+    //! records end; the rest of the last extent is zeros, ignored when the file is opened.
+    //! A memory-mapped file grows its mapping by whole extents instead.
+    uint64_t growth_extent = 0;
+
+    //! \brief Give back the unused rest of the last extent on close()
+    //! \details Otherwise it stays allocated for appends after the file is next opened.
+    bool trim_on_close = false;
+};
+
+//! \brief Limits on one call of DataFile::compact()
+struct CompactionOptions {
+    //! \brief Move at most this many records; 0 for no limit
+    uint64_t max_moves = 0;
+
+    //! \brief Stop moving records once this much time has passed; zero for no limit
+    std::chrono::microseconds time_budget{0};
+};
+
+//! \brief A record relocated by DataFile::compact()
+struct RecordMove {
+    RPTR from;
+    RPTR to;
+};
+
+//! \brief What one call of DataFile::compact() did
+struct CompactionResult {
+    //! \brief Records moved, in order; patch indexes from these
+    std::vector<RecordMove> moves;
+
+    //! \brief Slots cut off the end of the file, moved records and free slots alike
+    uint64_t slots_released = 0;
+
+    //! \brief Whether the live records are now contiguous, with no free slot among them
+    bool complete = false;
+};
 
 //! \brief Data file class
 //! \details This class provides a way to create, open, and manage a data file.
@@ -39,12 +159,22 @@ constexpr RPTR INVALID_RPTR = 0xFFFFFFFFFFFFFFFFULL;
 //! This data file contains a linked list of deleted records, which are used to allocate new records.
 //! This eliminates the need to pack or compress the data file.
 //!
-//! \note This class is not: thread-safe, copyable, movable, constructible, or destructible.
+//! A file opened with DataFileOptions::concurrent may be used from several threads at once.
+//! Reads take no locks: each is a positional pread (or a buffer pool lookup) against the
+//! shared descriptor, checked against an atomically published next_record().  Writes to
+//! different records run in parallel.  Allocation (new_record, new_records), delete_record,
+//! and the header writes of flush() and commit() are serialized by one small lock, held
+//! only while the free list and header change, never across the record data I/O.  A read
+//! racing a write of the same record may see part of each, and a record number may only be
+//! read once new_record() has returned it.  open, close and moves must not overlap other
+//! calls, and header() is only stable while no thread allocates.
+//!
+//! \note This class is not copyable; it is movable.
 class DataFile {
 public:
     // Open or create a data file
-    static DataFile create(const std::string& path, uint32_t record_length);
-    static DataFile open(const std::string& path);
+    static DataFile create(const std::string& path, uint32_t record_length, const DataFileOptions& options = {});
+    static DataFile open(const std::string& path, const DataFileOptions& options = {});
     
     // Non-copyable, movable
     DataFile(const DataFile&) = delete;
@@ -66,34 +196,158 @@ public:
     //! \details Writes the record at the given record number from the buffer
     void write_record(RPTR record_number, const uint8_t* buffer);
 
+    //! \brief Read a record without blocking the calling thread
+    //! \param record_number The record number to read
+    //! \param buffer Receives the record; must stay valid until the read completes
+    //! \param buffer_index Index of a buffer registered with the engine that contains buffer, or -1
+    //! \return An awaitable; co_await it to wait for the record
+    //! \details An invalid record number throws at the call.  The coroutine resumes on an
+    //! engine thread, and the file must stay open until then.  Memory-mapped, buffer pooled
+    //! and compressed files copy the record at the call and return a completed awaitable.
+    //! \code
+    //! co_await df.async_read_record(n, buffer);
+    //! \endcode
+    IoAwaitable async_read_record(RPTR record_number, uint8_t* buffer, int buffer_index = -1);
+
+    //! \brief Write a record without blocking the calling thread
+    //! \details As async_read_record().  With a write-ahead log, the write is logged at the call.
+    IoAwaitable async_write_record(RPTR record_number, const uint8_t* buffer, int buffer_index = -1);
+
+    //! \brief View a record in place
+    //! \param record_number The record number to view
+    //! \return A read-only view of the record straight into the file mapping
+    //! \details Only available when the file was opened with DataFileOptions::memory_mapped.
+    //! The view is invalidated by any call that grows the file (new_record, or write_record
+    //! at next_record()), since growing the file may move the mapping.
+    std::span<const uint8_t> view_record(RPTR record_number) const;
+
+    //! \brief Read a batch of records
+    //! \param record_numbers The record numbers to read, in any order
+    //! \param buffer Receives record_numbers.size() records, laid out in the order of record_numbers
+    //! \param status Receives one code per record (ErrorCode::SUCCESS or the failure); same size as record_numbers
+    //! \return The number of records read successfully
+    //! \details The requests are sorted and runs of adjacent records are read with a single preadv(2).
+    //! A bad record number or a failed read is reported in status rather than thrown, so one
+    //! failure does not abort the rest of the batch.
+    size_t read_records(std::span<const RPTR> record_numbers, uint8_t* buffer, std::span<ErrorCode> status);
+
+    //! \brief Write a batch of records
+    //! \param record_numbers The record numbers to write, in any order
+    //! \param buffer Holds record_numbers.size() records, laid out in the order of record_numbers
+    //! \param status Receives one code per record (ErrorCode::SUCCESS or the failure); same size as record_numbers
+    //! \return The number of records written successfully
+    //! \details The requests are sorted and runs of adjacent records are written with a single pwritev(2).
+    //! If a record number appears more than once, the last occurrence wins, as with
+    //! consecutive write_record() calls.
+    size_t write_records(std::span<const RPTR> record_numbers, const uint8_t* buffer, std::span<ErrorCode> status);
+
     //! \brief New record
     //! \param data The data to write to the new record
-    //! \details Creates a new record and writes the data to it
+    //! \details Creates a new record and writes the data to it.  Deleted slots are reused
+    //! before the file is extended.
     RPTR new_record(void* data);
 
+    //! \brief Allocate and write several records in one operation
+    //! \param record_numbers Receives the number of each new record
+    //! \param data Holds record_numbers.size() records, back to back
+    //! \details Slots come from the free list first and then from a single contiguous
+    //! extension of the file, and the data is written with write_records().
+    void new_records(std::span<RPTR> record_numbers, const uint8_t* data);
+
+    //! \brief Write records past the end of the file, leaving the free list alone
+    //! \param data Holds count records, back to back
+    //! \return The number of the first record; the rest follow it in order
+    //! \details For bulk loads: the records take one contiguous run of slots, written with
+    //! large vectored writes, and the header changes once.
+    RPTR append_records(const uint8_t* data, size_t count);
+
     //! \brief Delete a record at the given record number
     //! \param record_number Logical record number to delete
-    //! \details Deletes the record at the given record number
+    //! \details The slot is zeroed and pushed onto the free list headed by first_record(); its
+    //! first sizeof(RPTR) bytes link to the next free slot.  Deleting a record that is already
+    //! free throws INVALID_ARGUMENT.  The first delete walks the free list once, to note
+    //! which slots are free in memory, at one bit a slot.
     // Delete a record at the given pointer, returns 0 on success
     int delete_record(RPTR record_number);
     
+    //! \brief Visit every live record in order
+    //! \param options Range, block size, and whether to skip deleted slots
+    //! \return A single-pass range of record views; see RecordScan
+    //! \details Much faster than read_record() in a loop: the file is read in large blocks
+    //! with kernel readahead, and records are not copied out of the block.
+    //! \code
+    //! for (std::span<const uint8_t> record : df.scan()) { ... }
+    //! \endcode
+    RecordScan scan(const ScanOptions& options = {});
+
+    //! \brief Shrink the file by moving the last records into free slots
+    //! \param options How much work to do before returning
+    //! \return The moves made, so that whatever refers to the moved records can be patched
+    //! \details Repeatedly cuts the last slot off the file: a free one is dropped, and a live
+    //! one is copied into the lowest free slot first.  The file is then truncated.  Call
+    //! again until the result is complete to compact in bounded slices; between calls the
+    //! file is fully usable.
+    //!
+    //! The first call walks the free list and relinks it in ascending order, so that later
+    //! slices and allocations take the lowest free slots first.  Readers may run throughout,
+    //! though a record number moved away from is invalid once the call returns.  Records are
+    //! copied without the allocation lock, so allocations and deletes go on alongside; a
+    //! slice ends early if records are appended meanwhile.  Writes and deletes of the
+    //! records at the end of the file, and snapshots, must not overlap a call.
+    //! Memory-mapped and compressed files cannot be compacted.
+    //! \code
+    //! CompactionOptions slice;
+    //! slice.time_budget = std::chrono::milliseconds(5);
+    //! for (CompactionResult r; !r.complete; ) {
+    //!     r = df.compact(slice);
+    //!     for (RecordMove move : r.moves) { index.update(move.from, move.to); }
+    //! }
+    //! \endcode
+    CompactionResult compact(const CompactionOptions& options = {});
+
+    //! \brief Open a consistent point-in-time view of the file
+    //! \details Only available when the file was opened with DataFileOptions::versioned.
+    //! The snapshot sees every write that finished before this call and none that begins
+    //! after it; see Snapshot.  Opening one waits for writes begun while no snapshot was
+    //! open, which keep no versions, to finish.
+    //! \code
+    //! Snapshot snap = df.snapshot();
+    //! for (std::span<const uint8_t> record : snap.scan()) { ... }
+    //! \endcode
+    Snapshot snapshot();
+
+    //! \brief Versions kept for open snapshots; all zero unless the file is versioned
+    VersionStats version_stats() const;
+    
     // Get header information
     const DataFileHeader& header() const { return header_; }
     uint32_t record_length() const { return header_.record_length; }
     RPTR first_record() const { return header_.first_record; }
-    RPTR next_record() const { return header_.next_record; }
+    RPTR next_record() const { return load_next_record(); }
     uint32_t version() const { return header_.version; }
     uint64_t creation_time() const { return header_.creation_time; }
     uint64_t last_update_time() const { return header_.last_update_time; }
     
     //! \brief Flush all writes to disk
-    //! \details Flushes all writes to disk
+    //! \details Writes the header if it changed and forces the file to stable storage:
+    //! msync(2) of the mapping in memory-mapped mode, fdatasync(2) otherwise.
     void flush();
     
+    //! \brief Make every write so far durable
+    //! \details With a write-ahead log, waits for the log to be synced through this file's
+    //! last write, sharing the sync with concurrent committers; the file's own pages are
+    //! left to be written back lazily.  Without a log this is flush().
+    void commit();
+    
     //! \brief Dump the file header information
     //! \details Prints the file header information to stdout in a human-readable format
     void dump_header() const;
     
+    bool is_memory_mapped() const { return map_.is_mapped(); }
+    bool is_compressed() const { return compressed_.is_open(); }
+    bool is_versioned() const { return versions_ != nullptr; }
+    bool has_record_checksums() const { return (header_.flags & PLDB_RECORD_CHECKSUMS) != 0; }
+    
     //! \brief Hexdump a record
     //! \param record_number The record number to dump
     //! \details Prints the contents of the specified record in hexdump format
@@ -114,29 +368,180 @@ protected:
     //! \param path The path to the data file
     //! \param record_length The length of each record in the data file
     //! \details Initializes the data file by creating a new file and writing the header to it
-    void initialize(const std::string& path, uint32_t record_length);
+    void initialize(const std::string& path, uint32_t record_length, const DataFileOptions& options = {});
 
 private:
+    friend class RecordScan;
+    friend class Snapshot;
+    
     DataFile() = default;
     
     //! \brief Load the data file
     //! \param path The path to the data file
     //! \details Loads the data file by opening the file and reading the header from it
-    void load(const std::string& path);
+    void load(const std::string& path, const DataFileOptions& options);
+
+    //! \brief Read raw bytes from the file
+    //! \details Reads from the mapping in memory-mapped mode, from the buffer pool if one is
+    //! attached, through the page cache of a compressed file, with pread otherwise.
+    //! Throws if the range extends past the end of the file.
+    void read_at(uint64_t offset, void* buffer, size_t length) const;
+
+    //! \brief Write raw bytes to the file
+    //! \details Writes into the mapping in memory-mapped mode (growing it as needed), into
+    //! the buffer pool if one is attached, into the pages of a compressed file, with pwrite
+    //! otherwise.
+    void write_at(uint64_t offset, const void* buffer, size_t length);
+
+    //! \brief Whether records are read and written with pread/pwrite on the descriptor
+    bool descriptor_io() const;
+
+    //! \brief Set slot_length_ and the block layout from header_
+    void compute_layout();
+
+    //! \brief Number of whole slots between the header and the given file offset
+    RPTR slots_before(uint64_t offset) const;
+
+    //! \brief Read a record, and verify its checksum if it has one
+    void read_slot(RPTR record_number, uint8_t* buffer) const;
+
+    //! \brief Write a record, followed by its checksum if the file keeps them
+    void write_slot(RPTR record_number, const uint8_t* buffer);
+
+    //! \brief Throw FILE_CORRUPTED if verification is on and data does not match stored
+    void check_record(RPTR record_number, const uint8_t* data, uint32_t stored) const;
+
+    //! \brief write_record() without the version bookkeeping
+    void store_record(RPTR record_number, const uint8_t* buffer);
+
+    //! \brief write_records() without the version bookkeeping
+    size_t store_records(std::span<const RPTR> record_numbers, const uint8_t* buffer, std::span<ErrorCode> status);
+
+    //! \brief Write freshly allocated records, throwing if any of them fails
+    void store_new_records(std::span<const RPTR> record_numbers, const uint8_t* data, RPTR first_new);
+
+    //! \brief Hand the current contents of records about to be written to the version store
+    //! \param free Whether the records are being allocated, so that snapshots see them as free
+    //! \details Slots not yet in the file are kept as zeros; invalid record numbers are skipped.
+    void keep_versions(std::span<const RPTR> record_numbers, uint64_t sequence, bool free);
+
+    //! \brief Make a slot a free one linking to next_free
+    //! \param clear Zero the rest of the slot; otherwise it must already be zero
+    void write_free_slot(RPTR record_number, RPTR next_free, bool clear);
+
+    //! \brief Whether a slot is on the free list; allocator_mutex_ must be held
+    //! \details Loads free_slots_ the first time.
+    bool on_free_list(RPTR record_number);
+
+    //! \brief Walk the free list into free_slots_, throwing FILE_CORRUPTED if it is not a chain
+    //! of distinct slots below next_record
+    void load_free_slots();
+
+    //! \brief Note in free_slots_, if it is loaded, that a slot went on or off the free list
+    void mark_free(RPTR record_number, bool free);
+
+    //! \brief Put a slot on compaction_free_, linking it in order; allocator_mutex_ must be held
+    void insert_free_slot(RPTR record_number);
+
+    //! \brief Start a compaction: load the free list into compaction_free_, in ascending
+    //! order, relinking the slots in that order if they are not
+    void load_compaction_list();
+
+    //! \brief Take a slot off the free list, or from the end of the file
+    //! \details Does no heap allocation and no I/O beyond reading the free-list link.
+    //! allocator_mutex_ must be held.
+    RPTR allocate_slot();
+
+    // next_record, file_end_ and last_lsn_ are read without locks while other threads
+    // advance them, so they are accessed through std::atomic_ref; the plain members keep
+    // DataFile movable
+
+    //! \brief header_.next_record, read atomically
+    RPTR load_next_record() const;
+
+    //! \brief Publish a new header_.next_record, allocating the file up to it; allocator_mutex_
+    //! must be held
+    void store_next_record(RPTR next_record);
+
+    //! \brief Allocate the file up to at least end, a growth extent at a time
+    void reserve(uint64_t end);
+
+    //! \brief file_end_, read atomically
+    uint64_t load_file_end() const;
+
+    //! \brief Raise file_end_ to at least end
+    void extend_file_end(uint64_t end);
+
+    //! \brief Raise last_lsn_ to at least lsn
+    void note_lsn(WriteAheadLog::Lsn lsn);
+
+    //! \brief Replay the write-ahead log into the freshly opened file
+    void recover();
+
+    //! \brief Common driver for read_records() and write_records()
+    size_t transfer_records(std::span<const RPTR> record_numbers, uint8_t* buffer, std::span<ErrorCode> status, bool write);
+
+    //! \brief Set up the I/O mode selected by options_ once the file is open
+    void attach(const DataFileOptions& options);
+
+    //! \brief Map the file, or grow the mapping so that it covers at least end bytes
+    void ensure_mapped(uint64_t end);
 
     //! \brief Read the header from the file
     //! \details Reads the header from the file into the header_ member variable
     void read_header();
     
-    //! \brief Write the header to the file
-    //! \details Writes the header_ member variable to the file
+    //! \brief Write the header to the file, if it changed since it was last written
+    //! \details Version 3 files take the next sequence number and write the copy it selects,
+    //! leaving the other one as it was.  The caller holds allocator_mutex_ if others may
+    //! be using the file.
     void write_header();
     
-    std::fstream file_;
+    PosixFile file_;
+    MemoryMap map_;
+    //! Page layer of a compressed file; reads through it fill its cache
+    mutable CompressedFile compressed_;
     std::string file_path_;
     DataFileHeader header_;
-    static constexpr size_t HEADER_SIZE = sizeof(DataFileHeader);
+    DataFileOptions options_;
+    BufferPool::FileId pool_file_ = 0;
+    uint64_t wal_key_ = 0;
+    WriteAheadLog::Lsn last_lsn_ = 0;
+    //! Logical end of the file; a memory-mapped or preallocated file is larger on disk
+    uint64_t file_end_ = 0;
+    //! Size of the file on disk, when it has been allocated past file_end_
+    uint64_t allocated_end_ = 0;
+    //! Bytes before the first record: PLDB_V3_HEADER_SIZE, or less for older versions
+    uint32_t header_size_ = PLDB_V3_HEADER_SIZE;
+    //! Whether header_ has changed since it was written; guarded by allocator_mutex_
+    bool header_dirty_ = false;
+    //! Bytes per record in the file, including its checksum
+    uint32_t slot_length_ = 0;
+    //! Block-aligned layout: slots per block, and bytes from one block of slots to the
+    //! next; records_per_block_ is 0 when slots are packed back to back
+    uint32_t records_per_block_ = 0;
+    uint32_t block_stride_ = 0;
+    //! Serializes changes to the free list and header; see the class notes
+    std::unique_ptr<std::mutex> allocator_mutex_ = std::make_unique<std::mutex>();
+    //! While a compaction is under way, the free list in order (ascending); null otherwise
+    std::unique_ptr<std::deque<RPTR>> compaction_free_;
+    //! Which slots are on the free list, by record number; null until a delete needs it
+    std::unique_ptr<std::vector<bool>> free_slots_;
+    //! Superseded versions for snapshots; null unless the file is versioned
+    std::unique_ptr<VersionStore> versions_;
+    //! Smallest amount a memory mapping grows by
+    static constexpr size_t MAP_GROWTH = 1024 * 1024;
 };
 
+//! \brief CRC32C of a data file header, taking its checksum field as zero
+uint32_t data_file_header_checksum(const DataFileHeader& header);
+
+//! \brief Pick the current header of a version 3 file
+//! \param copies The PLDB_HEADER_COPIES copies read from the start of the file
+//! \param got Bytes of them actually read
+//! \return Index of the valid copy with the later sequence number, or -1 if no copy is a
+//! valid version 3 header
+int current_data_file_header(const DataFileHeader* copies, size_t got);
+
 } // namespace pentaledger
 
@@ -27,7 +27,25 @@ namespace pentaledger {
 constexpr uint32_t PLDB_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('D' << 16) | ('B' << 24));
 
 // File format version
-constexpr uint32_t PLDB_VERSION = 1;
+// Version 2 adds flags and a header checksum; version 1 files have a 48-byte header.
+// Version 3 keeps two copies of the header, written alternately (see DataFileHeader::sequence).
+constexpr uint32_t PLDB_VERSION = 3;
+
+// Size of the header of a version 1 file, which ends after record_length
+constexpr uint32_t PLDB_V1_HEADER_SIZE = 48;
+
+// DataFileHeader::flags: each record slot ends with a CRC32C of the record
+constexpr uint32_t PLDB_RECORD_CHECKSUMS = 1u << 0;
+
+// DataFileHeader::flags: block-aligned layout, for direct I/O.  The header area takes a
+// whole PLDB_BLOCK_SIZE block and no slot straddles a block boundary: each block holds as
+// many whole slots as fit, then padding, and a slot longer than a block starts a run of
+// blocks of its own.
+constexpr uint32_t PLDB_BLOCK_ALIGNED = 1u << 1;
+
+// Block size of the block-aligned layout; a multiple of the logical block size of
+// common devices
+constexpr uint32_t PLDB_BLOCK_SIZE = 4096;
 
 //! \brief File header structure
 //! \details This is a fixed size header that is written to the beginning of the data file.
@@ -59,5 +77,25 @@ struct DataFileHeader {
     //! \brief Record Length
     //! \details Fixed length of each record.  This is the length of the data stored in each record.
     uint32_t record_length;
+
+    //! \brief Format flags
+    //! \details PLDB_ flag bits (version 2 and later).
+    uint32_t flags;
+
+    //! \brief Header checksum
+    //! \details CRC32C of the header with this field zeroed (version 2 and later).
+    uint32_t checksum;
+
+    //! \brief Header write sequence number
+    //! \details Version 3 and later: incremented by every header write, which goes to copy
+    //! sequence % PLDB_HEADER_COPIES.  The valid copy with the later number is current, so a
+    //! torn header write leaves the one before it in place.  Zero in older versions.
+    uint32_t sequence;
 };
+
+// Number of header copies at the start of a version 3 file
+constexpr uint32_t PLDB_HEADER_COPIES = 2;
+
+// Size of the header area of a version 3 file: the copies, back to back
+constexpr uint32_t PLDB_V3_HEADER_SIZE = PLDB_HEADER_COPIES * sizeof(DataFileHeader);
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include "record_pointer.hpp"
+#include "posix_file.hpp"
+#include "heap_file_header.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace pentaledger {
+
+class HeapFile;
+
+//! \brief Options chosen when a heap file is created
+struct HeapFileOptions {
+    //! \brief Bytes per page; a multiple of PAGE_SIZE up to HeapFile::MAX_PAGE_SIZE
+    //! \details Records too long for a page of their own go to chains of overflow pages,
+    //! so larger pages keep more records inline.
+    uint32_t page_size = 8192;
+};
+
+//! \brief A single forward pass over the records of a HeapFile, one page at a time
+//! \details Records are visited in page and slot order, each under its record number;
+//! one that has moved or overflowed is read from where it lives.  A view is valid until
+//! the iterator is advanced.  Writing to the file during a scan invalidates it.
+//!
+//! \note Not copyable or movable, since iterators refer to the scan; keep the result of
+//! HeapFile::scan() in a local.
+class HeapScan {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::span<const uint8_t>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        value_type operator*() const { return scan_->current_; }
+
+        iterator& operator++() {
+            scan_->advance();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return scan_->done_; }
+
+        //! \brief Number of the record currently viewed
+        RPTR record_number() const { return scan_->current_record_; }
+
+    private:
+        friend class HeapScan;
+        explicit iterator(HeapScan* scan) : scan_(scan) {}
+
+        HeapScan* scan_ = nullptr;
+    };
+
+    HeapScan(const HeapScan&) = delete;
+    HeapScan& operator=(const HeapScan&) = delete;
+
+    //! \brief Start the scan
+    iterator begin();
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    friend class HeapFile;
+    explicit HeapScan(HeapFile& file);
+
+    //! \brief Move to the next record, or set done_
+    void advance();
+
+    HeapFile& file_;
+    std::vector<uint8_t> page_;
+    //! A record that does not live in page_ at its own slot
+    std::vector<uint8_t> record_;
+    uint64_t page_number_ = 0;
+    uint32_t slot_ = 0;
+    RPTR current_record_ = 0;
+    std::span<const uint8_t> current_;
+    bool started_ = false;
+    bool done_ = false;
+};
+
+//! \brief Variable-length record file with slotted pages
+//! \details Offers the record API of DataFile (new_record, read_record, write_record,
+//! delete_record) for records of any length, each stored in just the bytes it needs.
+//! Records live in slotted data pages: a slot directory at the front of the page points
+//! at records packed from the back, so a record can grow, shrink or go away and the page
+//! is compacted around it.  A free-space map of one byte per page finds a page for a new
+//! record without reading the pages.  A record longer than fits in a page goes to a chain
+//! of overflow pages, and only a small descriptor stays in its slot.
+//!
+//! A record number names a page and a slot, and stays valid until the record is deleted,
+//! as with DataFile, after which it may be given to a new record.  A record that outgrows
+//! its page moves to another one and leaves a forward link in its slot, so its number
+//! still works; reaching it costs one extra page read.
+//!
+//! \note This class is not thread-safe.  It is movable but not copyable.
+class HeapFile {
+public:
+    //! \brief Create a file, discarding any existing one
+    static HeapFile create(const std::string& path, const HeapFileOptions& options = {});
+    static HeapFile open(const std::string& path);
+
+    // Non-copyable, movable
+    HeapFile(const HeapFile&) = delete;
+    HeapFile& operator=(const HeapFile&) = delete;
+    HeapFile(HeapFile&&) noexcept = default;
+    HeapFile& operator=(HeapFile&&) noexcept = default;
+
+    ~HeapFile();
+
+    //! \brief Store a new record
+    //! \return Its record number
+    RPTR new_record(const void* data, uint32_t length);
+
+    //! \brief Read a record into buffer, which is resized to fit it
+    void read_record(RPTR record_number, std::vector<uint8_t>& buffer);
+
+    //! \brief Length of a record, without reading it
+    uint32_t record_size(RPTR record_number);
+
+    //! \brief Replace a record, which may change length; its number stays the same
+    void write_record(RPTR record_number, const void* data, uint32_t length);
+
+    //! \brief Delete a record and free its space
+    int delete_record(RPTR record_number);
+
+    //! \brief Visit every record
+    //! \code
+    //! for (std::span<const uint8_t> record : hf.scan()) { ... }
+    //! \endcode
+    HeapScan scan();
+
+    const HeapFileHeader& header() const { return header_; }
+    uint32_t page_size() const { return header_.page_size; }
+    uint64_t page_count() const { return header_.page_count; }
+    uint64_t record_count() const { return header_.record_count; }
+
+    //! \brief Bytes of data in the records, which is what the file would ideally hold
+    uint64_t record_bytes() const { return header_.record_bytes; }
+
+    //! \brief Bytes of the file taken by its pages
+    uint64_t file_size() const { return header_.page_count * header_.page_size; }
+
+    //! \brief Write the header and free-space map and force the file to stable storage
+    void flush();
+
+    void close();
+    bool is_open() const { return file_.is_open(); }
+
+    //! \brief Largest page; a record number has room for the slots of a page this size
+    static constexpr uint32_t MAX_PAGE_SIZE = 256 * 1024;
+
+private:
+    friend class HeapScan;
+
+    HeapFile() = default;
+
+    //! \brief Check that the header describes a usable file, and size the buffers
+    void validate_header();
+    void read_header();
+    void write_header();
+
+    //! \brief Read the free-space map pages into free_space_
+    void read_free_space_map();
+    //! \brief Write free_space_ back to the map pages
+    void write_free_space_map();
+    //! \brief Record the free space of a data page in free_space_
+    void note_free_space(uint64_t page_number, const uint8_t* page);
+
+    //! \brief Whether a page holds the free-space map
+    bool is_map_page(uint64_t page_number) const;
+
+    void read_page(uint64_t page_number, uint8_t* page) const;
+    void write_page(uint64_t page_number, const uint8_t* page);
+
+    //! \brief Take a free overflow page, or add one to the end of the file
+    uint64_t allocate_page();
+
+    //! \brief Load into page a data page with room for length bytes of content in a new
+    //! slot, creating one if none has room
+    //! \param avoid A page not to use, or 0
+    uint64_t find_page(uint32_t length, uint8_t* page, uint64_t avoid);
+
+    //! \brief Read a record's page into page and return its slot number
+    //! \details Throws unless the record number names a record's home slot.
+    uint32_t locate(RPTR record_number, uint8_t* page) const;
+
+    //! \brief Copy out what a slot holds, following an overflow descriptor
+    void read_content(const uint8_t* page, uint32_t slot, std::vector<uint8_t>& buffer) const;
+
+    //! \brief Record length held by a slot that is not a forward link
+    uint64_t content_length(const uint8_t* page, uint32_t slot) const;
+
+    //! \brief Free a slot's content, and its overflow chain if it has one
+    void release(uint8_t* page, uint32_t slot);
+
+    //! \brief Put content in a page at the given slot, or at any free slot if slot is -1
+    //! \return The slot used, or -1 if the page has no room
+    int place(uint8_t* page, int slot, const uint8_t* content, uint32_t length, uint32_t flags);
+
+    //! \brief Pack a page's records against its end, merging the fragmented space
+    void compact(uint8_t* page);
+
+    //! \brief Write a record to a chain of overflow pages and return its first page
+    uint64_t write_overflow(const uint8_t* data, uint64_t length);
+    void read_overflow(const HeapOverflow& overflow, uint8_t* buffer) const;
+    void free_overflow(uint64_t first_page);
+
+    //! \brief Content for a slot: the record itself, or an overflow descriptor
+    //! \return The slot flags to use
+    uint32_t prepare_content(const uint8_t* data, uint32_t length, HeapOverflow& overflow, const uint8_t*& content, uint32_t& content_length);
+
+    PosixFile file_;
+    std::string file_path_;
+    HeapFileHeader header_{};
+    //! Free space of each page in 1/256ths of a page; zero for all but data pages
+    std::vector<uint8_t> free_space_;
+    bool map_dirty_ = false;
+    //! Page that took the last new record, tried first for the next one
+    uint64_t insert_page_ = 0;
+    //! Longest record kept in a data page
+    uint32_t max_inline_ = 0;
+    std::vector<uint8_t> page_;
+    std::vector<uint8_t> scratch_;
+};
+
+} // namespace pentaledger
@@ -0,0 +1,121 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "record_pointer.hpp"
+#include <cstdint>
+
+namespace pentaledger {
+// Magic number constant: "PLHP" as a 32-bit value (little-endian)
+constexpr uint32_t PLHP_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('H' << 16) | ('P' << 24));
+
+// File format version
+constexpr uint32_t PLHP_VERSION = 1;
+
+// Page types, in HeapPageHeader::type
+constexpr uint32_t HEAP_PAGE_DATA = 1;
+constexpr uint32_t HEAP_PAGE_OVERFLOW = 2;
+constexpr uint32_t HEAP_PAGE_FREE = 3;
+
+// Flags in the high bits of HeapSlot::length
+//! The slot holds the RPTR of the page and slot the record has moved to
+constexpr uint32_t HEAP_SLOT_FORWARD = 0x80000000u;
+//! The slot holds a record moved here from its home slot; scans skip it
+constexpr uint32_t HEAP_SLOT_MOVED = 0x40000000u;
+//! The slot holds a HeapOverflow descriptor instead of the record
+constexpr uint32_t HEAP_SLOT_OVERFLOW = 0x20000000u;
+constexpr uint32_t HEAP_SLOT_LENGTH = 0x1fffffffu;
+
+//! \brief Heap file header structure
+//! \details Written at the beginning of the file, in page 0.  The file is a sequence of
+//! page_size pages.  Page 1 and every (page_size + 1)-th page after it hold the free-space
+//! map: one byte per following page, giving the free space of a data page in 1/256ths of
+//! a page.  The other pages are data pages, overflow pages, or free overflow pages.
+struct HeapFileHeader {
+    //! \brief Magic number to identify the file.  Should be PLHP_MAGIC.
+    uint32_t magic_number;
+
+    //! \brief File format version.  Should be PLHP_VERSION.
+    uint32_t version;
+
+    //! \brief File creation time as Unix timestamp (seconds since epoch)
+    uint64_t creation_time;
+
+    //! \brief Last update time as Unix timestamp (seconds since epoch)
+    uint64_t last_update_time;
+
+    //! \brief Bytes per page
+    uint32_t page_size;
+
+    uint32_t reserved;
+
+    //! \brief Pages in the file, the header page included
+    uint64_t page_count;
+
+    //! \brief First free overflow page, or 0
+    uint64_t first_free_page;
+
+    //! \brief Live records
+    uint64_t record_count;
+
+    //! \brief Bytes of data in the live records
+    uint64_t record_bytes;
+};
+
+//! \brief Header at the start of every data and overflow page
+//! \details A data page is slotted: a directory of slot_count HeapSlot entries grows up
+//! from the header, and the records they point at are packed down from the end of the
+//! page.  An overflow page holds used bytes of one record after the header.
+struct HeapPageHeader {
+    //! \brief HEAP_PAGE_DATA, HEAP_PAGE_OVERFLOW or HEAP_PAGE_FREE
+    uint32_t type;
+
+    //! \brief Data page: entries in the slot directory.  Overflow page: bytes used.
+    uint32_t slot_count;
+
+    //! \brief Data page: offset of the lowest record byte
+    uint32_t free_end;
+
+    //! \brief Data page: bytes of dead records below free_end, reclaimed by compacting
+    uint32_t fragmented;
+
+    //! \brief Overflow or free page: next page of the chain, or 0
+    uint64_t next_page;
+};
+
+//! \brief Slot directory entry of a data page
+//! \details A slot with offset 0 is free; its number may be given to a new record.
+struct HeapSlot {
+    //! \brief Offset of the record in the page
+    uint32_t offset;
+
+    //! \brief Record length, ORed with HEAP_SLOT_* flags
+    uint32_t length;
+};
+
+//! \brief What a data page holds for a record stored in overflow pages
+struct HeapOverflow {
+    //! \brief Record length
+    uint64_t length;
+
+    //! \brief First page of the chain
+    uint64_t first_page;
+};
+}
@@ -0,0 +1,180 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include <coroutine>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace pentaledger {
+
+class IoEngine;
+
+//! \brief One positional read or write handed to an IoEngine
+//! \details The request, and its buffer, must stay alive until it completes.  On completion
+//! the engine sets result and then resumes waiter, or else calls callback, on one of its
+//! own threads.
+struct IoRequest {
+    int fd = -1;
+    void* buffer = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+    bool write = false;
+
+    //! \brief Index of the buffer in IoEngine::register_buffers(), or -1
+    //! \details The buffer must lie inside the registered one.
+    int buffer_index = -1;
+
+    //! \brief Bytes transferred (always length on success), or -errno
+    ssize_t result = 0;
+
+    std::coroutine_handle<> waiter;
+    void (*callback)(IoRequest& request) = nullptr;
+    void* user_data = nullptr;
+
+    //! Bytes already transferred; short transfers are continued by the engine
+    size_t done = 0;
+};
+
+//! \brief Tuning for an IoEngine
+struct IoEngineOptions {
+    //! \brief Submission queue entries of the io_uring; completions may queue up to twice this
+    unsigned queue_depth = 256;
+
+    //! \brief Worker threads of the fallback engine
+    unsigned threads = 4;
+
+    //! \brief Use the thread pool even where io_uring is available
+    bool force_thread_pool = false;
+};
+
+//! \brief Asynchronous positional file I/O
+//! \details Built on io_uring where the kernel supports it (one submission syscall per
+//! batch, one completion thread), with a pool of threads running pread/pwrite as the
+//! fallback.  Completions are delivered on an engine thread.
+//!
+//! Requests are submitted as they are queued, except inside a Batch: then everything
+//! queued by the thread goes to the kernel together when the outermost Batch ends.  The
+//! completion thread also batches whatever its resumed coroutines queue while it
+//! processes one round of completions.
+//!
+//! \note This class is thread-safe.  It is not copyable or movable.
+class IoEngine {
+public:
+    //! \brief Defers submission of requests queued by this thread until destroyed
+    class Batch {
+    public:
+        explicit Batch(IoEngine& engine);
+        ~Batch();
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+    private:
+        IoEngine& engine_;
+        IoEngine* outer_;
+    };
+
+    //! \brief Create the best available engine
+    static std::unique_ptr<IoEngine> create(const IoEngineOptions& options = {});
+
+    //! \brief The process-wide engine, created on first use with default options
+    static IoEngine& shared();
+
+    //! \brief Waits for every submitted request to complete
+    virtual ~IoEngine();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    //! \brief Queue a request
+    void submit(IoRequest& request);
+
+    //! \brief Queue several requests with a single submission
+    void submit(std::span<IoRequest*> requests);
+
+    //! \brief Register fixed buffers that requests can refer to by index
+    //! \details With io_uring the buffers are pinned once instead of on every request.
+    //! Replaces any buffers registered before; must not be called with requests in flight.
+    //! \return True if the engine registered them (the thread pool accepts and ignores them)
+    bool register_buffers(std::span<const struct iovec> buffers);
+
+    //! \brief "io_uring" or "thread_pool"
+    virtual const char* name() const = 0;
+
+protected:
+    IoEngine() = default;
+
+    //! \brief Queue without submitting
+    virtual void enqueue(IoRequest& request) = 0;
+
+    //! \brief Hand everything queued to the kernel or the workers
+    virtual void flush() = 0;
+
+    virtual bool do_register_buffers(std::span<const struct iovec> buffers) = 0;
+
+    //! \brief Deliver a finished request; continues it instead if it transferred only part
+    //! \return True if the request was finished, false if it was queued again
+    bool complete(IoRequest& request, ssize_t result);
+
+    //! \brief Whether this thread is inside a Batch for this engine
+    bool batching() const;
+};
+
+//! \brief co_await-able result of DataFile::async_read_record / async_write_record
+//! \details Completes immediately when the file is memory mapped or buffer pooled, since
+//! then the record is only copied in memory.  Throws DatabaseException(IO_ERROR) from the
+//! co_await if the I/O failed.
+class IoAwaitable {
+public:
+    //! \brief An operation that is carried out when awaited
+    IoAwaitable(IoEngine& engine, const IoRequest& request)
+        : engine_(&engine), request_(request) {}
+
+    //! \brief An operation that has already completed, or failed with error
+    explicit IoAwaitable(std::string error = {})
+        : ready_(true), error_(std::move(error)) {}
+
+    IoAwaitable(const IoAwaitable&) = delete;
+    IoAwaitable& operator=(const IoAwaitable&) = delete;
+
+    bool await_ready() const noexcept { return ready_; }
+
+    void await_suspend(std::coroutine_handle<> waiter) {
+        request_.waiter = waiter;
+        engine_->submit(request_);
+    }
+
+    void await_resume() const;
+
+private:
+    IoEngine* engine_ = nullptr;
+    IoRequest request_;
+    bool ready_ = false;
+    std::string error_;
+};
+
+} // namespace pentaledger
+
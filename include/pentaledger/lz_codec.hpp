@@ -0,0 +1,47 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pentaledger {
+
+//! \brief Largest output of lz_compress() for length bytes of input
+size_t lz_compress_bound(size_t length);
+
+//! \brief Compress with the built-in LZ77 codec
+//! \details A byte-oriented LZ4-style block format: runs of literals alternate with
+//! back-references of at least four bytes into the previous 64 KiB.  It favours speed
+//! over ratio; long runs of zeros or repeated values compress to a few bytes per 255.
+//! \param input The bytes to compress
+//! \param length Number of bytes
+//! \param output Receives the compressed bytes
+//! \param capacity Size of output
+//! \return The compressed size, or 0 if it would not fit in capacity
+size_t lz_compress(const void* input, size_t length, void* output, size_t capacity);
+
+//! \brief Decompress the output of lz_compress()
+//! \return The decompressed size
+//! \details Throws DatabaseException(FILE_CORRUPTED) if the input is malformed or would
+//! decompress to more than capacity bytes; never reads or writes out of bounds.
+size_t lz_decompress(const void* input, size_t length, void* output, size_t capacity);
+
+} // namespace pentaledger
@@ -0,0 +1,68 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pentaledger {
+
+//! \brief Owning wrapper around a shared, writable mapping of a file
+//! \details The mapping always starts at file offset 0.  Growing the mapping with remap()
+//! may move it, which invalidates every pointer previously obtained from data().
+//!
+//! \note This class is movable but not copyable.  A moved-from object is unmapped.
+class MemoryMap {
+public:
+    MemoryMap() = default;
+
+    // Non-copyable, movable
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap& operator=(const MemoryMap&) = delete;
+    MemoryMap(MemoryMap&& other) noexcept;
+    MemoryMap& operator=(MemoryMap&& other) noexcept;
+
+    ~MemoryMap();
+
+    //! \brief Map the first length bytes of the file
+    //! \param fd Open file descriptor; the file must be at least length bytes long
+    //! \param length Number of bytes to map
+    void map(int fd, size_t length);
+
+    //! \brief Resize the mapping to length bytes, possibly moving it
+    void remap(int fd, size_t length);
+
+    //! \brief Synchronously write dirty pages of the mapping back to the file (msync)
+    void sync();
+
+    //! \brief Release the mapping
+    void unmap();
+
+    bool is_mapped() const { return data_ != nullptr; }
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+} // namespace pentaledger
+
@@ -0,0 +1,185 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Set to 0 (CMake option PENTALEDGER_ENABLE_METRICS=OFF) to compile the
+// instrumentation points out of the storage layer entirely.
+#ifndef PENTALEDGER_METRICS
+#define PENTALEDGER_METRICS 1
+#endif
+
+namespace pentaledger {
+
+//! \brief Instrumented storage operations
+enum class Metric : uint8_t {
+    RECORD_READ,        //!< DataFile::read_record
+    RECORD_WRITE,       //!< DataFile::write_record
+    BATCH_READ,         //!< DataFile::read_records, one sample per batch
+    BATCH_WRITE,        //!< DataFile::write_records, one sample per batch
+    RECORD_ALLOCATE,    //!< Slot allocation in DataFile::new_record / new_records
+    HEADER_WRITE,       //!< DataFile and BTreeFile header writes
+    FLUSH,              //!< DataFile::flush and BTreeFile::flush
+    NODE_READ,          //!< BTreeFile::read_node
+    SCAN_READ,          //!< One block read by DataFile::scan()
+    PAGE_COMPRESS,      //!< One page compressed by a compressed DataFile
+    PAGE_DECOMPRESS,    //!< One page decompressed by a compressed DataFile
+    RECORD_MOVE,        //!< One record copied by DataFile::compact
+    COUNT
+};
+
+constexpr size_t METRIC_COUNT = static_cast<size_t>(Metric::COUNT);
+
+//! \brief Name of a metric as used in exported snapshots, e.g. "record_read"
+const char* metric_name(Metric metric);
+
+//! \brief Log-linear (HDR-style) latency buckets
+//! \details Values below SUB_BUCKETS nanoseconds get a bucket each; above that every
+//! power of two is split into SUB_BUCKETS equal buckets, so a bucket's width is at most
+//! 1/SUB_BUCKETS (6.25%) of its lower bound.  Values at or above 2^MAX_BITS ns (about
+//! 18 minutes) land in the last bucket.
+struct LatencyBuckets {
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1ULL << SUB_BITS;
+    static constexpr unsigned MAX_BITS = 40;
+    static constexpr size_t COUNT = SUB_BUCKETS + (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static constexpr size_t index(uint64_t ns) {
+        if (ns < SUB_BUCKETS) {
+            return static_cast<size_t>(ns);
+        }
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(ns));
+        if (msb > MAX_BITS) {
+            return COUNT - 1;
+        }
+        unsigned shift = msb - SUB_BITS;
+        return static_cast<size_t>(SUB_BUCKETS + shift * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS));
+    }
+
+    //! \brief Largest value that falls in a bucket
+    static constexpr uint64_t upper_bound(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        uint64_t shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+        uint64_t sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+};
+
+//! \brief Totals and latency distribution of one metric
+struct MetricSnapshot {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, LatencyBuckets::COUNT> buckets{};
+
+    uint64_t mean_ns() const { return count == 0 ? 0 : total_ns / count; }
+
+    //! \brief Latency at quantile q (0..1), accurate to the bucket width
+    uint64_t percentile_ns(double q) const;
+};
+
+//! \brief Point-in-time totals of every metric, summed over all threads
+struct MetricsSnapshot {
+    std::array<MetricSnapshot, METRIC_COUNT> metrics{};
+
+    const MetricSnapshot& operator[](Metric metric) const { return metrics[static_cast<size_t>(metric)]; }
+
+    //! \brief Render as a JSON object, e.g. for the server's metrics endpoint
+    //! \details {"enabled":true,"metrics":{"record_read":{"count":..,"bytes":..,"mean_ns":..,
+    //! "max_ns":..,"p50_ns":..,"p90_ns":..,"p99_ns":..,"p999_ns":..},...}}
+    std::string to_json() const;
+};
+
+//! \brief Called for every instrumented operation when installed with set_trace_hook()
+//! \param start_ns Start time on the steady clock, in nanoseconds
+using TraceHook = void (*)(Metric metric, uint64_t start_ns, uint64_t duration_ns, uint64_t bytes);
+
+//! \brief Whether the library was built with instrumentation
+constexpr bool metrics_enabled() { return PENTALEDGER_METRICS != 0; }
+
+//! \brief Sum the counters of every thread, including threads that have exited
+//! \details Counters are read without stopping writers, so a snapshot taken during
+//! activity may be off by the operations in flight.
+MetricsSnapshot metrics_snapshot();
+
+//! \brief Zero every counter
+//! \details Meant for tests and benchmarks; operations racing with a reset may be lost.
+void metrics_reset();
+
+//! \brief Install a hook that sees every instrumented operation; nullptr removes it
+//! \details The hook runs on the calling thread inside the storage call, so it should be
+//! cheap and must not call back into the file being traced.
+void set_trace_hook(TraceHook hook);
+
+#if PENTALEDGER_METRICS
+
+//! \brief Add one operation to the calling thread's counters
+//! \details Lock-free: each thread owns its counters and is their only writer.
+void metrics_record(Metric metric, uint64_t start_ns, uint64_t duration_ns, uint64_t bytes);
+
+//! \brief Times the enclosing scope as one operation of a metric
+class MetricTimer {
+public:
+    explicit MetricTimer(Metric metric, uint64_t bytes = 0)
+        : metric_(metric), bytes_(bytes), start_(std::chrono::steady_clock::now()) {}
+
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+
+    ~MetricTimer() {
+        auto end = std::chrono::steady_clock::now();
+        metrics_record(metric_, nanoseconds(start_), nanoseconds(end) - nanoseconds(start_), bytes_);
+    }
+
+private:
+    static uint64_t nanoseconds(std::chrono::steady_clock::time_point t) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+    }
+
+    Metric metric_;
+    uint64_t bytes_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define PENTALEDGER_METRIC_CONCAT_(a, b) a##b
+#define PENTALEDGER_METRIC_CONCAT(a, b) PENTALEDGER_METRIC_CONCAT_(a, b)
+
+//! \brief Time the rest of the enclosing scope as one operation of metric
+#define PENTALEDGER_METRIC_SCOPE(metric, bytes) \
+    ::pentaledger::MetricTimer PENTALEDGER_METRIC_CONCAT(metric_timer_, __LINE__)(metric, bytes)
+
+#else
+
+inline void metrics_record(Metric, uint64_t, uint64_t, uint64_t) {}
+
+#define PENTALEDGER_METRIC_SCOPE(metric, bytes) static_cast<void>(0)
+
+#endif
+
+} // namespace pentaledger
+
@@ -0,0 +1,46 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pentaledger {
+
+//! \brief Find where a key belongs among the sorted keys of a B-tree node
+//! \param keys The first key, e.g. BTreeNode::keyspace
+//! \param count Number of keys
+//! \param key_length Bytes per key; keys compare as with memcmp
+//! \param stride Bytes from one key to the next: the key length plus the RPTR after it
+//! \param key The key sought
+//! \return Index of the first key not below key; count if there is none
+//! \details Keys of 4 or 8 bytes, such as the big-endian integers the bulk loader writes,
+//! are compared as integers by a branchless kernel that counts the keys below the one
+//! sought: AVX2 or SSE4.2 when the CPU has them, plain integer compares otherwise; the
+//! choice is made once, at startup.  Other keys are binary-searched in place with memcmp.
+int node_lower_bound(const char* keys, int count, size_t key_length, size_t stride, const char* key);
+
+//! \brief node_lower_bound() by binary search with memcmp, whatever the key length
+int node_lower_bound_portable(const char* keys, int count, size_t key_length, size_t stride, const char* key);
+
+//! \brief The kernel node_lower_bound() uses for 4- and 8-byte keys: "avx2", "sse4.2" or "scalar"
+const char* node_search_kernel();
+
+} // namespace pentaledger
@@ -0,0 +1,242 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "types.hpp"
+#include "record_pointer.hpp"
+#include "posix_file.hpp"
+#include "pax_file_header.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace pentaledger {
+
+class PaxFile;
+
+//! \brief Options chosen when a PAX file is created
+struct PaxFileOptions {
+    //! \brief Bytes per data page; rounded up to whole PAGE_SIZE pages
+    //! \details Larger pages make longer runs of each column, so a projection reads more
+    //! of what it needs per request.  A page must hold at least one record.
+    uint32_t page_size = 256 * 1024;
+};
+
+//! \brief The requested columns of the records of one page
+class PaxBatch {
+public:
+    //! \brief Number of the first record in the batch
+    RPTR first_record() const { return first_record_; }
+
+    //! \brief Records in the batch, live or not
+    uint32_t size() const { return count_; }
+
+    //! \brief Whether a row holds a record (false if it is on the free list)
+    bool live(uint32_t row) const { return live_[row] != 0; }
+
+    //! \brief The contiguous values of the i-th requested column
+    const uint8_t* column(size_t i) const { return columns_[i]; }
+
+    //! \brief Decode one value of the i-th requested column
+    template <class T>
+    T value(size_t i, uint32_t row) const {
+        T v;
+        std::memcpy(&v, columns_[i] + static_cast<size_t>(row) * sizeof(T), sizeof(T));
+        return v;
+    }
+
+private:
+    friend class PaxColumnScan;
+
+    RPTR first_record_ = 0;
+    uint32_t count_ = 0;
+    std::vector<const uint8_t*> columns_;
+    std::vector<uint8_t> live_;
+};
+
+//! \brief A single forward pass over some columns of a PaxFile, one page at a time
+//! \details Only the requested column runs of each page are read.  Writing to the file
+//! during a scan invalidates it.
+//!
+//! \note Not copyable or movable, since iterators refer to the scan; keep the result of
+//! PaxFile::scan_columns() in a local.
+class PaxColumnScan {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = PaxBatch;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        const PaxBatch& operator*() const { return scan_->batch_; }
+        const PaxBatch* operator->() const { return &scan_->batch_; }
+
+        iterator& operator++() {
+            scan_->advance();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return scan_->done_; }
+
+    private:
+        friend class PaxColumnScan;
+        explicit iterator(PaxColumnScan* scan) : scan_(scan) {}
+
+        PaxColumnScan* scan_ = nullptr;
+    };
+
+    PaxColumnScan(const PaxColumnScan&) = delete;
+    PaxColumnScan& operator=(const PaxColumnScan&) = delete;
+
+    //! \brief Start the scan
+    iterator begin();
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    friend class PaxFile;
+    PaxColumnScan(PaxFile& file, std::span<const uint32_t> columns);
+
+    //! \brief Load the next page into batch_, or set done_
+    void advance();
+
+    PaxFile& file_;
+    std::vector<uint32_t> columns_;
+    std::vector<std::vector<uint8_t>> buffers_;
+    std::vector<bool> free_;
+    PaxBatch batch_;
+    uint64_t page_ = 0;
+    uint64_t page_count_ = 0;
+    bool started_ = false;
+    bool done_ = false;
+};
+
+//! \brief Fixed-length record file with a columnar (PAX) page layout
+//! \details Offers the point-access API of DataFile (new_record, read_record, write_record,
+//! delete_record, with the same free list of deleted records) on a layout that groups
+//! records into pages and stores each field contiguously within its page.  Analytic scans
+//! that need a few fields of wide records then read only those fields: see scan_columns().
+//!
+//! Records are passed to and from the point-access calls in row form, the columns
+//! concatenated in order.  A point access touches one run per column.
+//!
+//! \note This class is not thread-safe.  It is movable but not copyable.
+class PaxFile {
+public:
+    //! \brief Create a file, discarding any existing one
+    //! \param column_sizes Width of each column in bytes; together at least sizeof(RPTR)
+    static PaxFile create(const std::string& path, std::span<const uint32_t> column_sizes, const PaxFileOptions& options = {});
+    static PaxFile open(const std::string& path);
+
+    // Non-copyable, movable
+    PaxFile(const PaxFile&) = delete;
+    PaxFile& operator=(const PaxFile&) = delete;
+    PaxFile(PaxFile&&) noexcept = default;
+    PaxFile& operator=(PaxFile&&) noexcept = default;
+
+    ~PaxFile();
+
+    //! \brief Read a record into buffer in row form
+    void read_record(RPTR record_number, uint8_t* buffer);
+
+    //! \brief Write a record given in row form
+    void write_record(RPTR record_number, const uint8_t* buffer);
+
+    //! \brief Read a single field of a record
+    void read_field(RPTR record_number, uint32_t column, uint8_t* buffer);
+
+    //! \brief Allocate a record, reusing a deleted one if possible, and write data to it
+    RPTR new_record(const void* data);
+
+    //! \brief Delete a record, zeroing it and pushing it onto the free list
+    //! \details Throws INVALID_ARGUMENT if the record is already free.  The first delete
+    //! walks the free list once, to note which records are free in memory.
+    int delete_record(RPTR record_number);
+
+    //! \brief Visit the listed columns of every record, a page at a time
+    //! \param columns Column numbers; batch column i is columns[i]
+    PaxColumnScan scan_columns(std::span<const uint32_t> columns);
+
+    const PaxFileHeader& header() const { return header_; }
+    uint32_t record_length() const { return header_.record_length; }
+    uint32_t column_count() const { return header_.column_count; }
+    uint32_t column_size(uint32_t column) const { return header_.column_sizes[column]; }
+    uint32_t records_per_page() const { return header_.records_per_page; }
+    RPTR first_record() const { return header_.first_record; }
+    RPTR next_record() const { return header_.next_record; }
+
+    //! \brief Write the header and force the file to stable storage
+    void flush();
+
+    void close();
+    bool is_open() const { return file_.is_open(); }
+
+    //! \brief Space reserved at the start of the file for the header
+    static constexpr size_t HEADER_SIZE = PAGE_SIZE;
+
+private:
+    friend class PaxColumnScan;
+
+    PaxFile() = default;
+
+    //! \brief File offset of a field
+    uint64_t locate_field(RPTR record_number, uint32_t column) const;
+
+    //! \brief File offset of a column's run in a page
+    uint64_t locate_column(uint64_t page, uint32_t column) const;
+
+    //! \brief Read or write the first length bytes of a record in row form
+    void transfer(RPTR record_number, uint8_t* buffer, size_t length, bool write);
+
+    void check_record(RPTR record_number) const;
+
+    //! \brief Whether a record is on the free list; loads free_slots_ the first time
+    bool on_free_list(RPTR record_number);
+
+    //! \brief Walk the free list into free_slots_, throwing FILE_CORRUPTED if it is not a chain
+    //! of distinct records below next_record
+    void load_free_slots();
+
+    //! \brief Note in free_slots_, if it is loaded, that a record went on or off the free list
+    void mark_free(RPTR record_number, bool free);
+
+    //! \brief Fill column_offsets_ from the header
+    void compute_layout();
+    void read_header();
+    void write_header();
+
+    PosixFile file_;
+    std::string file_path_;
+    PaxFileHeader header_{};
+    //! Start of each column's run within a page
+    std::vector<uint64_t> column_offsets_;
+    //! Which records are on the free list, by record number; null until a delete needs it
+    std::unique_ptr<std::vector<bool>> free_slots_;
+};
+
+} // namespace pentaledger
+
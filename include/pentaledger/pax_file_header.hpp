@@ -0,0 +1,73 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include "record_pointer.hpp"
+#include <cstdint>
+
+namespace pentaledger {
+// Magic number constant: "PLPX" as a 32-bit value (little-endian)
+constexpr uint32_t PLPX_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('P' << 16) | ('X' << 24));
+
+// File format version
+constexpr uint32_t PLPX_VERSION = 1;
+
+// Most columns a PAX file can have
+constexpr uint32_t PAX_MAX_COLUMNS = 256;
+
+//! \brief PAX file header structure
+//! \details Written at the beginning of the file, which reserves PAGE_SIZE bytes for it.
+//! Data pages follow, each page_size bytes long and holding records_per_page records.
+//! Within a page each column is stored contiguously: the column_sizes[0] bytes of every
+//! record's first field, then those of the second field, and so on.
+struct PaxFileHeader {
+    //! \brief Magic number to identify the file.  Should be PLPX_MAGIC.
+    uint32_t magic_number;
+
+    //! \brief File format version.  Should be PLPX_VERSION.
+    uint32_t version;
+
+    //! \brief File creation time as Unix timestamp (seconds since epoch)
+    uint64_t creation_time;
+
+    //! \brief Last update time as Unix timestamp (seconds since epoch)
+    uint64_t last_update_time;
+
+    //! \brief Pointer to first deleted record in the file
+    RPTR first_record;
+
+    //! \brief Pointer to next available position for new record
+    RPTR next_record;
+
+    //! \brief Sum of the column sizes
+    uint32_t record_length;
+
+    //! \brief Number of columns in use in column_sizes
+    uint32_t column_count;
+
+    //! \brief Bytes per data page
+    uint32_t page_size;
+
+    //! \brief Records stored in each data page
+    uint32_t records_per_page;
+
+    //! \brief Width of each column in bytes
+    uint32_t column_sizes[PAX_MAX_COLUMNS];
+};
+}
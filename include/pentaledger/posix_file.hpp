@@ -0,0 +1,104 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace pentaledger {
+
+//! \brief Owning wrapper around a POSIX file descriptor
+//! \details All I/O is positional (pread/pwrite), so there is no shared file cursor
+//! to seek before every access.  Failures are reported as DatabaseException.
+//!
+//! \note This class is movable but not copyable.  A moved-from object is closed.
+class PosixFile {
+public:
+    PosixFile() = default;
+
+    // Non-copyable, movable
+    PosixFile(const PosixFile&) = delete;
+    PosixFile& operator=(const PosixFile&) = delete;
+    PosixFile(PosixFile&& other) noexcept;
+    PosixFile& operator=(PosixFile&& other) noexcept;
+
+    ~PosixFile();
+
+    //! \brief Open a file
+    //! \param path The path to the file
+    //! \param flags Flags passed to open(2), e.g. O_RDWR | O_CREAT
+    //! \param mode Permission bits used when the file is created
+    //! \return true if the file was opened, false otherwise (errno is preserved)
+    bool open(const std::string& path, int flags, mode_t mode = 0644);
+
+    //! \brief Close the file descriptor, if open
+    void close();
+
+    bool is_open() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    //! \brief Read up to length bytes at the given offset
+    //! \return The number of bytes read; less than length only at end of file
+    size_t read_at(void* buffer, size_t length, uint64_t offset) const;
+
+    //! \brief Read exactly length bytes at the given offset
+    //! \details Throws DatabaseException if fewer than length bytes are available
+    void read_exact(void* buffer, size_t length, uint64_t offset) const;
+
+    //! \brief Write exactly length bytes at the given offset
+    void write_exact(const void* buffer, size_t length, uint64_t offset);
+
+    //! \brief Scatter-read into count buffers starting at the given offset (preadv)
+    //! \return The number of bytes read, or -1 with errno set on failure; retried on EINTR
+    ssize_t readv_at(const struct iovec* iov, int count, uint64_t offset) const;
+
+    //! \brief Gather-write count buffers starting at the given offset (pwritev)
+    //! \return The number of bytes written, or -1 with errno set on failure; retried on EINTR
+    ssize_t writev_at(const struct iovec* iov, int count, uint64_t offset);
+
+    //! \brief Current size of the file in bytes
+    uint64_t size() const;
+
+    //! \brief Set the size of the file, extending it with zeros if needed
+    void truncate(uint64_t length);
+
+    //! \brief Allocate disk blocks for a range of the file, extending it with zeros if needed
+    //! \details fallocate() on Linux, so that the range is reserved as one extent where the
+    //! file system can; elsewhere, or where the file system cannot, the file is only extended.
+    void allocate(uint64_t offset, uint64_t length);
+
+    //! \brief Flush file data (not necessarily metadata) to stable storage
+    void sync_data();
+
+    //! \brief Bypass the kernel page cache for this descriptor, or stop doing so
+    //! \details O_DIRECT (F_NOCACHE on macOS).  While it is on, buffers, offsets and lengths
+    //! of reads and writes must be multiples of the device's logical block size.  Throws
+    //! DatabaseException(INVALID_ARGUMENT) if the file system does not support it.
+    void set_direct(bool enable);
+
+private:
+    int fd_ = -1;
+};
+
+} // namespace pentaledger
+
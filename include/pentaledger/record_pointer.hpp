@@ -24,6 +24,9 @@ namespace pentaledger {
 
 typedef uint64_t RPTR;
 
+// Invalid record pointer constant
+constexpr RPTR INVALID_RPTR = 0xFFFFFFFFFFFFFFFFULL;
+
 struct RecordPointer {
 
     //! \brief First record pointer
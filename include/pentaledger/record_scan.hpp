@@ -0,0 +1,156 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "record_pointer.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace pentaledger {
+
+class DataFile;
+class Snapshot;
+
+//! \brief Options for DataFile::scan()
+struct ScanOptions {
+    //! \brief Bytes read per block; rounded up to whole pages
+    size_t block_size = 1024 * 1024;
+
+    //! \brief First record to visit
+    RPTR first_record = 1;
+
+    //! \brief Last record to visit; 0 scans to the end of the file
+    RPTR last_record = 0;
+
+    //! \brief Skip deleted slots: those on the free list and those that are all zeros
+    bool skip_deleted = true;
+};
+
+//! \brief A single forward pass over the records of a DataFile
+//! \details Reads the file in large page-aligned blocks into a page-aligned buffer, after
+//! advising the kernel of sequential access, and hands out views of the records in the
+//! buffer.  In memory-mapped mode the views point straight into the mapping and nothing
+//! is copied.
+//!
+//! A view is valid until the iterator is advanced.  Writing to the file during a scan
+//! invalidates the scan, unless the scan belongs to a Snapshot: a snapshot scan substitutes
+//! the kept version of each record written since the snapshot for what the block holds.
+//!
+//! \note Not copyable or movable, since iterators refer to the scan; keep the result of
+//! DataFile::scan() in a local.
+class RecordScan {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::span<const uint8_t>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        value_type operator*() const { return scan_->current_; }
+
+        iterator& operator++() {
+            scan_->advance();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return scan_->done_; }
+
+        //! \brief Number of the record currently viewed
+        RPTR record_number() const { return scan_->current_record_; }
+
+    private:
+        friend class RecordScan;
+        explicit iterator(RecordScan* scan) : scan_(scan) {}
+
+        RecordScan* scan_ = nullptr;
+    };
+
+    RecordScan(const RecordScan&) = delete;
+    RecordScan& operator=(const RecordScan&) = delete;
+
+    //! \brief Start the scan
+    //! \details A scan is a single pass: calling begin() again continues where it left off.
+    iterator begin();
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    friend class DataFile;
+    friend class Snapshot;
+    RecordScan(DataFile& file, const ScanOptions& options, const Snapshot* snapshot = nullptr);
+
+    struct FreeDeleter {
+        void operator()(uint8_t* p) const { std::free(p); }
+    };
+
+    //! \brief Move to the next live record, or set done_
+    void advance();
+
+    //! \brief Read the next block, keeping the unread tail of the current one in front of it
+    //! \return False at the end of the scanned range
+    bool fill();
+
+    //! \brief Verify the checksums of the slots from data on, as many as are buffered (up
+    //! to a batch), and move verified_ past the good ones
+    void verify_slots(RPTR record, const uint8_t* data);
+
+    //! \brief Mark the slots on the free list in free_
+    void load_free_list();
+
+    DataFile& file_;
+    ScanOptions options_;
+    //! The snapshot scanned, or null for the current records
+    const Snapshot* snapshot_ = nullptr;
+    //! A kept version substituted for the slot in the block
+    std::vector<uint8_t> image_;
+    bool started_ = false;
+    bool done_ = false;
+
+    RPTR next_record_ = 0;
+    RPTR last_record_ = 0;
+    RPTR current_record_ = 0;
+    std::span<const uint8_t> current_;
+    std::vector<bool> free_;
+
+    // Buffered mode: carry_size_ bytes of room for a partial record, then the block
+    std::unique_ptr<uint8_t, FreeDeleter> buffer_;
+    size_t carry_size_ = 0;
+    size_t block_size_ = 0;
+    uint64_t read_offset_ = 0;
+    uint64_t end_offset_ = 0;
+    size_t skip_ = 0;
+    //! Block-aligned layout: bytes after the last slot of each block
+    size_t padding_ = 0;
+
+    const uint8_t* cursor_ = nullptr;
+    const uint8_t* limit_ = nullptr;
+    //! End of the slots whose checksums have been verified
+    const uint8_t* verified_ = nullptr;
+};
+
+} // namespace pentaledger
+
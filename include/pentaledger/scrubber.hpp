@@ -0,0 +1,145 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pentaledger {
+
+//! \brief A checksum mismatch or read failure found by a Scrubber
+struct ScrubError {
+    //! \brief The file it was found in
+    std::string path;
+
+    //! \brief Offset of the damaged header, record slot or node; for a compressed data file,
+    //! the offset within its uncompressed contents
+    uint64_t offset = 0;
+
+    std::string message;
+};
+
+//! \brief Counters of a Scrubber, since it was constructed
+struct ScrubStats {
+    //! \brief Complete passes over all registered files
+    uint64_t passes = 0;
+
+    //! \brief Files verified
+    uint64_t files = 0;
+
+    //! \brief Bytes read and verified
+    uint64_t bytes = 0;
+
+    //! \brief Errors reported
+    uint64_t errors = 0;
+};
+
+//! \brief Options of a Scrubber
+struct ScrubberOptions {
+    //! \brief Read rate the scrubber holds itself to; 0 for no limit
+    uint64_t bytes_per_second = 16 * 1024 * 1024;
+
+    //! \brief Pause between the end of one pass and the start of the next
+    std::chrono::milliseconds pass_interval{std::chrono::minutes(10)};
+
+    //! \brief Called, on the scrubber's thread, for each error found
+    std::function<void(const ScrubError&)> on_error;
+};
+
+//! \brief Background verification of the checksums of whole files
+//! \details A scrubber thread walks the registered files over and over, reading each one
+//! through its own descriptor and checking every checksum it carries: the header and
+//! record slots of a DataFile created with record_checksums (and, for a compressed one, the
+//! page table and every extent), and the header and nodes of a BTreeFile.  This finds
+//! damage in records nobody happens to read.  Reads are paced to
+//! ScrubberOptions::bytes_per_second so that the scrubber stays out of the way of the
+//! foreground workload.
+//!
+//! A file may be open elsewhere while it is scrubbed.  A record slot or node that fails is
+//! read again before it is reported, which rules out a write that was in flight; but the
+//! scrubber only sees what has reached the file, so a compressed data file should be
+//! flushed before its pass to avoid reports about a page table that has since moved on.
+//!
+//! \note The public functions are thread-safe.  Not copyable or movable.
+class Scrubber {
+public:
+    explicit Scrubber(const ScrubberOptions& options = {});
+    ~Scrubber();
+
+    Scrubber(const Scrubber&) = delete;
+    Scrubber& operator=(const Scrubber&) = delete;
+
+    //! \brief Verify a DataFile on every pass
+    void add_data_file(const std::string& path);
+
+    //! \brief Verify a BTreeFile on every pass
+    void add_btree_file(const std::string& path);
+
+    //! \brief Stop verifying a file; a pass already reading it finishes the file
+    void remove(const std::string& path);
+
+    //! \brief Start the scrubber thread; the first pass begins at once
+    void start();
+
+    //! \brief Stop the scrubber thread, interrupting a pass in progress
+    void stop();
+
+    bool running() const;
+    ScrubStats stats() const;
+
+    //! \brief Verify a DataFile now, on the calling thread
+    //! \param bytes_per_second Read rate limit; 0 for none
+    //! \return The errors found
+    static std::vector<ScrubError> scrub_data_file(const std::string& path, uint64_t bytes_per_second = 0);
+
+    //! \brief Verify a BTreeFile now, on the calling thread
+    static std::vector<ScrubError> scrub_btree_file(const std::string& path, uint64_t bytes_per_second = 0);
+
+private:
+    enum class Kind { DATA_FILE, BTREE_FILE };
+
+    struct Target {
+        std::string path;
+        Kind kind;
+    };
+
+    void add(const std::string& path, Kind kind);
+    void run();
+
+    //! \brief Sleep until the given time, or until stop() is called
+    //! \return false if the scrubber was stopped
+    bool wait_until(std::chrono::steady_clock::time_point deadline);
+
+    ScrubberOptions options_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<Target> targets_;
+    ScrubStats stats_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+} // namespace pentaledger
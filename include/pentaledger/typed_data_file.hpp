@@ -0,0 +1,307 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "data_file.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+namespace pentaledger {
+
+//! \brief Storage size of a fixed-width field type
+//! \details STRING and BLOB have no natural size; give one in Field.
+constexpr size_t field_size(FieldType type) {
+    switch (type) {
+        case FieldType::INT32: return sizeof(int32_t);
+        case FieldType::INT64: return sizeof(int64_t);
+        case FieldType::FLOAT: return sizeof(float);
+        case FieldType::DOUBLE: return sizeof(double);
+        case FieldType::STRING:
+        case FieldType::BLOB: return 0;
+    }
+    return 0;
+}
+
+//! \brief One field of a Schema
+//! \tparam Type The field's type
+//! \tparam Size Bytes it occupies; required for STRING and BLOB, implied otherwise
+//! \details A STRING is stored NUL-padded to Size bytes and read back up to the first NUL.
+template <FieldType Type, size_t Size = field_size(Type)>
+struct Field {
+    static_assert(Size > 0, "STRING and BLOB fields need an explicit size");
+    static_assert(field_size(Type) == 0 || field_size(Type) == Size, "Numeric fields have a fixed size");
+
+    static constexpr FieldType type = Type;
+    static constexpr size_t size = Size;
+};
+
+namespace detail {
+
+template <FieldType Type>
+struct FieldValue;
+
+template <> struct FieldValue<FieldType::INT32> { using type = int32_t; };
+template <> struct FieldValue<FieldType::INT64> { using type = int64_t; };
+template <> struct FieldValue<FieldType::FLOAT> { using type = float; };
+template <> struct FieldValue<FieldType::DOUBLE> { using type = double; };
+template <> struct FieldValue<FieldType::STRING> { using type = std::string_view; };
+template <> struct FieldValue<FieldType::BLOB> { using type = std::span<const uint8_t>; };
+
+} // namespace detail
+
+//! \brief Compile-time record layout
+//! \details Fields are packed back to back in declaration order; offsets and the record
+//! length are constants.  Declare an enum of field names to index it:
+//! \code
+//! using TripSchema = Schema<Field<FieldType::INT64>,          // TRIP_ID
+//!                           Field<FieldType::DOUBLE>,         // MILES
+//!                           Field<FieldType::STRING, 24>>;    // CATEGORY
+//! enum TripField { TRIP_ID, MILES, CATEGORY };
+//! \endcode
+template <class... Fields>
+struct Schema {
+    static constexpr size_t field_count = sizeof...(Fields);
+    static constexpr std::array<FieldType, field_count> types = {Fields::type...};
+    static constexpr std::array<size_t, field_count> sizes = {Fields::size...};
+
+    static constexpr std::array<size_t, field_count> offsets = [] {
+        std::array<size_t, field_count> result{};
+        size_t offset = 0;
+        for (size_t i = 0; i < field_count; ++i) {
+            result[i] = offset;
+            offset += sizes[i];
+        }
+        return result;
+    }();
+
+    static constexpr size_t packed_length = (Fields::size + ... + 0);
+
+    //! \brief Stored record length; at least sizeof(RPTR), which a deleted record needs
+    static constexpr uint32_t record_length = static_cast<uint32_t>(std::max(packed_length, sizeof(RPTR)));
+
+    template <size_t I>
+    using field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+    //! \brief C++ type a field reads as
+    template <size_t I>
+    using value_type = typename detail::FieldValue<field<I>::type>::type;
+};
+
+//! \brief Read-only view of a record laid out by Schema
+//! \details Fields are decoded straight from the viewed bytes; nothing else is copied.
+//! STRING and BLOB fields are returned as views into the record.
+template <class S>
+class RecordView {
+public:
+    RecordView() = default;
+    explicit RecordView(std::span<const uint8_t> data) : data_(data.data()) {}
+    explicit RecordView(const uint8_t* data) : data_(data) {}
+
+    template <size_t I>
+    typename S::template value_type<I> get() const {
+        static_assert(I < S::field_count, "No such field");
+        constexpr FieldType type = S::types[I];
+        const uint8_t* p = data_ + S::offsets[I];
+        if constexpr (type == FieldType::STRING) {
+            const auto* text = reinterpret_cast<const char*>(p);
+            return std::string_view(text, static_cast<size_t>(std::find(text, text + S::sizes[I], '\0') - text));
+        } else if constexpr (type == FieldType::BLOB) {
+            return std::span<const uint8_t>(p, S::sizes[I]);
+        } else {
+            // A memcpy of a constant size compiles to a single (unaligned) load
+            typename S::template value_type<I> value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    }
+
+    const uint8_t* data() const { return data_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+};
+
+//! \brief Writable view of a record laid out by Schema
+template <class S>
+class RecordRef : public RecordView<S> {
+public:
+    RecordRef() = default;
+    explicit RecordRef(uint8_t* data) : RecordView<S>(data), data_(data) {}
+
+    //! \brief Store a field; a STRING or BLOB is truncated or zero-padded to the field size
+    template <size_t I, class T>
+    void set(const T& value) const {
+        static_assert(I < S::field_count, "No such field");
+        constexpr FieldType type = S::types[I];
+        uint8_t* p = data_ + S::offsets[I];
+        if constexpr (type == FieldType::STRING) {
+            std::string_view text(value);
+            size_t n = std::min(text.size(), S::sizes[I]);
+            std::memcpy(p, text.data(), n);
+            std::memset(p + n, 0, S::sizes[I] - n);
+        } else if constexpr (type == FieldType::BLOB) {
+            std::span<const uint8_t> bytes(value);
+            size_t n = std::min(bytes.size(), S::sizes[I]);
+            std::memcpy(p, bytes.data(), n);
+            std::memset(p + n, 0, S::sizes[I] - n);
+        } else {
+            auto stored = static_cast<typename S::template value_type<I>>(value);
+            std::memcpy(p, &stored, sizeof(stored));
+        }
+    }
+
+    uint8_t* data() const { return data_; }
+
+private:
+    uint8_t* data_ = nullptr;
+};
+
+//! \brief A record laid out by Schema, with its own storage
+template <class S>
+class TypedRecord {
+public:
+    TypedRecord() { bytes_.fill(0); }
+
+    template <size_t I>
+    typename S::template value_type<I> get() const { return view().template get<I>(); }
+
+    template <size_t I, class T>
+    void set(const T& value) { ref().template set<I>(value); }
+
+    RecordView<S> view() const { return RecordView<S>(bytes_.data()); }
+    RecordRef<S> ref() { return RecordRef<S>(bytes_.data()); }
+
+    const uint8_t* data() const { return bytes_.data(); }
+    uint8_t* data() { return bytes_.data(); }
+
+private:
+    std::array<uint8_t, S::record_length> bytes_;
+};
+
+//! \brief A DataFile whose records follow a compile-time Schema
+//! \details A thin layer over DataFile: the stored record length is checked against the
+//! schema when the file is opened, and records are accessed through typed views instead
+//! of raw buffers.  view() and scan() decode fields in place without copying the record.
+template <class S>
+class TypedDataFile {
+public:
+    using schema = S;
+
+    //! \brief Single pass over the live records, as RecordView<S>
+    class Scan {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = RecordView<S>;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(RecordScan::iterator it) : it_(it) {}
+
+            RecordView<S> operator*() const { return RecordView<S>(*it_); }
+            iterator& operator++() {
+                ++it_;
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+            bool operator==(std::default_sentinel_t end) const { return it_ == end; }
+            RPTR record_number() const { return it_.record_number(); }
+
+        private:
+            RecordScan::iterator it_;
+        };
+
+        iterator begin() { return iterator(scan_.begin()); }
+        std::default_sentinel_t end() const { return {}; }
+
+    private:
+        friend class TypedDataFile;
+        Scan(DataFile& file, const ScanOptions& options) : scan_(file.scan(options)) {}
+
+        RecordScan scan_;
+    };
+
+    static TypedDataFile create(const std::string& path, const DataFileOptions& options = {}) {
+        return TypedDataFile(DataFile::create(path, S::record_length, options));
+    }
+
+    //! \brief Open a file, checking that its records are S::record_length bytes long
+    //! \details Throws DatabaseException(INVALID_SCHEMA) on a mismatch.
+    static TypedDataFile open(const std::string& path, const DataFileOptions& options = {}) {
+        DataFile file = DataFile::open(path, options);
+        if (file.record_length() != S::record_length) {
+            throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Schema record length " + std::to_string(S::record_length) +
+                                    " does not match stored record length " + std::to_string(file.record_length()) + ": " + path);
+        }
+        return TypedDataFile(std::move(file));
+    }
+
+    //! \brief Copy a record out of the file
+    TypedRecord<S> read(RPTR record_number) {
+        TypedRecord<S> record;
+        file_.read_record(record_number, record.data());
+        return record;
+    }
+
+    //! \brief View a record in place; memory-mapped files only (see DataFile::view_record)
+    RecordView<S> view(RPTR record_number) const {
+        return RecordView<S>(file_.view_record(record_number));
+    }
+
+    void write(RPTR record_number, const TypedRecord<S>& record) {
+        file_.write_record(record_number, record.data());
+    }
+
+    RPTR insert(const TypedRecord<S>& record) {
+        return file_.new_record(const_cast<uint8_t*>(record.data()));
+    }
+
+    void remove(RPTR record_number) {
+        file_.delete_record(record_number);
+    }
+
+    //! \brief Visit the live records; see DataFile::scan()
+    Scan scan(const ScanOptions& options = {}) {
+        return Scan(file_, options);
+    }
+
+    void flush() { file_.flush(); }
+    void close() { file_.close(); }
+
+    //! \brief The underlying file, for the untyped API
+    DataFile& file() { return file_; }
+    const DataFile& file() const { return file_; }
+
+private:
+    explicit TypedDataFile(DataFile&& file) : file_(std::move(file)) {}
+
+    DataFile file_;
+};
+
+} // namespace pentaledger
+
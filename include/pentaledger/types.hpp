@@ -57,7 +57,8 @@ enum class ErrorCode {
     INVALID_SCHEMA,
     DUPLICATE_KEY,
     KEY_NOT_FOUND,
-    IO_ERROR
+    IO_ERROR,
+    INVALID_ARGUMENT
 };
 
 // Exception class for database errors
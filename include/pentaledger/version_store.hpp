@@ -0,0 +1,192 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "record_pointer.hpp"
+#include "record_scan.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pentaledger {
+
+class DataFile;
+
+//! \brief Counters of the versions a DataFile keeps for its snapshots
+struct VersionStats {
+    //! \brief Superseded record images held in memory
+    uint64_t versions = 0;
+
+    //! \brief Bytes of record data they hold
+    uint64_t bytes = 0;
+
+    //! \brief Snapshots open
+    uint64_t snapshots = 0;
+
+    //! \brief Sequence number of the last write begun
+    uint64_t sequence = 0;
+};
+
+//! \brief Record images superseded while snapshots are open
+//! \details The file always holds the newest version of each record.  Every write of a
+//! versioned DataFile takes the next commit sequence number; while any snapshot is open,
+//! it first keeps the image it is about to overwrite, tagged with that number.  A snapshot
+//! taken at sequence S sees, for each record, the kept image with the smallest sequence
+//! above S if there is one, and the file otherwise.  An image is dropped, as snapshots
+//! close and as its record is written again, once no open snapshot falls between it and
+//! the image before it and no snapshot opened later could: a record rewritten many times
+//! under one long snapshot holds two images, not one per write.
+//!
+//! The images live in memory only; snapshots do not survive the process.
+//!
+//! \note Internal to DataFile.  Thread-safe.
+class VersionStore {
+public:
+    //! \brief Register a write and return its sequence number
+    //! \param keep_images Set to whether the write must keep() the images it overwrites
+    uint64_t begin_write(bool& keep_images);
+
+    //! \brief Mark a write finished, successful or not
+    void end_write(uint64_t sequence);
+
+    //! \brief Keep the image of a record that the write sequence is about to overwrite
+    //! \param free Whether the record was on the free list (or not yet written)
+    void keep(RPTR record, uint64_t sequence, bool free, const uint8_t* data, size_t length);
+
+    //! \brief Copy the image of a record as of a snapshot
+    //! \param free Set to whether the record was free at the snapshot
+    //! \return false if the record has not been written since the snapshot, so the file
+    //! holds its image
+    bool find(RPTR record, uint64_t snapshot, uint8_t* buffer, size_t length, bool& free) const;
+
+    //! \brief Whether no images are held; a cheap test before find()
+    bool empty() const { return versions_.load(std::memory_order_acquire) == 0; }
+
+    //! \brief Open a snapshot and return its sequence number
+    //! \details Waits for writes that began without keeping images to finish, so that
+    //! every write after the snapshot keeps what it overwrites.
+    uint64_t open_snapshot();
+
+    //! \brief Close a snapshot and drop the images nobody needs any more
+    void close_snapshot(uint64_t sequence);
+
+    VersionStats stats() const;
+
+private:
+    struct Version {
+        //! Sequence number of the write that replaced this image
+        uint64_t superseded_by;
+        bool free;
+        std::vector<uint8_t> data;
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<RPTR, std::vector<Version>> records;
+    };
+
+    //! \brief The last write all of whose predecessors have finished; mutex_ must be held
+    //! \details A snapshot opened now or later starts at least there.
+    uint64_t stable() const;
+
+    //! \brief Drop the images of a record that no snapshot reads; mutex_ must be held
+    void prune(std::vector<Version>& versions);
+
+    //! \brief prune() every record
+    void collect();
+
+    static constexpr size_t SHARDS = 64;
+    std::array<Shard, SHARDS> shards_;
+    std::atomic<uint64_t> versions_{0};
+    std::atomic<uint64_t> bytes_{0};
+
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    uint64_t last_sequence_ = 0;
+    //! Writes in progress, and whether each keeps images
+    std::map<uint64_t, bool> in_flight_;
+    size_t writes_without_images_ = 0;
+    size_t opening_ = 0;
+    std::multiset<uint64_t> snapshots_;
+};
+
+//! \brief A consistent point-in-time view of a versioned DataFile
+//! \details Obtained from DataFile::snapshot().  Reads see every write that finished before
+//! the snapshot was taken and none that began after it, however long the snapshot stays
+//! open and whatever other threads write meanwhile.  They take no record locks and never
+//! wait for writers: a read goes to the file, and falls back to a kept image only for
+//! records written since the snapshot.  Records allocated after the snapshot read as empty.
+//!
+//! Closing the snapshot (release(), or destroying it) lets the file drop the versions it
+//! kept for it.  A snapshot must not outlive its file, and the file must not be moved
+//! while snapshots of it are open.
+//!
+//! \note Movable, not copyable.  One snapshot may be read by several threads at once.
+class Snapshot {
+public:
+    Snapshot() = default;
+    Snapshot(Snapshot&& other) noexcept;
+    Snapshot& operator=(Snapshot&& other) noexcept;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot();
+
+    //! \brief Commit sequence number the snapshot sees up to
+    uint64_t sequence() const { return sequence_; }
+
+    //! \brief DataFile::next_record() as of the snapshot
+    RPTR next_record() const { return next_record_; }
+
+    bool is_open() const { return file_ != nullptr; }
+
+    //! \brief Read a record as it was when the snapshot was taken
+    void read_record(RPTR record_number, uint8_t* buffer) const;
+
+    //! \brief Visit the records as they were when the snapshot was taken
+    //! \details As DataFile::scan(), except that the scan may run while the file is written.
+    RecordScan scan(const ScanOptions& options = {}) const;
+
+    //! \brief Close the snapshot
+    void release();
+
+private:
+    friend class DataFile;
+    friend class RecordScan;
+
+    Snapshot(DataFile* file, uint64_t sequence, RPTR next_record)
+        : file_(file), sequence_(sequence), next_record_(next_record) {}
+
+    //! \brief VersionStore::find() for this snapshot
+    bool find(RPTR record, uint8_t* buffer, bool& free) const;
+
+    DataFile* file_ = nullptr;
+    uint64_t sequence_ = 0;
+    RPTR next_record_ = 0;
+};
+
+} // namespace pentaledger
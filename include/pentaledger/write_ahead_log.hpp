@@ -0,0 +1,178 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "posix_file.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pentaledger {
+
+// Magic number of a log file: "PLWL" as a 32-bit value (little-endian)
+constexpr uint32_t PLWL_MAGIC = static_cast<uint32_t>('P' | ('L' << 8) | ('W' << 16) | ('L' << 24));
+
+// Log file format version
+constexpr uint32_t PLWL_VERSION = 1;
+
+//! \brief Group commit tuning for a WriteAheadLog
+struct WriteAheadLogOptions {
+    //! \brief Longest a committer waits for others to join its group before syncing
+    //! \details Zero syncs immediately; commits that arrive during a sync still share the next one.
+    std::chrono::microseconds commit_delay{0};
+
+    //! \brief Sync without waiting out commit_delay once this many committers are waiting
+    size_t group_size = 8;
+};
+
+//! \brief Redo log shared by data and index files
+//! \details Files opened with a log append a redo record for every write before making it,
+//! and may then leave their own pages to be written back lazily.  commit() makes the log
+//! durable; committers that arrive together share a single fdatasync (group commit).
+//! When a file is opened with its log, the log is replayed into it first, which restores
+//! every committed write that had not reached the file.
+//!
+//! Records are checksummed, and a torn record at the tail of the log (from a crash during
+//! a log write) is discarded when the log is opened.  The log grows until checkpoint().
+//!
+//! \note This class is thread-safe.  It is not copyable or movable.
+class WriteAheadLog {
+public:
+    //! \brief Log sequence number; increases with every appended record
+    using Lsn = uint64_t;
+
+    //! \brief Counters describing log activity
+    struct Stats {
+        uint64_t appends = 0;
+        uint64_t commits = 0;
+        uint64_t syncs = 0;
+        uint64_t bytes_written = 0;
+    };
+
+    //! \brief Open or create a log file
+    //! \details An existing log is scanned and any torn tail is truncated.
+    explicit WriteAheadLog(const std::string& path, const WriteAheadLogOptions& options = {});
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    //! \brief Writes out buffered records (without syncing them)
+    ~WriteAheadLog();
+
+    //! \brief Stable key identifying a file's records in the log
+    //! \details Derived from the absolute, normalized path, so a file reopened through a
+    //! different relative path still finds its records.
+    static uint64_t file_key(const std::string& path);
+
+    //! \brief Append a redo record for a write of length bytes at offset
+    //! \return The record's sequence number, for commit()
+    Lsn append_write(uint64_t file_key, uint64_t offset, const void* data, uint32_t length);
+
+    //! \brief Append a redo record setting the file's length
+    //! \details Used when a file is created, so that replay does not resurrect the records
+    //! of an earlier file at the same path.
+    Lsn append_truncate(uint64_t file_key, uint64_t length);
+
+    //! \brief Wait until every record up to and including lsn is on stable storage
+    void commit(Lsn lsn);
+
+    //! \brief Wait until every record appended so far is on stable storage
+    void commit();
+
+    //! \brief Re-apply a file's records, oldest first
+    //! \param file_key The file's key
+    //! \param write Called for each logged write
+    //! \param truncate Called for each logged length change
+    //! \details Replay is idempotent: applying a file's records to it in order always leaves
+    //! it as it was after the last logged change.
+    void replay(uint64_t file_key,
+                const std::function<void(uint64_t offset, const uint8_t* data, uint32_t length)>& write,
+                const std::function<void(uint64_t length)>& truncate);
+
+    //! \brief Discard the whole log
+    //! \details Call only after every file using the log has been flushed, since their
+    //! records can no longer be replayed.
+    void checkpoint();
+
+    Lsn last_lsn() const;
+    Lsn durable_lsn() const;
+    Stats stats() const;
+    const std::string& path() const { return path_; }
+
+private:
+    enum RecordType : uint16_t {
+        RECORD_WRITE = 1,
+        RECORD_TRUNCATE = 2
+    };
+
+    //! \brief On-disk record header, followed by length bytes of payload
+    struct RecordHeader {
+        //! CRC-32C of the rest of the header and the payload
+        uint32_t checksum;
+        uint16_t type;
+        uint16_t reserved;
+        uint32_t length;
+        uint32_t reserved2;
+        Lsn lsn;
+        uint64_t file_key;
+        //! File offset of a write, or the new length for a truncate
+        uint64_t offset;
+    };
+
+    //! \brief On-disk log file header
+    struct LogHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t reserved;
+    };
+
+    Lsn append(uint16_t type, uint64_t file_key, uint64_t offset, const void* data, uint32_t length);
+
+    //! \brief Visit the valid records of the log on disk
+    //! \return The offset just past the last valid record
+    uint64_t scan(const std::function<void(const RecordHeader&, const uint8_t*)>& visit) const;
+
+    //! \brief Write buffered records to the log file without syncing; mutex_ must be held
+    //! and no sync may be in progress
+    void write_buffer_locked();
+
+    PosixFile file_;
+    std::string path_;
+    WriteAheadLogOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable synced_;
+    std::condition_variable joined_;
+    std::vector<uint8_t> buffer_;
+    uint64_t log_end_ = 0;
+    Lsn next_lsn_ = 1;
+    Lsn durable_lsn_ = 0;
+    bool syncing_ = false;
+    size_t waiting_ = 0;
+    Stats stats_;
+};
+
+} // namespace pentaledger
+
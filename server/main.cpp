@@ -3,6 +3,7 @@
 #include <httplib.h>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
+#include "pentaledger/metrics.hpp"
 
 namespace {
 
@@ -63,6 +64,10 @@ int main(int argc, char* argv[]) {
         res.set_content("{\"status\":\"ok\"}", "application/json");
     });
 
+    svr.Get("/v0/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(pentaledger::metrics_snapshot().to_json(), "application/json");
+    });
+
     spdlog::info("Server starting on {}:{}", address, port);
 
     if (!svr.listen(address.c_str(), port)) {
@@ -0,0 +1,468 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/btree_builder.hpp"
+#include "../../include/pentaledger/posix_file.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+namespace {
+
+// Read buffer of each run merged; memory_limit / MERGE_BUFFER runs are merged at once
+constexpr size_t MERGE_BUFFER = 1024 * 1024;
+
+//! \brief Appends entries to a run file through a buffer
+class RunWriter {
+public:
+    explicit RunWriter(const std::string& path) {
+        if (!file_.open(path, O_RDWR | O_CREAT | O_TRUNC)) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Cannot create sort run " + path);
+        }
+        buffer_.reserve(MERGE_BUFFER);
+    }
+
+    void write(const char* data, size_t length) {
+        if (buffer_.size() + length > MERGE_BUFFER) {
+            drain();
+        }
+        if (length >= MERGE_BUFFER) {
+            file_.write_exact(data, length, offset_);
+            offset_ += length;
+            return;
+        }
+        buffer_.insert(buffer_.end(), data, data + length);
+    }
+
+    void close() {
+        drain();
+        file_.close();
+    }
+
+private:
+    void drain() {
+        if (!buffer_.empty()) {
+            file_.write_exact(buffer_.data(), buffer_.size(), offset_);
+            offset_ += buffer_.size();
+            buffer_.clear();
+        }
+    }
+
+    PosixFile file_;
+    std::vector<char> buffer_;
+    uint64_t offset_ = 0;
+};
+
+//! \brief Reads the entries of a run file in order, a buffer at a time
+class RunReader {
+public:
+    RunReader(const std::string& path, size_t entry_size, size_t buffer_size)
+        : entry_size_(entry_size), buffer_(std::max(buffer_size / entry_size, size_t{1}) * entry_size) {
+        if (!file_.open(path, O_RDONLY)) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Cannot open sort run " + path);
+        }
+        ::posix_fadvise(file_.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    //! \brief The next entry, or nullptr at the end of the run
+    const char* next() {
+        if (position_ == end_) {
+            end_ = file_.read_at(buffer_.data(), buffer_.size(), offset_);
+            end_ -= end_ % entry_size_;
+            offset_ += end_;
+            position_ = 0;
+            if (end_ == 0) {
+                return nullptr;
+            }
+        }
+        const char* entry = buffer_.data() + position_;
+        position_ += entry_size_;
+        return entry;
+    }
+
+private:
+    PosixFile file_;
+    size_t entry_size_;
+    std::vector<char> buffer_;
+    size_t position_ = 0;
+    size_t end_ = 0;
+    uint64_t offset_ = 0;
+};
+
+} // namespace
+
+BTreeBuilder::BTreeBuilder(BTreeFile& tree, const BTreeBuildOptions& options) : tree_(tree), options_(options) {
+    if (!tree_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (tree_.header_.root_node != 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Only an empty B-tree can be built: " + tree_.file_path_);
+    }
+    if (!(options_.fill_factor >= 0.5 && options_.fill_factor <= 1.0)) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "B-tree fill factor must be from 0.5 to 1");
+    }
+    key_length_ = static_cast<size_t>(tree_.header_.key_length);
+    entry_size_ = key_length_ + ADR;
+    max_keys_ = static_cast<size_t>(std::max(tree_.max_keys_, 1));
+    buffer_capacity_ = std::max<size_t>(options_.memory_limit / (2 * entry_size_ + sizeof(size_t)), 16);
+    last_key_.resize(key_length_);
+    last_emitted_.resize(key_length_);
+
+    // Any nodes in the file are left from keys since deleted, and free to overwrite
+    tree_.header_.raised_node = 0;
+    tree_.header_dirty_ = true;
+}
+
+BTreeBuilder::~BTreeBuilder() {
+    for (const std::string& run : runs_) {
+        std::error_code ec;
+        std::filesystem::remove(run, ec);
+    }
+}
+
+size_t BTreeBuilder::capacity(size_t level) const {
+    size_t entries = static_cast<size_t>(std::lround(options_.fill_factor * static_cast<double>(max_keys_)));
+    entries = std::clamp(entries, std::max<size_t>(max_keys_ / 2, 1), max_keys_);
+    return level == 0 ? entries : entries + 1;
+}
+
+size_t BTreeBuilder::maximum(size_t level) const {
+    return level == 0 ? max_keys_ : max_keys_ + 1;
+}
+
+size_t BTreeBuilder::minimum(size_t level) const {
+    return level == 0 ? std::max<size_t>(max_keys_ / 2, 1) : max_keys_ / 2 + 1;
+}
+
+RPTR BTreeBuilder::allocate() {
+    RPTR node_ptr = next_ptr_++;
+    if (node_ptr >= tree_.next_node_ptr_) {
+        // Nodes are written a little out of order, so the file is grown ahead of them
+        tree_.reserve(tree_.locate_offset(node_ptr) + BTreeFile::NODE_SIZE);
+        tree_.next_node_ptr_ = node_ptr + 1;
+        tree_.header_dirty_ = true;
+    }
+    return node_ptr;
+}
+
+RPTR BTreeBuilder::append(size_t level, const char* key, RPTR rptr) {
+    if (level == levels_.size()) {
+        levels_.emplace_back();
+    }
+    Level& l = levels_[level];
+    if (l.nodes == 0) {
+        l.current_ptr = allocate();
+        l.first_ptr = l.current_ptr;
+        l.nodes = 1;
+    } else if (l.current.size() == capacity(level) * entry_size_) {
+        // The open node is full: the one before it can be written now that its right
+        // sibling is known, and a new one opened
+        RPTR node_ptr = allocate();
+        if (l.previous_ptr != 0) {
+            write(level, l.previous, l.previous_ptr, l.before_previous_ptr, l.current_ptr, false, false);
+        }
+        l.before_previous_ptr = l.previous_ptr;
+        l.previous_ptr = l.current_ptr;
+        l.previous.swap(l.current);
+        l.current.clear();
+        l.current_ptr = node_ptr;
+        ++l.nodes;
+    }
+    l.current.insert(l.current.end(), key, key + key_length_);
+    l.current.insert(l.current.end(), reinterpret_cast<const char*>(&rptr), reinterpret_cast<const char*>(&rptr) + ADR);
+    return l.current_ptr;
+}
+
+void BTreeBuilder::write(size_t level, const std::vector<char>& entries, RPTR node_ptr, RPTR left, RPTR right, bool root, bool adopt) {
+    BTreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    node.nonleaf = level > 0 ? 1 : 0;
+    node.parent_node = root ? 0 : append(level + 1, entries.data(), node_ptr);
+    node.left_sibling = left;
+    node.right_sibling = right;
+    
+    // A non-leaf node's first entry is its lowest key and key0
+    const char* from = entries.data();
+    size_t count = entries.size() / entry_size_;
+    if (level > 0) {
+        std::memcpy(&node.key0, from + key_length_, ADR);
+        from += entry_size_;
+        --count;
+    }
+    std::memcpy(node.keyspace, from, count * entry_size_);
+    node.key_count = static_cast<int>(count);
+    tree_.write_node(node_ptr, node);
+    if (adopt && level > 0) {
+        tree_.adopt(node, node_ptr);
+    }
+}
+
+void BTreeBuilder::emit(const char* entries, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const char* entry = entries + i * entry_size_;
+        if (emitted_ + i != 0 && !duplicates_ && std::memcmp(entry, last_emitted_.data(), key_length_) == 0) {
+            if (tree_.header_size_ == sizeof(BTreeHeader)) {
+                throw DatabaseException(ErrorCode::DUPLICATE_KEY, "Equal keys need a B-tree file with header copies: " + tree_.file_path_);
+            }
+            duplicates_ = true;
+        }
+        std::memcpy(last_emitted_.data(), entry, key_length_);
+        RPTR rptr;
+        std::memcpy(&rptr, entry + key_length_, ADR);
+        append(0, entry, rptr);
+    }
+    emitted_ += count;
+}
+
+void BTreeBuilder::add(const char* key, RPTR record) {
+    if (finished_) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "B-tree build already finished: " + tree_.file_path_);
+    }
+    if (sorted_) {
+        if (have_last_ && std::memcmp(key, last_key_.data(), key_length_) < 0) {
+            sorted_ = false;
+            if (emitted_ != 0) {
+                unwind();
+            }
+        } else {
+            std::memcpy(last_key_.data(), key, key_length_);
+            have_last_ = true;
+        }
+    }
+    
+    buffer_.insert(buffer_.end(), key, key + key_length_);
+    buffer_.insert(buffer_.end(), reinterpret_cast<const char*>(&record), reinterpret_cast<const char*>(&record) + ADR);
+    if (buffer_.size() >= buffer_capacity_ * entry_size_) {
+        if (sorted_) {
+            emit(buffer_.data(), buffer_.size() / entry_size_);
+            buffer_.clear();
+        } else {
+            spill();
+        }
+    }
+}
+
+void BTreeBuilder::add(const char* keys, std::span<const RPTR> records) {
+    for (size_t i = 0; i < records.size(); ++i) {
+        add(keys + i * key_length_, records[i]);
+    }
+}
+
+void BTreeBuilder::sort_buffer() {
+    const size_t count = buffer_.size() / entry_size_;
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return std::memcmp(buffer_.data() + a * entry_size_, buffer_.data() + b * entry_size_, key_length_) < 0;
+    });
+    std::vector<char> sorted(buffer_.size());
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(sorted.data() + i * entry_size_, buffer_.data() + order[i] * entry_size_, entry_size_);
+    }
+    buffer_.swap(sorted);
+}
+
+std::string BTreeBuilder::run_path() {
+    std::filesystem::path index(tree_.file_path_);
+    std::filesystem::path directory = options_.temp_directory.empty() ? index.parent_path() : std::filesystem::path(options_.temp_directory);
+    return (directory / (index.filename().string() + ".run" + std::to_string(runs_written_++))).string();
+}
+
+void BTreeBuilder::spill() {
+    if (buffer_.empty()) {
+        return;
+    }
+    sort_buffer();
+    runs_.push_back(run_path());
+    RunWriter out(runs_.back());
+    out.write(buffer_.data(), buffer_.size());
+    out.close();
+    buffer_.clear();
+}
+
+void BTreeBuilder::unwind() {
+    // The leaves written so far hold the earliest pairs, in order, followed by the last two
+    // still in memory
+    runs_.push_back(run_path());
+    RunWriter out(runs_.back());
+    Level& leaves = levels_[0];
+    const RPTR held = leaves.previous_ptr != 0 ? leaves.previous_ptr : leaves.current_ptr;
+    BTreeNode node;
+    for (RPTR node_ptr = leaves.first_ptr; node_ptr != held; node_ptr = node.right_sibling) {
+        tree_.read_node(node_ptr, node);
+        out.write(node.keyspace, static_cast<size_t>(node.key_count) * entry_size_);
+    }
+    out.write(leaves.previous.data(), leaves.previous.size());
+    out.write(leaves.current.data(), leaves.current.size());
+    out.close();
+    
+    levels_.clear();
+    next_ptr_ = 1;
+    emitted_ = 0;
+    duplicates_ = false;
+}
+
+void BTreeBuilder::merge(const std::vector<std::string>& runs, const std::string* output) {
+    const size_t buffer_size = std::max(options_.memory_limit / runs.size(), 16 * entry_size_);
+    std::vector<RunReader> readers;
+    readers.reserve(runs.size());
+    std::vector<const char*> heads(runs.size());
+    for (const std::string& run : runs) {
+        readers.emplace_back(run, entry_size_, buffer_size);
+    }
+    
+    // The run with the lowest key on top; of equal keys, the earlier run, to keep input order
+    auto later = [&](size_t a, size_t b) {
+        int c = std::memcmp(heads[a], heads[b], key_length_);
+        return c > 0 || (c == 0 && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        heads[i] = readers[i].next();
+        if (heads[i] != nullptr) {
+            heap.push(i);
+        }
+    }
+    
+    std::optional<RunWriter> out;
+    if (output != nullptr) {
+        out.emplace(*output);
+    }
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        if (out) {
+            out->write(heads[i], entry_size_);
+        } else {
+            emit(heads[i], 1);
+        }
+        heads[i] = readers[i].next();
+        if (heads[i] != nullptr) {
+            heap.push(i);
+        }
+    }
+    if (out) {
+        out->close();
+    }
+}
+
+uint64_t BTreeBuilder::finish() {
+    if (finished_) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "B-tree build already finished: " + tree_.file_path_);
+    }
+    finished_ = true;
+    
+    if (sorted_) {
+        emit(buffer_.data(), buffer_.size() / entry_size_);
+    } else if (runs_.empty()) {
+        sort_buffer();
+        emit(buffer_.data(), buffer_.size() / entry_size_);
+    } else {
+        spill();
+        
+        // Merge groups of runs into longer ones until the rest can be merged at once
+        const size_t fan_in = std::max<size_t>(options_.memory_limit / MERGE_BUFFER, 2);
+        while (runs_.size() > fan_in) {
+            std::vector<std::string> merged;
+            for (size_t i = 0; i < runs_.size(); i += fan_in) {
+                std::vector<std::string> group(runs_.begin() + i, runs_.begin() + std::min(i + fan_in, runs_.size()));
+                if (group.size() == 1) {
+                    merged.push_back(group[0]);
+                    continue;
+                }
+                merged.push_back(run_path());
+                merge(group, &merged.back());
+                for (const std::string& run : group) {
+                    std::filesystem::remove(run);
+                }
+            }
+            runs_.swap(merged);
+        }
+        merge(runs_, nullptr);
+        for (const std::string& run : runs_) {
+            std::filesystem::remove(run);
+        }
+        runs_.clear();
+    }
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+    
+    // Write the nodes held back, leaves first.  The last node of a level may be short: it
+    // takes entries from the one before it, or the two are merged if they fit in one node.
+    RPTR root = 0;
+    for (size_t level = 0; level < levels_.size(); ++level) {
+        Level& l = levels_[level];
+        RPTR left = l.previous_ptr;
+        bool moved = false;
+        if (l.nodes > 1 && l.current.size() < minimum(level) * entry_size_) {
+            std::vector<char> entries = l.previous;
+            entries.insert(entries.end(), l.current.begin(), l.current.end());
+            const size_t total = entries.size() / entry_size_;
+            if (total <= maximum(level)) {
+                tree_.release_node(l.current_ptr);
+                l.current.swap(entries);
+                l.current_ptr = l.previous_ptr;
+                l.previous.clear();
+                l.previous_ptr = 0;
+                left = l.before_previous_ptr;
+                --l.nodes;
+            } else {
+                const size_t split = (total - total / 2) * entry_size_;
+                l.previous.assign(entries.begin(), entries.begin() + split);
+                l.current.assign(entries.begin() + split, entries.end());
+            }
+            moved = true;
+        }
+        
+        if (l.nodes == 1 && level + 1 == levels_.size()) {
+            write(level, l.current, l.current_ptr, 0, 0, true, moved);
+            root = l.current_ptr;
+            break;
+        }
+        if (l.previous_ptr != 0) {
+            write(level, l.previous, l.previous_ptr, l.before_previous_ptr, l.current_ptr, false, false);
+        }
+        write(level, l.current, l.current_ptr, left, 0, false, moved);
+    }
+    
+    if (duplicates_) {
+        tree_.header_flags_ |= BTREE_DUPLICATE_KEYS;
+    } else {
+        tree_.header_flags_ &= ~BTREE_DUPLICATE_KEYS;
+    }
+    tree_.header_.root_node = root;
+    tree_.header_.leftmost_node = root != 0 ? levels_[0].first_ptr : 0;
+    tree_.header_.rightmost_node = root != 0 ? levels_[0].current_ptr : 0;
+    tree_.header_dirty_ = true;
+    const RPTR old_end = tree_.next_node_ptr_;
+    for (RPTR node_ptr = next_ptr_; node_ptr < old_end; ++node_ptr) {
+        tree_.release_node(node_ptr);
+    }
+    levels_.clear();
+    return emitted_;
+}
+
+} // namespace pentaledger
@@ -19,23 +19,30 @@
 
 #include "../../include/pentaledger/btree_file.hpp"
 #include "../../include/pentaledger/types.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include "../../include/pentaledger/node_search.hpp"
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <vector>
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
 #include <ctime>
+#include <fcntl.h>
 
 namespace pentaledger {
 
-BTreeFile BTreeFile::create(const std::string& path, int key_length) {
+BTreeFile BTreeFile::create(const std::string& path, int key_length, const BTreeFileOptions& options) {
     BTreeFile btf;
-    btf.initialize(path, key_length);
+    btf.initialize(path, key_length, options);
     return btf;
 }
 
-BTreeFile BTreeFile::open(const std::string& path) {
+BTreeFile BTreeFile::open(const std::string& path, const BTreeFileOptions& options) {
     BTreeFile btf;
-    btf.load(path);
+    btf.load(path, options);
     return btf;
 }
 
@@ -43,63 +50,168 @@ BTreeFile::~BTreeFile() {
     close();
 }
 
-void BTreeFile::initialize(const std::string& path, int key_length) {
+void BTreeFile::initialize(const std::string& path, int key_length, const BTreeFileOptions& options) {
     file_path_ = path;
     
-    // Open file for reading and writing, create if it doesn't exist
-    file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
-    
-    if (!file_.is_open()) {
-        // File doesn't exist, create it
-        file_.open(path, std::ios::out | std::ios::binary);
-        file_.close();
-        file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    // A node must hold at least two entries to split
+    if (key_length <= 0 || key_length > MAX_KEY_LENGTH) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "B-tree key length must be 1 to " + std::to_string(MAX_KEY_LENGTH) + " bytes");
     }
     
-    if (!file_.is_open()) {
+    // Create the file, discarding the nodes of any previous tree
+    if (!file_.open(path, O_RDWR | O_CREAT | O_TRUNC)) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Failed to open B-tree file: " + path);
     }
+    attach(options);
+    if (options_.wal != nullptr) {
+        // Older records for this path belong to a previous tree
+        last_lsn_ = options_.wal->append_truncate(wal_key_, 0);
+    }
     
     // Initialize header
     std::memset(&header_, 0, sizeof(BTreeHeader));
     header_.root_node = 0;
     header_.key_length = key_length;
-    header_.max_key_per_node = (NODE - (sizeof(int) * 2) - (ADR * 4)) / (key_length + ADR);
+    header_.max_key_per_node = static_cast<int>(sizeof(BTreeNode::keyspace) / (key_length + ADR));
     header_.raised_node = 0;
     header_.locked = 0;
     header_.leftmost_node = 0;
     header_.rightmost_node = 0;
     
     next_node_ptr_ = 1;
+    allocated_end_ = 0;
+    header_sequence_ = 0;
+    header_flags_ = options.direct_io ? BTREE_BLOCK_ALIGNED : 0;
+    compute_layout();
     
-    // Write header to file
-    write_header();
+    // Write both header copies, so that both start out valid
+    for (uint32_t copy = 0; copy < BTREE_HEADER_COPIES; ++copy) {
+        header_dirty_ = true;
+        write_header();
+    }
 }
 
-void BTreeFile::load(const std::string& path) {
+void BTreeFile::load(const std::string& path, const BTreeFileOptions& options) {
     file_path_ = path;
     
     // Open file for reading and writing
-    file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
-    
-    if (!file_.is_open()) {
+    if (!file_.open(path, O_RDWR)) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Failed to open B-tree file: " + path);
     }
     
-    // Read header from file
-    read_header();
+    if (options.wal != nullptr) {
+        wal_key_ = WriteAheadLog::file_key(path);
+        options_.wal = options.wal;
+        recover();
+    }
     
-    // Calculate next_node_ptr_ from file size
-    file_.seekg(0, std::ios::end);
-    std::streampos file_size_pos = file_.tellg();
-    file_.seekg(0, std::ios::beg);
+    // Read header from file; on failure close without writing it back
+    try {
+        read_header();
+    } catch (...) {
+        file_.close();
+        throw;
+    }
+    attach(options);
+    
+    // Count the nodes in the file; a file with header copies says how many it holds, which
+    // excludes space allocated ahead of them
+    size_t file_size = static_cast<size_t>(file_.size());
+    RPTR in_file = 1;
+    if (file_size > header_size_) {
+        size_t bytes = file_size - header_size_;
+        size_t nodes_in_file = bytes / NODE_SIZE;
+        if (nodes_per_block_ != 0) {
+            nodes_in_file = bytes / BTREE_BLOCK_SIZE * nodes_per_block_ +
+                            std::min<size_t>(bytes % BTREE_BLOCK_SIZE / NODE_SIZE, nodes_per_block_);
+        }
+        in_file = static_cast<RPTR>(nodes_in_file) + 1;
+    }
+    next_node_ptr_ = header_size_ != sizeof(BTreeHeader) ? std::min(next_node_ptr_, in_file) : in_file;
+    allocated_end_ = file_size;
     
-    size_t file_size = static_cast<size_t>(file_size_pos);
-    if (file_size > HEADER_SIZE) {
-        size_t nodes_in_file = (file_size - HEADER_SIZE) / NODE_SIZE;
-        next_node_ptr_ = static_cast<RPTR>(nodes_in_file) + 1;
+    if (options_.pin_upper_levels) {
+        try {
+            pin_upper_levels();
+        } catch (...) {
+            if (options_.buffer_pool != nullptr) {
+                options_.buffer_pool->unregister_file(pool_file_);
+            }
+            file_.close();
+            throw;
+        }
+    }
+}
+
+void BTreeFile::recover() {
+    options_.wal->replay(wal_key_,
+        [this](uint64_t offset, const uint8_t* data, uint32_t length) {
+            file_.write_exact(data, length, offset);
+        },
+        [this](uint64_t length) {
+            file_.truncate(length);
+        });
+    file_.sync_data();
+}
+
+void BTreeFile::attach(const BTreeFileOptions& options) {
+    options_ = options;
+    if (options_.direct_io && options_.buffer_pool == nullptr) {
+        options_.buffer_pool = &BufferPool::shared();
+    }
+    if (options_.wal != nullptr) {
+        wal_key_ = WriteAheadLog::file_key(file_path_);
+    }
+    if (options_.buffer_pool != nullptr) {
+        if (options_.direct_io) {
+            file_.set_direct(true);
+        }
+        pool_file_ = options_.buffer_pool->register_file(file_.fd(), options_.direct_io);
+    }
+}
+
+void BTreeFile::reserve(uint64_t end) {
+    // An older file is as long as its nodes, so it grows only as they are written
+    if (options_.growth_extent == 0 || end <= allocated_end_ || header_size_ == sizeof(BTreeHeader)) {
+        return;
+    }
+    uint64_t target = (end + options_.growth_extent - 1) / options_.growth_extent * options_.growth_extent;
+    file_.allocate(allocated_end_, target - allocated_end_);
+    allocated_end_ = target;
+    if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->reserve(pool_file_, target);
+    }
+}
+
+void BTreeFile::compute_layout() {
+    // Older files overstated max_key_per_node; no node ever held that many
+    size_t fit = header_.key_length > 0 ? sizeof(BTreeNode::keyspace) / (header_.key_length + ADR) : 0;
+    max_keys_ = static_cast<int>(std::min<size_t>(std::max(header_.max_key_per_node, 0), fit));
+    
+    if ((header_flags_ & BTREE_BLOCK_ALIGNED) == 0) {
+        nodes_per_block_ = 0;
+        return;
+    }
+    header_size_ = BTREE_BLOCK_SIZE;
+    nodes_per_block_ = BTREE_BLOCK_SIZE / NODE_SIZE;
+}
+
+void BTreeFile::read_at(uint64_t offset, void* buffer, size_t length) {
+    if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->read(pool_file_, offset, buffer, length);
+    } else {
+        file_.read_exact(buffer, length, offset);
+    }
+}
+
+void BTreeFile::write_at(uint64_t offset, const void* buffer, size_t length) {
+    if (options_.wal != nullptr) {
+        last_lsn_ = options_.wal->append_write(wal_key_, offset, buffer, static_cast<uint32_t>(length));
+    }
+    if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->write(pool_file_, offset, buffer, length);
     } else {
-        next_node_ptr_ = 1;
+        file_.write_exact(buffer, length, offset);
     }
 }
 
@@ -108,43 +220,137 @@ void BTreeFile::read_header() {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
     
-    file_.seekg(0, std::ios::beg);
-    if (!file_.read(reinterpret_cast<char*>(&header_), HEADER_SIZE)) {
+    BTreeHeaderCopy copies[BTREE_HEADER_COPIES] = {};
+    size_t got = file_.read_at(copies, sizeof(copies), 0);
+    int current = current_btree_header(copies, got);
+    if (current >= 0) {
+        header_ = copies[current].header;
+        header_sequence_ = copies[current].sequence;
+        header_flags_ = copies[current].flags;
+        next_node_ptr_ = copies[current].next_node;
+        if ((header_flags_ & ~(BTREE_BLOCK_ALIGNED | BTREE_DUPLICATE_KEYS)) != 0) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Unsupported B-tree file flags: " + std::to_string(header_flags_));
+        }
+        header_size_ = BTREE_HEADER_SIZE;
+        header_dirty_ = false;
+        compute_layout();
+        return;
+    }
+    
+    // Otherwise this is an older file with a single header, unless its copies are all
+    // damaged.  (Where the magic of the first copy would be, an older file has the start of
+    // its first node, which is never the magic.)
+    if (got < sizeof(BTreeHeader)) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Failed to read B-tree file header");
     }
+    header_ = copies[0].header;
+    if (copies[0].magic == PLBT_MAGIC || (header_.checksum != 0 && header_.checksum != btree_header_checksum(header_))) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree file header checksum mismatch: " + file_path_);
+    }
+    header_sequence_ = 0;
+    header_flags_ = 0;
+    header_size_ = sizeof(BTreeHeader);
+    header_dirty_ = false;
+    compute_layout();
 }
 
 void BTreeFile::write_header() {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
+    if (!header_dirty_) {
+        return;
+    }
     
-    // Clear any existing error flags before seeking and writing
-    file_.clear();
-    file_.seekp(0, std::ios::beg);
-    if (file_.fail()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to seek to beginning of file for header write");
+    if (header_size_ == sizeof(BTreeHeader)) {
+        PENTALEDGER_METRIC_SCOPE(Metric::HEADER_WRITE, sizeof(BTreeHeader));
+        header_.checksum = btree_header_checksum(header_);
+        write_at(0, &header_, sizeof(BTreeHeader));
+    } else {
+        PENTALEDGER_METRIC_SCOPE(Metric::HEADER_WRITE, sizeof(BTreeHeaderCopy));
+        BTreeHeaderCopy copy{};
+        copy.header = header_;
+        copy.magic = PLBT_MAGIC;
+        copy.sequence = ++header_sequence_;
+        copy.flags = header_flags_;
+        copy.next_node = next_node_ptr_;
+        copy.header.checksum = btree_header_copy_checksum(copy);
+        header_.checksum = copy.header.checksum;
+        write_at((copy.sequence % BTREE_HEADER_COPIES) * sizeof(BTreeHeaderCopy), &copy, sizeof(copy));
     }
+    header_dirty_ = false;
+}
+
+size_t BTreeFile::locate_offset(RPTR node_ptr) const {
+    if (nodes_per_block_ != 0) {
+        RPTR index = node_ptr - 1;
+        return header_size_ + index / nodes_per_block_ * BTREE_BLOCK_SIZE + index % nodes_per_block_ * NODE_SIZE;
+    }
+    return header_size_ + ((node_ptr - 1) * NODE_SIZE);
+}
+
+void BTreeFile::read_node(RPTR node_ptr, BTreeNode& node) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::NODE_READ, NODE_SIZE);
     
-    if (!file_.write(reinterpret_cast<const char*>(&header_), HEADER_SIZE)) {
-        if (file_.bad()) {
-            throw DatabaseException(ErrorCode::IO_ERROR, "Critical error writing B-tree file header (badbit set)");
-        } else if (file_.fail()) {
-            throw DatabaseException(ErrorCode::IO_ERROR, "Non-critical error writing B-tree file header (failbit set)");
-        } else {
-            throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write B-tree file header");
-        }
+    if (node_ptr == 0 || node_ptr >= next_node_ptr_) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid node pointer: " + std::to_string(node_ptr));
+    }
+    
+    read_at(locate_offset(node_ptr), &node, NODE_SIZE);
+    if (options_.verify_checksums && node.checksum != 0 && node.checksum != btree_node_checksum(node)) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Checksum mismatch in B-tree node " + std::to_string(node_ptr));
+    }
+}
+
+void BTreeFile::write_node(RPTR node_ptr, const BTreeNode& node) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (node_ptr == 0 || node_ptr > next_node_ptr_) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid node pointer: " + std::to_string(node_ptr));
+    }
+    
+    BTreeNode stored;
+    std::memcpy(&stored, &node, NODE_SIZE);
+    stored.checksum = btree_node_checksum(stored);
+    if (node_ptr == next_node_ptr_) {
+        reserve(locate_offset(node_ptr) + NODE_SIZE);
     }
-    file_.flush();
-    if (file_.fail()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to flush B-tree file header to disk");
+    write_at(locate_offset(node_ptr), &stored, NODE_SIZE);
+    if (node_ptr == next_node_ptr_) {
+        ++next_node_ptr_;
+        header_dirty_ = true;
+    }
+    if (options_.pin_upper_levels) {
+        update_pinned(node_ptr, node);
     }
 }
 
 void BTreeFile::flush() {
-    if (file_.is_open()) {
-        file_.flush();
+    if (!file_.is_open()) {
+        return;
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::FLUSH, 0);
+    
+    write_header();
+    if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->flush(pool_file_);
     }
+    file_.sync_data();
+}
+
+void BTreeFile::commit() {
+    if (options_.wal == nullptr) {
+        flush();
+        return;
+    }
+    
+    write_header();
+    options_.wal->commit(last_lsn_);
 }
 
 void BTreeFile::dump_header() const {
@@ -177,20 +383,199 @@ void BTreeFile::dump_header() const {
     }
     std::cout << std::endl;
     
-    std::cout << "Header Size: " << HEADER_SIZE << " bytes" << std::endl;
+    std::cout << "Header Size: " << header_size_ << " bytes" << std::endl;
     std::cout << "Node Size: " << NODE_SIZE << " bytes" << std::endl;
     std::cout << "Next Node Pointer: " << next_node_ptr_ << std::endl;
+    if (options_.pin_upper_levels) {
+        std::cout << "Pinned Nodes: " << pinned_.size() << " (" << pinned_memory() << " bytes)" << std::endl;
+    }
     std::cout << "======================" << std::endl;
 }
 
 void BTreeFile::close() {
     if (file_.is_open()) {
-        header_.locked = 0;
+        if (header_.locked != 0) {
+            header_.locked = 0;
+            header_dirty_ = true;
+        }
         write_header(); // Write header before closing
+        if (options_.buffer_pool != nullptr) {
+            options_.buffer_pool->unregister_file(pool_file_);
+        }
+        uint64_t end = locate_offset(next_node_ptr_);
+        if (options_.trim_on_close && allocated_end_ > end) {
+            file_.truncate(end);
+        }
         file_.close();
     }
 }
 
+uint32_t btree_node_checksum(const BTreeNode& node) {
+    return crc32c_excluding(&node, sizeof(node), offsetof(BTreeNode, checksum));
+}
+
+uint32_t btree_header_checksum(const BTreeHeader& header) {
+    return crc32c_excluding(&header, sizeof(header), offsetof(BTreeHeader, checksum));
+}
+
+uint32_t btree_header_copy_checksum(const BTreeHeaderCopy& copy) {
+    return crc32c_excluding(&copy, sizeof(copy), offsetof(BTreeHeaderCopy, header) + offsetof(BTreeHeader, checksum));
+}
+
+int current_btree_header(const BTreeHeaderCopy* copies, size_t got) {
+    int current = -1;
+    for (uint32_t i = 0; i < BTREE_HEADER_COPIES && got >= (i + 1) * sizeof(BTreeHeaderCopy); ++i) {
+        const BTreeHeaderCopy& copy = copies[i];
+        if (copy.magic != PLBT_MAGIC || copy.header.checksum != btree_header_copy_checksum(copy)) {
+            continue;
+        }
+        // Sequence numbers wrap; the copies are at most one write apart
+        if (current < 0 || static_cast<int32_t>(copy.sequence - copies[current].sequence) > 0) {
+            current = static_cast<int>(i);
+        }
+    }
+    return current;
+}
+
+namespace {
+
+// Entries are (key, RPTR) pairs packed in keyspace: a record in a leaf, a child elsewhere
+
+RPTR entry_rptr(const BTreeNode& node, int index, size_t key_length) {
+    RPTR rptr;
+    std::memcpy(&rptr, node.keyspace + index * (key_length + ADR) + key_length, ADR);
+    return rptr;
+}
+
+void set_entry(char* entry, const char* key, RPTR rptr, size_t key_length) {
+    std::memcpy(entry, key, key_length);
+    std::memcpy(entry + key_length, &rptr, ADR);
+}
+
+//! \brief Index of the first entry whose key is not below key
+int lower_bound(const BTreeNode& node, const char* key, size_t key_length) {
+    return node_lower_bound(node.keyspace, node.key_count, key_length, key_length + ADR, key);
+}
+
+bool key_at(const BTreeNode& node, int index, const char* key, size_t key_length) {
+    return index < node.key_count && std::memcmp(node.keyspace + index * (key_length + ADR), key, key_length) == 0;
+}
+
+//! \brief The children of a non-leaf node are key0 (index -1) and the entries
+RPTR child_at(const BTreeNode& node, int index, size_t key_length) {
+    return index < 0 ? node.key0 : entry_rptr(node, index, key_length);
+}
+
+//! \brief Set the entries of node to count entries from entries, zeroing the rest of keyspace
+void set_entries(BTreeNode& node, const char* entries, int count, size_t entry_size) {
+    std::memcpy(node.keyspace, entries, count * entry_size);
+    std::memset(node.keyspace + count * entry_size, 0, sizeof(node.keyspace) - count * entry_size);
+    node.key_count = count;
+}
+
+} // namespace
+
+RPTR BTreeFile::descend(const char* key, std::vector<PathStep>* path, BTreeNode& node, bool leftmost) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    const size_t entry_size = key_length + ADR;
+    
+    // A path longer than the file is a cycle
+    RPTR node_ptr = header_.root_node;
+    for (RPTR depth = 0;; ++depth) {
+        // Search the pinned copy of a non-leaf node, or read the node
+        const char* entries;
+        int key_count;
+        RPTR key0;
+        auto pinned = pinned_.find(node_ptr);
+        if (pinned != pinned_.end()) {
+            entries = pinned_entries_.data() + pinned->second.slot * max_keys_ * entry_size;
+            key_count = pinned->second.key_count;
+            key0 = pinned->second.key0;
+        } else {
+            read_node(node_ptr, node);
+            if (node.key_count < 0 || node.key_count > max_keys_) {
+                throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree node " + std::to_string(node_ptr) + " is corrupt");
+            }
+            if (!node.nonleaf) {
+                return node_ptr;
+            }
+            entries = node.keyspace;
+            key_count = node.key_count;
+            key0 = node.key0;
+        }
+        if (depth >= next_node_ptr_) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree node " + std::to_string(node_ptr) + " is corrupt");
+        }
+        
+        // Follow the last separator not above the key (below it, for the leftmost child the
+        // key could be under), or key0 if every separator is
+        int child = node_lower_bound(entries, key_count, key_length, entry_size, key);
+        if (leftmost || child == key_count || std::memcmp(entries + child * entry_size, key, key_length) != 0) {
+            --child;
+        }
+        if (path != nullptr) {
+            path->push_back({node_ptr, child});
+        }
+        if (child < 0) {
+            node_ptr = key0;
+        } else {
+            std::memcpy(&node_ptr, entries + child * entry_size + key_length, ADR);
+        }
+    }
+}
+
+RPTR BTreeFile::find_leaf(const char* key, std::vector<PathStep>* path, BTreeNode& node, int& index) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    if ((header_flags_ & BTREE_DUPLICATE_KEYS) == 0) {
+        RPTR leaf = descend(key, path, node);
+        index = lower_bound(node, key, key_length);
+        return leaf;
+    }
+    
+    // Equal keys may sit left of a separator that matches them: start from the leftmost
+    // leaf the key could be in, and step right past leaves whose keys are all below it
+    RPTR leaf = descend(key, path, node, true);
+    index = lower_bound(node, key, key_length);
+    bool stepped = false;
+    while (index == node.key_count && node.right_sibling != 0) {
+        leaf = node.right_sibling;
+        read_node(leaf, node);
+        index = lower_bound(node, key, key_length);
+        stepped = true;
+    }
+    if (stepped && path != nullptr) {
+        path->clear();
+        path_to(leaf, node, *path);
+    }
+    return leaf;
+}
+
+void BTreeFile::path_to(RPTR node_ptr, const BTreeNode& node, std::vector<PathStep>& path) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    BTreeNode parent;
+    RPTR parent_ptr = node.parent_node;
+    
+    // A path longer than the file is a cycle
+    for (RPTR depth = 0; parent_ptr != 0; ++depth) {
+        if (depth >= next_node_ptr_) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree node " + std::to_string(parent_ptr) + " is corrupt");
+        }
+        read_node(parent_ptr, parent);
+        int child = -1;
+        while (child < parent.key_count && child_at(parent, child, key_length) != node_ptr) {
+            ++child;
+        }
+        if (!parent.nonleaf || child == parent.key_count) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree node " + std::to_string(node_ptr) +
+                                    " is not a child of its parent " + std::to_string(parent_ptr));
+        }
+        path.push_back({parent_ptr, child});
+        node_ptr = parent_ptr;
+        parent_ptr = parent.parent_node;
+    }
+    std::reverse(path.begin(), path.end());
+}
+
 RPTR BTreeFile::locate(const char* key) {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
@@ -200,135 +585,606 @@ RPTR BTreeFile::locate(const char* key) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Key pointer is null");
     }
     
-    // If there's no root node, the tree is empty
     if (header_.root_node == 0) {
         return INVALID_RPTR;
     }
     
-    // Helper function to read a node directly from file
-    auto read_node_direct = [this](RPTR node_ptr, BTreeNode& node) -> bool {
-        if (node_ptr == 0) {
-            return false;
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    BTreeNode node;
+    int index = 0;
+    find_leaf(key, nullptr, node, index);
+    return key_at(node, index, key, key_length) ? entry_rptr(node, index, key_length) : INVALID_RPTR;
+}
+
+void BTreeFile::insert_key(const char* key, RPTR record) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (key == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Key pointer is null");
+    }
+    
+    if (max_keys_ < 2) {
+        throw DatabaseException(ErrorCode::INVALID_SCHEMA, "B-tree nodes hold too few keys to split: " + file_path_);
+    }
+    
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    BTreeNode node;
+    if (header_.root_node == 0) {
+        // The first key makes a leaf that is the whole tree
+        std::memset(&node, 0, sizeof(node));
+        node.key_count = 1;
+        set_entry(node.keyspace, key, record, key_length);
+        RPTR node_ptr = allocate_node();
+        write_node(node_ptr, node);
+        header_.root_node = node_ptr;
+        header_.leftmost_node = node_ptr;
+        header_.rightmost_node = node_ptr;
+        header_dirty_ = true;
+        return;
+    }
+    
+    std::vector<PathStep> path;
+    const bool duplicates = (header_flags_ & BTREE_DUPLICATE_KEYS) != 0;
+    int index = 0;
+    RPTR leaf = find_leaf(key, duplicates ? nullptr : &path, node, index);
+    if (key_at(node, index, key, key_length)) {
+        throw DatabaseException(ErrorCode::DUPLICATE_KEY, "Key is already in B-tree " + file_path_);
+    }
+    if (duplicates) {
+        // find_leaf() may have stepped past the leaf the key goes in, into one whose
+        // separator is above it
+        leaf = descend(key, &path, node);
+        index = lower_bound(node, key, key_length);
+    }
+    insert_entry(path, leaf, node, index, key, record);
+}
+
+void BTreeFile::delete_key(const char* key) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (key == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Key pointer is null");
+    }
+    
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    const size_t entry_size = key_length + ADR;
+    std::vector<PathStep> path;
+    BTreeNode node;
+    int index = 0;
+    RPTR leaf = header_.root_node != 0 ? find_leaf(key, &path, node, index) : 0;
+    if (leaf == 0 || !key_at(node, index, key, key_length)) {
+        throw DatabaseException(ErrorCode::KEY_NOT_FOUND, "Key is not in B-tree " + file_path_);
+    }
+    
+    // Separators above may still hold the key; they only need to stay at or below the
+    // keys of their subtree
+    std::memmove(node.keyspace + index * entry_size, node.keyspace + (index + 1) * entry_size,
+                 (node.key_count - index - 1) * entry_size);
+    --node.key_count;
+    std::memset(node.keyspace + node.key_count * entry_size, 0, entry_size);
+    rebalance(path, leaf, node);
+}
+
+void BTreeFile::insert_entry(std::vector<PathStep>& path, RPTR node_ptr, BTreeNode& node, int index, const char* key, RPTR rptr) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    const size_t entry_size = key_length + ADR;
+    std::vector<char> entries((max_keys_ + 1) * entry_size);
+    std::vector<char> separator(key_length);
+    
+    while (true) {
+        if (node.key_count < max_keys_) {
+            char* entry = node.keyspace + index * entry_size;
+            std::memmove(entry + entry_size, entry, (node.key_count - index) * entry_size);
+            set_entry(entry, key, rptr, key_length);
+            ++node.key_count;
+            write_node(node_ptr, node);
+            return;
         }
         
-        size_t offset = HEADER_SIZE + ((node_ptr - 1) * NODE_SIZE);
-        file_.seekg(offset, std::ios::beg);
-        if (file_.fail()) {
-            return false;
-        }
+        // Split the full node and the new entry between it and a new right sibling
+        const int total = node.key_count + 1;
+        std::memcpy(entries.data(), node.keyspace, index * entry_size);
+        set_entry(entries.data() + index * entry_size, key, rptr, key_length);
+        std::memcpy(entries.data() + (index + 1) * entry_size, node.keyspace + index * entry_size,
+                    (node.key_count - index) * entry_size);
         
-        if (!file_.read(reinterpret_cast<char*>(&node), NODE_SIZE)) {
-            return false;
+        BTreeNode right;
+        std::memset(&right, 0, sizeof(right));
+        right.nonleaf = node.nonleaf;
+        int left_count;
+        if (!node.nonleaf) {
+            // The right leaf's first key separates the two
+            left_count = (total + 1) / 2;
+            set_entries(right, entries.data() + left_count * entry_size, total - left_count, entry_size);
+            std::memcpy(separator.data(), right.keyspace, key_length);
+        } else {
+            // The middle entry moves up; its child becomes the right node's key0
+            left_count = total / 2;
+            const char* middle = entries.data() + left_count * entry_size;
+            std::memcpy(separator.data(), middle, key_length);
+            std::memcpy(&right.key0, middle + key_length, ADR);
+            set_entries(right, middle + entry_size, total - left_count - 1, entry_size);
         }
+        set_entries(node, entries.data(), left_count, entry_size);
         
-        return true;
-    };
-    
-    // Helper function to compare keys
-    auto compare_key = [this](const char* key1, const char* key2) -> int {
-        return std::memcmp(key1, key2, header_.key_length);
-    };
-    
-    // Helper function to get key at index in node
-    auto get_key_at = [this](const BTreeNode& node, int index, char* key_buf) -> bool {
-        if (index < 0 || index >= node.key_count) {
-            return false;
+        RPTR right_ptr = allocate_node();
+        right.parent_node = node.parent_node;
+        right.left_sibling = node_ptr;
+        right.right_sibling = node.right_sibling;
+        node.right_sibling = right_ptr;
+        write_node(right_ptr, right);
+        if (right.right_sibling != 0) {
+            BTreeNode next;
+            read_node(right.right_sibling, next);
+            next.left_sibling = right_ptr;
+            write_node(right.right_sibling, next);
+        } else if (!right.nonleaf) {
+            header_.rightmost_node = right_ptr;
+            header_dirty_ = true;
+        }
+        if (right.nonleaf) {
+            adopt(right, right_ptr);
         }
         
-        // Calculate offset in keyspace
-        // Each entry is (key_length + ADR) bytes
-        size_t entry_size = header_.key_length + ADR;
-        size_t offset = index * entry_size;
-        
-        if (offset + header_.key_length > sizeof(node.keyspace)) {
-            return false;
+        if (path.empty()) {
+            // The root split: raise a new root over the two halves
+            BTreeNode root;
+            std::memset(&root, 0, sizeof(root));
+            root.nonleaf = 1;
+            root.key0 = node_ptr;
+            root.key_count = 1;
+            set_entry(root.keyspace, separator.data(), right_ptr, key_length);
+            RPTR root_ptr = allocate_node();
+            write_node(root_ptr, root);
+            node.parent_node = root_ptr;
+            right.parent_node = root_ptr;
+            write_node(node_ptr, node);
+            write_node(right_ptr, right);
+            header_.root_node = root_ptr;
+            header_dirty_ = true;
+            return;
         }
+        write_node(node_ptr, node);
         
-        std::memcpy(key_buf, node.keyspace + offset, header_.key_length);
-        return true;
-    };
+        // Add the separator for the right half to the parent, after the child just split
+        PathStep step = path.back();
+        path.pop_back();
+        node_ptr = step.node;
+        read_node(node_ptr, node);
+        index = step.child + 1;
+        key = separator.data();
+        rptr = right_ptr;
+    }
+}
+
+void BTreeFile::rebalance(std::vector<PathStep>& path, RPTR node_ptr, BTreeNode& node) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    const size_t entry_size = key_length + ADR;
+    const int min_keys = max_keys_ / 2;
     
-    // Helper function to get RPTR at index in node
-    auto get_rptr_at = [this](const BTreeNode& node, int index) -> RPTR {
-        if (index < 0 || index >= node.key_count) {
-            return INVALID_RPTR;
+    while (true) {
+        if (path.empty()) {
+            // The root may be left with fewer entries than any other node, but not none
+            if (node.key_count > 0) {
+                write_node(node_ptr, node);
+                return;
+            }
+            if (node.nonleaf) {
+                // Its only child becomes the root, and the tree one level lower
+                BTreeNode child;
+                read_node(node.key0, child);
+                child.parent_node = 0;
+                write_node(node.key0, child);
+                header_.root_node = node.key0;
+            } else {
+                header_.root_node = 0;
+                header_.leftmost_node = 0;
+                header_.rightmost_node = 0;
+            }
+            release_node(node_ptr);
+            header_dirty_ = true;
+            return;
+        }
+        if (node.key_count >= min_keys) {
+            write_node(node_ptr, node);
+            return;
         }
         
-        // Calculate offset in keyspace
-        // Each entry is (key_length + ADR) bytes
-        size_t entry_size = header_.key_length + ADR;
-        size_t offset = index * entry_size + header_.key_length;
+        // Pair the node with the next child of its parent, or the previous one if it is the last
+        PathStep step = path.back();
+        path.pop_back();
+        BTreeNode parent;
+        read_node(step.node, parent);
+        const int separator = step.child + 1 < parent.key_count ? step.child + 1 : step.child;
+        RPTR left_ptr = child_at(parent, separator - 1, key_length);
+        RPTR right_ptr = child_at(parent, separator, key_length);
+        BTreeNode sibling;
+        read_node(left_ptr == node_ptr ? right_ptr : left_ptr, sibling);
+        BTreeNode& left = left_ptr == node_ptr ? node : sibling;
+        BTreeNode& right = left_ptr == node_ptr ? sibling : node;
+        char* separator_entry = parent.keyspace + separator * entry_size;
         
-        if (offset + ADR > sizeof(node.keyspace)) {
-            return INVALID_RPTR;
+        // Gather both nodes' entries; between two non-leaf nodes the separator comes down
+        // with the right node's key0 as its child
+        std::vector<char> entries((left.key_count + right.key_count + 1) * entry_size);
+        std::memcpy(entries.data(), left.keyspace, left.key_count * entry_size);
+        int total = left.key_count;
+        if (left.nonleaf) {
+            set_entry(entries.data() + total * entry_size, separator_entry, right.key0, key_length);
+            ++total;
         }
+        std::memcpy(entries.data() + total * entry_size, right.keyspace, right.key_count * entry_size);
+        total += right.key_count;
         
-        RPTR rptr;
-        std::memcpy(&rptr, node.keyspace + offset, ADR);
-        return rptr;
-    };
-    
-    // Helper function to get child pointer at index (for non-leaf nodes)
-    auto get_child_ptr = [this](const BTreeNode& node, int index) -> RPTR {
-        // In a B-tree, child pointers are typically stored between keys
-        // This is a simplified version - actual structure may vary
-        if (index < 0 || index > node.key_count) {
-            return INVALID_RPTR;
+        if (total <= max_keys_) {
+            // Merge the right node into the left one and drop it from the parent
+            set_entries(left, entries.data(), total, entry_size);
+            left.right_sibling = right.right_sibling;
+            if (right.right_sibling != 0) {
+                BTreeNode next;
+                read_node(right.right_sibling, next);
+                next.left_sibling = left_ptr;
+                write_node(right.right_sibling, next);
+            } else if (!left.nonleaf) {
+                header_.rightmost_node = left_ptr;
+                header_dirty_ = true;
+            }
+            if (left.nonleaf) {
+                adopt(left, left_ptr);
+            }
+            write_node(left_ptr, left);
+            release_node(right_ptr);
+            
+            std::memmove(separator_entry, separator_entry + entry_size, (parent.key_count - separator - 1) * entry_size);
+            --parent.key_count;
+            std::memset(parent.keyspace + parent.key_count * entry_size, 0, entry_size);
+            node_ptr = step.node;
+            node = parent;
+            continue;
         }
         
-        // For now, return INVALID_RPTR as this requires understanding the exact layout
-        return INVALID_RPTR;
-    };
+        // Too many for one node: share them evenly, with a new separator between the halves
+        const int left_count = total / 2;
+        set_entries(left, entries.data(), left_count, entry_size);
+        const char* middle = entries.data() + left_count * entry_size;
+        if (!left.nonleaf) {
+            set_entries(right, middle, total - left_count, entry_size);
+            std::memcpy(separator_entry, right.keyspace, key_length);
+        } else {
+            std::memcpy(separator_entry, middle, key_length);
+            std::memcpy(&right.key0, middle + key_length, ADR);
+            set_entries(right, middle + entry_size, total - left_count - 1, entry_size);
+            adopt(left, left_ptr);
+            adopt(right, right_ptr);
+        }
+        write_node(left_ptr, left);
+        write_node(right_ptr, right);
+        write_node(step.node, parent);
+        return;
+    }
+}
+
+void BTreeFile::adopt(const BTreeNode& node, RPTR node_ptr) {
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    BTreeNode child;
+    for (int i = -1; i < node.key_count; ++i) {
+        RPTR child_ptr = child_at(node, i, key_length);
+        read_node(child_ptr, child);
+        if (child.parent_node != node_ptr) {
+            child.parent_node = node_ptr;
+            write_node(child_ptr, child);
+        }
+    }
+}
+
+void BTreeFile::pin_upper_levels() {
+    pinned_.clear();
+    pinned_entries_.clear();
+    free_slots_.clear();
+    if (header_.root_node == 0) {
+        return;
+    }
     
-    // Start search from root
-    RPTR current_node_ptr = header_.root_node;
+    // Breadth first, stopping at the leaves; a level wider than the file is a cycle
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    std::vector<RPTR> level = {header_.root_node};
+    std::vector<RPTR> below;
     BTreeNode node;
-    char key_buf[MAX_KEY_LENGTH];
+    while (!level.empty()) {
+        below.clear();
+        for (RPTR node_ptr : level) {
+            read_node(node_ptr, node);
+            if (node.key_count < 0 || node.key_count > max_keys_ || pinned_.count(node_ptr) != 0) {
+                throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree node " + std::to_string(node_ptr) + " is corrupt");
+            }
+            if (!node.nonleaf) {
+                return;
+            }
+            update_pinned(node_ptr, node);
+            for (int i = -1; i < node.key_count; ++i) {
+                below.push_back(child_at(node, i, key_length));
+            }
+        }
+        level.swap(below);
+    }
+}
+
+void BTreeFile::update_pinned(RPTR node_ptr, const BTreeNode& node) {
+    auto pinned = pinned_.find(node_ptr);
+    if (!node.nonleaf) {
+        if (pinned != pinned_.end()) {
+            free_slots_.push_back(pinned->second.slot);
+            pinned_.erase(pinned);
+        }
+        return;
+    }
     
-    while (current_node_ptr != 0) {
-        if (!read_node_direct(current_node_ptr, node)) {
-            return INVALID_RPTR;
+    const size_t slot_size = static_cast<size_t>(max_keys_) * (header_.key_length + ADR);
+    if (pinned == pinned_.end()) {
+        uint32_t slot;
+        if (!free_slots_.empty()) {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(pinned_entries_.size() / slot_size);
+            pinned_entries_.resize(pinned_entries_.size() + slot_size);
         }
+        pinned = pinned_.emplace(node_ptr, PinnedNode{0, 0, slot}).first;
+    }
+    PinnedNode& pin = pinned->second;
+    pin.key0 = node.key0;
+    pin.key_count = std::clamp(node.key_count, 0, max_keys_);
+    std::memcpy(pinned_entries_.data() + pin.slot * slot_size, node.keyspace, slot_size);
+}
+
+size_t BTreeFile::pinned_memory() const {
+    // A hash node holds the entry and a next pointer, plus the cached hash
+    const size_t per_node = sizeof(std::pair<const RPTR, PinnedNode>) + 2 * sizeof(void*);
+    return pinned_entries_.capacity() + free_slots_.capacity() * sizeof(uint32_t) +
+           pinned_.size() * per_node + pinned_.bucket_count() * sizeof(void*);
+}
+
+RPTR BTreeFile::allocate_node() {
+    if (header_.raised_node == 0) {
+        return next_node_ptr_;
+    }
+    RPTR node_ptr = header_.raised_node;
+    BTreeNode node;
+    read_node(node_ptr, node);
+    header_.raised_node = node.right_sibling;
+    header_dirty_ = true;
+    return node_ptr;
+}
+
+void BTreeFile::release_node(RPTR node_ptr) {
+    BTreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    node.right_sibling = header_.raised_node;
+    write_node(node_ptr, node);
+    header_.raised_node = node_ptr;
+    header_dirty_ = true;
+}
+
+void BTreeFile::build(const char* keys, std::span<const RPTR> records) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (header_.root_node != 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Only an empty B-tree can be built: " + file_path_);
+    }
+    
+    const size_t key_length = static_cast<size_t>(header_.key_length);
+    const size_t entry_size = key_length + ADR;
+    const size_t count = records.size();
+    bool duplicates = false;
+    for (size_t i = 1; i < count; ++i) {
+        int c = std::memcmp(keys + (i - 1) * key_length, keys + i * key_length, key_length);
+        if (c > 0) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "B-tree keys are out of order at key " + std::to_string(i));
+        }
+        duplicates = duplicates || c == 0;
+    }
+    if (duplicates && header_size_ == sizeof(BTreeHeader)) {
+        throw DatabaseException(ErrorCode::DUPLICATE_KEY, "Equal keys need a B-tree file with header copies: " + file_path_);
+    }
+    if (count == 0) {
+        return;
+    }
+    
+    // Plan the levels, leaves first: the fewest nodes that hold the level below, among which
+    // its entries are shared evenly, so that no node is less than about half full
+    const size_t capacity = static_cast<size_t>(std::max(max_keys_, 1));
+    std::vector<size_t> level_nodes = {(count + capacity - 1) / capacity};
+    while (level_nodes.back() > 1) {
+        level_nodes.push_back((level_nodes.back() + capacity) / (capacity + 1));
+    }
+    std::vector<RPTR> first_node(level_nodes.size(), 1);
+    for (size_t level = 1; level < level_nodes.size(); ++level) {
+        first_node[level] = first_node[level - 1] + level_nodes[level - 1];
+    }
+    
+    // Any nodes in the file are left from keys since deleted, and free to overwrite
+    const RPTR old_end = next_node_ptr_;
+    header_.raised_node = 0;
+    
+    // Lowest key under each node of the level below, for the separators of the level above
+    std::vector<char> low_keys(keys, keys + count * key_length);
+    std::vector<RPTR> parents;
+    BTreeNode node;
+    for (size_t level = 0; level < level_nodes.size(); ++level) {
+        const size_t items = level == 0 ? count : level_nodes[level - 1];
+        const size_t nodes = level_nodes[level];
         
-        // Search for key in current node
-        int i = 0;
-        
-        // Search through keyspace
-        for (i = 0; i < node.key_count; ++i) {
-            if (!get_key_at(node, i, key_buf)) {
-                break;
-            }
-            
-            int cmp = compare_key(key, key_buf);
-            if (cmp == 0) {
-                // Found the key - return its associated RPTR
-                RPTR result = get_rptr_at(node, i);
-                return result;
-            } else if (cmp < 0) {
-                // Key is less than current key
-                if (node.nonleaf) {
-                    // In a non-leaf node, follow the child pointer before this key
-                    // For now, return not found as child pointer traversal needs exact structure
-                    return INVALID_RPTR;
-                } else {
-                    // In a leaf node, key not found
-                    return INVALID_RPTR;
+        // Node j holds items [j * items / nodes, (j + 1) * items / nodes)
+        parents.assign(nodes, 0);
+        if (level + 1 < level_nodes.size()) {
+            const size_t above = level_nodes[level + 1];
+            for (size_t p = 0; p < above; ++p) {
+                for (size_t j = p * nodes / above; j < (p + 1) * nodes / above; ++j) {
+                    parents[j] = first_node[level + 1] + p;
                 }
             }
         }
         
-        // If this is a leaf node and we've checked all keys, not found
-        if (!node.nonleaf) {
-            return INVALID_RPTR;
+        std::vector<char> node_low_keys(nodes * key_length);
+        for (size_t j = 0; j < nodes; ++j) {
+            const size_t begin = j * items / nodes;
+            const size_t end = (j + 1) * items / nodes;
+            std::memset(&node, 0, sizeof(node));
+            node.nonleaf = level > 0 ? 1 : 0;
+            node.parent_node = parents[j];
+            node.left_sibling = j > 0 ? first_node[level] + j - 1 : 0;
+            node.right_sibling = j + 1 < nodes ? first_node[level] + j + 1 : 0;
+            
+            // A leaf points at records; a non-leaf node at the nodes of the level below
+            size_t entries_from = begin;
+            if (level > 0) {
+                node.key0 = first_node[level - 1] + begin;
+                entries_from = begin + 1;
+            }
+            node.key_count = static_cast<int>(end - entries_from);
+            for (size_t i = entries_from; i < end; ++i) {
+                char* entry = node.keyspace + (i - entries_from) * entry_size;
+                RPTR rptr = level == 0 ? records[i] : first_node[level - 1] + i;
+                std::memcpy(entry, low_keys.data() + i * key_length, key_length);
+                std::memcpy(entry + key_length, &rptr, ADR);
+            }
+            std::memcpy(node_low_keys.data() + j * key_length, low_keys.data() + begin * key_length, key_length);
+            write_node(first_node[level] + j, node);
         }
-        
-        // For non-leaf nodes, if key is greater than all keys, follow rightmost child
-        // For now, return not found as this requires exact B-tree structure knowledge
-        return INVALID_RPTR;
+        low_keys = std::move(node_low_keys);
     }
     
-    return INVALID_RPTR;
+    // A run of equal keys may straddle nodes; lookups then take the leftmost path to it
+    if (duplicates) {
+        header_flags_ |= BTREE_DUPLICATE_KEYS;
+    } else {
+        header_flags_ &= ~BTREE_DUPLICATE_KEYS;
+    }
+    header_.root_node = first_node.back();
+    header_.leftmost_node = 1;
+    header_.rightmost_node = level_nodes[0];
+    header_dirty_ = true;
+    for (RPTR node_ptr = header_.root_node + 1; node_ptr < old_end; ++node_ptr) {
+        release_node(node_ptr);
+    }
 }
 
-} // namespace pentaledger
+BTreeCursor BTreeFile::cursor() {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    return BTreeCursor(*this);
+}
+
+void BTreeFile::prefetch_node(RPTR node_ptr) {
+    // Direct I/O bypasses the page cache the hint would fill
+    if (node_ptr == 0 || node_ptr >= next_node_ptr_ || options_.direct_io) {
+        return;
+    }
+    ::posix_fadvise(file_.fd(), static_cast<off_t>(locate_offset(node_ptr)), static_cast<off_t>(NODE_SIZE), POSIX_FADV_WILLNEED);
+}
+
+BTreeCursor::BTreeCursor(BTreeFile& file) : file_(&file) {}
+
+void BTreeCursor::enter(RPTR node_ptr, bool forward) {
+    leaf_ptr_ = node_ptr;
+    index_ = 0;
+    if (node_ptr == 0) {
+        leaf_.key_count = 0;
+        return;
+    }
+    file_->read_node(node_ptr, leaf_);
+    if (leaf_.nonleaf || leaf_.key_count < 0 || leaf_.key_count > file_->max_keys_) {
+        leaf_.key_count = 0;
+        leaf_ptr_ = 0;
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "B-tree leaf " + std::to_string(node_ptr) + " is corrupt");
+    }
+    
+    // Start pulling in the next leaf while the caller works through this one
+    file_->prefetch_node(forward ? leaf_.right_sibling : leaf_.left_sibling);
+}
 
+bool BTreeCursor::lower_bound(const char* key) {
+    if (key == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Key pointer is null");
+    }
+    if (file_->header_.root_node == 0) {
+        enter(0, true);
+        return false;
+    }
+    
+    // The first of equal keys, even where a run of them spans leaves
+    leaf_ptr_ = file_->find_leaf(key, nullptr, leaf_, index_);
+    file_->prefetch_node(leaf_.right_sibling);
+    
+    // Every key of this leaf is below key: the answer is the first key of the next one
+    if (index_ == leaf_.key_count && leaf_.right_sibling != 0) {
+        enter(leaf_.right_sibling, true);
+    }
+    return valid();
+}
+
+bool BTreeCursor::seek(const char* key) {
+    return lower_bound(key) && std::memcmp(this->key(), key, static_cast<size_t>(file_->header_.key_length)) == 0;
+}
+
+bool BTreeCursor::upper_bound(const char* key) {
+    const size_t key_length = static_cast<size_t>(file_->header_.key_length);
+    for (lower_bound(key); valid() && std::memcmp(this->key(), key, key_length) == 0;) {
+        next();
+    }
+    return valid();
+}
+
+bool BTreeCursor::first() {
+    enter(file_->header_.root_node == 0 ? 0 : file_->header_.leftmost_node, true);
+    return valid();
+}
+
+bool BTreeCursor::last() {
+    enter(file_->header_.root_node == 0 ? 0 : file_->header_.rightmost_node, false);
+    index_ = leaf_.key_count - 1;
+    return valid();
+}
+
+bool BTreeCursor::next() {
+    if (leaf_ptr_ == 0) {
+        return false;
+    }
+    if (index_ < leaf_.key_count) {
+        ++index_;
+    }
+    if (index_ == leaf_.key_count && leaf_.right_sibling != 0) {
+        enter(leaf_.right_sibling, true);
+    }
+    return valid();
+}
+
+bool BTreeCursor::prev() {
+    if (leaf_ptr_ == 0) {
+        return false;
+    }
+    if (index_ >= 0) {
+        --index_;
+    }
+    if (index_ < 0 && leaf_.left_sibling != 0) {
+        enter(leaf_.left_sibling, false);
+        index_ = leaf_.key_count - 1;
+    }
+    return valid();
+}
+
+const char* BTreeCursor::key() const {
+    return leaf_.keyspace + index_ * (file_->header_.key_length + ADR);
+}
+
+RPTR BTreeCursor::record() const {
+    return entry_rptr(leaf_, index_, static_cast<size_t>(file_->header_.key_length));
+}
+
+} // namespace pentaledger
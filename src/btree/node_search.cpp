@@ -0,0 +1,199 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/node_search.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PENTALEDGER_NODE_SEARCH_SIMD 1
+#else
+#define PENTALEDGER_NODE_SEARCH_SIMD 0
+#endif
+
+namespace pentaledger {
+
+namespace {
+
+// The kernels count the keys below the one sought, which for sorted keys is its lower
+// bound.  Keys are big-endian for memcmp order, so they are byte-swapped and compared as
+// unsigned integers; the SIMD compares are signed, so the sign bits are flipped first.
+
+uint64_t load_key64(const char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return __builtin_bswap64(value);
+}
+
+uint32_t load_key32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return __builtin_bswap32(value);
+}
+
+int count_below64_scalar(const char* keys, int count, size_t stride, const char* key) {
+    const uint64_t target = load_key64(key);
+    int below = 0;
+    for (int i = 0; i < count; ++i) {
+        below += load_key64(keys + i * stride) < target;
+    }
+    return below;
+}
+
+int count_below32_scalar(const char* keys, int count, size_t stride, const char* key) {
+    const uint32_t target = load_key32(key);
+    int below = 0;
+    for (int i = 0; i < count; ++i) {
+        below += load_key32(keys + i * stride) < target;
+    }
+    return below;
+}
+
+#if PENTALEDGER_NODE_SEARCH_SIMD
+__attribute__((target("avx2")))
+int count_below64_avx2(const char* keys, int count, size_t stride, const char* key) {
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(1ull << 63));
+    const __m256i target = _mm256_set1_epi64x(static_cast<long long>(load_key64(key) ^ (1ull << 63)));
+    int below = 0;
+    int i = 0;
+    if (stride == 16) {
+        // Four entries are two loads; the keys are their even quadwords, in any order
+        for (; i + 4 <= count; i += 4) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i * 16));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i * 16 + 32));
+            __m256i k = _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_unpacklo_epi64(a, b), swap), sign);
+            below += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, k))));
+        }
+    }
+    return below + count_below64_scalar(keys + i * stride, count - i, stride, key);
+}
+
+__attribute__((target("avx2")))
+int count_below32_avx2(const char* keys, int count, size_t stride, const char* key) {
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i sign = _mm256_set1_epi32(static_cast<int>(1u << 31));
+    const __m256i target = _mm256_set1_epi32(static_cast<int>(load_key32(key) ^ (1u << 31)));
+    const int s = static_cast<int>(stride);
+    const __m256i offsets = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+    int below = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i k = _mm256_i32gather_epi32(reinterpret_cast<const int*>(keys + i * stride), offsets, 1);
+        k = _mm256_xor_si256(_mm256_shuffle_epi8(k, swap), sign);
+        below += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, k))));
+    }
+    return below + count_below32_scalar(keys + i * stride, count - i, stride, key);
+}
+
+__attribute__((target("sse4.2")))
+int count_below64_sse42(const char* keys, int count, size_t stride, const char* key) {
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m128i sign = _mm_set1_epi64x(static_cast<long long>(1ull << 63));
+    const __m128i target = _mm_set1_epi64x(static_cast<long long>(load_key64(key) ^ (1ull << 63)));
+    int below = 0;
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(keys + i * stride));
+        __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(keys + (i + 1) * stride));
+        __m128i k = _mm_xor_si128(_mm_shuffle_epi8(_mm_unpacklo_epi64(a, b), swap), sign);
+        below += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, k))));
+    }
+    return below + count_below64_scalar(keys + i * stride, count - i, stride, key);
+}
+
+__attribute__((target("sse4.2")))
+int count_below32_sse42(const char* keys, int count, size_t stride, const char* key) {
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i sign = _mm_set1_epi32(static_cast<int>(1u << 31));
+    const __m128i target = _mm_set1_epi32(static_cast<int>(load_key32(key) ^ (1u << 31)));
+    int below = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t raw[4];
+        for (int j = 0; j < 4; ++j) {
+            std::memcpy(&raw[j], keys + (i + j) * stride, sizeof(raw[j]));
+        }
+        __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(raw));
+        k = _mm_xor_si128(_mm_shuffle_epi8(k, swap), sign);
+        below += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, k))));
+    }
+    return below + count_below32_scalar(keys + i * stride, count - i, stride, key);
+}
+#endif
+
+using CountBelow = int (*)(const char*, int, size_t, const char*);
+
+struct Kernels {
+    CountBelow below64;
+    CountBelow below32;
+    const char* name;
+};
+
+Kernels select() {
+#if PENTALEDGER_NODE_SEARCH_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return {count_below64_avx2, count_below32_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return {count_below64_sse42, count_below32_sse42, "sse4.2"};
+    }
+#endif
+    return {count_below64_scalar, count_below32_scalar, "scalar"};
+}
+
+// A local static, so that it is ready even for callers in other static initializers
+const Kernels& kernels() {
+    static const Kernels selected = select();
+    return selected;
+}
+
+} // namespace
+
+int node_lower_bound(const char* keys, int count, size_t key_length, size_t stride, const char* key) {
+    if (key_length == sizeof(uint64_t)) {
+        return kernels().below64(keys, count, stride, key);
+    }
+    if (key_length == sizeof(uint32_t)) {
+        return kernels().below32(keys, count, stride, key);
+    }
+    return node_lower_bound_portable(keys, count, key_length, stride, key);
+}
+
+int node_lower_bound_portable(const char* keys, int count, size_t key_length, size_t stride, const char* key) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (std::memcmp(keys + mid * stride, key, key_length) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+const char* node_search_kernel() {
+    return kernels().name;
+}
+
+} // namespace pentaledger
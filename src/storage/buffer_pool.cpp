@@ -0,0 +1,532 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/buffer_pool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace pentaledger {
+
+// ---------------------------------------------------------------------------
+// PageHandle
+
+PageHandle::PageHandle(PageHandle&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr)),
+      frame_(other.frame_),
+      data_(std::exchange(other.data_, nullptr)),
+      page_(std::exchange(other.page_, INVALID_PAGE_ID)) {
+}
+
+PageHandle& PageHandle::operator=(PageHandle&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        frame_ = other.frame_;
+        data_ = std::exchange(other.data_, nullptr);
+        page_ = std::exchange(other.page_, INVALID_PAGE_ID);
+    }
+    return *this;
+}
+
+PageHandle::~PageHandle() {
+    release();
+}
+
+void PageHandle::mark_dirty() {
+    if (pool_ != nullptr) {
+        pool_->mark_dirty(frame_);
+    }
+}
+
+void PageHandle::release() {
+    if (pool_ != nullptr) {
+        pool_->unpin(frame_);
+        pool_ = nullptr;
+        data_ = nullptr;
+        page_ = INVALID_PAGE_ID;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// BufferPool
+
+BufferPool::BufferPool(size_t capacity_bytes)
+    : capacity_pages_(std::max<size_t>(capacity_bytes / PAGE_SIZE, 1)) {
+}
+
+BufferPool::~BufferPool() {
+    // Best effort: a pool destroyed with registered files still writes their pages back
+    try {
+        flush_all();
+    } catch (const DatabaseException&) {
+    }
+}
+
+BufferPool& BufferPool::shared() {
+    static BufferPool pool(DEFAULT_CAPACITY);
+    return pool;
+}
+
+BufferPool::FileId BufferPool::register_file(int fd, bool direct) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, std::string("Failed to stat file for buffer pool: ") + std::strerror(errno));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    FileId id = next_file_id_++;
+    files_[id] = FileEntry{fd, static_cast<uint64_t>(st.st_size), direct, static_cast<uint64_t>(st.st_size)};
+    return id;
+}
+
+void BufferPool::unregister_file(FileId file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        wait_for_io(lock, i);
+        if (frames_[i].page == INVALID_PAGE_ID || frames_[i].file != file) {
+            continue;
+        }
+        if (frames_[i].pin_count != 0) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Cannot unregister a file with pinned pages");
+        }
+        if (frames_[i].dirty) {
+            write_back(lock, i);
+        }
+        evict_locked(i);
+    }
+    files_.erase(file);
+}
+
+PageHandle BufferPool::fetch(FileId file, PageId page) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t index = pin(lock, file, page, true);
+    return PageHandle(this, index, frames_[index].data.get(), page);
+}
+
+void BufferPool::read(FileId file, uint64_t offset, void* buffer, size_t length) {
+    auto* out = static_cast<uint8_t*>(buffer);
+    while (length > 0) {
+        PageId page = static_cast<PageId>(offset / PAGE_SIZE);
+        size_t in_page = static_cast<size_t>(offset % PAGE_SIZE);
+        size_t n = std::min(length, PAGE_SIZE - in_page);
+
+        PageHandle handle = fetch(file, page);
+        std::memcpy(out, handle.data() + in_page, n);
+
+        out += n;
+        offset += n;
+        length -= n;
+    }
+}
+
+void BufferPool::write(FileId file, uint64_t offset, const void* buffer, size_t length) {
+    const auto* in = static_cast<const uint8_t*>(buffer);
+    while (length > 0) {
+        PageId page = static_cast<PageId>(offset / PAGE_SIZE);
+        size_t in_page = static_cast<size_t>(offset % PAGE_SIZE);
+        size_t n = std::min(length, PAGE_SIZE - in_page);
+        bool whole_page = (in_page == 0 && n == PAGE_SIZE);
+
+        PageHandle handle;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            size_t index = pin(lock, file, page, !whole_page);
+            handle = PageHandle(this, index, frames_[index].data.get(), page);
+        }
+        std::memcpy(handle.data() + in_page, in, n);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            frames_[handle.frame_].dirty = true;
+            FileEntry& entry = files_.at(file);
+            entry.size = std::max(entry.size, offset + n);
+        }
+
+        in += n;
+        offset += n;
+        length -= n;
+    }
+}
+
+void BufferPool::truncate(FileId file, uint64_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (files_.find(file) == files_.end()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File is not registered with the buffer pool");
+    }
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        // A write-back under way could land past the new end after the cut
+        wait_for_io(lock, i);
+        Frame& frame = frames_[i];
+        if (frame.page == INVALID_PAGE_ID || frame.file != file) {
+            continue;
+        }
+        uint64_t start = static_cast<uint64_t>(frame.page) * PAGE_SIZE;
+        if (start >= size) {
+            if (frame.pin_count != 0) {
+                throw DatabaseException(ErrorCode::IO_ERROR, "Cannot truncate a file over pinned pages");
+            }
+            evict_locked(i);
+        } else if (start + PAGE_SIZE > size) {
+            std::memset(frame.data.get() + (size - start), 0, static_cast<size_t>(start + PAGE_SIZE - size));
+        }
+    }
+    FileEntry& entry = files_.at(file);
+    entry.size = size;
+    entry.allocated = size;
+    if (::ftruncate(entry.fd, static_cast<off_t>(size)) != 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, std::string("Failed to truncate file: ") + std::strerror(errno));
+    }
+}
+
+void BufferPool::reserve(FileId file, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FileEntry& entry = files_.at(file);
+    entry.allocated = std::max(entry.allocated, size);
+}
+
+void BufferPool::flush(FileId file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        // A write-back already under way may have missed the latest change
+        wait_for_io(lock, i);
+        const Frame& frame = frames_[i];
+        if (frame.dirty && frame.file == file && frame.page != INVALID_PAGE_ID) {
+            write_back(lock, i);
+        }
+    }
+}
+
+void BufferPool::flush_all() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        wait_for_io(lock, i);
+        const Frame& frame = frames_[i];
+        if (frame.dirty && frame.page != INVALID_PAGE_ID) {
+            write_back(lock, i);
+        }
+    }
+}
+
+uint64_t BufferPool::file_size(FileId file) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.at(file).size;
+}
+
+void BufferPool::set_capacity(size_t capacity_bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    capacity_pages_ = std::max<size_t>(capacity_bytes / PAGE_SIZE, 1);
+
+    // Release unpinned frames until the pool fits; pinned ones go when they are unpinned
+    for (size_t i = 0; i < frames_.size() && allocated_pages_ > capacity_pages_; ++i) {
+        wait_for_io(lock, i);
+        if (frames_[i].data && frames_[i].pin_count == 0 && frames_[i].dirty) {
+            write_back(lock, i);
+        }
+        Frame& frame = frames_[i];
+        if (frame.data && frame.pin_count == 0 && !frame.dirty) {
+            if (frame.page != INVALID_PAGE_ID) {
+                evict_locked(i);
+            }
+            frame.data.reset();
+            --allocated_pages_;
+        }
+    }
+}
+
+size_t BufferPool::capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_pages_ * PAGE_SIZE;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.capacity_pages = capacity_pages_;
+    stats.resident_pages = page_table_.size();
+    return stats;
+}
+
+size_t BufferPool::pin(std::unique_lock<std::mutex>& lock, FileId file, PageId page, bool load) {
+    const uint64_t key = page_key(file, page);
+    for (;;) {
+        auto it = page_table_.find(key);
+        if (it != page_table_.end()) {
+            Frame& frame = frames_[it->second];
+            if (frame.loading || frame.writing) {
+                // Another thread is reading the page in or writing it back: take it once
+                // that is done, or load it again if the load failed
+                io_done_.wait(lock);
+                continue;
+            }
+            ++frame.pin_count;
+            frame.referenced = true;
+            ++stats_.hits;
+            return it->second;
+        }
+
+        size_t index = acquire_frame(lock);
+        if (page_table_.count(key) != 0) {
+            // Brought in by another thread while a victim was being written back
+            free_frames_.push_back(index);
+            continue;
+        }
+        auto file_it = files_.find(file);
+        if (file_it == files_.end()) {
+            free_frames_.push_back(index);
+            throw DatabaseException(ErrorCode::IO_ERROR, "File is not registered with the buffer pool");
+        }
+
+        ++stats_.misses;
+        Frame& frame = frames_[index];
+        frame.file = file;
+        frame.page = page;
+        frame.pin_count = 1;
+        frame.dirty = false;
+        frame.referenced = true;
+        frame.loading = load;
+        page_table_[key] = index;
+        if (!load) {
+            return index;
+        }
+
+        // Read without the lock; the frame is pinned, so it stays put
+        const int fd = file_it->second.fd;
+        const bool direct = file_it->second.direct;
+        uint8_t* data = frame.data.get();
+        lock.unlock();
+
+        // Pages past the end of the file read as zeros
+        std::string error;
+        size_t n = 0;
+        uint64_t offset = static_cast<uint64_t>(page) * PAGE_SIZE;
+        while (n < PAGE_SIZE) {
+            ssize_t r = ::pread(fd, data + n, PAGE_SIZE - n, static_cast<off_t>(offset + n));
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r < 0) {
+                error = "Failed to load page " + std::to_string(page) + ": " + std::strerror(errno);
+                break;
+            }
+            if (r == 0) {
+                break;
+            }
+            n += static_cast<size_t>(r);
+            // A direct read stops short only at the end of the file, and cannot resume
+            // at the unaligned offset where it stopped
+            if (direct) {
+                break;
+            }
+        }
+        std::memset(data + n, 0, PAGE_SIZE - n);
+
+        lock.lock();
+        Frame& loaded = frames_[index];
+        loaded.loading = false;
+        io_done_.notify_all();
+        if (!error.empty()) {
+            page_table_.erase(key);
+            loaded.page = INVALID_PAGE_ID;
+            loaded.pin_count = 0;
+            loaded.referenced = false;
+            free_frames_.push_back(index);
+            throw DatabaseException(ErrorCode::IO_ERROR, error);
+        }
+        return index;
+    }
+}
+
+std::unique_ptr<uint8_t, BufferPool::FreeDeleter> BufferPool::allocate_page() {
+    std::unique_ptr<uint8_t, FreeDeleter> page(static_cast<uint8_t*>(std::aligned_alloc(PAGE_SIZE, PAGE_SIZE)));
+    if (!page) {
+        throw DatabaseException(ErrorCode::INSUFFICIENT_SPACE, "Failed to allocate a buffer pool page");
+    }
+    return page;
+}
+
+size_t BufferPool::acquire_frame(std::unique_lock<std::mutex>& lock) {
+    // Reuse an empty frame, or allocate one while under budget
+    while (!free_frames_.empty()) {
+        size_t index = free_frames_.back();
+        free_frames_.pop_back();
+        if (frames_[index].data) {
+            return index;
+        }
+        if (allocated_pages_ < capacity_pages_) {
+            frames_[index].data = allocate_page();
+            ++allocated_pages_;
+            return index;
+        }
+    }
+    if (allocated_pages_ < capacity_pages_) {
+        frames_.emplace_back();
+        frames_.back().data = allocate_page();
+        ++allocated_pages_;
+        return frames_.size() - 1;
+    }
+
+    for (;;) {
+        // CLOCK: sweep at most twice, clearing reference bits on the first pass
+        bool busy = false;
+        for (size_t step = 0; step < frames_.size() * 2; ++step) {
+            size_t index = clock_hand_;
+            clock_hand_ = (clock_hand_ + 1) % frames_.size();
+
+            Frame& frame = frames_[index];
+            if (!frame.data || frame.pin_count != 0 || frame.page == INVALID_PAGE_ID) {
+                continue;
+            }
+            if (frame.loading || frame.writing) {
+                busy = true;
+                continue;
+            }
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            if (frame.dirty) {
+                write_back(lock, index);
+                // Used again while it was written: no longer a victim
+                const Frame& written = frames_[index];
+                if (written.pin_count != 0 || written.dirty || written.referenced) {
+                    continue;
+                }
+            }
+
+            evict_locked(index);
+            ++stats_.evictions;
+            // evict_locked made the frame free; take it back
+            free_frames_.pop_back();
+            return index;
+        }
+        if (!busy) {
+            throw DatabaseException(ErrorCode::INSUFFICIENT_SPACE, "Buffer pool exhausted: every page is pinned");
+        }
+        // The only candidates are busy with I/O; sweep again once one is done
+        io_done_.wait(lock);
+    }
+}
+
+void BufferPool::write_back(std::unique_lock<std::mutex>& lock, size_t index) {
+    Frame& frame = frames_[index];
+    const FileEntry& entry = files_.at(frame.file);
+    const FileId file = frame.file;
+    const PageId page = frame.page;
+    const int fd = entry.fd;
+    const uint8_t* data = frame.data.get();
+    uint64_t offset = static_cast<uint64_t>(page) * PAGE_SIZE;
+
+    // Never extend the file past its logical size with the zero tail of a page.  A direct
+    // write has to be the whole page, so a tail past what is allocated on disk is cut off
+    // again afterwards.
+    size_t length = entry.size > offset ? static_cast<size_t>(std::min<uint64_t>(PAGE_SIZE, entry.size - offset)) : 0;
+    const bool whole = entry.direct && length > 0 && length < PAGE_SIZE;
+    const bool trim = whole && offset + PAGE_SIZE > entry.allocated;
+    if (whole) {
+        length = PAGE_SIZE;
+    }
+
+    // Write without the lock.  The page is marked clean first, so that a change made to it
+    // meanwhile marks it dirty again.
+    frame.dirty = false;
+    frame.writing = true;
+    lock.unlock();
+    std::string error;
+    size_t n = 0;
+    while (n < length) {
+        ssize_t w = ::pwrite(fd, data + n, length - n, static_cast<off_t>(offset + n));
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0) {
+            error = "Failed to write back page " + std::to_string(page) + ": " + std::strerror(errno);
+            break;
+        }
+        n += static_cast<size_t>(w);
+    }
+    lock.lock();
+    frames_[index].writing = false;
+    io_done_.notify_all();
+    if (!error.empty()) {
+        frames_[index].dirty = true;
+        throw DatabaseException(ErrorCode::IO_ERROR, error);
+    }
+
+    if (trim) {
+        // Cut with the lock held, to the sizes as they are now, which cover any page
+        // written back meanwhile
+        FileEntry& current = files_.at(file);
+        uint64_t end = std::max(current.size, current.allocated);
+        if (::ftruncate(fd, static_cast<off_t>(end)) != 0) {
+            frames_[index].dirty = true;
+            throw DatabaseException(ErrorCode::IO_ERROR, "Failed to trim page " + std::to_string(page) + ": " + std::strerror(errno));
+        }
+        current.allocated = end;
+    }
+    ++stats_.write_backs;
+}
+
+void BufferPool::wait_for_io(std::unique_lock<std::mutex>& lock, size_t index) {
+    io_done_.wait(lock, [&] { return !frames_[index].loading && !frames_[index].writing; });
+}
+
+void BufferPool::evict_locked(size_t index) {
+    Frame& frame = frames_[index];
+    page_table_.erase(page_key(frame.file, frame.page));
+    frame.page = INVALID_PAGE_ID;
+    frame.dirty = false;
+    frame.referenced = false;
+    free_frames_.push_back(index);
+}
+
+void BufferPool::unpin(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Frame& frame = frames_[index];
+    if (frame.pin_count > 0) {
+        --frame.pin_count;
+    }
+
+    // Give back frames that a shrinking set_capacity() could not release while pinned
+    if (frame.pin_count == 0 && allocated_pages_ > capacity_pages_ && !frame.writing) {
+        try {
+            if (frame.dirty) {
+                write_back(lock, index);
+            }
+            Frame& idle = frames_[index];
+            if (idle.pin_count == 0 && !idle.dirty && allocated_pages_ > capacity_pages_) {
+                evict_locked(index);
+                idle.data.reset();
+                --allocated_pages_;
+            }
+        } catch (const DatabaseException&) {
+            // Keep the page; the write-back is retried on the next flush or eviction
+        }
+    }
+}
+
+void BufferPool::mark_dirty(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_[index].dirty = true;
+}
+
+} // namespace pentaledger
@@ -0,0 +1,572 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/bulk_loader.hpp"
+#include "../../include/pentaledger/data_file.hpp"
+#include "../../include/pentaledger/btree_file.hpp"
+#include "../../include/pentaledger/typed_data_file.hpp"
+#include "../../include/pentaledger/posix_file.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <optional>
+#include <thread>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+namespace {
+
+//! \brief The records parsed from one chunk of input, or the error that stopped it
+struct ParsedChunk {
+    std::vector<uint8_t> records;
+    std::vector<uint8_t> keys;
+    size_t count = 0;
+    //! Lines in the chunk, including empty ones
+    uint64_t lines = 0;
+    //! Line of the chunk, from 1, holding the error; 0 if there is none
+    uint64_t error_line = 0;
+    std::string error;
+};
+
+//! \brief An input error, thrown within a chunk and reported with its line number
+struct ParseError {
+    std::string message;
+};
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+template <class T>
+void store_number(std::string_view text, const LoadColumn& column, uint8_t* field) {
+    text = trim(text);
+    if (text.empty()) {
+        return;  // left as zero
+    }
+    if (text.front() == '+') {
+        text.remove_prefix(1);
+    }
+    T value{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        throw ParseError{"column " + column.name + ": '" + std::string(text) + "' is not a valid value"};
+    }
+    std::memcpy(field, &value, sizeof(value));
+}
+
+//! \brief Convert the text of a field into its column's storage form
+void store_field(std::string_view text, const LoadColumn& column, uint8_t* field) {
+    switch (column.type) {
+        case FieldType::INT32: store_number<int32_t>(text, column, field); break;
+        case FieldType::INT64: store_number<int64_t>(text, column, field); break;
+        case FieldType::FLOAT: store_number<float>(text, column, field); break;
+        case FieldType::DOUBLE: store_number<double>(text, column, field); break;
+        case FieldType::STRING:
+            if (text.size() > column.size) {
+                throw ParseError{"column " + column.name + ": value longer than " + std::to_string(column.size) + " bytes"};
+            }
+            std::memcpy(field, text.data(), text.size());
+            break;
+        case FieldType::BLOB: break;
+    }
+}
+
+void append_utf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+//! \brief Turns the lines of a chunk into records
+class ChunkParser {
+public:
+    ChunkParser(const std::vector<LoadColumn>& columns, const std::vector<uint32_t>& offsets,
+                const BulkLoadOptions& options, uint32_t record_length)
+        : columns_(columns), offsets_(offsets), options_(options), record_length_(record_length) {}
+
+    ParsedChunk parse(const std::string& text, bool skip_first_line) const {
+        ParsedChunk chunk;
+        chunk.records.reserve(text.size() / 2);
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find('\n', pos);
+            if (end == std::string::npos) {
+                end = text.size();
+            }
+            std::string_view line(text.data() + pos, end - pos);
+            pos = end + 1;
+            ++chunk.lines;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if ((skip_first_line && chunk.lines == 1) || trim(line).empty()) {
+                continue;
+            }
+
+            chunk.records.resize(chunk.records.size() + record_length_);
+            uint8_t* record = chunk.records.data() + chunk.records.size() - record_length_;
+            std::memset(record, 0, record_length_);
+            try {
+                if (options_.format == LoadFormat::CSV) {
+                    parse_csv(line, record);
+                } else {
+                    parse_json(line, record);
+                }
+            } catch (const ParseError& e) {
+                chunk.error_line = chunk.lines;
+                chunk.error = e.message;
+                chunk.records.resize(chunk.records.size() - record_length_);
+                return chunk;
+            }
+
+            if (options_.key_column >= 0) {
+                const LoadColumn& key = columns_[options_.key_column];
+                chunk.keys.resize(chunk.keys.size() + key.width());
+                encode_index_key(key, record + offsets_[options_.key_column], chunk.keys.data() + chunk.keys.size() - key.width());
+            }
+            ++chunk.count;
+        }
+        return chunk;
+    }
+
+private:
+    void parse_csv(std::string_view line, uint8_t* record) const {
+        std::string quoted;
+        size_t field = 0;
+        size_t pos = 0;
+        while (true) {
+            std::string_view text;
+            if (pos < line.size() && line[pos] == '"') {
+                // Quoted: runs to the closing quote, a doubled quote standing for one
+                quoted.clear();
+                ++pos;
+                while (true) {
+                    size_t quote = line.find('"', pos);
+                    if (quote == std::string_view::npos) {
+                        throw ParseError{"unterminated quoted field"};
+                    }
+                    quoted.append(line.data() + pos, quote - pos);
+                    pos = quote + 1;
+                    if (pos < line.size() && line[pos] == '"') {
+                        quoted += '"';
+                        ++pos;
+                    } else {
+                        break;
+                    }
+                }
+                if (pos < line.size() && line[pos] != options_.delimiter) {
+                    throw ParseError{"unexpected text after a quoted field"};
+                }
+                text = quoted;
+            } else {
+                size_t end = line.find(options_.delimiter, pos);
+                if (end == std::string_view::npos) {
+                    end = line.size();
+                }
+                text = line.substr(pos, end - pos);
+                pos = end;
+            }
+
+            if (field < columns_.size()) {
+                store_field(text, columns_[field], record + offsets_[field]);
+            }
+            ++field;
+            if (pos >= line.size()) {
+                break;
+            }
+            ++pos;  // the delimiter
+        }
+        if (field != columns_.size()) {
+            throw ParseError{"expected " + std::to_string(columns_.size()) + " fields, found " + std::to_string(field)};
+        }
+    }
+
+    static void skip_space(std::string_view line, size_t& pos) {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) {
+            ++pos;
+        }
+    }
+
+    //! \brief Read the JSON string starting at the quote at pos, unescaped into out
+    static void parse_json_string(std::string_view line, size_t& pos, std::string& out) {
+        out.clear();
+        ++pos;
+        while (true) {
+            if (pos >= line.size()) {
+                throw ParseError{"unterminated string"};
+            }
+            char c = line[pos++];
+            if (c == '"') {
+                return;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= line.size()) {
+                throw ParseError{"unterminated string"};
+            }
+            c = line[pos++];
+            switch (c) {
+                case '"': case '\\': case '/': out += c; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t code = parse_hex4(line, pos);
+                    if (code >= 0xD800 && code < 0xDC00 && line.substr(pos, 2) == "\\u") {
+                        pos += 2;
+                        uint32_t low = parse_hex4(line, pos);
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default: throw ParseError{std::string("invalid escape \\") + c};
+            }
+        }
+    }
+
+    static uint32_t parse_hex4(std::string_view line, size_t& pos) {
+        uint32_t code = 0;
+        if (pos + 4 > line.size()) {
+            throw ParseError{"invalid \\u escape"};
+        }
+        auto [end, error] = std::from_chars(line.data() + pos, line.data() + pos + 4, code, 16);
+        if (error != std::errc() || end != line.data() + pos + 4) {
+            throw ParseError{"invalid \\u escape"};
+        }
+        pos += 4;
+        return code;
+    }
+
+    void parse_json(std::string_view line, uint8_t* record) const {
+        std::string name;
+        std::string value;
+        size_t pos = 0;
+        skip_space(line, pos);
+        if (pos >= line.size() || line[pos] != '{') {
+            throw ParseError{"expected a JSON object"};
+        }
+        ++pos;
+        skip_space(line, pos);
+        if (pos < line.size() && line[pos] == '}') {
+            ++pos;
+        } else {
+            while (true) {
+                skip_space(line, pos);
+                if (pos >= line.size() || line[pos] != '"') {
+                    throw ParseError{"expected a member name"};
+                }
+                parse_json_string(line, pos, name);
+                skip_space(line, pos);
+                if (pos >= line.size() || line[pos] != ':') {
+                    throw ParseError{"expected ':' after \"" + name + "\""};
+                }
+                ++pos;
+                skip_space(line, pos);
+                if (pos >= line.size()) {
+                    throw ParseError{"missing value for \"" + name + "\""};
+                }
+
+                // Strings are unescaped; anything else is kept as its text
+                std::string_view text;
+                bool null = false;
+                if (line[pos] == '"') {
+                    parse_json_string(line, pos, value);
+                    text = value;
+                } else if (line[pos] == '{' || line[pos] == '[') {
+                    throw ParseError{"nested value for \"" + name + "\" is not supported"};
+                } else {
+                    size_t end = pos;
+                    while (end < line.size() && line[end] != ',' && line[end] != '}' && line[end] != ' ' && line[end] != '\t') {
+                        ++end;
+                    }
+                    text = line.substr(pos, end - pos);
+                    pos = end;
+                    if (text == "true") {
+                        text = "1";
+                    } else if (text == "false") {
+                        text = "0";
+                    } else if (text == "null") {
+                        null = true;
+                    }
+                }
+
+                for (size_t i = 0; i < columns_.size(); ++i) {
+                    if (columns_[i].name == name) {
+                        if (!null) {
+                            store_field(text, columns_[i], record + offsets_[i]);
+                        }
+                        break;
+                    }
+                }
+
+                skip_space(line, pos);
+                if (pos < line.size() && line[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                if (pos < line.size() && line[pos] == '}') {
+                    ++pos;
+                    break;
+                }
+                throw ParseError{"expected ',' or '}'"};
+            }
+        }
+        skip_space(line, pos);
+        if (pos != line.size()) {
+            throw ParseError{"unexpected text after the object"};
+        }
+    }
+
+    const std::vector<LoadColumn>& columns_;
+    const std::vector<uint32_t>& offsets_;
+    const BulkLoadOptions& options_;
+    uint32_t record_length_;
+};
+
+template <class U>
+void store_big_endian(U value, uint8_t* key) {
+    for (size_t i = 0; i < sizeof(U); ++i) {
+        key[i] = static_cast<uint8_t>(value >> (8 * (sizeof(U) - 1 - i)));
+    }
+}
+
+template <class U>
+void encode_signed(const uint8_t* field, uint8_t* key) {
+    U bits;
+    std::memcpy(&bits, field, sizeof(bits));
+    store_big_endian<U>(bits ^ (U(1) << (8 * sizeof(U) - 1)), key);
+}
+
+template <class U>
+void encode_floating(const uint8_t* field, uint8_t* key) {
+    const U sign = U(1) << (8 * sizeof(U) - 1);
+    U bits;
+    std::memcpy(&bits, field, sizeof(bits));
+    store_big_endian<U>((bits & sign) ? ~bits : bits | sign, key);
+}
+
+} // namespace
+
+uint32_t LoadColumn::width() const {
+    return type == FieldType::STRING ? size : static_cast<uint32_t>(field_size(type));
+}
+
+std::vector<LoadColumn> parse_load_columns(std::string_view spec) {
+    std::vector<LoadColumn> columns;
+    while (!spec.empty()) {
+        size_t comma = spec.find(',');
+        std::string_view item = trim(spec.substr(0, comma));
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+        size_t colon = item.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Column '" + std::string(item) + "' needs a name and a type");
+        }
+        LoadColumn column;
+        column.name = std::string(item.substr(0, colon));
+        std::string_view type = item.substr(colon + 1);
+        if (type == "int32") {
+            column.type = FieldType::INT32;
+        } else if (type == "int64") {
+            column.type = FieldType::INT64;
+        } else if (type == "float") {
+            column.type = FieldType::FLOAT;
+        } else if (type == "double") {
+            column.type = FieldType::DOUBLE;
+        } else if (type.substr(0, 7) == "string:") {
+            column.type = FieldType::STRING;
+            std::string_view size = type.substr(7);
+            auto [end, error] = std::from_chars(size.data(), size.data() + size.size(), column.size);
+            if (error != std::errc() || end != size.data() + size.size() || column.size == 0) {
+                throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Column " + column.name + " has an invalid string size");
+            }
+        } else {
+            throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Column " + column.name + " has unknown type '" + std::string(type) + "'");
+        }
+        columns.push_back(std::move(column));
+    }
+    return columns;
+}
+
+void encode_index_key(const LoadColumn& column, const uint8_t* field, uint8_t* key) {
+    switch (column.type) {
+        case FieldType::INT32: encode_signed<uint32_t>(field, key); break;
+        case FieldType::INT64: encode_signed<uint64_t>(field, key); break;
+        case FieldType::FLOAT: encode_floating<uint32_t>(field, key); break;
+        case FieldType::DOUBLE: encode_floating<uint64_t>(field, key); break;
+        case FieldType::STRING:
+        case FieldType::BLOB: std::memcpy(key, field, column.width()); break;
+    }
+}
+
+BulkLoader::BulkLoader(std::vector<LoadColumn> columns, const BulkLoadOptions& options)
+    : columns_(std::move(columns)), options_(options) {
+    if (columns_.empty()) {
+        throw DatabaseException(ErrorCode::INVALID_SCHEMA, "A bulk load needs at least one column");
+    }
+    for (const LoadColumn& column : columns_) {
+        if (column.type == FieldType::BLOB || column.width() == 0) {
+            throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Column " + column.name + " cannot be loaded from text");
+        }
+        offsets_.push_back(record_length_);
+        record_length_ += column.width();
+    }
+    if (options_.key_column >= static_cast<int>(columns_.size())) {
+        throw DatabaseException(ErrorCode::INVALID_SCHEMA, "Key column " + std::to_string(options_.key_column) + " does not exist");
+    }
+    if (options_.threads == 0) {
+        options_.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    options_.chunk_size = std::max<size_t>(options_.chunk_size, 4096);
+}
+
+BulkLoadResult BulkLoader::load(const std::string& input_path, DataFile& file, BTreeFile* index) {
+    if (file.record_length() != record_length_) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Record length " + std::to_string(file.record_length()) +
+                                " does not match the columns (" + std::to_string(record_length_) + ")");
+    }
+    if (index != nullptr) {
+        if (options_.key_column < 0) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Building an index needs a key column");
+        }
+        if (static_cast<uint32_t>(index->key_length()) != columns_[options_.key_column].width()) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Index key length does not match column " + columns_[options_.key_column].name);
+        }
+    }
+
+    PosixFile input;
+    if (!input.open(input_path, O_RDONLY)) {
+        throw DatabaseException(ErrorCode::FILE_NOT_FOUND, "Cannot open " + input_path);
+    }
+
+    BulkLoadResult result;
+    BulkLoadOptions options = options_;
+    if (index == nullptr) {
+        options.key_column = -1;  // no keys to collect
+    }
+    ChunkParser parser(columns_, offsets_, options, record_length_);
+    std::deque<std::future<ParsedChunk>> pending;
+    std::optional<BTreeBuilder> builder;
+    if (index != nullptr) {
+        builder.emplace(*index, options_.index_build);
+    }
+    uint64_t lines_before = 0;
+
+    // Append a parsed chunk, in input order
+    auto write = [&](ParsedChunk chunk) {
+        if (chunk.error_line != 0) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, input_path + " line " +
+                                    std::to_string(lines_before + chunk.error_line) + ": " + chunk.error);
+        }
+        if (chunk.count != 0) {
+            RPTR first = file.append_records(chunk.records.data(), chunk.count);
+            if (result.records == 0) {
+                result.first_record = first;
+            }
+            result.records += chunk.count;
+            if (builder) {
+                const size_t key_length = columns_[options_.key_column].width();
+                for (size_t i = 0; i < chunk.count; ++i) {
+                    builder->add(reinterpret_cast<const char*>(chunk.keys.data()) + i * key_length, first + i);
+                }
+            }
+        }
+        lines_before += chunk.lines;
+    };
+
+    // Cut the input into chunks that end at a line end, keeping the rest for the next one
+    std::string carry;
+    uint64_t offset = 0;
+    bool first_chunk = true;
+    bool at_end = false;
+    while (!at_end) {
+        std::string text = std::move(carry);
+        carry.clear();
+        size_t cut = std::string::npos;
+        while (cut == std::string::npos && !at_end) {
+            size_t have = text.size();
+            text.resize(have + options_.chunk_size);
+            size_t got = input.read_at(text.data() + have, options_.chunk_size, offset);
+            text.resize(have + got);
+            offset += got;
+            at_end = got == 0;
+            size_t newline = text.rfind('\n');
+            if (newline != std::string::npos) {
+                cut = newline + 1;
+            }
+        }
+        if (cut != std::string::npos && cut < text.size()) {
+            carry.assign(text, cut, std::string::npos);
+            text.resize(cut);
+        }
+        if (text.empty()) {
+            continue;
+        }
+
+        bool skip_header = first_chunk && options_.format == LoadFormat::CSV && options_.header_row;
+        first_chunk = false;
+        pending.push_back(std::async(std::launch::async, [&parser, skip_header, text = std::move(text)] {
+            return parser.parse(text, skip_header);
+        }));
+        while (pending.size() >= 2 * options_.threads) {
+            ParsedChunk chunk = pending.front().get();
+            pending.pop_front();
+            write(std::move(chunk));
+        }
+    }
+    while (!pending.empty()) {
+        ParsedChunk chunk = pending.front().get();
+        pending.pop_front();
+        write(std::move(chunk));
+    }
+    result.bytes_read = offset;
+
+    if (builder) {
+        builder->finish();
+    }
+    return result;
+}
+
+} // namespace pentaledger
@@ -0,0 +1,358 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/compressed_file.hpp"
+#include "../../include/pentaledger/lz_codec.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <unistd.h>
+
+namespace pentaledger {
+
+namespace {
+
+//! Extents are reserved in multiples of this, leaving a page room to grow in place
+constexpr uint64_t EXTENT_ALIGN = 512;
+constexpr uint32_t MAX_PAGE_SIZE = 64 * 1024 * 1024;
+
+uint64_t round_up(uint64_t n, uint64_t to) {
+    return (n + to - 1) / to * to;
+}
+
+void read_fully(int fd, void* buffer, size_t length, uint64_t offset) {
+    auto* p = static_cast<uint8_t*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, p + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Failed to read compressed file at offset " + std::to_string(offset) + ": " + std::strerror(errno));
+        }
+        if (n == 0) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Compressed file is truncated at offset " + std::to_string(offset + done));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void write_fully(int fd, const void* buffer, size_t length, uint64_t offset) {
+    const auto* p = static_cast<const uint8_t*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, p + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write compressed file at offset " + std::to_string(offset) + ": " + std::strerror(errno));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+CompressedFile::CompressedFile(CompressedFile&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1)),
+      header_(other.header_),
+      table_(std::move(other.table_)),
+      table_dirty_(other.table_dirty_),
+      header_dirty_(other.header_dirty_),
+      frames_(std::move(other.frames_)),
+      cached_(std::move(other.cached_)),
+      cache_pages_(other.cache_pages_),
+      clock_(other.clock_),
+      scratch_(std::move(other.scratch_)) {}
+
+CompressedFile& CompressedFile::operator=(CompressedFile&& other) noexcept {
+    if (this != &other) {
+        fd_ = std::exchange(other.fd_, -1);
+        header_ = other.header_;
+        table_ = std::move(other.table_);
+        table_dirty_ = other.table_dirty_;
+        header_dirty_ = other.header_dirty_;
+        frames_ = std::move(other.frames_);
+        cached_ = std::move(other.cached_);
+        cache_pages_ = other.cache_pages_;
+        clock_ = other.clock_;
+        scratch_ = std::move(other.scratch_);
+    }
+    return *this;
+}
+
+void CompressedFile::create(int fd, uint32_t page_size, uint32_t cache_pages) {
+    if (page_size < PAGE_SIZE || page_size > MAX_PAGE_SIZE) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Compressed page size must be between " + std::to_string(PAGE_SIZE) +
+                                " and " + std::to_string(MAX_PAGE_SIZE) + " bytes");
+    }
+
+    header_ = {};
+    header_.magic_number = PLCZ_MAGIC;
+    header_.version = PLCZ_VERSION;
+    header_.page_size = page_size;
+    header_.allocated_end = PAGE_SIZE;
+    table_.clear();
+
+    attach(fd, cache_pages);
+    write_header();
+}
+
+void CompressedFile::open(int fd, uint32_t cache_pages) {
+    read_fully(fd, &header_, sizeof(header_), 0);
+    if (header_.magic_number != PLCZ_MAGIC) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid magic number - not a PentaLedger compressed file");
+    }
+    if (header_.version != PLCZ_VERSION) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Unsupported compressed file version " + std::to_string(header_.version));
+    }
+    if (header_.checksum != compressed_header_checksum(header_)) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Compressed file header checksum mismatch");
+    }
+    if (header_.page_size < PAGE_SIZE || header_.page_size > MAX_PAGE_SIZE ||
+        static_cast<uint64_t>(header_.page_count) * sizeof(CompressedPageEntry) > header_.table_capacity ||
+        header_.table_offset + header_.table_capacity > header_.allocated_end) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Inconsistent compressed file header");
+    }
+
+    table_.resize(header_.page_count);
+    if (!table_.empty()) {
+        read_fully(fd, table_.data(), table_.size() * sizeof(CompressedPageEntry), header_.table_offset);
+    }
+    if (crc32c(table_.data(), table_.size() * sizeof(CompressedPageEntry)) != header_.table_checksum) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Compressed page table checksum mismatch");
+    }
+    for (const CompressedPageEntry& entry : table_) {
+        if (entry.length > entry.capacity || entry.length > header_.page_size || entry.offset + entry.capacity > header_.allocated_end) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Compressed page table entry out of range");
+        }
+    }
+
+    attach(fd, cache_pages);
+}
+
+void CompressedFile::attach(int fd, uint32_t cache_pages) {
+    fd_ = fd;
+    cache_pages_ = std::max<uint32_t>(cache_pages, 1);
+    table_dirty_ = false;
+    header_dirty_ = false;
+    frames_.clear();
+    cached_.clear();
+    scratch_.resize(lz_compress_bound(header_.page_size));
+}
+
+bool CompressedFile::is_compressed(int fd) {
+    uint32_t magic = 0;
+    return ::pread(fd, &magic, sizeof(magic), 0) == static_cast<ssize_t>(sizeof(magic)) && magic == PLCZ_MAGIC;
+}
+
+size_t CompressedFile::read_at(void* buffer, size_t length, uint64_t offset) {
+    if (offset >= header_.logical_size) {
+        return 0;
+    }
+    length = static_cast<size_t>(std::min<uint64_t>(length, header_.logical_size - offset));
+
+    auto* out = static_cast<uint8_t*>(buffer);
+    for (size_t done = 0; done < length; ) {
+        uint64_t page = (offset + done) / header_.page_size;
+        size_t within = static_cast<size_t>((offset + done) % header_.page_size);
+        size_t n = std::min<size_t>(header_.page_size - within, length - done);
+        std::memcpy(out + done, fetch(page, false).data.get() + within, n);
+        done += n;
+    }
+    return length;
+}
+
+void CompressedFile::read_exact(void* buffer, size_t length, uint64_t offset) {
+    if (read_at(buffer, length, offset) != length) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Read of " + std::to_string(length) + " bytes at offset " + std::to_string(offset) + " is past end of file");
+    }
+}
+
+void CompressedFile::write_exact(const void* buffer, size_t length, uint64_t offset) {
+    const auto* in = static_cast<const uint8_t*>(buffer);
+    for (size_t done = 0; done < length; ) {
+        uint64_t page = (offset + done) / header_.page_size;
+        size_t within = static_cast<size_t>((offset + done) % header_.page_size);
+        size_t n = std::min<size_t>(header_.page_size - within, length - done);
+
+        Frame& frame = fetch(page, n == header_.page_size);
+        std::memcpy(frame.data.get() + within, in + done, n);
+        frame.dirty = true;
+        done += n;
+    }
+    header_.logical_size = std::max(header_.logical_size, offset + length);
+    header_dirty_ = true;
+}
+
+CompressedFile::Frame& CompressedFile::fetch(uint64_t page, bool overwrite) {
+    auto it = cached_.find(page);
+    if (it != cached_.end()) {
+        Frame& frame = frames_[it->second];
+        frame.last_use = ++clock_;
+        return frame;
+    }
+
+    size_t index;
+    if (frames_.size() < cache_pages_) {
+        frames_.emplace_back();
+        frames_.back().data = std::make_unique<uint8_t[]>(header_.page_size);
+        index = frames_.size() - 1;
+    } else {
+        index = static_cast<size_t>(std::min_element(frames_.begin(), frames_.end(), [](const Frame& a, const Frame& b) {
+            return a.last_use < b.last_use;
+        }) - frames_.begin());
+        Frame& victim = frames_[index];
+        if (victim.dirty) {
+            store(victim.page, victim.data.get());
+            victim.dirty = false;
+        }
+        // A frame whose load failed is not in the map
+        auto owner = cached_.find(victim.page);
+        if (owner != cached_.end() && owner->second == index) {
+            cached_.erase(owner);
+        }
+    }
+
+    Frame& frame = frames_[index];
+    frame.page = page;
+    frame.last_use = ++clock_;
+    if (!overwrite) {
+        load(page, frame.data.get());
+    }
+    cached_[page] = index;
+    return frame;
+}
+
+void CompressedFile::load(uint64_t page, uint8_t* data) {
+    if (page >= table_.size() || table_[page].length == 0) {
+        std::memset(data, 0, header_.page_size);
+        return;
+    }
+
+    const CompressedPageEntry& entry = table_[page];
+    PENTALEDGER_METRIC_SCOPE(Metric::PAGE_DECOMPRESS, entry.length);
+
+    // Extents are verified before they are decompressed; that costs a fraction of the
+    // decompression itself
+    uint8_t* stored = entry.length == header_.page_size ? data : scratch_.data();
+    read_fully(fd_, stored, entry.length, entry.offset);
+    if (crc32c(stored, entry.length) != entry.checksum) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Checksum mismatch in compressed page " + std::to_string(page));
+    }
+    if (stored == data) {
+        return;
+    }
+    if (lz_decompress(scratch_.data(), entry.length, data, header_.page_size) != header_.page_size) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Compressed page " + std::to_string(page) + " has the wrong size");
+    }
+}
+
+void CompressedFile::store(uint64_t page, const uint8_t* data) {
+    PENTALEDGER_METRIC_SCOPE(Metric::PAGE_COMPRESS, header_.page_size);
+
+    // A page that does not shrink is stored as it is
+    const uint8_t* bytes = scratch_.data();
+    size_t length = lz_compress(data, header_.page_size, scratch_.data(), header_.page_size - 1);
+    if (length == 0) {
+        bytes = data;
+        length = header_.page_size;
+    }
+
+    if (page >= table_.size()) {
+        table_.resize(page + 1, CompressedPageEntry{});
+    }
+    CompressedPageEntry& entry = table_[page];
+    if (length > entry.capacity) {
+        entry.capacity = static_cast<uint32_t>(round_up(length, EXTENT_ALIGN));
+        entry.offset = allocate(entry.capacity);
+    }
+    write_fully(fd_, bytes, length, entry.offset);
+    entry.length = static_cast<uint32_t>(length);
+    entry.checksum = crc32c(bytes, length);
+    table_dirty_ = true;
+}
+
+uint64_t CompressedFile::allocate(uint64_t bytes) {
+    uint64_t offset = header_.allocated_end;
+    header_.allocated_end += bytes;
+    return offset;
+}
+
+void CompressedFile::flush() {
+    if (fd_ < 0) {
+        return;
+    }
+
+    for (Frame& frame : frames_) {
+        if (frame.dirty) {
+            store(frame.page, frame.data.get());
+            frame.dirty = false;
+        }
+    }
+
+    if (!table_dirty_ && !header_dirty_) {
+        return;
+    }
+
+    // The header goes last, so that it only ever points at a complete table
+    if (table_dirty_) {
+        uint64_t bytes = table_.size() * sizeof(CompressedPageEntry);
+        if (bytes > header_.table_capacity) {
+            header_.table_capacity = round_up(bytes * 2, EXTENT_ALIGN);
+            header_.table_offset = allocate(header_.table_capacity);
+        }
+        write_fully(fd_, table_.data(), bytes, header_.table_offset);
+        header_.page_count = static_cast<uint32_t>(table_.size());
+        header_.table_checksum = crc32c(table_.data(), bytes);
+        table_dirty_ = false;
+    }
+    write_header();
+    header_dirty_ = false;
+}
+
+void CompressedFile::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    flush();
+    fd_ = -1;
+    frames_.clear();
+    cached_.clear();
+    table_.clear();
+}
+
+void CompressedFile::write_header() {
+    header_.checksum = compressed_header_checksum(header_);
+    write_fully(fd_, &header_, sizeof(header_), 0);
+}
+
+uint32_t compressed_header_checksum(const CompressedFileHeader& header) {
+    return crc32c_excluding(&header, sizeof(header), offsetof(CompressedFileHeader, checksum));
+}
+
+} // namespace pentaledger
@@ -0,0 +1,195 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "../../include/pentaledger/crc32c.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define PENTALEDGER_CRC32C_SSE42 1
+#else
+#define PENTALEDGER_CRC32C_SSE42 0
+#endif
+
+namespace pentaledger {
+
+namespace {
+
+// Reflected Castagnoli polynomial
+constexpr uint32_t POLY = 0x82F63B78;
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+// TABLES[0] is the classic byte-at-a-time table; TABLES[k] advances a byte through k
+// further zero bytes, so that eight input bytes can be folded in with eight lookups
+constexpr Tables make_tables() {
+    Tables tables{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t k = 1; k < 8; ++k) {
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+        }
+    }
+    return tables;
+}
+
+constexpr Tables TABLES = make_tables();
+
+uint32_t crc32c_slice8(const uint8_t* p, size_t length, uint32_t crc) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = TABLES[7][word & 0xFF] ^ TABLES[6][(word >> 8) & 0xFF] ^
+              TABLES[5][(word >> 16) & 0xFF] ^ TABLES[4][(word >> 24) & 0xFF] ^
+              TABLES[3][(word >> 32) & 0xFF] ^ TABLES[2][(word >> 40) & 0xFF] ^
+              TABLES[1][(word >> 48) & 0xFF] ^ TABLES[0][word >> 56];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = TABLES[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if PENTALEDGER_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(const uint8_t* p, size_t length, uint32_t crc) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    while (length >= 4) {
+        uint32_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        length -= 4;
+    }
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+// Four independent checksums advanced in lockstep; each crc32 has a latency of several
+// cycles but the CPU can start one per cycle
+__attribute__((target("sse4.2")))
+void crc32c_sse42_x4(const uint8_t* p, size_t length, size_t stride, uint32_t* crcs) {
+    const uint8_t* p0 = p;
+    const uint8_t* p1 = p + stride;
+    const uint8_t* p2 = p + 2 * stride;
+    const uint8_t* p3 = p + 3 * stride;
+    size_t done = 0;
+#if defined(__x86_64__)
+    uint64_t c0 = 0xFFFFFFFF, c1 = 0xFFFFFFFF, c2 = 0xFFFFFFFF, c3 = 0xFFFFFFFF;
+    for (; done + 8 <= length; done += 8) {
+        uint64_t w0, w1, w2, w3;
+        std::memcpy(&w0, p0 + done, 8);
+        std::memcpy(&w1, p1 + done, 8);
+        std::memcpy(&w2, p2 + done, 8);
+        std::memcpy(&w3, p3 + done, 8);
+        c0 = _mm_crc32_u64(c0, w0);
+        c1 = _mm_crc32_u64(c1, w1);
+        c2 = _mm_crc32_u64(c2, w2);
+        c3 = _mm_crc32_u64(c3, w3);
+    }
+    crcs[0] = static_cast<uint32_t>(c0);
+    crcs[1] = static_cast<uint32_t>(c1);
+    crcs[2] = static_cast<uint32_t>(c2);
+    crcs[3] = static_cast<uint32_t>(c3);
+#else
+    crcs[0] = crcs[1] = crcs[2] = crcs[3] = 0xFFFFFFFF;
+#endif
+    crcs[0] = ~crc32c_sse42(p0 + done, length - done, crcs[0]);
+    crcs[1] = ~crc32c_sse42(p1 + done, length - done, crcs[1]);
+    crcs[2] = ~crc32c_sse42(p2 + done, length - done, crcs[2]);
+    crcs[3] = ~crc32c_sse42(p3 + done, length - done, crcs[3]);
+}
+#endif
+
+using Implementation = uint32_t (*)(const uint8_t*, size_t, uint32_t);
+
+Implementation select() {
+#if PENTALEDGER_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_slice8;
+}
+
+// A local static, so that it is ready even for callers in other static initializers
+Implementation implementation() {
+    static const Implementation selected = select();
+    return selected;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+    return ~implementation()(static_cast<const uint8_t*>(data), length, ~crc);
+}
+
+void crc32c_many(const void* data, size_t length, size_t stride, size_t count, uint32_t* crcs) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    size_t i = 0;
+#if PENTALEDGER_CRC32C_SSE42
+    if (crc32c_hardware()) {
+        for (; i + 4 <= count; i += 4) {
+            crc32c_sse42_x4(p + i * stride, length, stride, crcs + i);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        crcs[i] = crc32c(p + i * stride, length);
+    }
+}
+
+uint32_t crc32c_portable(const void* data, size_t length, uint32_t crc) {
+    return ~crc32c_slice8(static_cast<const uint8_t*>(data), length, ~crc);
+}
+
+bool crc32c_hardware() {
+    return implementation() != crc32c_slice8;
+}
+
+uint32_t crc32c_excluding(const void* data, size_t length, size_t field_offset) {
+    static constexpr uint8_t zeros[sizeof(uint32_t)] = {};
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = crc32c(p, field_offset);
+    crc = crc32c(zeros, sizeof(zeros), crc);
+    return crc32c(p + field_offset + sizeof(zeros), length - field_offset - sizeof(zeros), crc);
+}
+
+} // namespace pentaledger
@@ -19,24 +19,69 @@
 
 #include "../../include/pentaledger/data_file.hpp"
 #include "../../include/pentaledger/types.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include <atomic>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
 #include <ctime>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <climits>
+#include <cstddef>
+#include <fcntl.h>
 
 namespace pentaledger {
 
-DataFile DataFile::create(const std::string& path, uint32_t record_length) {
+namespace {
+
+#ifdef IOV_MAX
+constexpr size_t MAX_IOV = IOV_MAX;
+#else
+constexpr size_t MAX_IOV = 1024;
+#endif
+
+// Registers one write of a versioned file with its VersionStore for as long as it lives,
+// so that the write is ended however it leaves
+class VersionedWrite {
+public:
+    explicit VersionedWrite(VersionStore* store) : store_(store) {
+        if (store_ != nullptr) {
+            sequence_ = store_->begin_write(keep_);
+        }
+    }
+    ~VersionedWrite() {
+        if (store_ != nullptr) {
+            store_->end_write(sequence_);
+        }
+    }
+    VersionedWrite(const VersionedWrite&) = delete;
+    VersionedWrite& operator=(const VersionedWrite&) = delete;
+
+    //! Whether the write has to keep what it overwrites
+    bool keep() const { return keep_; }
+    uint64_t sequence() const { return sequence_; }
+
+private:
+    VersionStore* store_;
+    uint64_t sequence_ = 0;
+    bool keep_ = false;
+};
+
+} // namespace
+
+DataFile DataFile::create(const std::string& path, uint32_t record_length, const DataFileOptions& options) {
     DataFile df;
-    df.initialize(path, record_length);
+    df.initialize(path, record_length, options);
     return df;
 }
 
-DataFile DataFile::open(const std::string& path) {
+DataFile DataFile::open(const std::string& path, const DataFileOptions& options) {
     DataFile df;
-    df.load(path);
+    df.load(path, options);
     return df;
 }
 
@@ -44,24 +89,27 @@ DataFile::~DataFile() {
     close();
 }
 
-void DataFile::initialize(const std::string& path, uint32_t record_length) {
+void DataFile::initialize(const std::string& path, uint32_t record_length, const DataFileOptions& options) {
     file_path_ = path;
     
-    // Create new file
-    file_.open(path, std::ios::out | std::ios::binary);
-    if (!file_.is_open()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to create data file: " + path);
+    // A deleted record holds the free-list link, so it must fit one
+    if (record_length < sizeof(RPTR)) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Record length must be at least " + std::to_string(sizeof(RPTR)) + " bytes");
     }
-    file_.close();
     
-    // Open for read/write
-    file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file_.is_open()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to open created data file: " + path);
+    // Create new file, discarding any existing contents
+    if (!file_.open(path, O_RDWR | O_CREAT | O_TRUNC)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to create data file: " + path);
+    }
+    file_end_ = 0;
+    allocated_end_ = 0;
+    if (options.compressed) {
+        compressed_.create(file_.fd(), options.compressed_page_size, options.compressed_cache_pages);
     }
     
     // Initialize header
     uint64_t current_time = static_cast<uint64_t>(std::time(nullptr));
+    header_ = {};
     header_.magic_number = PLDB_MAGIC;
     header_.version = PLDB_VERSION;
     header_.creation_time = current_time;
@@ -69,20 +117,107 @@ void DataFile::initialize(const std::string& path, uint32_t record_length) {
     header_.first_record = 0;
     header_.next_record = 1; // Start records after header
     header_.record_length = record_length;
+    header_.flags = (options.record_checksums ? PLDB_RECORD_CHECKSUMS : 0) | (options.direct_io ? PLDB_BLOCK_ALIGNED : 0);
+    header_size_ = PLDB_V3_HEADER_SIZE;
+    compute_layout();
+    
+    attach(options);
+    if (options_.wal != nullptr) {
+        // Older records for this path belong to a previous file
+        last_lsn_ = options_.wal->append_truncate(wal_key_, 0);
+    }
     
-    write_header();
+    // Both copies start out valid
+    for (uint32_t copy = 0; copy < PLDB_HEADER_COPIES; ++copy) {
+        header_dirty_ = true;
+        write_header();
+    }
 }
 
-void DataFile::load(const std::string& path) {
+void DataFile::load(const std::string& path, const DataFileOptions& options) {
     file_path_ = path;
     
     // Open existing file
-    file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file_.is_open()) {
+    if (!file_.open(path, O_RDWR)) {
         throw DatabaseException(ErrorCode::FILE_NOT_FOUND, "Data file not found: " + path);
     }
     
-    read_header();
+    try {
+        // A compressed file says so itself; options.compressed only matters at creation.  Its
+        // pages are rewritten in place, which a log replay by offset would corrupt.
+        if (CompressedFile::is_compressed(file_.fd())) {
+            if (options.wal != nullptr) {
+                throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A compressed data file cannot be used with a write-ahead log");
+            }
+            compressed_.open(file_.fd(), options.compressed_cache_pages);
+        }
+        
+        if (options.wal != nullptr) {
+            wal_key_ = WriteAheadLog::file_key(path);
+            options_.wal = options.wal;
+            recover();
+        }
+        file_end_ = compressed_.is_open() ? compressed_.size() : file_.size();
+        
+        read_header();
+        if (!compressed_.is_open()) {
+            // Space allocated ahead of the records (growth_extent) holds nothing yet
+            allocated_end_ = file_end_;
+            file_end_ = std::min<uint64_t>(file_end_, locate_offset(header_.next_record));
+        }
+        attach(options);
+    } catch (...) {
+        // Close without writing the header back, which would overwrite (and, with a
+        // checksum, seemingly repair) whatever made the file fail to open
+        compressed_ = CompressedFile();
+        file_.close();
+        throw;
+    }
+}
+
+void DataFile::recover() {
+    options_.wal->replay(wal_key_,
+        [this](uint64_t offset, const uint8_t* data, uint32_t length) {
+            file_.write_exact(data, length, offset);
+        },
+        [this](uint64_t length) {
+            file_.truncate(length);
+        });
+    file_.sync_data();
+}
+
+void DataFile::attach(const DataFileOptions& options) {
+    if (options.memory_mapped && options.buffer_pool != nullptr) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A data file cannot be both memory mapped and buffer pooled");
+    }
+    if (compressed_.is_open() && (options.memory_mapped || options.buffer_pool != nullptr || options.wal != nullptr)) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A compressed data file cannot be memory mapped, buffer pooled or logged");
+    }
+    if (options.concurrent && (options.memory_mapped || compressed_.is_open())) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A concurrent data file cannot be memory mapped or compressed");
+    }
+    if (options.direct_io && (options.memory_mapped || compressed_.is_open())) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A direct I/O data file cannot be memory mapped or compressed");
+    }
+    
+    options_ = options;
+    if (options_.direct_io && options_.buffer_pool == nullptr) {
+        options_.buffer_pool = &BufferPool::shared();
+    }
+    if (options_.versioned) {
+        versions_ = std::make_unique<VersionStore>();
+    }
+    if (options_.wal != nullptr) {
+        wal_key_ = WriteAheadLog::file_key(file_path_);
+    }
+    if (options_.memory_mapped) {
+        ensure_mapped(std::max<uint64_t>(file_end_, header_size_));
+    } else if (options_.buffer_pool != nullptr) {
+        if (options_.direct_io) {
+            file_.set_direct(true);
+        }
+        pool_file_ = options_.buffer_pool->register_file(file_.fd(), options_.direct_io);
+    }
 }
 
 void DataFile::read_header() {
@@ -90,8 +225,12 @@ void DataFile::read_header() {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
     
-    file_.seekg(0, std::ios::beg);
-    if (!file_.read(reinterpret_cast<char*>(&header_), HEADER_SIZE)) {
+    // Older headers are shorter and single; whatever follows them belongs to the first record
+    DataFileHeader copies[PLDB_HEADER_COPIES] = {};
+    size_t got = compressed_.is_open() ? compressed_.read_at(copies, sizeof(copies), 0) : file_.read_at(copies, sizeof(copies), 0);
+    int current = current_data_file_header(copies, got);
+    header_ = copies[std::max(current, 0)];
+    if (got < PLDB_V1_HEADER_SIZE) {
         throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Failed to read data file header");
     }
     
@@ -100,91 +239,579 @@ void DataFile::read_header() {
         throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid magic number - not a PentaLedger data file");
     }
     
-    // Validate version (warn if version mismatch, but allow reading)
-    if (header_.version != PLDB_VERSION) {
-        // Could throw an exception here if strict version checking is desired
-        // For now, we'll allow reading but the version mismatch should be noted
+    if (header_.version < 2) {
+        header_.flags = 0;
+        header_.checksum = 0;
+        header_.sequence = 0;
+        header_size_ = PLDB_V1_HEADER_SIZE;
+    } else {
+        if (header_.version >= 3 ? current < 0 : (got < sizeof(header_) || header_.checksum != data_file_header_checksum(header_))) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Data file header checksum mismatch: " + file_path_);
+        }
+        if ((header_.flags & ~(PLDB_RECORD_CHECKSUMS | PLDB_BLOCK_ALIGNED)) != 0 ||
+            (header_.version < 3 && (header_.flags & PLDB_BLOCK_ALIGNED) != 0)) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Unsupported data file flags: " + std::to_string(header_.flags));
+        }
+        header_size_ = header_.version >= 3 ? PLDB_V3_HEADER_SIZE : sizeof(header_);
+    }
+    
+    // A deleted record holds the free-list link, so it must fit one
+    if (header_.record_length < sizeof(RPTR)) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid record length " + std::to_string(header_.record_length) + " in data file header: " + file_path_);
+    }
+    header_dirty_ = false;
+    compute_layout();
+}
+
+void DataFile::compute_layout() {
+    // The block-aligned layout also widens the header area to a block
+    slot_length_ = header_.record_length + (has_record_checksums() ? sizeof(uint32_t) : 0);
+    if ((header_.flags & PLDB_BLOCK_ALIGNED) == 0) {
+        records_per_block_ = 0;
+        block_stride_ = 0;
+        return;
+    }
+    
+    header_size_ = PLDB_BLOCK_SIZE;
+    records_per_block_ = std::max<uint32_t>(PLDB_BLOCK_SIZE / slot_length_, 1);
+    block_stride_ = (records_per_block_ * slot_length_ + PLDB_BLOCK_SIZE - 1) / PLDB_BLOCK_SIZE * PLDB_BLOCK_SIZE;
+}
+
+RPTR DataFile::slots_before(uint64_t offset) const {
+    if (offset <= header_size_) {
+        return 0;
+    }
+    uint64_t bytes = offset - header_size_;
+    if (records_per_block_ == 0) {
+        return static_cast<RPTR>(bytes / slot_length_);
     }
+    uint64_t in_block = std::min<uint64_t>((bytes % block_stride_) / slot_length_, records_per_block_);
+    return static_cast<RPTR>(bytes / block_stride_ * records_per_block_ + in_block);
 }
 
 void DataFile::write_header() {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
-    
-    // Check if file stream is in a bad state
-    if (file_.bad() || file_.fail()) {
-        file_.clear(); // Clear error flags
+    if (!header_dirty_) {
+        return;
     }
     
     // Update timestamp whenever header is written
     header_.last_update_time = static_cast<uint64_t>(std::time(nullptr));
-    
-    // Seek to beginning of file
-    file_.seekp(0, std::ios::beg);
-    if (file_.fail()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to seek to beginning of file for header write");
+    uint64_t offset = 0;
+    uint32_t length = header_size_;
+    if (header_.version >= 3) {
+        ++header_.sequence;
+        offset = (header_.sequence % PLDB_HEADER_COPIES) * sizeof(DataFileHeader);
+        length = sizeof(DataFileHeader);
     }
-    
-    // Write the header
-    file_.write(reinterpret_cast<const char*>(&header_), HEADER_SIZE);
-    if (file_.fail() || file_.bad()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write data file header");
+    if (header_.version >= 2) {
+        header_.checksum = data_file_header_checksum(header_);
     }
+    PENTALEDGER_METRIC_SCOPE(Metric::HEADER_WRITE, length);
     
-    file_.flush();
-    if (file_.fail() || file_.bad()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to flush data file header");
+    write_at(offset, &header_, length);
+    header_dirty_ = false;
+}
+
+RPTR DataFile::load_next_record() const {
+    return std::atomic_ref<RPTR>(const_cast<RPTR&>(header_.next_record)).load(std::memory_order_acquire);
+}
+
+void DataFile::store_next_record(RPTR next_record) {
+    reserve(locate_offset(next_record));
+    std::atomic_ref<RPTR>(header_.next_record).store(next_record, std::memory_order_release);
+    header_dirty_ = true;
+}
+
+void DataFile::reserve(uint64_t end) {
+    if (options_.growth_extent == 0 || end <= allocated_end_ || map_.is_mapped() || compressed_.is_open()) {
+        return;
+    }
+    uint64_t target = (end + options_.growth_extent - 1) / options_.growth_extent * options_.growth_extent;
+    file_.allocate(allocated_end_, target - allocated_end_);
+    allocated_end_ = target;
+    if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->reserve(pool_file_, target);
+    }
+}
+
+uint64_t DataFile::load_file_end() const {
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(file_end_)).load(std::memory_order_acquire);
+}
+
+void DataFile::extend_file_end(uint64_t end) {
+    std::atomic_ref<uint64_t> file_end(file_end_);
+    uint64_t current = file_end.load(std::memory_order_relaxed);
+    while (current < end && !file_end.compare_exchange_weak(current, end, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void DataFile::note_lsn(WriteAheadLog::Lsn lsn) {
+    std::atomic_ref<WriteAheadLog::Lsn> last(last_lsn_);
+    WriteAheadLog::Lsn current = last.load(std::memory_order_relaxed);
+    while (current < lsn && !last.compare_exchange_weak(current, lsn, std::memory_order_release, std::memory_order_relaxed)) {
     }
 }
 
 size_t DataFile::locate_offset(RPTR record_number) const {
-    size_t offset = HEADER_SIZE + ((record_number - 1) * header_.record_length);
+    if (records_per_block_ != 0) {
+        RPTR index = record_number - 1;
+        return header_size_ + index / records_per_block_ * block_stride_ + index % records_per_block_ * slot_length_;
+    }
+    size_t offset = header_size_ + ((record_number - 1) * slot_length_);
    
     return offset;
 }
 
+void DataFile::read_at(uint64_t offset, void* buffer, size_t length) const {
+    if (offset + length > load_file_end()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Read of " + std::to_string(length) + " bytes at offset " + std::to_string(offset) + " is past end of file");
+    }
+    
+    if (map_.is_mapped()) {
+        std::memcpy(buffer, map_.data() + offset, length);
+    } else if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->read(pool_file_, offset, buffer, length);
+    } else if (compressed_.is_open()) {
+        compressed_.read_exact(buffer, length, offset);
+    } else {
+        file_.read_exact(buffer, length, offset);
+    }
+}
+
+void DataFile::write_at(uint64_t offset, const void* buffer, size_t length) {
+    uint64_t end = offset + length;
+    
+    if (options_.wal != nullptr) {
+        note_lsn(options_.wal->append_write(wal_key_, offset, buffer, static_cast<uint32_t>(length)));
+    }
+    
+    if (map_.is_mapped()) {
+        ensure_mapped(end);
+        std::memcpy(map_.data() + offset, buffer, length);
+    } else if (options_.buffer_pool != nullptr) {
+        options_.buffer_pool->write(pool_file_, offset, buffer, length);
+    } else if (compressed_.is_open()) {
+        compressed_.write_exact(buffer, length, offset);
+    } else {
+        file_.write_exact(buffer, length, offset);
+    }
+    
+    extend_file_end(end);
+}
+
+void DataFile::ensure_mapped(uint64_t end) {
+    if (map_.is_mapped() && end <= map_.size()) {
+        return;
+    }
+    
+    // Grow geometrically so appends do not remap on every record.  The file itself has
+    // to be at least as long as the mapping, otherwise touching the tail raises SIGBUS;
+    // it is trimmed back to file_end_ on close().
+    size_t capacity = std::max<size_t>({end, map_.size() * 2, MAP_GROWTH});
+    capacity = (capacity + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    
+    if (options_.growth_extent != 0) {
+        capacity = (capacity + options_.growth_extent - 1) / options_.growth_extent * options_.growth_extent;
+        file_.allocate(map_.size(), capacity - map_.size());
+    } else {
+        file_.truncate(capacity);
+    }
+    allocated_end_ = capacity;
+    map_.remap(file_.fd(), capacity);
+}
+
+bool DataFile::descriptor_io() const {
+    return !map_.is_mapped() && options_.buffer_pool == nullptr && !compressed_.is_open();
+}
+
+// Slots up to this size are read through a stack buffer
+constexpr uint32_t SMALL_SLOT = 1024;
+
+void DataFile::read_slot(RPTR record_number, uint8_t* buffer) const {
+    const uint64_t offset = locate_offset(record_number);
+    const uint32_t length = header_.record_length;
+    if (!has_record_checksums()) {
+        read_at(offset, buffer, length);
+        return;
+    }
+    
+    uint32_t stored = 0;
+    if (descriptor_io()) {
+        if (offset + slot_length_ > load_file_end()) {
+            throw DatabaseException(ErrorCode::IO_ERROR, "Record " + std::to_string(record_number) + " is past end of file");
+        }
+        // Record and checksum in one read: a plain pread into the stack for small slots,
+        // which is measurably cheaper than a two-part preadv, and a preadv otherwise
+        if (slot_length_ <= SMALL_SLOT) {
+            uint8_t slot[SMALL_SLOT];
+            file_.read_exact(slot, slot_length_, offset);
+            std::memcpy(buffer, slot, length);
+            std::memcpy(&stored, slot + length, sizeof(stored));
+        } else {
+            struct iovec iov[2] = {{buffer, length}, {&stored, sizeof(stored)}};
+            if (file_.readv_at(iov, 2, offset) != static_cast<ssize_t>(slot_length_)) {
+                throw DatabaseException(ErrorCode::IO_ERROR, "Failed to read record " + std::to_string(record_number));
+            }
+        }
+    } else {
+        read_at(offset, buffer, length);
+        read_at(offset + length, &stored, sizeof(stored));
+    }
+    check_record(record_number, buffer, stored);
+}
+
+void DataFile::check_record(RPTR record_number, const uint8_t* data, uint32_t stored) const {
+    if (options_.verify_checksums && crc32c(data, header_.record_length) != stored) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Checksum mismatch in record " + std::to_string(record_number) + " of " + file_path_);
+    }
+}
+
+void DataFile::write_slot(RPTR record_number, const uint8_t* buffer) {
+    const uint64_t offset = locate_offset(record_number);
+    const uint32_t length = header_.record_length;
+    if (!has_record_checksums()) {
+        write_at(offset, buffer, length);
+        return;
+    }
+    
+    uint32_t crc = crc32c(buffer, length);
+    if (!descriptor_io()) {
+        write_at(offset, buffer, length);
+        write_at(offset + length, &crc, sizeof(crc));
+        return;
+    }
+    
+    // Record and checksum in one pwritev
+    if (options_.wal != nullptr) {
+        options_.wal->append_write(wal_key_, offset, buffer, length);
+        note_lsn(options_.wal->append_write(wal_key_, offset + length, &crc, sizeof(crc)));
+    }
+    struct iovec iov[2] = {{const_cast<uint8_t*>(buffer), length}, {&crc, sizeof(crc)}};
+    if (file_.writev_at(iov, 2, offset) != static_cast<ssize_t>(slot_length_)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write record " + std::to_string(record_number));
+    }
+    extend_file_end(offset + slot_length_);
+}
+
 void DataFile::read_record(RPTR record_number, uint8_t* buffer) {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_READ, header_.record_length);
     
-    if (record_number > header_.next_record) {
+    if (record_number > load_next_record()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
     }
     
-    file_.seekg(locate_offset(record_number), std::ios::beg);
-    if (!file_.read(reinterpret_cast<char*>(buffer), header_.record_length)) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to read record at pointer: " + std::to_string(record_number));
+    try {
+        read_slot(record_number, buffer);
+    } catch (const DatabaseException& e) {
+        // Keep FILE_CORRUPTED from a checksum mismatch; anything else is an I/O failure
+        ErrorCode code = e.code() == ErrorCode::FILE_CORRUPTED ? e.code() : ErrorCode::IO_ERROR;
+        throw DatabaseException(code, "Failed to read record at pointer: " + std::to_string(record_number) + ": " + e.what());
     }
 }
 
+std::span<const uint8_t> DataFile::view_record(RPTR record_number) const {
+    if (!map_.is_mapped()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data file is not memory mapped");
+    }
+    
+    if (record_number == 0 || record_number >= load_next_record()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+    
+    size_t offset = locate_offset(record_number);
+    if (offset + slot_length_ > load_file_end()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Record " + std::to_string(record_number) + " is past end of file");
+    }
+    
+    const uint8_t* data = map_.data() + offset;
+    if (has_record_checksums()) {
+        uint32_t stored;
+        std::memcpy(&stored, data + header_.record_length, sizeof(stored));
+        check_record(record_number, data, stored);
+    }
+    return std::span<const uint8_t>(data, header_.record_length);
+}
+
 void DataFile::write_record(RPTR record_number, const uint8_t* buffer) {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
     
-    if (record_number > header_.next_record) {
+    if (record_number > load_next_record()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+    
+    VersionedWrite version(versions_.get());
+    if (version.keep()) {
+        keep_versions(std::span<const RPTR>(&record_number, 1), version.sequence(), false);
+    }
+    store_record(record_number, buffer);
+}
+
+void DataFile::store_record(RPTR record_number, const uint8_t* buffer) {
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_WRITE, header_.record_length);
+    
+    // Calculate offset and write the record
+    size_t offset = locate_offset(record_number);
+    try {
+        write_slot(record_number, buffer);
+    } catch (const DatabaseException&) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write record at pointer: " + std::to_string(record_number) + " (offset: " + std::to_string(offset) + ")");
+    }
+}
+
+IoAwaitable DataFile::async_read_record(RPTR record_number, uint8_t* buffer, int buffer_index) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (record_number == 0 || record_number >= load_next_record()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
     }
     
-    // Check if file stream is in a bad state
-    if (file_.bad() || file_.fail()) {
-        file_.clear(); // Clear error flags
+    // A checksummed record is verified as it is read, so it is read here too
+    size_t offset = locate_offset(record_number);
+    if (!descriptor_io() || has_record_checksums()) {
+        read_slot(record_number, buffer);
+        return IoAwaitable();
+    }
+    
+    if (offset + header_.record_length > load_file_end()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Record " + std::to_string(record_number) + " is past end of file");
+    }
+    
+    IoRequest request;
+    request.fd = file_.fd();
+    request.buffer = buffer;
+    request.length = header_.record_length;
+    request.offset = offset;
+    request.buffer_index = buffer_index;
+    return IoAwaitable(options_.io_engine != nullptr ? *options_.io_engine : IoEngine::shared(), request);
+}
+
+IoAwaitable DataFile::async_write_record(RPTR record_number, const uint8_t* buffer, int buffer_index) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (record_number == 0 || record_number > load_next_record()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+    
+    // A versioned write has to end only once the record is in the file
+    if (versions_ != nullptr) {
+        write_record(record_number, buffer);
+        return IoAwaitable();
     }
     
-    // Calculate offset and seek to record location
     size_t offset = locate_offset(record_number);
-    file_.seekp(offset, std::ios::beg);
-    if (file_.fail()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to seek to record " + std::to_string(record_number) + " at offset " + std::to_string(offset));
+    if (!descriptor_io() || has_record_checksums()) {
+        write_slot(record_number, buffer);
+        return IoAwaitable();
     }
     
-    // Write the record
-    file_.write(reinterpret_cast<const char*>(buffer), header_.record_length);
-    if (file_.fail() || file_.bad()) {
-        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write record at pointer: " + std::to_string(record_number) + " (offset: " + std::to_string(offset) + ")");
+    if (options_.wal != nullptr) {
+        note_lsn(options_.wal->append_write(wal_key_, offset, buffer, header_.record_length));
     }
+    extend_file_end(offset + header_.record_length);
+    
+    IoRequest request;
+    request.fd = file_.fd();
+    // The engine only reads from the buffer of a write
+    request.buffer = const_cast<uint8_t*>(buffer);
+    request.length = header_.record_length;
+    request.offset = offset;
+    request.write = true;
+    request.buffer_index = buffer_index;
+    return IoAwaitable(options_.io_engine != nullptr ? *options_.io_engine : IoEngine::shared(), request);
+}
+
+size_t DataFile::read_records(std::span<const RPTR> record_numbers, uint8_t* buffer, std::span<ErrorCode> status) {
+    PENTALEDGER_METRIC_SCOPE(Metric::BATCH_READ, record_numbers.size() * header_.record_length);
+    return transfer_records(record_numbers, buffer, status, false);
+}
+
+size_t DataFile::write_records(std::span<const RPTR> record_numbers, const uint8_t* buffer, std::span<ErrorCode> status) {
+    VersionedWrite version(versions_.get());
+    if (version.keep()) {
+        keep_versions(record_numbers, version.sequence(), false);
+    }
+    return store_records(record_numbers, buffer, status);
+}
+
+size_t DataFile::store_records(std::span<const RPTR> record_numbers, const uint8_t* buffer, std::span<ErrorCode> status) {
+    PENTALEDGER_METRIC_SCOPE(Metric::BATCH_WRITE, record_numbers.size() * header_.record_length);
+    // transfer_records only reads from the buffer when writing
+    return transfer_records(record_numbers, const_cast<uint8_t*>(buffer), status, true);
+}
+
+size_t DataFile::transfer_records(std::span<const RPTR> record_numbers, uint8_t* buffer, std::span<ErrorCode> status, bool write) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (status.size() != record_numbers.size()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Batch status does not match the number of records");
+    }
+    
+    const size_t length = header_.record_length;
+    size_t done = 0;
+    
+    // Reject bad record numbers up front and sort the rest by position in the file.  The
+    // sort is stable so that duplicate writes still land in request order.
+    std::vector<size_t> order;
+    order.reserve(record_numbers.size());
+    for (size_t i = 0; i < record_numbers.size(); ++i) {
+        if (record_numbers[i] == 0 || record_numbers[i] > load_next_record()) {
+            status[i] = ErrorCode::IO_ERROR;
+        } else {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return record_numbers[a] < record_numbers[b];
+    });
+    
+    // Single-record transfer, used when there is no descriptor I/O to merge and to attribute
+    // errors in a failed run
+    auto transfer_one = [&](size_t index) {
+        try {
+            if (write) {
+                write_slot(record_numbers[index], buffer + index * length);
+            } else {
+                read_slot(record_numbers[index], buffer + index * length);
+            }
+            status[index] = ErrorCode::SUCCESS;
+            ++done;
+        } catch (const DatabaseException& e) {
+            status[index] = e.code();
+        }
+    };
+    
+    if (!descriptor_io()) {
+        for (size_t index : order) {
+            transfer_one(index);
+        }
+        return done;
+    }
+    
+    // With record checksums each slot takes two iovecs: the record and its checksum
+    const bool checksums = has_record_checksums();
+    const size_t parts = checksums ? 2 : 1;
+    const size_t max_run = MAX_IOV / parts;
+    std::vector<uint32_t> crcs(checksums ? std::min(order.size(), max_run) : 0);
+    std::vector<struct iovec> iov;
+    iov.reserve(std::min(order.size(), max_run) * parts);
+    
+    size_t run_start = 0;
+    while (run_start < order.size()) {
+        // Extend the run while the record numbers are consecutive
+        size_t run_end = run_start + 1;
+        while (run_end < order.size() && run_end - run_start < max_run &&
+               record_numbers[order[run_end]] == record_numbers[order[run_end - 1]] + 1 &&
+               (records_per_block_ == 0 || (record_numbers[order[run_end]] - 1) % records_per_block_ != 0)) {
+            ++run_end;
+        }
+        
+        iov.clear();
+        for (size_t k = run_start; k < run_end; ++k) {
+            iov.push_back({buffer + order[k] * length, length});
+            if (checksums) {
+                uint32_t& crc = crcs[k - run_start];
+                if (write) {
+                    crc = crc32c(buffer + order[k] * length, length);
+                }
+                iov.push_back({&crc, sizeof(crc)});
+            }
+        }
+        
+        uint64_t offset = locate_offset(record_numbers[order[run_start]]);
+        if (write && options_.wal != nullptr) {
+            for (size_t k = run_start; k < run_end; ++k) {
+                for (size_t part = 0; part < parts; ++part) {
+                    const struct iovec& v = iov[(k - run_start) * parts + part];
+                    note_lsn(options_.wal->append_write(wal_key_, offset + (k - run_start) * slot_length_ + (part == 0 ? 0 : length),
+                                                        v.iov_base, static_cast<uint32_t>(v.iov_len)));
+                }
+            }
+        }
+        ssize_t n = write ? file_.writev_at(iov.data(), static_cast<int>(iov.size()), offset)
+                          : file_.readv_at(iov.data(), static_cast<int>(iov.size()), offset);
+        
+        size_t complete = n > 0 ? static_cast<size_t>(n) / slot_length_ : 0;
+        if (write && n > 0) {
+            extend_file_end(offset + static_cast<uint64_t>(n));
+        }
+        for (size_t k = run_start; k < run_start + complete; ++k) {
+            if (!write && checksums) {
+                try {
+                    check_record(record_numbers[order[k]], buffer + order[k] * length, crcs[k - run_start]);
+                } catch (const DatabaseException& e) {
+                    status[order[k]] = e.code();
+                    continue;
+                }
+            }
+            status[order[k]] = ErrorCode::SUCCESS;
+            ++done;
+        }
+        
+        // A short or failed transfer is retried one record at a time so that each
+        // remaining record gets its own status.
+        for (size_t k = run_start + complete; k < run_end; ++k) {
+            transfer_one(order[k]);
+        }
+        
+        run_start = run_end;
+    }
+    
+    return done;
+}
+
+void DataFile::keep_versions(std::span<const RPTR> record_numbers, uint64_t sequence, bool free) {
+    const uint32_t length = header_.record_length;
+    std::vector<uint8_t> image(length);
+    for (RPTR record_number : record_numbers) {
+        if (record_number == 0 || record_number > load_next_record()) {
+            continue;
+        }
+        uint64_t offset = locate_offset(record_number);
+        if (offset + length > load_file_end()) {
+            // Allocated, or about to be, but never written
+            std::fill(image.begin(), image.end(), 0);
+            versions_->keep(record_number, sequence, true, image.data(), length);
+        } else {
+            read_at(offset, image.data(), length);
+            versions_->keep(record_number, sequence, free, image.data(), length);
+        }
+    }
+}
+
+RPTR DataFile::allocate_slot() {
+    if (header_.first_record == 0) {
+        RPTR record_number = header_.next_record;
+        store_next_record(record_number + 1);
+        return record_number;
+    }
+    
+    RPTR record_number = header_.first_record;
+    RPTR next_free = 0;
+    read_at(locate_offset(record_number), &next_free, sizeof(next_free));
+    if (next_free >= header_.next_record) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list of record " + std::to_string(record_number) + " links past end of file");
+    }
+    header_.first_record = next_free;
+    header_dirty_ = true;
+    mark_free(record_number, false);
+    if (compaction_free_ != nullptr) {
+        compaction_free_->pop_front();
+    }
+    return record_number;
 }
 
 RPTR DataFile::new_record(void* data) {
@@ -196,55 +823,410 @@ RPTR DataFile::new_record(void* data) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
     }
     
+    // The write is registered before the allocation, so that a snapshot taken meanwhile
+    // either sees neither or counts on this write to keep the free slot
+    VersionedWrite version(versions_.get());
     RPTR record_number;
-
-    if (header_.first_record) {
-        record_number = header_.first_record;
-        // Allocate a buffer and read the record
-        DataFileHeader *df;
-        std::vector<uint8_t> buffer(header_.record_length);
-        read_record(record_number, buffer.data());
-        df = reinterpret_cast<DataFileHeader*>(buffer.data());
-        header_.first_record = df->next_record;
-    }
-    else 
     {
-        record_number = header_.next_record++;
+        PENTALEDGER_METRIC_SCOPE(Metric::RECORD_ALLOCATE, 0);
+        std::lock_guard<std::mutex> lock(*allocator_mutex_);
+        record_number = allocate_slot();
+    }
+    if (version.keep()) {
+        keep_versions(std::span<const RPTR>(&record_number, 1), version.sequence(), true);
     }
-    
-    dump_header();
 
     // Write the data to the allocated record
-    write_record(record_number, reinterpret_cast<const uint8_t*>(data));
+    store_record(record_number, reinterpret_cast<const uint8_t*>(data));
     
     // Return the record pointer
     return record_number;
 }
 
+void DataFile::new_records(std::span<RPTR> record_numbers, const uint8_t* data) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (data == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
+    }
+    
+    // Drain the free list, then take the rest as one run at the end of the file
+    VersionedWrite version(versions_.get());
+    RPTR first_new;
+    {
+        PENTALEDGER_METRIC_SCOPE(Metric::RECORD_ALLOCATE, 0);
+        std::lock_guard<std::mutex> lock(*allocator_mutex_);
+        size_t i = 0;
+        while (i < record_numbers.size() && header_.first_record != 0) {
+            record_numbers[i++] = allocate_slot();
+        }
+        first_new = header_.next_record;
+        RPTR next = first_new;
+        for (; i < record_numbers.size(); ++i) {
+            record_numbers[i] = next++;
+        }
+        store_next_record(next);
+    }
+    if (version.keep()) {
+        keep_versions(record_numbers, version.sequence(), true);
+    }
+    store_new_records(record_numbers, data, first_new);
+}
+
+RPTR DataFile::append_records(const uint8_t* data, size_t count) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    
+    if (data == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
+    }
+    
+    VersionedWrite version(versions_.get());
+    RPTR first_new;
+    {
+        PENTALEDGER_METRIC_SCOPE(Metric::RECORD_ALLOCATE, 0);
+        std::lock_guard<std::mutex> lock(*allocator_mutex_);
+        first_new = header_.next_record;
+        store_next_record(first_new + count);
+    }
+    std::vector<RPTR> record_numbers(count);
+    std::iota(record_numbers.begin(), record_numbers.end(), first_new);
+    if (version.keep()) {
+        keep_versions(record_numbers, version.sequence(), true);
+    }
+    store_new_records(record_numbers, data, first_new);
+    return first_new;
+}
+
+void DataFile::store_new_records(std::span<const RPTR> record_numbers, const uint8_t* data, RPTR first_new) {
+    std::vector<ErrorCode> status(record_numbers.size());
+    size_t written = store_records(record_numbers, data, status);
+    if (written != record_numbers.size()) {
+        auto failed = std::find_if(status.begin(), status.end(), [](ErrorCode code) { return code != ErrorCode::SUCCESS; });
+        throw DatabaseException(*failed, "Failed to write " + std::to_string(record_numbers.size() - written) +
+                                " of " + std::to_string(record_numbers.size()) + " new records (first new slot " + std::to_string(first_new) + ")");
+    }
+}
+
+RecordScan DataFile::scan(const ScanOptions& options) {
+    return RecordScan(*this, options);
+}
+
+Snapshot DataFile::snapshot() {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (versions_ == nullptr) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Snapshots need a data file opened with DataFileOptions::versioned");
+    }
+    
+    // Every slot allocated by a write up to the snapshot is below next_record now; any
+    // allocated since keeps its free image for the snapshot
+    uint64_t sequence = versions_->open_snapshot();
+    return Snapshot(this, sequence, load_next_record());
+}
+
+VersionStats DataFile::version_stats() const {
+    return versions_ != nullptr ? versions_->stats() : VersionStats{};
+}
+
 int DataFile::delete_record(RPTR record_number) {
     if (!file_.is_open()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
     }
     
-    if (record_number > header_.next_record) {
+    if (record_number == 0 || record_number >= load_next_record()) {
         throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
     }
     
+    // Deleting a free slot again would link it into the free list twice
+    auto check_live = [&] {
+        if (on_free_list(record_number)) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Record " + std::to_string(record_number) + " is already deleted");
+        }
+    };
     
-    // Zero out the record to mark it as deleted
-    std::vector<uint8_t> zero_buffer(header_.record_length, 0);
-    write_record(record_number, zero_buffer.data());
+    // Checked before the record is kept too, so that snapshots only keep live records
+    VersionedWrite version(versions_.get());
+    if (version.keep()) {
+        {
+            std::lock_guard<std::mutex> lock(*allocator_mutex_);
+            check_live();
+        }
+        keep_versions(std::span<const RPTR>(&record_number, 1), version.sequence(), false);
+    }
+    
+    // Zero out the record to mark it as deleted, linking it to the previous head of the free
+    // list.  The check is under the same lock, so that racing deletes link it only once.
+    std::lock_guard<std::mutex> lock(*allocator_mutex_);
+    check_live();
+    header_dirty_ = true;
+    if (compaction_free_ == nullptr) {
+        write_free_slot(record_number, header_.first_record, true);
+        header_.first_record = record_number;
+        mark_free(record_number, true);
+        return 0;
+    }
+    
+    // A compaction keeps the list in order, so the slot goes in its place
+    insert_free_slot(record_number);
     
     // Return 0 on success
     return 0;
 }
 
+void DataFile::insert_free_slot(RPTR record_number) {
+    std::deque<RPTR>& ordered = *compaction_free_;
+    auto position = std::lower_bound(ordered.begin(), ordered.end(), record_number);
+    write_free_slot(record_number, position == ordered.end() ? 0 : *position, true);
+    if (position == ordered.begin()) {
+        header_.first_record = record_number;
+    } else {
+        write_free_slot(*std::prev(position), record_number, false);
+    }
+    ordered.insert(position, record_number);
+    mark_free(record_number, true);
+    header_dirty_ = true;
+}
+
+bool DataFile::on_free_list(RPTR record_number) {
+    if (free_slots_ == nullptr) {
+        load_free_slots();
+    }
+    return record_number < free_slots_->size() && (*free_slots_)[record_number];
+}
+
+void DataFile::load_free_slots() {
+    auto free_slots = std::make_unique<std::vector<bool>>(header_.next_record, false);
+    RPTR record = header_.first_record;
+    for (RPTR steps = 0; record != 0; ++steps) {
+        if (record >= header_.next_record || steps >= header_.next_record || (*free_slots)[record]) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list is corrupt at record " + std::to_string(record));
+        }
+        (*free_slots)[record] = true;
+        RPTR next = 0;
+        read_at(locate_offset(record), &next, sizeof(next));
+        record = next;
+    }
+    free_slots_ = std::move(free_slots);
+}
+
+void DataFile::mark_free(RPTR record_number, bool free) {
+    if (free_slots_ == nullptr) {
+        return;
+    }
+    if (record_number >= free_slots_->size()) {
+        if (!free) {
+            return;
+        }
+        free_slots_->resize(record_number + 1, false);
+    }
+    (*free_slots_)[record_number] = free;
+}
+
+void DataFile::write_free_slot(RPTR record_number, RPTR next_free, bool clear) {
+    static constexpr uint8_t zeros[PAGE_SIZE] = {};
+    size_t offset = locate_offset(record_number);
+    write_at(offset, &next_free, sizeof(next_free));
+    if (!clear && !has_record_checksums()) {
+        return;
+    }
+    
+    uint32_t crc = crc32c(&next_free, sizeof(next_free));
+    for (size_t done = sizeof(next_free); done < header_.record_length; ) {
+        size_t n = std::min<size_t>(PAGE_SIZE, header_.record_length - done);
+        if (clear) {
+            write_at(offset + done, zeros, n);
+        }
+        crc = crc32c(zeros, n, crc);
+        done += n;
+    }
+    if (has_record_checksums()) {
+        write_at(offset + header_.record_length, &crc, sizeof(crc));
+    }
+}
+
+void DataFile::load_compaction_list() {
+    std::deque<RPTR> ordered;
+    bool ascending = true;
+    RPTR record = header_.first_record;
+    for (RPTR steps = 0; record != 0; ++steps) {
+        if (record >= header_.next_record || steps >= header_.next_record) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list is corrupt at record " + std::to_string(record));
+        }
+        ascending = ascending && (ordered.empty() || ordered.back() < record);
+        ordered.push_back(record);
+        RPTR next = 0;
+        read_at(locate_offset(record), &next, sizeof(next));
+        record = next;
+    }
+    
+    if (!ascending) {
+        std::sort(ordered.begin(), ordered.end());
+        for (size_t i = 0; i < ordered.size(); ++i) {
+            write_free_slot(ordered[i], i + 1 < ordered.size() ? ordered[i + 1] : 0, false);
+        }
+        header_.first_record = ordered.front();
+        header_dirty_ = true;
+    }
+    compaction_free_ = std::make_unique<std::deque<RPTR>>(std::move(ordered));
+}
+
+CompactionResult DataFile::compact(const CompactionOptions& options) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (map_.is_mapped() || compressed_.is_open()) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Memory-mapped and compressed data files cannot be compacted");
+    }
+    if (versions_ != nullptr && versions_->stats().snapshots > 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A data file cannot be compacted while snapshots of it are open");
+    }
+    
+    const auto deadline = std::chrono::steady_clock::now() + options.time_budget;
+    CompactionResult result;
+    std::unique_lock<std::mutex> lock(*allocator_mutex_);
+    if (compaction_free_ == nullptr) {
+        load_compaction_list();
+    }
+    std::deque<RPTR>& ordered = *compaction_free_;
+    std::vector<uint8_t> record(header_.record_length);
+    
+    for (RPTR last = header_.next_record - 1; last != 0; last = header_.next_record - 1) {
+        if (!ordered.empty() && ordered.back() == last) {
+            // A free slot at the end is cut off; the one before it in the list ends it now
+            ordered.pop_back();
+            mark_free(last, false);
+            if (ordered.empty()) {
+                header_.first_record = 0;
+            } else {
+                write_free_slot(ordered.back(), 0, false);
+            }
+        } else if (ordered.empty()) {
+            break;
+        } else if ((options.max_moves != 0 && result.moves.size() >= options.max_moves) ||
+                   (options.time_budget.count() > 0 && std::chrono::steady_clock::now() >= deadline)) {
+            break;
+        } else {
+            // Take the lowest free slot off the list, and copy the last record into it without
+            // the lock, so that allocations and deletes go on meanwhile.  A slot allocated but
+            // never written moves as zeros.
+            RPTR to = ordered.front();
+            ordered.pop_front();
+            mark_free(to, false);
+            header_.first_record = ordered.empty() ? 0 : ordered.front();
+            lock.unlock();
+            try {
+                PENTALEDGER_METRIC_SCOPE(Metric::RECORD_MOVE, header_.record_length);
+                if (locate_offset(last) + slot_length_ > load_file_end()) {
+                    std::fill(record.begin(), record.end(), 0);
+                } else {
+                    read_slot(last, record.data());
+                }
+                write_slot(to, record.data());
+            } catch (...) {
+                // The slot goes back on the free list rather than leaking
+                lock.lock();
+                insert_free_slot(to);
+                throw;
+            }
+            lock.lock();
+            if (header_.next_record != last + 1) {
+                // Records were appended meanwhile, so the last one stays: the slot is free again
+                insert_free_slot(to);
+                break;
+            }
+            if (on_free_list(last)) {
+                // Deleted meanwhile: nothing moved, and the next pass cuts the slot off
+                insert_free_slot(to);
+                continue;
+            }
+            result.moves.push_back({last, to});
+        }
+        store_next_record(last);
+        ++result.slots_released;
+    }
+    result.complete = ordered.empty();
+    
+    if (result.slots_released > 0) {
+        // The header goes first, so that the file never holds fewer slots than it says
+        write_header();
+        uint64_t end = locate_offset(header_.next_record);
+        if (options_.wal != nullptr) {
+            note_lsn(options_.wal->append_truncate(wal_key_, end));
+        }
+        if (options_.buffer_pool != nullptr) {
+            options_.buffer_pool->truncate(pool_file_, end);
+        } else {
+            file_.truncate(end);
+        }
+        std::atomic_ref<uint64_t>(file_end_).store(end, std::memory_order_release);
+        allocated_end_ = end;
+    }
+    if (result.complete) {
+        compaction_free_.reset();
+    }
+    return result;
+}
+
 void DataFile::flush() {
-    if (file_.is_open()) {
-        file_.flush();
+    if (!file_.is_open()) {
+        return;
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::FLUSH, 0);
+    
+    {
+        std::lock_guard<std::mutex> lock(*allocator_mutex_);
+        write_header();
+    }
+    if (map_.is_mapped()) {
+        map_.sync();
+    } else {
+        if (options_.buffer_pool != nullptr) {
+            options_.buffer_pool->flush(pool_file_);
+        } else if (compressed_.is_open()) {
+            compressed_.flush();
+        }
+        file_.sync_data();
     }
 }
 
+void DataFile::commit() {
+    if (options_.wal == nullptr) {
+        flush();
+        return;
+    }
+    
+    // Log the header too, so that recovery also restores next_record and the free list
+    {
+        std::lock_guard<std::mutex> lock(*allocator_mutex_);
+        write_header();
+    }
+    options_.wal->commit(std::atomic_ref<WriteAheadLog::Lsn>(last_lsn_).load(std::memory_order_acquire));
+}
+
+uint32_t data_file_header_checksum(const DataFileHeader& header) {
+    return crc32c_excluding(&header, sizeof(header), offsetof(DataFileHeader, checksum));
+}
+
+int current_data_file_header(const DataFileHeader* copies, size_t got) {
+    int current = -1;
+    for (uint32_t i = 0; i < PLDB_HEADER_COPIES && got >= (i + 1) * sizeof(DataFileHeader); ++i) {
+        const DataFileHeader& copy = copies[i];
+        if (copy.magic_number != PLDB_MAGIC || copy.version < 3 || copy.checksum != data_file_header_checksum(copy)) {
+            continue;
+        }
+        // Sequence numbers wrap; the copies are at most one write apart
+        if (current < 0 || static_cast<int32_t>(copy.sequence - copies[current].sequence) > 0) {
+            current = static_cast<int>(i);
+        }
+    }
+    return current;
+}
+
 void DataFile::dump_header() const {
     std::cout << "=== DataFile Header ===" << std::endl;
     std::cout << "Magic Number: 0x" << std::hex << std::setw(8) << std::setfill('0') 
@@ -283,7 +1265,7 @@ void DataFile::dump_header() const {
     
     std::cout << "Next Record: " << header_.next_record << std::endl;
     std::cout << "Record Length: " << header_.record_length << " bytes" << std::endl;
-    std::cout << "Header Size: " << HEADER_SIZE << " bytes" << std::endl;
+    std::cout << "Header Size: " << header_size_ << " bytes" << std::endl;
     std::cout << "======================" << std::endl;
 }
 
@@ -340,6 +1322,20 @@ void DataFile::hexdump_record(RPTR record_number) {
 void DataFile::close() {
     if (file_.is_open()) {
         write_header(); // Save header before closing
+        if (map_.is_mapped()) {
+            // Drop the mapping and trim the growth slack so the file on disk is
+            // exactly what the stream mode would have written.
+            map_.unmap();
+            file_.truncate(file_end_);
+            allocated_end_ = file_end_;
+        } else if (options_.buffer_pool != nullptr) {
+            options_.buffer_pool->unregister_file(pool_file_);
+        } else if (compressed_.is_open()) {
+            compressed_.close();
+        }
+        if (options_.trim_on_close && allocated_end_ > file_end_) {
+            file_.truncate(file_end_);
+        }
         file_.close();
     }
 }
@@ -0,0 +1,710 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/heap_file.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+static_assert(sizeof(HeapFileHeader) <= PAGE_SIZE, "Heap file header does not fit its page");
+
+namespace {
+
+// A record number is its page number shifted over its slot number
+constexpr unsigned SLOT_BITS = 16;
+constexpr RPTR SLOT_MASK = (RPTR{1} << SLOT_BITS) - 1;
+
+RPTR make_record_number(uint64_t page_number, uint32_t slot) {
+    return page_number << SLOT_BITS | slot;
+}
+
+HeapPageHeader& page_header(uint8_t* page) {
+    return *reinterpret_cast<HeapPageHeader*>(page);
+}
+
+const HeapPageHeader& page_header(const uint8_t* page) {
+    return *reinterpret_cast<const HeapPageHeader*>(page);
+}
+
+HeapSlot* slots(uint8_t* page) {
+    return reinterpret_cast<HeapSlot*>(page + sizeof(HeapPageHeader));
+}
+
+const HeapSlot* slots(const uint8_t* page) {
+    return reinterpret_cast<const HeapSlot*>(page + sizeof(HeapPageHeader));
+}
+
+uint32_t directory_end(const HeapPageHeader& header) {
+    return static_cast<uint32_t>(sizeof(HeapPageHeader) + header.slot_count * sizeof(HeapSlot));
+}
+
+// Bytes content of this length takes in a page: never less than a forward link, so that
+// any record can be replaced by one where it stands
+uint32_t allocation(uint32_t length) {
+    return std::max<uint32_t>(length, sizeof(RPTR));
+}
+
+// Room in a page for content in a new slot
+uint32_t available(const HeapPageHeader& header) {
+    uint32_t room = header.free_end - directory_end(header) + header.fragmented;
+    return room > sizeof(HeapSlot) ? room - static_cast<uint32_t>(sizeof(HeapSlot)) : 0;
+}
+
+void init_data_page(uint8_t* page, uint32_t page_size) {
+    std::memset(page, 0, page_size);
+    page_header(page).type = HEAP_PAGE_DATA;
+    page_header(page).free_end = page_size;
+}
+
+// Drop the free slots at the end of the directory
+void trim_slots(uint8_t* page) {
+    HeapPageHeader& header = page_header(page);
+    while (header.slot_count > 0 && slots(page)[header.slot_count - 1].offset == 0) {
+        --header.slot_count;
+    }
+}
+
+} // namespace
+
+HeapFile HeapFile::create(const std::string& path, const HeapFileOptions& options) {
+    if (options.page_size < PAGE_SIZE || options.page_size > MAX_PAGE_SIZE || options.page_size % PAGE_SIZE != 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Heap page size must be a multiple of " + std::to_string(PAGE_SIZE) +
+                                " up to " + std::to_string(MAX_PAGE_SIZE) + " bytes");
+    }
+
+    HeapFile hf;
+    hf.file_path_ = path;
+    if (!hf.file_.open(path, O_RDWR | O_CREAT | O_TRUNC)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to create heap file: " + path);
+    }
+
+    // The header page, then the first page of the free-space map
+    uint64_t current_time = static_cast<uint64_t>(std::time(nullptr));
+    hf.header_.magic_number = PLHP_MAGIC;
+    hf.header_.version = PLHP_VERSION;
+    hf.header_.creation_time = current_time;
+    hf.header_.last_update_time = current_time;
+    hf.header_.page_size = options.page_size;
+    hf.header_.page_count = 2;
+    hf.validate_header();
+    hf.free_space_.assign(hf.header_.page_count, 0);
+    hf.map_dirty_ = true;
+    hf.write_free_space_map();
+    hf.write_header();
+    return hf;
+}
+
+HeapFile HeapFile::open(const std::string& path) {
+    HeapFile hf;
+    hf.file_path_ = path;
+    if (!hf.file_.open(path, O_RDWR)) {
+        throw DatabaseException(ErrorCode::FILE_NOT_FOUND, "Heap file not found: " + path);
+    }
+    try {
+        hf.read_header();
+        hf.read_free_space_map();
+    } catch (...) {
+        // Leave a file that failed to open as it was
+        hf.file_.close();
+        throw;
+    }
+    return hf;
+}
+
+HeapFile::~HeapFile() {
+    close();
+}
+
+void HeapFile::read_header() {
+    if (file_.read_at(&header_, sizeof(header_), 0) != sizeof(header_)) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Failed to read heap file header");
+    }
+
+    if (header_.magic_number != PLHP_MAGIC) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid magic number - not a PentaLedger heap file");
+    }
+    if (header_.version != PLHP_VERSION) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Unsupported heap file version " + std::to_string(header_.version));
+    }
+    validate_header();
+    if (file_.size() < header_.page_count * header_.page_size) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Heap file is shorter than its " + std::to_string(header_.page_count) + " pages: " + file_path_);
+    }
+}
+
+void HeapFile::validate_header() {
+    // Everything below is used to compute offsets, so it has to be consistent
+    if (header_.page_size < PAGE_SIZE || header_.page_size > MAX_PAGE_SIZE || header_.page_size % PAGE_SIZE != 0 ||
+        header_.page_count < 2 || header_.first_free_page >= header_.page_count) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Inconsistent heap file layout: " + file_path_);
+    }
+
+    max_inline_ = header_.page_size - static_cast<uint32_t>(sizeof(HeapPageHeader) + sizeof(HeapSlot));
+    page_.resize(header_.page_size);
+    scratch_.resize(header_.page_size);
+}
+
+void HeapFile::write_header() {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::HEADER_WRITE, sizeof(header_));
+
+    header_.last_update_time = static_cast<uint64_t>(std::time(nullptr));
+    file_.write_exact(&header_, sizeof(header_), 0);
+}
+
+bool HeapFile::is_map_page(uint64_t page_number) const {
+    return page_number >= 1 && (page_number - 1) % (static_cast<uint64_t>(header_.page_size) + 1) == 0;
+}
+
+void HeapFile::read_free_space_map() {
+    // Map page m covers the page_size pages after it
+    free_space_.assign(header_.page_count, 0);
+    for (uint64_t m = 1; m < header_.page_count; m += static_cast<uint64_t>(header_.page_size) + 1) {
+        read_page(m, scratch_.data());
+        uint64_t covered = std::min<uint64_t>(header_.page_size, header_.page_count - m - 1);
+        std::copy_n(scratch_.begin(), covered, free_space_.begin() + static_cast<ptrdiff_t>(m + 1));
+    }
+    map_dirty_ = false;
+}
+
+void HeapFile::write_free_space_map() {
+    if (!map_dirty_) {
+        return;
+    }
+    for (uint64_t m = 1; m < header_.page_count; m += static_cast<uint64_t>(header_.page_size) + 1) {
+        uint64_t covered = std::min<uint64_t>(header_.page_size, header_.page_count - m - 1);
+        std::fill(scratch_.begin(), scratch_.end(), 0);
+        std::copy_n(free_space_.begin() + static_cast<ptrdiff_t>(m + 1), covered, scratch_.begin());
+        write_page(m, scratch_.data());
+    }
+    map_dirty_ = false;
+}
+
+void HeapFile::note_free_space(uint64_t page_number, const uint8_t* page) {
+    uint64_t category = std::min<uint64_t>(255, uint64_t{available(page_header(page))} * 256 / header_.page_size);
+    if (free_space_[page_number] != category) {
+        free_space_[page_number] = static_cast<uint8_t>(category);
+        map_dirty_ = true;
+    }
+}
+
+void HeapFile::read_page(uint64_t page_number, uint8_t* page) const {
+    file_.read_exact(page, header_.page_size, page_number * header_.page_size);
+}
+
+void HeapFile::write_page(uint64_t page_number, const uint8_t* page) {
+    file_.write_exact(page, header_.page_size, page_number * header_.page_size);
+}
+
+uint64_t HeapFile::allocate_page() {
+    if (header_.first_free_page != 0) {
+        uint64_t page_number = header_.first_free_page;
+        HeapPageHeader free_page;
+        file_.read_exact(&free_page, sizeof(free_page), page_number * header_.page_size);
+        if (free_page.type != HEAP_PAGE_FREE || free_page.next_page >= header_.page_count) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free page list is corrupt at page " + std::to_string(page_number));
+        }
+        header_.first_free_page = free_page.next_page;
+        return page_number;
+    }
+
+    uint64_t page_number = header_.page_count;
+    if (is_map_page(page_number)) {
+        // Start the next stretch of the free-space map; it is all zeros until written back
+        std::fill(scratch_.begin(), scratch_.end(), 0);
+        write_page(page_number++, scratch_.data());
+    }
+    header_.page_count = page_number + 1;
+    free_space_.resize(header_.page_count, 0);
+    return page_number;
+}
+
+uint64_t HeapFile::find_page(uint32_t length, uint8_t* page, uint64_t avoid) {
+    // A page whose map entry is at least this has the room, if the entry is current
+    const uint64_t wanted = std::max<uint64_t>(1, (uint64_t{length} * 256 + header_.page_size - 1) / header_.page_size);
+    auto fits = [&](uint64_t page_number) {
+        if (page_number == avoid || free_space_[page_number] < wanted) {
+            return false;
+        }
+        read_page(page_number, page);
+        if (page_header(page).type != HEAP_PAGE_DATA) {
+            free_space_[page_number] = 0;
+            return false;
+        }
+        // Correct a stale entry
+        note_free_space(page_number, page);
+        return available(page_header(page)) >= length;
+    };
+
+    if (insert_page_ != 0 && insert_page_ < header_.page_count && fits(insert_page_)) {
+        return insert_page_;
+    }
+    for (uint64_t page_number = 2; page_number < header_.page_count; ++page_number) {
+        if (page_number != insert_page_ && fits(page_number)) {
+            insert_page_ = page_number;
+            return page_number;
+        }
+    }
+
+    insert_page_ = allocate_page();
+    init_data_page(page, header_.page_size);
+    return insert_page_;
+}
+
+uint32_t HeapFile::locate(RPTR record_number, uint8_t* page) const {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+
+    uint64_t page_number = record_number >> SLOT_BITS;
+    uint32_t slot = static_cast<uint32_t>(record_number & SLOT_MASK);
+    if (page_number < 2 || page_number >= header_.page_count || is_map_page(page_number)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+
+    read_page(page_number, page);
+    const HeapPageHeader& header = page_header(page);
+    if (header.type != HEAP_PAGE_DATA || slot >= header.slot_count || slots(page)[slot].offset == 0 ||
+        (slots(page)[slot].length & HEAP_SLOT_MOVED) != 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+    return slot;
+}
+
+uint64_t HeapFile::content_length(const uint8_t* page, uint32_t slot) const {
+    const HeapSlot& entry = slots(page)[slot];
+    if ((entry.length & HEAP_SLOT_OVERFLOW) != 0) {
+        HeapOverflow overflow;
+        std::memcpy(&overflow, page + entry.offset, sizeof(overflow));
+        return overflow.length;
+    }
+    return entry.length & HEAP_SLOT_LENGTH;
+}
+
+void HeapFile::read_content(const uint8_t* page, uint32_t slot, std::vector<uint8_t>& buffer) const {
+    const HeapSlot& entry = slots(page)[slot];
+    if ((entry.length & HEAP_SLOT_OVERFLOW) != 0) {
+        HeapOverflow overflow;
+        std::memcpy(&overflow, page + entry.offset, sizeof(overflow));
+        buffer.resize(overflow.length);
+        read_overflow(overflow, buffer.data());
+    } else {
+        buffer.assign(page + entry.offset, page + entry.offset + (entry.length & HEAP_SLOT_LENGTH));
+    }
+}
+
+void HeapFile::release(uint8_t* page, uint32_t slot) {
+    HeapPageHeader& header = page_header(page);
+    HeapSlot& entry = slots(page)[slot];
+    if ((entry.length & HEAP_SLOT_OVERFLOW) != 0) {
+        HeapOverflow overflow;
+        std::memcpy(&overflow, page + entry.offset, sizeof(overflow));
+        free_overflow(overflow.first_page);
+    }
+
+    // Space at the low end of the packed records rejoins the free gap; anywhere else it
+    // waits for the page to be compacted
+    uint32_t size = allocation(entry.length & HEAP_SLOT_LENGTH);
+    if (entry.offset == header.free_end) {
+        header.free_end += size;
+    } else {
+        header.fragmented += size;
+    }
+    entry = {0, 0};
+}
+
+int HeapFile::place(uint8_t* page, int slot, const uint8_t* content, uint32_t length, uint32_t flags) {
+    HeapPageHeader& header = page_header(page);
+    if (slot < 0) {
+        slot = static_cast<int>(header.slot_count);
+        for (uint32_t s = 0; s < header.slot_count; ++s) {
+            if (slots(page)[s].offset == 0) {
+                slot = static_cast<int>(s);
+                break;
+            }
+        }
+    }
+
+    const uint32_t size = allocation(length);
+    const uint32_t slot_count = std::max<uint32_t>(header.slot_count, static_cast<uint32_t>(slot) + 1);
+    const uint32_t directory = static_cast<uint32_t>(sizeof(HeapPageHeader) + slot_count * sizeof(HeapSlot));
+    if (directory + size > header.free_end) {
+        if (directory + size > header.free_end + header.fragmented) {
+            return -1;
+        }
+        compact(page);
+    }
+
+    // Slots the directory grows over are free
+    for (uint32_t s = header.slot_count; s < slot_count; ++s) {
+        slots(page)[s] = {0, 0};
+    }
+    header.slot_count = slot_count;
+    header.free_end -= size;
+    if (length != 0) {
+        std::memcpy(page + header.free_end, content, length);
+    }
+    slots(page)[slot] = {header.free_end, length | flags};
+    return slot;
+}
+
+void HeapFile::compact(uint8_t* page) {
+    std::copy_n(page, header_.page_size, scratch_.begin());
+    HeapPageHeader& header = page_header(page);
+    uint32_t end = header_.page_size;
+    for (uint32_t s = 0; s < header.slot_count; ++s) {
+        HeapSlot& entry = slots(page)[s];
+        if (entry.offset != 0) {
+            uint32_t size = allocation(entry.length & HEAP_SLOT_LENGTH);
+            end -= size;
+            std::memcpy(page + end, scratch_.data() + entry.offset, size);
+            entry.offset = end;
+        }
+    }
+    header.free_end = end;
+    header.fragmented = 0;
+}
+
+uint64_t HeapFile::write_overflow(const uint8_t* data, uint64_t length) {
+    const uint64_t per_page = header_.page_size - sizeof(HeapPageHeader);
+    std::vector<uint64_t> pages((length + per_page - 1) / per_page);
+    for (uint64_t& page_number : pages) {
+        page_number = allocate_page();
+    }
+
+    for (size_t i = 0; i < pages.size(); ++i) {
+        uint64_t used = std::min(per_page, length - i * per_page);
+        std::fill(scratch_.begin(), scratch_.end(), 0);
+        HeapPageHeader& header = page_header(scratch_.data());
+        header.type = HEAP_PAGE_OVERFLOW;
+        header.slot_count = static_cast<uint32_t>(used);
+        header.next_page = i + 1 < pages.size() ? pages[i + 1] : 0;
+        std::memcpy(scratch_.data() + sizeof(HeapPageHeader), data + i * per_page, used);
+        write_page(pages[i], scratch_.data());
+        free_space_[pages[i]] = 0;
+    }
+    return pages.front();
+}
+
+void HeapFile::read_overflow(const HeapOverflow& overflow, uint8_t* buffer) const {
+    // read_overflow() is const but reads through a page buffer of its own
+    std::vector<uint8_t> page(header_.page_size);
+    uint64_t page_number = overflow.first_page;
+    uint64_t done = 0;
+    for (uint64_t steps = 0; done < overflow.length; ++steps) {
+        if (page_number < 2 || page_number >= header_.page_count || steps >= header_.page_count) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Overflow chain is corrupt at page " + std::to_string(page_number));
+        }
+        read_page(page_number, page.data());
+        const HeapPageHeader& header = page_header(page.data());
+        if (header.type != HEAP_PAGE_OVERFLOW || header.slot_count > header_.page_size - sizeof(HeapPageHeader) ||
+            header.slot_count > overflow.length - done) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Overflow chain is corrupt at page " + std::to_string(page_number));
+        }
+        std::memcpy(buffer + done, page.data() + sizeof(HeapPageHeader), header.slot_count);
+        done += header.slot_count;
+        page_number = header.next_page;
+    }
+}
+
+void HeapFile::free_overflow(uint64_t first_page) {
+    uint64_t page_number = first_page;
+    for (uint64_t steps = 0; page_number != 0; ++steps) {
+        if (page_number < 2 || page_number >= header_.page_count || steps >= header_.page_count) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Overflow chain is corrupt at page " + std::to_string(page_number));
+        }
+        HeapPageHeader header;
+        file_.read_exact(&header, sizeof(header), page_number * header_.page_size);
+        if (header.type != HEAP_PAGE_OVERFLOW) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Overflow chain is corrupt at page " + std::to_string(page_number));
+        }
+
+        // Push the page onto the free page list
+        uint64_t next = header.next_page;
+        header.type = HEAP_PAGE_FREE;
+        header.slot_count = 0;
+        header.next_page = header_.first_free_page;
+        file_.write_exact(&header, sizeof(header), page_number * header_.page_size);
+        header_.first_free_page = page_number;
+        page_number = next;
+    }
+}
+
+uint32_t HeapFile::prepare_content(const uint8_t* data, uint32_t length, HeapOverflow& overflow,
+                                   const uint8_t*& content, uint32_t& content_length) {
+    if (length <= max_inline_) {
+        content = data;
+        content_length = length;
+        return 0;
+    }
+    overflow.length = length;
+    overflow.first_page = write_overflow(data, length);
+    content = reinterpret_cast<const uint8_t*>(&overflow);
+    content_length = sizeof(overflow);
+    return HEAP_SLOT_OVERFLOW;
+}
+
+RPTR HeapFile::new_record(const void* data, uint32_t length) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (data == nullptr && length > 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_WRITE, length);
+
+    HeapOverflow overflow;
+    const uint8_t* content;
+    uint32_t content_length;
+    uint32_t flags = prepare_content(static_cast<const uint8_t*>(data), length, overflow, content, content_length);
+
+    uint64_t page_number;
+    {
+        PENTALEDGER_METRIC_SCOPE(Metric::RECORD_ALLOCATE, 0);
+        page_number = find_page(allocation(content_length), page_.data(), 0);
+    }
+    int slot = place(page_.data(), -1, content, content_length, flags);
+    if (slot < 0) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Heap page " + std::to_string(page_number) + " has less room than it shows");
+    }
+    write_page(page_number, page_.data());
+    note_free_space(page_number, page_.data());
+
+    ++header_.record_count;
+    header_.record_bytes += length;
+    return make_record_number(page_number, static_cast<uint32_t>(slot));
+}
+
+void HeapFile::read_record(RPTR record_number, std::vector<uint8_t>& buffer) {
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_READ, 0);
+
+    uint32_t slot = locate(record_number, page_.data());
+    const HeapSlot& entry = slots(page_.data())[slot];
+    if ((entry.length & HEAP_SLOT_FORWARD) != 0) {
+        // One hop: a moved record is always forwarded from its home slot
+        RPTR target;
+        std::memcpy(&target, page_.data() + entry.offset, sizeof(target));
+        read_page(target >> SLOT_BITS, page_.data());
+        slot = static_cast<uint32_t>(target & SLOT_MASK);
+    }
+    read_content(page_.data(), slot, buffer);
+}
+
+uint32_t HeapFile::record_size(RPTR record_number) {
+    uint32_t slot = locate(record_number, page_.data());
+    const HeapSlot& entry = slots(page_.data())[slot];
+    if ((entry.length & HEAP_SLOT_FORWARD) != 0) {
+        RPTR target;
+        std::memcpy(&target, page_.data() + entry.offset, sizeof(target));
+        read_page(target >> SLOT_BITS, page_.data());
+        slot = static_cast<uint32_t>(target & SLOT_MASK);
+    }
+    return static_cast<uint32_t>(content_length(page_.data(), slot));
+}
+
+void HeapFile::write_record(RPTR record_number, const void* data, uint32_t length) {
+    if (data == nullptr && length > 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_WRITE, length);
+
+    uint8_t* home = page_.data();
+    const uint64_t home_page = record_number >> SLOT_BITS;
+    const uint32_t home_slot = locate(record_number, home);
+
+    // Where the record is now: its home slot, or the slot its forward link names
+    std::vector<uint8_t> moved;
+    uint64_t target_page = home_page;
+    uint32_t target_slot = home_slot;
+    if ((slots(home)[home_slot].length & HEAP_SLOT_FORWARD) != 0) {
+        RPTR target;
+        std::memcpy(&target, home + slots(home)[home_slot].offset, sizeof(target));
+        target_page = target >> SLOT_BITS;
+        target_slot = static_cast<uint32_t>(target & SLOT_MASK);
+        moved.resize(header_.page_size);
+        read_page(target_page, moved.data());
+    }
+    uint8_t* current = moved.empty() ? home : moved.data();
+    const uint64_t old_length = content_length(current, target_slot);
+    release(current, target_slot);
+
+    HeapOverflow overflow;
+    const uint8_t* content;
+    uint32_t content_length;
+    uint32_t flags = prepare_content(static_cast<const uint8_t*>(data), length, overflow, content, content_length);
+
+    // In place if the page still has room for it, which compacting may make
+    if (place(current, static_cast<int>(target_slot), content, content_length, flags | (moved.empty() ? 0 : HEAP_SLOT_MOVED)) >= 0) {
+        write_page(target_page, current);
+        note_free_space(target_page, current);
+    } else {
+        if (!moved.empty()) {
+            // Give up the slot it had moved to, and try its home page again
+            trim_slots(current);
+            write_page(target_page, current);
+            note_free_space(target_page, current);
+            release(home, home_slot);
+        }
+
+        if (!moved.empty() && place(home, static_cast<int>(home_slot), content, content_length, flags) >= 0) {
+            write_page(home_page, home);
+        } else {
+            // Move it to another page, then leave a forward link in the home slot; a
+            // link takes no more room than the record it replaces did
+            std::vector<uint8_t> other(header_.page_size);
+            uint64_t other_page = find_page(allocation(content_length), other.data(), home_page);
+            int slot = place(other.data(), -1, content, content_length, flags | HEAP_SLOT_MOVED);
+            if (slot < 0) {
+                throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Heap page " + std::to_string(other_page) + " has less room than it shows");
+            }
+            write_page(other_page, other.data());
+            note_free_space(other_page, other.data());
+
+            RPTR target = make_record_number(other_page, static_cast<uint32_t>(slot));
+            place(home, static_cast<int>(home_slot), reinterpret_cast<const uint8_t*>(&target), sizeof(target), HEAP_SLOT_FORWARD);
+            write_page(home_page, home);
+        }
+        note_free_space(home_page, home);
+    }
+
+    header_.record_bytes = header_.record_bytes - old_length + length;
+}
+
+int HeapFile::delete_record(RPTR record_number) {
+    uint8_t* home = page_.data();
+    const uint64_t home_page = record_number >> SLOT_BITS;
+    const uint32_t home_slot = locate(record_number, home);
+
+    uint64_t length;
+    if ((slots(home)[home_slot].length & HEAP_SLOT_FORWARD) != 0) {
+        RPTR target;
+        std::memcpy(&target, home + slots(home)[home_slot].offset, sizeof(target));
+        std::vector<uint8_t> moved(header_.page_size);
+        read_page(target >> SLOT_BITS, moved.data());
+        uint32_t target_slot = static_cast<uint32_t>(target & SLOT_MASK);
+        length = content_length(moved.data(), target_slot);
+        release(moved.data(), target_slot);
+        trim_slots(moved.data());
+        write_page(target >> SLOT_BITS, moved.data());
+        note_free_space(target >> SLOT_BITS, moved.data());
+    } else {
+        length = content_length(home, home_slot);
+    }
+
+    release(home, home_slot);
+    trim_slots(home);
+    write_page(home_page, home);
+    note_free_space(home_page, home);
+
+    --header_.record_count;
+    header_.record_bytes -= length;
+    return 0;
+}
+
+HeapScan HeapFile::scan() {
+    return HeapScan(*this);
+}
+
+void HeapFile::flush() {
+    if (!file_.is_open()) {
+        return;
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::FLUSH, 0);
+
+    write_free_space_map();
+    write_header();
+    file_.sync_data();
+}
+
+void HeapFile::close() {
+    if (file_.is_open()) {
+        write_free_space_map();
+        write_header();
+        file_.close();
+    }
+}
+
+HeapScan::HeapScan(HeapFile& file) : file_(file) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+}
+
+HeapScan::iterator HeapScan::begin() {
+    if (started_) {
+        return iterator(this);
+    }
+    started_ = true;
+
+    page_.resize(file_.header_.page_size);
+    page_number_ = 1;
+    slot_ = 0;
+    ::posix_fadvise(file_.file_.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    advance();
+    return iterator(this);
+}
+
+void HeapScan::advance() {
+    const uint64_t page_count = file_.header_.page_count;
+    while (page_number_ < page_count) {
+        const HeapPageHeader& header = page_header(page_.data());
+        if (page_number_ < 2 || header.type != HEAP_PAGE_DATA || slot_ >= header.slot_count) {
+            // On to the next data page
+            do {
+                ++page_number_;
+            } while (page_number_ < page_count && file_.is_map_page(page_number_));
+            if (page_number_ >= page_count) {
+                break;
+            }
+            PENTALEDGER_METRIC_SCOPE(Metric::SCAN_READ, file_.header_.page_size);
+            file_.read_page(page_number_, page_.data());
+            slot_ = 0;
+            continue;
+        }
+
+        const uint32_t slot = slot_++;
+        const HeapSlot& entry = slots(page_.data())[slot];
+        // Free slots, and records moved here, which are visited from their home slot
+        if (entry.offset == 0 || (entry.length & HEAP_SLOT_MOVED) != 0) {
+            continue;
+        }
+
+        current_record_ = make_record_number(page_number_, slot);
+        if ((entry.length & (HEAP_SLOT_FORWARD | HEAP_SLOT_OVERFLOW)) == 0) {
+            current_ = std::span<const uint8_t>(page_.data() + entry.offset, entry.length & HEAP_SLOT_LENGTH);
+        } else {
+            file_.read_record(current_record_, record_);
+            current_ = record_;
+        }
+        return;
+    }
+
+    done_ = true;
+    current_ = {};
+}
+
+} // namespace pentaledger
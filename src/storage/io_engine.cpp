@@ -0,0 +1,538 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/io_engine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define PENTALEDGER_HAVE_IO_URING 1
+#else
+#define PENTALEDGER_HAVE_IO_URING 0
+#endif
+
+namespace pentaledger {
+
+namespace {
+
+// Engine inside whose Batch the current thread is, if any
+thread_local IoEngine* batch_engine = nullptr;
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// IoEngine
+
+IoEngine::Batch::Batch(IoEngine& engine)
+    : engine_(engine), outer_(batch_engine) {
+    batch_engine = &engine;
+}
+
+IoEngine::Batch::~Batch() {
+    batch_engine = outer_;
+    if (outer_ != &engine_) {
+        engine_.flush();
+    }
+}
+
+IoEngine::~IoEngine() = default;
+
+void IoEngine::submit(IoRequest& request) {
+    request.done = 0;
+    request.result = 0;
+    enqueue(request);
+    if (!batching()) {
+        flush();
+    }
+}
+
+void IoEngine::submit(std::span<IoRequest*> requests) {
+    for (IoRequest* request : requests) {
+        request->done = 0;
+        request->result = 0;
+        enqueue(*request);
+    }
+    if (!batching()) {
+        flush();
+    }
+}
+
+bool IoEngine::register_buffers(std::span<const struct iovec> buffers) {
+    return do_register_buffers(buffers);
+}
+
+bool IoEngine::batching() const {
+    return batch_engine == this;
+}
+
+bool IoEngine::complete(IoRequest& request, ssize_t result) {
+    if (result > 0 && request.done + static_cast<size_t>(result) < request.length) {
+        request.done += static_cast<size_t>(result);
+        enqueue(request);
+        if (!batching()) {
+            flush();
+        }
+        return false;
+    }
+
+    request.result = result < 0 ? result : static_cast<ssize_t>(request.done + static_cast<size_t>(result));
+    if (request.waiter) {
+        request.waiter.resume();
+    } else if (request.callback != nullptr) {
+        request.callback(request);
+    }
+    return true;
+}
+
+void IoAwaitable::await_resume() const {
+    if (!error_.empty()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, error_);
+    }
+    if (ready_) {
+        return;
+    }
+    if (request_.result < 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, std::string("Asynchronous ") + (request_.write ? "write" : "read") +
+                                " failed at offset " + std::to_string(request_.offset) + ": " + std::strerror(static_cast<int>(-request_.result)));
+    }
+    if (static_cast<size_t>(request_.result) != request_.length) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Short asynchronous " + std::string(request_.write ? "write" : "read") +
+                                " of " + std::to_string(request_.result) + " of " + std::to_string(request_.length) +
+                                " bytes at offset " + std::to_string(request_.offset));
+    }
+}
+
+namespace {
+
+// ---------------------------------------------------------------------------
+// Thread pool engine: workers run pread/pwrite
+
+class ThreadPoolEngine final : public IoEngine {
+public:
+    explicit ThreadPoolEngine(unsigned threads) {
+        threads = std::max(threads, 1u);
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPoolEngine() override {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.insert(ready_.end(), pending_.begin(), pending_.end());
+            pending_.clear();
+            work_.notify_all();
+            idle_.wait(lock, [this] { return inflight_ == 0; });
+            stopping_ = true;
+            work_.notify_all();
+        }
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    const char* name() const override { return "thread_pool"; }
+
+protected:
+    void enqueue(IoRequest& request) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(&request);
+        ++inflight_;
+    }
+
+    void flush() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return;
+        }
+        ready_.insert(ready_.end(), pending_.begin(), pending_.end());
+        pending_.clear();
+        work_.notify_all();
+    }
+
+    bool do_register_buffers(std::span<const struct iovec>) override {
+        return true;
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+            if (ready_.empty()) {
+                return;
+            }
+            IoRequest* request = ready_.front();
+            ready_.pop_front();
+            lock.unlock();
+
+            ssize_t result = transfer(*request);
+            complete(*request, result);
+
+            lock.lock();
+            if (--inflight_ == 0) {
+                idle_.notify_all();
+            }
+        }
+    }
+
+    static ssize_t transfer(IoRequest& request) {
+        auto* data = static_cast<uint8_t*>(request.buffer) + request.done;
+        const size_t length = request.length - request.done;
+        const uint64_t offset = request.offset + request.done;
+        size_t total = 0;
+        while (total < length) {
+            ssize_t n = request.write
+                ? ::pwrite(request.fd, data + total, length - total, static_cast<off_t>(offset + total))
+                : ::pread(request.fd, data + total, length - total, static_cast<off_t>(offset + total));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -errno;
+            }
+            if (n == 0) {
+                break;
+            }
+            total += static_cast<size_t>(n);
+        }
+        return static_cast<ssize_t>(total);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable idle_;
+    std::vector<IoRequest*> pending_;
+    std::deque<IoRequest*> ready_;
+    size_t inflight_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+#if PENTALEDGER_HAVE_IO_URING
+
+// ---------------------------------------------------------------------------
+// io_uring engine, driven through the raw system calls
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+unsigned load_acquire(const unsigned* p) {
+    return std::atomic_ref<const unsigned>(*p).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned* p, unsigned value) {
+    std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+}
+
+class UringEngine final : public IoEngine {
+public:
+    //! Null if the kernel does not offer io_uring, or not with IORING_OP_READ/WRITE
+    static std::unique_ptr<UringEngine> try_create(unsigned queue_depth) {
+        std::unique_ptr<UringEngine> engine(new UringEngine);
+        if (!engine->setup(std::max(queue_depth, 8u))) {
+            return nullptr;
+        }
+        engine->completer_ = std::thread([raw = engine.get()] { raw->run(); });
+        return engine;
+    }
+
+    ~UringEngine() override {
+        if (completer_.joinable()) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            submit_locked();
+            idle_.wait(lock, [this] { return inflight_ == 0; });
+
+            // A NOP with no request tells the completion thread to stop
+            io_uring_sqe* sqe = next_sqe_locked();
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            commit_sqe_locked();
+            submit_locked();
+            lock.unlock();
+            completer_.join();
+        }
+        if (sqes_ != nullptr) {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+            ::munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != nullptr) {
+            ::munmap(sq_ring_, sq_ring_size_);
+        }
+        if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+        }
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+protected:
+    void enqueue(IoRequest& request) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // Keep completions within the completion queue.  The completion thread must not
+        // wait on itself; the kernel holds any overflow for it.
+        if (inflight_ >= cq_entries_ && std::this_thread::get_id() != completer_.get_id()) {
+            submit_locked();
+            space_.wait(lock, [this] { return inflight_ < cq_entries_; });
+        }
+
+        bool fixed = request.buffer_index >= 0 && buffers_registered_;
+        io_uring_sqe* sqe = next_sqe_locked();
+        sqe->opcode = request.write ? (fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE)
+                                    : (fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+        sqe->fd = request.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(static_cast<uint8_t*>(request.buffer) + request.done);
+        sqe->len = static_cast<uint32_t>(request.length - request.done);
+        sqe->off = request.offset + request.done;
+        if (fixed) {
+            sqe->buf_index = static_cast<uint16_t>(request.buffer_index);
+        }
+        sqe->user_data = reinterpret_cast<uint64_t>(&request);
+        commit_sqe_locked();
+        ++inflight_;
+    }
+
+    void flush() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        submit_locked();
+    }
+
+    bool do_register_buffers(std::span<const struct iovec> buffers) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (buffers_registered_) {
+            sys_io_uring_register(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+            buffers_registered_ = false;
+        }
+        if (buffers.empty()) {
+            return true;
+        }
+        // Fails if the buffers exceed RLIMIT_MEMLOCK; requests then use plain reads and writes
+        buffers_registered_ = sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                                                    static_cast<unsigned>(buffers.size())) == 0;
+        return buffers_registered_;
+    }
+
+private:
+    UringEngine() = default;
+
+    bool setup(unsigned entries) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = sys_io_uring_setup(entries, &params);
+        if (ring_fd_ < 0) {
+            return false;
+        }
+
+        // IORING_OP_READ and IORING_OP_WRITE arrived in Linux 5.6
+        std::vector<uint8_t> probe_space(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(probe_space.data());
+        if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+            probe->last_op < IORING_OP_WRITE ||
+            !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+            !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == nullptr) {
+            return false;
+        }
+        cq_ring_ = single ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+        if (cq_ring_ == nullptr || sqes_ == nullptr) {
+            return false;
+        }
+
+        auto* sq = static_cast<uint8_t*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+
+        auto* cq = static_cast<uint8_t*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_entries_ = params.cq_entries;
+        return true;
+    }
+
+    void* map(size_t length, off_t offset) {
+        void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    //! A zeroed submission entry, submitting what is queued first if the ring is full
+    io_uring_sqe* next_sqe_locked() {
+        if (queued_tail_ - load_acquire(sq_head_) == sq_entries_) {
+            submit_locked();
+        }
+        io_uring_sqe* sqe = &sqes_[queued_tail_ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void commit_sqe_locked() {
+        unsigned index = queued_tail_ & sq_mask_;
+        sq_array_[index] = index;
+        ++queued_tail_;
+        store_release(sq_tail_, queued_tail_);
+        ++queued_;
+    }
+
+    void submit_locked() {
+        while (queued_ > 0) {
+            int n = sys_io_uring_enter(ring_fd_, queued_, 0, 0);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                throw DatabaseException(ErrorCode::IO_ERROR, std::string("io_uring submission failed: ") + std::strerror(errno));
+            }
+            queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(n));
+        }
+    }
+
+    void run() {
+        bool stopping = false;
+        while (!stopping) {
+            int rc = sys_io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+            if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                std::terminate();
+            }
+
+            // Whatever the resumed coroutines queue goes out in one submission
+            Batch batch(*this);
+            {
+                // Pairs with enqueue(): the kernel orders the request before its completion,
+                // but the lock makes that visible to the memory model (and to sanitizers)
+                std::lock_guard<std::mutex> lock(mutex_);
+            }
+            unsigned head = *cq_head_;
+            unsigned tail = load_acquire(cq_tail_);
+            size_t finished = 0;
+            while (head != tail) {
+                io_uring_cqe cqe = cqes_[head & cq_mask_];
+                store_release(cq_head_, ++head);
+
+                if (cqe.user_data == 0) {
+                    stopping = true;
+                    continue;
+                }
+                complete(*reinterpret_cast<IoRequest*>(cqe.user_data), cqe.res);
+                ++finished;
+            }
+
+            if (finished > 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                inflight_ -= finished;
+                space_.notify_all();
+                if (inflight_ == 0) {
+                    idle_.notify_all();
+                }
+            }
+        }
+    }
+
+    int ring_fd_ = -1;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+    unsigned cq_entries_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable space_;
+    std::condition_variable idle_;
+    unsigned queued_tail_ = 0;
+    unsigned queued_ = 0;
+    size_t inflight_ = 0;
+    bool buffers_registered_ = false;
+    std::thread completer_;
+};
+
+#endif
+
+} // namespace
+
+std::unique_ptr<IoEngine> IoEngine::create(const IoEngineOptions& options) {
+#if PENTALEDGER_HAVE_IO_URING
+    if (!options.force_thread_pool) {
+        if (auto engine = UringEngine::try_create(options.queue_depth)) {
+            return engine;
+        }
+    }
+#endif
+    return std::make_unique<ThreadPoolEngine>(options.threads);
+}
+
+IoEngine& IoEngine::shared() {
+    static std::unique_ptr<IoEngine> engine = create();
+    return *engine;
+}
+
+} // namespace pentaledger
+
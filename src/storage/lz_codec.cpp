@@ -0,0 +1,232 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/lz_codec.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace pentaledger {
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+// Matches stop this far from the end, so the block always ends with literals
+constexpr size_t LAST_LITERALS = 5;
+// Inputs shorter than this are stored as a single run of literals
+constexpr size_t MIN_INPUT = 13;
+constexpr unsigned HASH_BITS = 12;
+
+uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//! \brief Appends sequences to the output, failing once capacity is exceeded
+class Writer {
+public:
+    Writer(uint8_t* out, size_t capacity) : out_(out), end_(out + capacity) {}
+
+    //! \brief Emit a sequence: literals, then a match unless match_length is 0
+    bool sequence(const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length) {
+        // Token, literals, offset and at most one length byte per 255 of either length
+        size_t worst = 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1;
+        if (static_cast<size_t>(end_ - out_) < worst) {
+            return false;
+        }
+
+        uint8_t* token = out_++;
+        size_t match_code = match_length == 0 ? 0 : match_length - MIN_MATCH;
+        *token = static_cast<uint8_t>((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literal_length >= 15) {
+            length_bytes(literal_length - 15);
+        }
+        if (literal_length != 0) {
+            std::memcpy(out_, literals, literal_length);
+        }
+        out_ += literal_length;
+
+        if (match_length != 0) {
+            *out_++ = static_cast<uint8_t>(offset);
+            *out_++ = static_cast<uint8_t>(offset >> 8);
+            if (match_code >= 15) {
+                length_bytes(match_code - 15);
+            }
+        }
+        return true;
+    }
+
+    uint8_t* position() const { return out_; }
+
+private:
+    void length_bytes(size_t n) {
+        for (; n >= 255; n -= 255) {
+            *out_++ = 255;
+        }
+        *out_++ = static_cast<uint8_t>(n);
+    }
+
+    uint8_t* out_;
+    uint8_t* end_;
+};
+
+[[noreturn]] void corrupt(const char* what) {
+    throw DatabaseException(ErrorCode::FILE_CORRUPTED, std::string("Corrupt compressed data: ") + what);
+}
+
+//! \brief Read an extended length: bytes are added while they are 255
+size_t read_length(const uint8_t*& in, const uint8_t* end) {
+    size_t n = 0;
+    uint8_t byte;
+    do {
+        if (in == end) {
+            corrupt("truncated length");
+        }
+        byte = *in++;
+        n += byte;
+    } while (byte == 255);
+    return n;
+}
+
+} // namespace
+
+size_t lz_compress_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+size_t lz_compress(const void* input, size_t length, void* output, size_t capacity) {
+    const auto* src = static_cast<const uint8_t*>(input);
+    Writer writer(static_cast<uint8_t*>(output), capacity);
+
+    size_t anchor = 0;
+    if (length >= MIN_INPUT) {
+        // Positions + 1 of the last occurrence of each hashed 4-byte sequence; 0 is empty
+        uint32_t table[1u << HASH_BITS] = {};
+        const size_t match_limit = length - LAST_LITERALS;
+        const size_t search_limit = length - MIN_INPUT + 1;
+
+        size_t i = 0;
+        while (i < search_limit) {
+            uint32_t value = load32(src + i);
+            uint32_t& slot = table[hash(value)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(i + 1);
+
+            if (candidate == 0 || i + 1 - candidate > MAX_OFFSET || load32(src + candidate - 1) != value) {
+                // Step faster through data that keeps failing to match
+                i += 1 + ((i - anchor) >> 6);
+                continue;
+            }
+            size_t match = candidate - 1;
+
+            // Grow the match backwards into the pending literals, then forwards
+            while (i > anchor && match > 0 && src[i - 1] == src[match - 1]) {
+                --i;
+                --match;
+            }
+            size_t match_length = MIN_MATCH;
+            while (i + match_length < match_limit && src[i + match_length] == src[match + match_length]) {
+                ++match_length;
+            }
+
+            if (!writer.sequence(src + anchor, i - anchor, i - match, match_length)) {
+                return 0;
+            }
+            i += match_length;
+            anchor = i;
+        }
+    }
+
+    if (!writer.sequence(src + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    return static_cast<size_t>(writer.position() - static_cast<uint8_t*>(output));
+}
+
+size_t lz_decompress(const void* input, size_t length, void* output, size_t capacity) {
+    const auto* in = static_cast<const uint8_t*>(input);
+    const uint8_t* const in_end = in + length;
+    auto* const out_start = static_cast<uint8_t*>(output);
+    uint8_t* out = out_start;
+    uint8_t* const out_end = out_start + capacity;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            literal_length += read_length(in, in_end);
+        }
+        if (literal_length > static_cast<size_t>(in_end - in) || literal_length > static_cast<size_t>(out_end - out)) {
+            corrupt("literals overrun");
+        }
+        if (literal_length != 0) {
+            std::memcpy(out, in, literal_length);
+        }
+        in += literal_length;
+        out += literal_length;
+
+        // The last sequence has no match
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            corrupt("truncated offset");
+        }
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > static_cast<size_t>(out - out_start)) {
+            corrupt("offset out of range");
+        }
+
+        size_t match_length = token & 15;
+        if (match_length == 15) {
+            match_length += read_length(in, in_end);
+        }
+        match_length += MIN_MATCH;
+        if (match_length > static_cast<size_t>(out_end - out)) {
+            corrupt("match overrun");
+        }
+
+        const uint8_t* from = out - offset;
+        if (offset >= match_length) {
+            std::memcpy(out, from, match_length);
+        } else if (offset == 1) {
+            std::memset(out, *from, match_length);
+        } else {
+            // Overlapping copy repeats the last offset bytes
+            for (size_t k = 0; k < match_length; ++k) {
+                out[k] = from[k];
+            }
+        }
+        out += match_length;
+    }
+
+    return static_cast<size_t>(out - out_start);
+}
+
+} // namespace pentaledger
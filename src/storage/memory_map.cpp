@@ -0,0 +1,93 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/memory_map.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <sys/mman.h>
+
+namespace pentaledger {
+
+MemoryMap::MemoryMap(MemoryMap&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {
+}
+
+MemoryMap& MemoryMap::operator=(MemoryMap&& other) noexcept {
+    if (this != &other) {
+        unmap();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+MemoryMap::~MemoryMap() {
+    unmap();
+}
+
+void MemoryMap::map(int fd, size_t length) {
+    unmap();
+    void* addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to map " + std::to_string(length) + " bytes: " + std::strerror(errno));
+    }
+    data_ = static_cast<uint8_t*>(addr);
+    size_ = length;
+}
+
+void MemoryMap::remap(int fd, size_t length) {
+    if (data_ == nullptr) {
+        map(fd, length);
+        return;
+    }
+    if (length == size_) {
+        return;
+    }
+#if defined(__linux__)
+    (void)fd;
+    void* addr = ::mremap(data_, size_, length, MREMAP_MAYMOVE);
+    if (addr == MAP_FAILED) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to remap to " + std::to_string(length) + " bytes: " + std::strerror(errno));
+    }
+    data_ = static_cast<uint8_t*>(addr);
+    size_ = length;
+#else
+    map(fd, length);
+#endif
+}
+
+void MemoryMap::sync() {
+    if (data_ != nullptr && ::msync(data_, size_, MS_SYNC) != 0) {
+        throw DatabaseException(ErrorCode::IO_ERROR, std::string("Failed to sync mapping: ") + std::strerror(errno));
+    }
+}
+
+void MemoryMap::unmap() {
+    if (data_ != nullptr) {
+        ::munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+} // namespace pentaledger
+
@@ -0,0 +1,233 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace pentaledger {
+
+const char* metric_name(Metric metric) {
+    switch (metric) {
+        case Metric::RECORD_READ: return "record_read";
+        case Metric::RECORD_WRITE: return "record_write";
+        case Metric::BATCH_READ: return "batch_read";
+        case Metric::BATCH_WRITE: return "batch_write";
+        case Metric::RECORD_ALLOCATE: return "record_allocate";
+        case Metric::HEADER_WRITE: return "header_write";
+        case Metric::FLUSH: return "flush";
+        case Metric::NODE_READ: return "node_read";
+        case Metric::SCAN_READ: return "scan_read";
+        case Metric::PAGE_COMPRESS: return "page_compress";
+        case Metric::PAGE_DECOMPRESS: return "page_decompress";
+        case Metric::RECORD_MOVE: return "record_move";
+        case Metric::COUNT: break;
+    }
+    return "unknown";
+}
+
+uint64_t MetricSnapshot::percentile_ns(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    q = std::clamp(q, 0.0, 1.0);
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(count) + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(LatencyBuckets::upper_bound(i), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+std::string MetricsSnapshot::to_json() const {
+    std::ostringstream out;
+    out << "{\"enabled\":" << (metrics_enabled() ? "true" : "false") << ",\"metrics\":{";
+    for (size_t i = 0; i < METRIC_COUNT; ++i) {
+        const MetricSnapshot& m = metrics[i];
+        if (i > 0) {
+            out << ',';
+        }
+        out << '"' << metric_name(static_cast<Metric>(i)) << "\":{"
+            << "\"count\":" << m.count
+            << ",\"bytes\":" << m.bytes
+            << ",\"mean_ns\":" << m.mean_ns()
+            << ",\"max_ns\":" << m.max_ns
+            << ",\"p50_ns\":" << m.percentile_ns(0.50)
+            << ",\"p90_ns\":" << m.percentile_ns(0.90)
+            << ",\"p99_ns\":" << m.percentile_ns(0.99)
+            << ",\"p999_ns\":" << m.percentile_ns(0.999)
+            << '}';
+    }
+    out << "}}";
+    return out.str();
+}
+
+#if PENTALEDGER_METRICS
+
+namespace {
+
+std::atomic<TraceHook> trace_hook{nullptr};
+
+//! Counters of one metric on one thread.  Only the owning thread writes them, so updates
+//! are plain load/store pairs on relaxed atomics; the atomics only make concurrent
+//! snapshot reads well defined.
+struct MetricCells {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+    std::array<std::atomic<uint64_t>, LatencyBuckets::COUNT> buckets{};
+};
+
+struct ThreadCells {
+    std::array<MetricCells, METRIC_COUNT> metrics;
+};
+
+void bump(std::atomic<uint64_t>& cell, uint64_t n) {
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void add_to(MetricsSnapshot& snapshot, const ThreadCells& cells) {
+    for (size_t m = 0; m < METRIC_COUNT; ++m) {
+        const MetricCells& in = cells.metrics[m];
+        MetricSnapshot& out = snapshot.metrics[m];
+        out.count += in.count.load(std::memory_order_relaxed);
+        out.bytes += in.bytes.load(std::memory_order_relaxed);
+        out.total_ns += in.total_ns.load(std::memory_order_relaxed);
+        out.max_ns = std::max(out.max_ns, in.max_ns.load(std::memory_order_relaxed));
+        for (size_t b = 0; b < LatencyBuckets::COUNT; ++b) {
+            out.buckets[b] += in.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void clear(ThreadCells& cells) {
+    for (MetricCells& m : cells.metrics) {
+        m.count.store(0, std::memory_order_relaxed);
+        m.bytes.store(0, std::memory_order_relaxed);
+        m.total_ns.store(0, std::memory_order_relaxed);
+        m.max_ns.store(0, std::memory_order_relaxed);
+        for (auto& bucket : m.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+//! Every live thread's counters, plus the totals of threads that have exited
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCells*> live;
+    MetricsSnapshot retired;
+};
+
+Registry& registry() {
+    // Never destroyed: threads may still exit after static destructors have run
+    static Registry* instance = new Registry;
+    return *instance;
+}
+
+//! Registers the thread's counters on first use and folds them into the retired totals
+//! when the thread exits
+class ThreadSlot {
+public:
+    ThreadSlot() : cells_(std::make_unique<ThreadCells>()) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.live.push_back(cells_.get());
+    }
+
+    ~ThreadSlot() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        add_to(r.retired, *cells_);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), cells_.get()));
+    }
+
+    ThreadCells& cells() { return *cells_; }
+
+private:
+    std::unique_ptr<ThreadCells> cells_;
+};
+
+} // namespace
+
+void metrics_record(Metric metric, uint64_t start_ns, uint64_t duration_ns, uint64_t bytes) {
+    thread_local ThreadSlot slot;
+    MetricCells& cells = slot.cells().metrics[static_cast<size_t>(metric)];
+
+    bump(cells.count, 1);
+    bump(cells.bytes, bytes);
+    bump(cells.total_ns, duration_ns);
+    if (duration_ns > cells.max_ns.load(std::memory_order_relaxed)) {
+        cells.max_ns.store(duration_ns, std::memory_order_relaxed);
+    }
+    bump(cells.buckets[LatencyBuckets::index(duration_ns)], 1);
+
+    TraceHook hook = trace_hook.load(std::memory_order_acquire);
+    if (hook != nullptr) {
+        hook(metric, start_ns, duration_ns, bytes);
+    }
+}
+
+MetricsSnapshot metrics_snapshot() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    MetricsSnapshot snapshot = r.retired;
+    for (const ThreadCells* cells : r.live) {
+        add_to(snapshot, *cells);
+    }
+    return snapshot;
+}
+
+void metrics_reset() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.retired = MetricsSnapshot{};
+    for (ThreadCells* cells : r.live) {
+        clear(*cells);
+    }
+}
+
+void set_trace_hook(TraceHook hook) {
+    trace_hook.store(hook, std::memory_order_release);
+}
+
+#else
+
+MetricsSnapshot metrics_snapshot() {
+    return MetricsSnapshot{};
+}
+
+void metrics_reset() {
+}
+
+void set_trace_hook(TraceHook) {
+}
+
+#endif
+
+} // namespace pentaledger
+
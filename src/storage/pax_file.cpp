@@ -0,0 +1,415 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/pax_file.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+static_assert(sizeof(PaxFileHeader) <= PaxFile::HEADER_SIZE, "PAX header does not fit its reserved space");
+
+PaxFile PaxFile::create(const std::string& path, std::span<const uint32_t> column_sizes, const PaxFileOptions& options) {
+    if (column_sizes.empty() || column_sizes.size() > PAX_MAX_COLUMNS) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "A PAX file needs between 1 and " + std::to_string(PAX_MAX_COLUMNS) + " columns");
+    }
+
+    uint64_t record_length = 0;
+    for (uint32_t size : column_sizes) {
+        if (size == 0) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "PAX columns must be at least one byte wide");
+        }
+        record_length += size;
+    }
+
+    // A deleted record holds the free-list link, so it must fit one
+    if (record_length < sizeof(RPTR)) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Record length must be at least " + std::to_string(sizeof(RPTR)) + " bytes");
+    }
+
+    uint64_t page_size = (std::max<uint64_t>(options.page_size, 1) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    if (page_size > UINT32_MAX || record_length > page_size) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "PAX page size " + std::to_string(options.page_size) +
+                                " cannot hold a record of " + std::to_string(record_length) + " bytes");
+    }
+
+    PaxFile pf;
+    pf.file_path_ = path;
+    if (!pf.file_.open(path, O_RDWR | O_CREAT | O_TRUNC)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to create PAX file: " + path);
+    }
+
+    uint64_t current_time = static_cast<uint64_t>(std::time(nullptr));
+    pf.header_.magic_number = PLPX_MAGIC;
+    pf.header_.version = PLPX_VERSION;
+    pf.header_.creation_time = current_time;
+    pf.header_.last_update_time = current_time;
+    pf.header_.first_record = 0;
+    pf.header_.next_record = 1;
+    pf.header_.record_length = static_cast<uint32_t>(record_length);
+    pf.header_.column_count = static_cast<uint32_t>(column_sizes.size());
+    pf.header_.page_size = static_cast<uint32_t>(page_size);
+    pf.header_.records_per_page = static_cast<uint32_t>(page_size / record_length);
+    std::copy(column_sizes.begin(), column_sizes.end(), pf.header_.column_sizes);
+
+    pf.compute_layout();
+    pf.write_header();
+    return pf;
+}
+
+PaxFile PaxFile::open(const std::string& path) {
+    PaxFile pf;
+    pf.file_path_ = path;
+    if (!pf.file_.open(path, O_RDWR)) {
+        throw DatabaseException(ErrorCode::FILE_NOT_FOUND, "PAX file not found: " + path);
+    }
+    pf.read_header();
+    return pf;
+}
+
+PaxFile::~PaxFile() {
+    close();
+}
+
+void PaxFile::read_header() {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+
+    if (file_.read_at(&header_, sizeof(header_), 0) != sizeof(header_)) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Failed to read PAX file header");
+    }
+
+    if (header_.magic_number != PLPX_MAGIC) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid magic number - not a PentaLedger PAX file");
+    }
+
+    // Everything below is used to compute offsets, so it has to be consistent
+    uint64_t record_length = 0;
+    bool valid = header_.column_count > 0 && header_.column_count <= PAX_MAX_COLUMNS;
+    for (uint32_t c = 0; valid && c < header_.column_count; ++c) {
+        valid = header_.column_sizes[c] > 0;
+        record_length += header_.column_sizes[c];
+    }
+    valid = valid && record_length == header_.record_length && header_.page_size % PAGE_SIZE == 0 &&
+            header_.records_per_page == header_.page_size / header_.record_length && header_.records_per_page > 0;
+    if (!valid) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Inconsistent PAX file layout: " + file_path_);
+    }
+
+    compute_layout();
+}
+
+void PaxFile::compute_layout() {
+    column_offsets_.resize(header_.column_count);
+    uint64_t offset = 0;
+    for (uint32_t c = 0; c < header_.column_count; ++c) {
+        column_offsets_[c] = offset;
+        offset += static_cast<uint64_t>(header_.records_per_page) * header_.column_sizes[c];
+    }
+}
+
+void PaxFile::write_header() {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::HEADER_WRITE, sizeof(header_));
+
+    header_.last_update_time = static_cast<uint64_t>(std::time(nullptr));
+    file_.write_exact(&header_, sizeof(header_), 0);
+}
+
+uint64_t PaxFile::locate_column(uint64_t page, uint32_t column) const {
+    return HEADER_SIZE + page * header_.page_size + column_offsets_[column];
+}
+
+uint64_t PaxFile::locate_field(RPTR record_number, uint32_t column) const {
+    uint64_t index = record_number - 1;
+    uint64_t slot = index % header_.records_per_page;
+    return locate_column(index / header_.records_per_page, column) + slot * header_.column_sizes[column];
+}
+
+void PaxFile::check_record(RPTR record_number) const {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+
+    if (record_number == 0 || record_number >= header_.next_record) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+}
+
+void PaxFile::transfer(RPTR record_number, uint8_t* buffer, size_t length, bool write) {
+    size_t done = 0;
+    for (uint32_t c = 0; c < header_.column_count && done < length; ++c) {
+        size_t n = std::min<size_t>(header_.column_sizes[c], length - done);
+        uint64_t offset = locate_field(record_number, c);
+        if (write) {
+            file_.write_exact(buffer + done, n, offset);
+        } else {
+            file_.read_exact(buffer + done, n, offset);
+        }
+        done += n;
+    }
+}
+
+void PaxFile::read_record(RPTR record_number, uint8_t* buffer) {
+    check_record(record_number);
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_READ, header_.record_length);
+
+    try {
+        transfer(record_number, buffer, header_.record_length, false);
+    } catch (const DatabaseException&) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to read record at pointer: " + std::to_string(record_number));
+    }
+}
+
+void PaxFile::write_record(RPTR record_number, const uint8_t* buffer) {
+    check_record(record_number);
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_WRITE, header_.record_length);
+
+    try {
+        // transfer only reads from the buffer when writing
+        transfer(record_number, const_cast<uint8_t*>(buffer), header_.record_length, true);
+    } catch (const DatabaseException&) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to write record at pointer: " + std::to_string(record_number));
+    }
+}
+
+void PaxFile::read_field(RPTR record_number, uint32_t column, uint8_t* buffer) {
+    check_record(record_number);
+    if (column >= header_.column_count) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "No column " + std::to_string(column));
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::RECORD_READ, header_.column_sizes[column]);
+
+    file_.read_exact(buffer, header_.column_sizes[column], locate_field(record_number, column));
+}
+
+RPTR PaxFile::new_record(const void* data) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+
+    if (data == nullptr) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Data pointer is null");
+    }
+
+    RPTR record_number;
+    {
+        PENTALEDGER_METRIC_SCOPE(Metric::RECORD_ALLOCATE, 0);
+        if (header_.first_record != 0) {
+            record_number = header_.first_record;
+            RPTR next_free = 0;
+            transfer(record_number, reinterpret_cast<uint8_t*>(&next_free), sizeof(next_free), false);
+            if (next_free >= header_.next_record) {
+                throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list of record " + std::to_string(record_number) + " links past end of file");
+            }
+            header_.first_record = next_free;
+            mark_free(record_number, false);
+        } else {
+            record_number = header_.next_record++;
+
+            // Size the file to whole pages, so that every column of every allocated record
+            // can be read even before it is written.  The new page is a hole until then.
+            uint64_t index = record_number - 1;
+            if (index % header_.records_per_page == 0) {
+                file_.truncate(HEADER_SIZE + (index / header_.records_per_page + 1) * header_.page_size);
+            }
+        }
+    }
+
+    write_record(record_number, static_cast<const uint8_t*>(data));
+    return record_number;
+}
+
+int PaxFile::delete_record(RPTR record_number) {
+    check_record(record_number);
+    // Deleting a free record again would link it into the free list twice
+    if (on_free_list(record_number)) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Record " + std::to_string(record_number) + " is already deleted");
+    }
+
+    // Zero every field, then link the record to the previous head of the free list
+    static constexpr uint8_t zeros[PAGE_SIZE] = {};
+    for (uint32_t c = 0; c < header_.column_count; ++c) {
+        uint64_t offset = locate_field(record_number, c);
+        for (size_t done = 0; done < header_.column_sizes[c]; ) {
+            size_t n = std::min<size_t>(PAGE_SIZE, header_.column_sizes[c] - done);
+            file_.write_exact(zeros, n, offset + done);
+            done += n;
+        }
+    }
+    RPTR next_free = header_.first_record;
+    transfer(record_number, reinterpret_cast<uint8_t*>(&next_free), sizeof(next_free), true);
+    header_.first_record = record_number;
+    mark_free(record_number, true);
+
+    return 0;
+}
+
+bool PaxFile::on_free_list(RPTR record_number) {
+    if (free_slots_ == nullptr) {
+        load_free_slots();
+    }
+    return record_number < free_slots_->size() && (*free_slots_)[record_number];
+}
+
+void PaxFile::load_free_slots() {
+    auto free_slots = std::make_unique<std::vector<bool>>(header_.next_record, false);
+    RPTR record = header_.first_record;
+    for (RPTR steps = 0; record != 0; ++steps) {
+        if (record >= header_.next_record || steps >= header_.next_record || (*free_slots)[record]) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list is corrupt at record " + std::to_string(record));
+        }
+        (*free_slots)[record] = true;
+        RPTR next = 0;
+        transfer(record, reinterpret_cast<uint8_t*>(&next), sizeof(next), false);
+        record = next;
+    }
+    free_slots_ = std::move(free_slots);
+}
+
+void PaxFile::mark_free(RPTR record_number, bool free) {
+    if (free_slots_ == nullptr) {
+        return;
+    }
+    if (record_number >= free_slots_->size()) {
+        if (!free) {
+            return;
+        }
+        free_slots_->resize(record_number + 1, false);
+    }
+    (*free_slots_)[record_number] = free;
+}
+
+PaxColumnScan PaxFile::scan_columns(std::span<const uint32_t> columns) {
+    return PaxColumnScan(*this, columns);
+}
+
+void PaxFile::flush() {
+    if (!file_.is_open()) {
+        return;
+    }
+    PENTALEDGER_METRIC_SCOPE(Metric::FLUSH, 0);
+
+    write_header();
+    file_.sync_data();
+}
+
+void PaxFile::close() {
+    if (file_.is_open()) {
+        write_header();
+        file_.close();
+    }
+}
+
+PaxColumnScan::PaxColumnScan(PaxFile& file, std::span<const uint32_t> columns)
+    : file_(file), columns_(columns.begin(), columns.end()) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    for (uint32_t column : columns_) {
+        if (column >= file_.header_.column_count) {
+            throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "No column " + std::to_string(column));
+        }
+    }
+}
+
+PaxColumnScan::iterator PaxColumnScan::begin() {
+    if (started_) {
+        return iterator(this);
+    }
+    started_ = true;
+
+    const PaxFileHeader& header = file_.header_;
+    const RPTR records = header.next_record - 1;
+    page_count_ = (records + header.records_per_page - 1) / header.records_per_page;
+
+    // Mark the records on the free list; a chain longer than the file has a cycle
+    free_.assign(static_cast<size_t>(header.next_record), false);
+    RPTR record = header.first_record;
+    for (RPTR steps = 0; record != 0; ++steps) {
+        if (record >= header.next_record || steps >= header.next_record) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list is corrupt at record " + std::to_string(record));
+        }
+        free_[record] = true;
+        RPTR next = 0;
+        file_.transfer(record, reinterpret_cast<uint8_t*>(&next), sizeof(next), false);
+        record = next;
+    }
+
+    buffers_.resize(columns_.size());
+    batch_.columns_.resize(columns_.size());
+    for (size_t i = 0; i < columns_.size(); ++i) {
+        buffers_[i].resize(static_cast<size_t>(header.records_per_page) * header.column_sizes[columns_[i]]);
+        batch_.columns_[i] = buffers_[i].data();
+    }
+    batch_.live_.resize(header.records_per_page);
+
+    // Readahead would pull in the columns between the requested ones; the runs that are
+    // wanted are requested explicitly instead
+    ::posix_fadvise(file_.file_.fd(), 0, 0, POSIX_FADV_RANDOM);
+
+    advance();
+    return iterator(this);
+}
+
+void PaxColumnScan::advance() {
+    const PaxFileHeader& header = file_.header_;
+
+    if (page_ >= page_count_) {
+        if (!done_) {
+            done_ = true;
+            ::posix_fadvise(file_.file_.fd(), 0, 0, POSIX_FADV_NORMAL);
+        }
+        return;
+    }
+
+    const RPTR first = page_ * header.records_per_page + 1;
+    const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(header.records_per_page, header.next_record - first));
+
+    for (size_t i = 0; i < columns_.size(); ++i) {
+        size_t length = static_cast<size_t>(count) * header.column_sizes[columns_[i]];
+        PENTALEDGER_METRIC_SCOPE(Metric::SCAN_READ, length);
+        file_.file_.read_exact(buffers_[i].data(), length, file_.locate_column(page_, columns_[i]));
+    }
+
+    // Start pulling in the next page's runs while the caller works through this one
+    if (page_ + 1 < page_count_) {
+        for (uint32_t column : columns_) {
+            ::posix_fadvise(file_.file_.fd(), static_cast<off_t>(file_.locate_column(page_ + 1, column)),
+                            static_cast<off_t>(static_cast<uint64_t>(header.records_per_page) * header.column_sizes[column]),
+                            POSIX_FADV_WILLNEED);
+        }
+    }
+
+    batch_.first_record_ = first;
+    batch_.count_ = count;
+    for (uint32_t row = 0; row < count; ++row) {
+        batch_.live_[row] = free_[first + row] ? 0 : 1;
+    }
+    ++page_;
+}
+
+} // namespace pentaledger
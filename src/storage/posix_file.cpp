@@ -0,0 +1,178 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/posix_file.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace pentaledger {
+
+namespace {
+
+[[noreturn]] void throw_io_error(const std::string& what) {
+    throw DatabaseException(ErrorCode::IO_ERROR, what + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+PosixFile::PosixFile(PosixFile&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1)) {
+}
+
+PosixFile& PosixFile::operator=(PosixFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+}
+
+PosixFile::~PosixFile() {
+    close();
+}
+
+bool PosixFile::open(const std::string& path, int flags, mode_t mode) {
+    close();
+    do {
+        fd_ = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+    } while (fd_ < 0 && errno == EINTR);
+    return fd_ >= 0;
+}
+
+void PosixFile::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+size_t PosixFile::read_at(void* buffer, size_t length, uint64_t offset) const {
+    auto* out = static_cast<uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = ::pread(fd_, out + total, length - total, static_cast<off_t>(offset + total));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw_io_error("Failed to read " + std::to_string(length) + " bytes at offset " + std::to_string(offset));
+        }
+        if (n == 0) {
+            break; // end of file
+        }
+        total += static_cast<size_t>(n);
+    }
+    return total;
+}
+
+void PosixFile::read_exact(void* buffer, size_t length, uint64_t offset) const {
+    if (read_at(buffer, length, offset) != length) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Short read of " + std::to_string(length) + " bytes at offset " + std::to_string(offset));
+    }
+}
+
+void PosixFile::write_exact(const void* buffer, size_t length, uint64_t offset) {
+    const auto* in = static_cast<const uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = ::pwrite(fd_, in + total, length - total, static_cast<off_t>(offset + total));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw_io_error("Failed to write " + std::to_string(length) + " bytes at offset " + std::to_string(offset));
+        }
+        total += static_cast<size_t>(n);
+    }
+}
+
+ssize_t PosixFile::readv_at(const struct iovec* iov, int count, uint64_t offset) const {
+    ssize_t n;
+    do {
+        n = ::preadv(fd_, iov, count, static_cast<off_t>(offset));
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t PosixFile::writev_at(const struct iovec* iov, int count, uint64_t offset) {
+    ssize_t n;
+    do {
+        n = ::pwritev(fd_, iov, count, static_cast<off_t>(offset));
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+uint64_t PosixFile::size() const {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        throw_io_error("Failed to stat file");
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+void PosixFile::truncate(uint64_t length) {
+    if (::ftruncate(fd_, static_cast<off_t>(length)) != 0) {
+        throw_io_error("Failed to resize file to " + std::to_string(length) + " bytes");
+    }
+}
+
+void PosixFile::allocate(uint64_t offset, uint64_t length) {
+#if defined(__linux__)
+    if (::fallocate(fd_, 0, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0) {
+        return;
+    }
+    if (errno != EOPNOTSUPP) {
+        throw_io_error("Failed to allocate " + std::to_string(length) + " bytes at offset " + std::to_string(offset));
+    }
+#endif
+    if (size() < offset + length) {
+        truncate(offset + length);
+    }
+}
+
+void PosixFile::sync_data() {
+#if defined(__APPLE__)
+    int rc = ::fsync(fd_);
+#else
+    int rc = ::fdatasync(fd_);
+#endif
+    if (rc != 0) {
+        throw_io_error("Failed to sync file");
+    }
+}
+
+void PosixFile::set_direct(bool enable) {
+#if defined(__APPLE__)
+    int rc = ::fcntl(fd_, F_NOCACHE, enable ? 1 : 0);
+#else
+    int flags = ::fcntl(fd_, F_GETFL);
+    int rc = flags < 0 ? -1 : ::fcntl(fd_, F_SETFL, enable ? flags | O_DIRECT : flags & ~O_DIRECT);
+#endif
+    if (rc != 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, std::string("Direct I/O is not available for this file: ") + std::strerror(errno));
+    }
+}
+
+} // namespace pentaledger
+
@@ -0,0 +1,248 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/record_scan.hpp"
+#include "../../include/pentaledger/data_file.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include "../../include/pentaledger/metrics.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+namespace {
+
+size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+bool all_zero(const uint8_t* p, size_t length) {
+    // Each byte equals the next, and the first is zero
+    return p[0] == 0 && std::memcmp(p, p + 1, length - 1) == 0;
+}
+
+} // namespace
+
+RecordScan::RecordScan(DataFile& file, const ScanOptions& options, const Snapshot* snapshot)
+    : file_(file), options_(options), snapshot_(snapshot) {
+    if (!file_.is_open()) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "File not open");
+    }
+    if (options_.first_record == 0) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Scan cannot start at record 0");
+    }
+}
+
+RecordScan::iterator RecordScan::begin() {
+    if (started_) {
+        return iterator(this);
+    }
+    started_ = true;
+
+    const uint32_t slot = file_.slot_length_;
+
+    // Stop at the last record that is both allocated and actually in the file
+    const uint64_t file_end = file_.load_file_end();
+    RPTR in_file = file_.slots_before(file_end);
+    last_record_ = std::min<RPTR>(file_.load_next_record() - 1, in_file);
+    if (options_.last_record != 0) {
+        last_record_ = std::min(last_record_, options_.last_record);
+    }
+    if (snapshot_ != nullptr) {
+        last_record_ = std::min(last_record_, snapshot_->next_record() - 1);
+        image_.resize(file_.header_.record_length);
+    }
+    next_record_ = options_.first_record;
+    padding_ = file_.records_per_block_ != 0 ? file_.block_stride_ - file_.records_per_block_ * slot : 0;
+    if (next_record_ > last_record_) {
+        done_ = true;
+        return iterator(this);
+    }
+
+    if (options_.skip_deleted) {
+        load_free_list();
+    }
+
+    uint64_t first_offset = file_.locate_offset(next_record_);
+    end_offset_ = file_.locate_offset(last_record_ + 1);
+
+    if (file_.map_.is_mapped()) {
+        cursor_ = file_.map_.data() + first_offset;
+        verified_ = cursor_;
+        limit_ = file_.map_.data() + end_offset_;
+    } else {
+        // The scan reads the file directly, so cached pages have to be on disk first
+        if (file_.options_.buffer_pool != nullptr) {
+            file_.options_.buffer_pool->flush(file_.pool_file_);
+        }
+
+        block_size_ = round_up(std::max<size_t>(options_.block_size, PAGE_SIZE), PAGE_SIZE);
+        carry_size_ = round_up(slot, PAGE_SIZE);
+        buffer_.reset(static_cast<uint8_t*>(std::aligned_alloc(PAGE_SIZE, carry_size_ + block_size_)));
+        if (!buffer_) {
+            throw DatabaseException(ErrorCode::INSUFFICIENT_SPACE, "Failed to allocate scan buffer");
+        }
+
+        read_offset_ = first_offset / PAGE_SIZE * PAGE_SIZE;
+        skip_ = static_cast<size_t>(first_offset - read_offset_);
+        cursor_ = limit_ = verified_ = buffer_.get() + carry_size_;
+
+        // Offsets in a compressed file are not file offsets, so there is nothing to advise
+        if (!file_.compressed_.is_open()) {
+            ::posix_fadvise(file_.file_.fd(), static_cast<off_t>(read_offset_),
+                            static_cast<off_t>(end_offset_ - read_offset_), POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    advance();
+    return iterator(this);
+}
+
+void RecordScan::advance() {
+    const uint32_t length = file_.header_.record_length;
+    const uint32_t slot = file_.slot_length_;
+    const bool verify = file_.has_record_checksums() && file_.options_.verify_checksums;
+
+    while (next_record_ <= last_record_) {
+        if (static_cast<size_t>(limit_ - cursor_) < slot && !fill()) {
+            break;
+        }
+
+        RPTR record = next_record_++;
+        const uint8_t* data = cursor_;
+        cursor_ += slot;
+        if (padding_ != 0 && record % file_.records_per_block_ == 0) {
+            // The last slot of a block: step over the padding, which may not be read yet
+            size_t room = static_cast<size_t>(limit_ - cursor_);
+            skip_ = padding_ > room ? padding_ - room : 0;
+            cursor_ += std::min(padding_, room);
+        }
+
+        // A record written since the snapshot is read from its kept version.  The block
+        // was read first, and a write keeps the version before it touches the file, so a
+        // slot the block caught mid-write always has one.
+        bool free = options_.skip_deleted && free_[record];
+        if (snapshot_ != nullptr && !file_.versions_->empty() && snapshot_->find(record, image_.data(), free)) {
+            data = image_.data();
+            verified_ = std::max(verified_, cursor_);
+        } else if (verify && data + slot > verified_) {
+            // Deleted slots carry a checksum too, so every slot is verified
+            verify_slots(record, data);
+        }
+
+        if (options_.skip_deleted && (free || all_zero(data, length))) {
+            continue;
+        }
+
+        current_record_ = record;
+        current_ = std::span<const uint8_t>(data, length);
+        return;
+    }
+
+    done_ = true;
+    current_ = {};
+}
+
+void RecordScan::verify_slots(RPTR record, const uint8_t* data) {
+    constexpr size_t BATCH = 64;
+    const uint32_t length = file_.header_.record_length;
+    const uint32_t slot = file_.slot_length_;
+    size_t count = std::min<size_t>({BATCH, static_cast<size_t>(limit_ - data) / slot,
+                                     static_cast<size_t>(last_record_ - record + 1)});
+    if (file_.records_per_block_ != 0) {
+        // Slots are contiguous only up to the end of their block
+        count = std::min<size_t>(count, file_.records_per_block_ - (record - 1) % file_.records_per_block_);
+    }
+
+    uint32_t crcs[BATCH];
+    crc32c_many(data, length, slot, count, crcs);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t stored;
+        std::memcpy(&stored, data + i * slot + length, sizeof(stored));
+        if (crcs[i] != stored) {
+            if (i == 0) {
+                file_.check_record(record, data, stored);
+            }
+            // Report a damaged slot only once the scan reaches it
+            count = i;
+            break;
+        }
+    }
+    verified_ = data + count * slot;
+}
+
+bool RecordScan::fill() {
+    if (!buffer_ || read_offset_ >= end_offset_) {
+        return false;
+    }
+
+    // Move the partial record left over from the last block to just before the new one,
+    // so that it continues into the freshly read bytes
+    uint8_t* block = buffer_.get() + carry_size_;
+    size_t leftover = static_cast<size_t>(limit_ - cursor_);
+    std::memmove(block - leftover, cursor_, leftover);
+
+    size_t want = static_cast<size_t>(std::min<uint64_t>(block_size_, round_up(end_offset_ - read_offset_, PAGE_SIZE)));
+    size_t got;
+    {
+        PENTALEDGER_METRIC_SCOPE(Metric::SCAN_READ, want);
+        got = file_.compressed_.is_open() ? file_.compressed_.read_at(block, want, read_offset_)
+                                          : file_.file_.read_at(block, want, read_offset_);
+    }
+    if (got <= skip_) {
+        return false;
+    }
+    read_offset_ += got;
+
+    // Start pulling in the block after this one while the caller works through this one
+    if (read_offset_ < end_offset_ && !file_.compressed_.is_open()) {
+        ::posix_fadvise(file_.file_.fd(), static_cast<off_t>(read_offset_),
+                        static_cast<off_t>(std::min<uint64_t>(block_size_, end_offset_ - read_offset_)), POSIX_FADV_WILLNEED);
+    }
+
+    cursor_ = verified_ = block - leftover + skip_;
+    limit_ = block + got;
+    skip_ = 0;
+    return true;
+}
+
+void RecordScan::load_free_list() {
+    free_.assign(static_cast<size_t>(last_record_) + 1, false);
+
+    // Follow the links; a chain longer than the file has a cycle.  The allocator lock keeps
+    // other threads from changing the list meanwhile.
+    std::lock_guard<std::mutex> lock(*file_.allocator_mutex_);
+    RPTR record = file_.header_.first_record;
+    for (RPTR steps = 0; record != 0; ++steps) {
+        if (record >= file_.header_.next_record || steps >= file_.header_.next_record) {
+            throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Free list is corrupt at record " + std::to_string(record));
+        }
+        if (record <= last_record_) {
+            free_[record] = true;
+        }
+        RPTR next = 0;
+        file_.read_at(file_.locate_offset(record), &next, sizeof(next));
+        record = next;
+    }
+}
+
+} // namespace pentaledger
+
@@ -0,0 +1,448 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "../../include/pentaledger/scrubber.hpp"
+#include "../../include/pentaledger/btree_file.hpp"
+#include "../../include/pentaledger/compressed_file.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include "../../include/pentaledger/data_file.hpp"
+#include "../../include/pentaledger/posix_file.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Report = std::function<void(const ScrubError&)>;
+
+// Bytes verified per read, rounded down to whole slots or nodes
+constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+// Pages cached while a compressed data file is scrubbed
+constexpr uint32_t SCRUB_CACHE_PAGES = 4;
+
+//! Paces the reads of one pass to a byte rate
+class Throttle {
+public:
+    Throttle(uint64_t bytes_per_second, std::function<bool(Clock::time_point)> sleep)
+        : rate_(bytes_per_second), sleep_(std::move(sleep)), start_(Clock::now()) {}
+
+    //! Account for bytes about to be read, first sleeping until the rate allows them
+    //! \return false if the sleep was interrupted
+    bool consume(uint64_t bytes) {
+        consumed_ += bytes;
+        if (rate_ == 0) {
+            return true;
+        }
+        auto due = start_ + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(consumed_) / static_cast<double>(rate_)));
+        return due <= Clock::now() || sleep_(due);
+    }
+
+    uint64_t consumed() const { return consumed_; }
+
+private:
+    uint64_t rate_;
+    std::function<bool(Clock::time_point)> sleep_;
+    Clock::time_point start_;
+    uint64_t consumed_ = 0;
+};
+
+//! The contents of a data file as DataFile sees them: the file itself, or the
+//! uncompressed pages of a compressed one
+class Contents {
+public:
+    bool open(const std::string& path) {
+        if (!file_.open(path, O_RDONLY)) {
+            return false;
+        }
+        if (CompressedFile::is_compressed(file_.fd())) {
+            compressed_.open(file_.fd(), SCRUB_CACHE_PAGES);
+        }
+        return true;
+    }
+
+    size_t read_at(void* buffer, size_t length, uint64_t offset) {
+        return compressed_.is_open() ? compressed_.read_at(buffer, length, offset) : file_.read_at(buffer, length, offset);
+    }
+
+    uint64_t size() const {
+        return compressed_.is_open() ? compressed_.size() : file_.size();
+    }
+
+    PosixFile& file() { return file_; }
+
+private:
+    PosixFile file_;
+    CompressedFile compressed_;
+};
+
+//! Checks a run of fixed-size units (record slots or nodes) of a file: reads them a chunk
+//! at a time, pacing the reads, and hands each unit to a check that returns an error
+//! message or nothing.  A failing unit is read again before it is reported.  When a chunk
+//! cannot be read the units are retried one at a time, so that only the unreadable ones are
+//! lost; repeats of the same read error are reported once.
+//! \return false if the pass was interrupted
+template <class Read, class Check>
+bool scrub_units(const std::string& path, uint64_t begin, uint64_t end, size_t unit, Throttle& throttle,
+                 const Report& report, Read read, Check check) {
+    const size_t per_chunk = std::max<size_t>(CHUNK_SIZE / unit, 1);
+    std::vector<uint8_t> buffer(per_chunk * unit);
+    std::string last_read_error;
+
+    auto verify = [&](uint64_t offset, const uint8_t* data) {
+        std::string problem = check(offset, data);
+        if (problem.empty()) {
+            return;
+        }
+        std::vector<uint8_t> again(unit);
+        if (read(again.data(), unit, offset) == unit && check(offset, again.data()).empty()) {
+            return;
+        }
+        report({path, offset, problem});
+    };
+
+    for (uint64_t offset = begin; offset + unit <= end; ) {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(per_chunk, (end - offset) / unit));
+        size_t length = count * unit;
+        if (!throttle.consume(length)) {
+            return false;
+        }
+
+        try {
+            size_t got = read(buffer.data(), length, offset);
+            for (size_t i = 0; i < got / unit; ++i) {
+                verify(offset + i * unit, buffer.data() + i * unit);
+            }
+            if (got < length) {
+                report({path, offset + got, "File ends before the last unit"});
+                return true;
+            }
+        } catch (const DatabaseException&) {
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t at = offset + i * unit;
+                try {
+                    if (read(buffer.data(), unit, at) == unit) {
+                        verify(at, buffer.data());
+                    }
+                } catch (const DatabaseException& e) {
+                    if (e.what() != last_read_error) {
+                        last_read_error = e.what();
+                        report({path, at, last_read_error});
+                    }
+                }
+            }
+        }
+        offset += length;
+    }
+    return true;
+}
+
+bool verify_data_file(const std::string& path, Throttle& throttle, const Report& report) {
+    Contents contents;
+    DataFileHeader copies[PLDB_HEADER_COPIES] = {};
+    size_t got = 0;
+    try {
+        if (!contents.open(path)) {
+            report({path, 0, "Failed to open data file"});
+            return true;
+        }
+        got = contents.read_at(copies, sizeof(copies), 0);
+    } catch (const DatabaseException& e) {
+        // A damaged compressed file header or page table, or an unreadable header
+        report({path, 0, e.what()});
+        return true;
+    }
+
+    // The current header copy of a version 3 file; the other may be mid-write
+    int current = current_data_file_header(copies, got);
+    const DataFileHeader& header = copies[std::max(current, 0)];
+    if (got < PLDB_V1_HEADER_SIZE || header.magic_number != PLDB_MAGIC) {
+        report({path, 0, "Not a PentaLedger data file"});
+        return true;
+    }
+    uint64_t header_size = PLDB_V1_HEADER_SIZE;
+    uint32_t slot = header.record_length;
+    bool checksums = false;
+    bool aligned = false;
+    if (header.version >= 2) {
+        if (header.version >= 3 ? current < 0 : (got < sizeof(header) || header.checksum != data_file_header_checksum(header))) {
+            report({path, 0, "Data file header checksum mismatch"});
+            return true;
+        }
+        aligned = header.version >= 3 && (header.flags & PLDB_BLOCK_ALIGNED) != 0;
+        header_size = aligned ? PLDB_BLOCK_SIZE : header.version >= 3 ? PLDB_V3_HEADER_SIZE : sizeof(header);
+        checksums = (header.flags & PLDB_RECORD_CHECKSUMS) != 0;
+        slot += checksums ? sizeof(uint32_t) : 0;
+    }
+    if (slot < sizeof(RPTR)) {
+        report({path, 0, "Invalid record length " + std::to_string(header.record_length)});
+        return true;
+    }
+
+    // A block-aligned file packs whole slots into each block and pads the rest
+    const uint64_t per_block = aligned ? std::max<uint64_t>(PLDB_BLOCK_SIZE / slot, 1) : 1;
+    const uint64_t stride = aligned ? (per_block * slot + PLDB_BLOCK_SIZE - 1) / PLDB_BLOCK_SIZE * PLDB_BLOCK_SIZE : slot;
+    auto locate = [&](uint64_t index) {
+        return header_size + index / per_block * stride + index % per_block * slot;
+    };
+
+    // Without record checksums the records are still read, which checks that they can be
+    // and, for a compressed file, verifies every extent they live in
+    uint64_t end = contents.size();
+    if (checksums && header.next_record > 0) {
+        end = std::min<uint64_t>(end, locate(header.next_record - 1));
+    }
+    const uint32_t length = header.record_length;
+    auto read = [&](uint8_t* buffer, size_t n, uint64_t offset) { return contents.read_at(buffer, n, offset); };
+    auto check = [&](uint64_t offset, const uint8_t* data) -> std::string {
+        if (!checksums) {
+            return {};
+        }
+        uint32_t stored;
+        std::memcpy(&stored, data + length, sizeof(stored));
+        if (crc32c(data, length) == stored) {
+            return {};
+        }
+        uint64_t within = offset - header_size;
+        return "Checksum mismatch in record " + std::to_string(within / stride * per_block + within % stride / slot + 1);
+    };
+    if (!aligned) {
+        return scrub_units(path, header_size, end, slot, throttle, report, read, check);
+    }
+
+    // Whole blocks a block at a time, then the slots of a final partial block
+    uint64_t blocks_end = end < header_size ? header_size : header_size + (end - header_size) / stride * stride;
+    bool finished = scrub_units(path, header_size, blocks_end, stride, throttle, report, read,
+        [&](uint64_t offset, const uint8_t* data) -> std::string {
+            for (uint64_t i = 0; i < per_block; ++i) {
+                std::string problem = check(offset + i * slot, data + i * slot);
+                if (!problem.empty()) {
+                    return problem;
+                }
+            }
+            return {};
+        });
+    return finished && scrub_units(path, blocks_end, end, slot, throttle, report, read, check);
+}
+
+bool verify_btree_file(const std::string& path, Throttle& throttle, const Report& report) {
+    PosixFile file;
+    if (!file.open(path, O_RDONLY)) {
+        report({path, 0, "Failed to open B-tree file"});
+        return true;
+    }
+
+    BTreeHeaderCopy copies[BTREE_HEADER_COPIES] = {};
+    size_t got = 0;
+    try {
+        got = file.read_at(copies, sizeof(copies), 0);
+        if (got < sizeof(BTreeHeader)) {
+            report({path, 0, "B-tree file is shorter than its header"});
+            return true;
+        }
+    } catch (const DatabaseException& e) {
+        report({path, 0, e.what()});
+        return true;
+    }
+
+    // A file with header copies needs one valid copy; an older one has a single header
+    uint64_t header_size = BTREE_HEADER_SIZE;
+    bool aligned = false;
+    int current = current_btree_header(copies, got);
+    if (current >= 0) {
+        aligned = (copies[current].flags & BTREE_BLOCK_ALIGNED) != 0;
+        header_size = aligned ? BTREE_BLOCK_SIZE : BTREE_HEADER_SIZE;
+    } else {
+        const BTreeHeader& header = copies[0].header;
+        if (copies[0].magic == PLBT_MAGIC) {
+            report({path, 0, "B-tree file header checksum mismatch"});
+        } else {
+            header_size = sizeof(BTreeHeader);
+            if (header.checksum != 0 && header.checksum != btree_header_checksum(header)) {
+                report({path, 0, "B-tree file header checksum mismatch"});
+            }
+        }
+    }
+
+    // Nodes written before checksums existed have a zero checksum and are only read
+    const uint64_t per_block = aligned ? BTREE_BLOCK_SIZE / sizeof(BTreeNode) : 1;
+    const uint64_t stride = aligned ? BTREE_BLOCK_SIZE : sizeof(BTreeNode);
+    auto read = [&](uint8_t* buffer, size_t n, uint64_t offset) { return file.read_at(buffer, n, offset); };
+    auto check = [&](uint64_t offset, const uint8_t* data) -> std::string {
+        BTreeNode node;
+        std::memcpy(&node, data, sizeof(node));
+        if (node.checksum == 0 || node.checksum == btree_node_checksum(node)) {
+            return {};
+        }
+        uint64_t within = offset - header_size;
+        return "Checksum mismatch in B-tree node " + std::to_string(within / stride * per_block + within % stride / sizeof(BTreeNode) + 1);
+    };
+    const uint64_t end = file.size();
+    if (!aligned) {
+        return scrub_units(path, header_size, end, sizeof(BTreeNode), throttle, report, read, check);
+    }
+
+    // Whole blocks a block at a time, then the nodes of a final partial block
+    uint64_t blocks_end = end < header_size ? header_size : header_size + (end - header_size) / stride * stride;
+    bool finished = scrub_units(path, header_size, blocks_end, stride, throttle, report, read,
+        [&](uint64_t offset, const uint8_t* data) -> std::string {
+            for (uint64_t i = 0; i < per_block; ++i) {
+                std::string problem = check(offset + i * sizeof(BTreeNode), data + i * sizeof(BTreeNode));
+                if (!problem.empty()) {
+                    return problem;
+                }
+            }
+            return {};
+        });
+    return finished && scrub_units(path, blocks_end, end, sizeof(BTreeNode), throttle, report, read, check);
+}
+
+std::vector<ScrubError> scrub_now(bool (*scrub)(const std::string&, Throttle&, const Report&),
+                                  const std::string& path, uint64_t bytes_per_second) {
+    std::vector<ScrubError> errors;
+    Throttle throttle(bytes_per_second, [](Clock::time_point due) {
+        std::this_thread::sleep_until(due);
+        return true;
+    });
+    scrub(path, throttle, [&](const ScrubError& error) { errors.push_back(error); });
+    return errors;
+}
+
+} // namespace
+
+Scrubber::Scrubber(const ScrubberOptions& options) : options_(options) {}
+
+Scrubber::~Scrubber() {
+    stop();
+}
+
+void Scrubber::add_data_file(const std::string& path) {
+    add(path, Kind::DATA_FILE);
+}
+
+void Scrubber::add_btree_file(const std::string& path) {
+    add(path, Kind::BTREE_FILE);
+}
+
+void Scrubber::add(const std::string& path, Kind kind) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Target& target : targets_) {
+        if (target.path == path) {
+            target.kind = kind;
+            return;
+        }
+    }
+    targets_.push_back({path, kind});
+}
+
+void Scrubber::remove(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::erase_if(targets_, [&](const Target& target) { return target.path == path; });
+}
+
+void Scrubber::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (thread_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    thread_ = std::thread(&Scrubber::run, this);
+}
+
+void Scrubber::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable()) {
+            return;
+        }
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+bool Scrubber::running() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return thread_.joinable() && !stopping_;
+}
+
+ScrubStats Scrubber::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+bool Scrubber::wait_until(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return !wake_.wait_until(lock, deadline, [this] { return stopping_; });
+}
+
+void Scrubber::run() {
+    Report report = [this](const ScrubError& error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.errors;
+        }
+        if (options_.on_error) {
+            options_.on_error(error);
+        }
+    };
+
+    for (;;) {
+        std::vector<Target> targets;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            targets = targets_;
+        }
+
+        Throttle throttle(options_.bytes_per_second, [this](Clock::time_point due) { return wait_until(due); });
+        for (const Target& target : targets) {
+            uint64_t before = throttle.consumed();
+            bool finished = target.kind == Kind::DATA_FILE ? verify_data_file(target.path, throttle, report)
+                                                           : verify_btree_file(target.path, throttle, report);
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.bytes += throttle.consumed() - before;
+            if (!finished || stopping_) {
+                return;
+            }
+            ++stats_.files;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.passes;
+        }
+
+        if (!wait_until(Clock::now() + options_.pass_interval)) {
+            return;
+        }
+    }
+}
+
+std::vector<ScrubError> Scrubber::scrub_data_file(const std::string& path, uint64_t bytes_per_second) {
+    return scrub_now(&verify_data_file, path, bytes_per_second);
+}
+
+std::vector<ScrubError> Scrubber::scrub_btree_file(const std::string& path, uint64_t bytes_per_second) {
+    return scrub_now(&verify_btree_file, path, bytes_per_second);
+}
+
+} // namespace pentaledger
@@ -0,0 +1,229 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "../../include/pentaledger/version_store.hpp"
+#include "../../include/pentaledger/data_file.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace pentaledger {
+
+uint64_t VersionStore::begin_write(bool& keep_images) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t sequence = ++last_sequence_;
+    keep_images = !snapshots_.empty() || opening_ > 0;
+    in_flight_.emplace(sequence, keep_images);
+    if (!keep_images) {
+        ++writes_without_images_;
+    }
+    return sequence;
+}
+
+void VersionStore::end_write(uint64_t sequence) {
+    bool collect_now = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = in_flight_.find(sequence);
+        if (it == in_flight_.end()) {
+            return;
+        }
+        if (!it->second && --writes_without_images_ == 0) {
+            idle_.notify_all();
+        }
+        in_flight_.erase(it);
+
+        // Images kept for snapshots that have all closed since would otherwise wait for
+        // the next snapshot to close
+        collect_now = snapshots_.empty() && opening_ == 0 && !empty();
+    }
+    if (collect_now) {
+        collect();
+    }
+}
+
+void VersionStore::keep(RPTR record, uint64_t sequence, bool free, const uint8_t* data, size_t length) {
+    Version version{sequence, free, std::vector<uint8_t>(data, data + length)};
+
+    // mutex_ before a shard lock, as in collect()
+    std::lock_guard<std::mutex> lock(mutex_);
+    Shard& shard = shards_[record % SHARDS];
+    std::unique_lock<std::shared_mutex> shard_lock(shard.mutex);
+    std::vector<Version>& versions = shard.records[record];
+    prune(versions);
+    versions.push_back(std::move(version));
+    versions_.fetch_add(1, std::memory_order_release);
+    bytes_.fetch_add(length, std::memory_order_relaxed);
+}
+
+bool VersionStore::find(RPTR record, uint64_t snapshot, uint8_t* buffer, size_t length, bool& free) const {
+    const Shard& shard = shards_[record % SHARDS];
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(record);
+    if (it == shard.records.end()) {
+        return false;
+    }
+
+    // Images are kept in the order of the writes that replaced them; the first one replaced
+    // after the snapshot is what the snapshot sees
+    for (const Version& version : it->second) {
+        if (version.superseded_by > snapshot) {
+            std::memcpy(buffer, version.data.data(), std::min(length, version.data.size()));
+            free = version.free;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t VersionStore::open_snapshot() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++opening_;
+    idle_.wait(lock, [this] { return writes_without_images_ == 0; });
+    --opening_;
+
+    uint64_t sequence = stable();
+    snapshots_.insert(sequence);
+    return sequence;
+}
+
+void VersionStore::close_snapshot(uint64_t sequence) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = snapshots_.find(sequence);
+        if (it == snapshots_.end()) {
+            return;
+        }
+        snapshots_.erase(it);
+    }
+    collect();
+}
+
+uint64_t VersionStore::stable() const {
+    return in_flight_.empty() ? last_sequence_ : in_flight_.begin()->first - 1;
+}
+
+void VersionStore::prune(std::vector<Version>& versions) {
+    // A snapshot S reads the first image superseded after S, so an image superseded at
+    // sequence B, following one superseded at A, serves exactly the snapshots in [A, B).
+    // Dropping it leaves the ones around it serving the same snapshots as before.
+    const uint64_t future = stable();
+    uint64_t previous = 0;
+    auto out = versions.begin();
+    for (auto it = versions.begin(); it != versions.end(); ++it) {
+        auto reader = snapshots_.lower_bound(previous);
+        previous = it->superseded_by;
+        if (it->superseded_by > future || (reader != snapshots_.end() && *reader < it->superseded_by)) {
+            if (out != it) {
+                *out = std::move(*it);
+            }
+            ++out;
+        } else {
+            versions_.fetch_sub(1, std::memory_order_relaxed);
+            bytes_.fetch_sub(it->data.size(), std::memory_order_relaxed);
+        }
+    }
+    versions.erase(out, versions.end());
+}
+
+void VersionStore::collect() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Shard& shard : shards_) {
+        std::unique_lock<std::shared_mutex> shard_lock(shard.mutex);
+        for (auto it = shard.records.begin(); it != shard.records.end(); ) {
+            prune(it->second);
+            it = it->second.empty() ? shard.records.erase(it) : std::next(it);
+        }
+    }
+}
+
+VersionStats VersionStore::stats() const {
+    VersionStats stats;
+    stats.versions = versions_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.snapshots = snapshots_.size();
+    stats.sequence = last_sequence_;
+    return stats;
+}
+
+Snapshot::Snapshot(Snapshot&& other) noexcept
+    : file_(std::exchange(other.file_, nullptr)), sequence_(other.sequence_), next_record_(other.next_record_) {}
+
+Snapshot& Snapshot::operator=(Snapshot&& other) noexcept {
+    if (this != &other) {
+        release();
+        file_ = std::exchange(other.file_, nullptr);
+        sequence_ = other.sequence_;
+        next_record_ = other.next_record_;
+    }
+    return *this;
+}
+
+Snapshot::~Snapshot() {
+    release();
+}
+
+void Snapshot::release() {
+    if (file_ != nullptr) {
+        file_->versions_->close_snapshot(sequence_);
+        file_ = nullptr;
+    }
+}
+
+bool Snapshot::find(RPTR record, uint8_t* buffer, bool& free) const {
+    return file_->versions_->find(record, sequence_, buffer, file_->header_.record_length, free);
+}
+
+void Snapshot::read_record(RPTR record_number, uint8_t* buffer) const {
+    if (file_ == nullptr) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Snapshot is closed");
+    }
+    if (record_number == 0 || record_number >= next_record_) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Invalid record pointer");
+    }
+
+    // The file first, then the kept images: a write that began after the snapshot keeps
+    // the image before it touches the file, so if the file read saw any of that write (or
+    // failed its checksum halfway through it) the image is there now
+    bool free = false;
+    try {
+        if (file_->locate_offset(record_number) + file_->slot_length_ > file_->load_file_end()) {
+            // Allocated but not yet written
+            std::memset(buffer, 0, file_->header_.record_length);
+        } else {
+            file_->read_slot(record_number, buffer);
+        }
+    } catch (const DatabaseException&) {
+        if (find(record_number, buffer, free)) {
+            return;
+        }
+        throw;
+    }
+    find(record_number, buffer, free);
+}
+
+RecordScan Snapshot::scan(const ScanOptions& options) const {
+    if (file_ == nullptr) {
+        throw DatabaseException(ErrorCode::INVALID_ARGUMENT, "Snapshot is closed");
+    }
+    return RecordScan(*file_, options, this);
+}
+
+} // namespace pentaledger
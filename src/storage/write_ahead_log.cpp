@@ -0,0 +1,267 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../include/pentaledger/write_ahead_log.hpp"
+#include "../../include/pentaledger/crc32c.hpp"
+#include "../../include/pentaledger/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+
+namespace pentaledger {
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const WriteAheadLogOptions& options)
+    : path_(path), options_(options) {
+    if (!file_.open(path, O_RDWR | O_CREAT)) {
+        throw DatabaseException(ErrorCode::IO_ERROR, "Failed to open write-ahead log: " + path);
+    }
+
+    uint64_t size = file_.size();
+    if (size < sizeof(LogHeader)) {
+        LogHeader header{PLWL_MAGIC, PLWL_VERSION, 0};
+        file_.truncate(0);
+        file_.write_exact(&header, sizeof(header), 0);
+        file_.sync_data();
+        log_end_ = sizeof(LogHeader);
+        return;
+    }
+
+    LogHeader header;
+    file_.read_exact(&header, sizeof(header), 0);
+    if (header.magic != PLWL_MAGIC) {
+        throw DatabaseException(ErrorCode::FILE_CORRUPTED, "Invalid magic number - not a PentaLedger log file: " + path);
+    }
+
+    // Find the end of the valid records and drop anything after it (a torn tail)
+    Lsn last = 0;
+    log_end_ = scan([&](const RecordHeader& record, const uint8_t*) {
+        last = std::max(last, record.lsn);
+    });
+    if (log_end_ < size) {
+        file_.truncate(log_end_);
+        file_.sync_data();
+    }
+
+    next_lsn_ = last + 1;
+    durable_lsn_ = last;
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    synced_.wait(lock, [this] { return !syncing_; });
+    try {
+        write_buffer_locked();
+    } catch (const DatabaseException&) {
+        // Nothing more can be done for uncommitted records here
+    }
+}
+
+uint64_t WriteAheadLog::file_key(const std::string& path) {
+    std::string normal = std::filesystem::absolute(path).lexically_normal().string();
+
+    // 64-bit FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (unsigned char c : normal) {
+        hash ^= c;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append_write(uint64_t file_key, uint64_t offset, const void* data, uint32_t length) {
+    return append(RECORD_WRITE, file_key, offset, data, length);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append_truncate(uint64_t file_key, uint64_t length) {
+    return append(RECORD_TRUNCATE, file_key, length, nullptr, 0);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append(uint16_t type, uint64_t file_key, uint64_t offset, const void* data, uint32_t length) {
+    RecordHeader record;
+    std::memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.length = length;
+    record.file_key = file_key;
+    record.offset = offset;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    record.lsn = next_lsn_++;
+
+    const auto* header_bytes = reinterpret_cast<const uint8_t*>(&record);
+    uint32_t crc = crc32c(header_bytes + sizeof(record.checksum), sizeof(record) - sizeof(record.checksum));
+    record.checksum = crc32c(data, length, crc);
+
+    buffer_.insert(buffer_.end(), header_bytes, header_bytes + sizeof(record));
+    if (length > 0) {
+        const auto* payload = static_cast<const uint8_t*>(data);
+        buffer_.insert(buffer_.end(), payload, payload + length);
+    }
+    ++stats_.appends;
+    return record.lsn;
+}
+
+void WriteAheadLog::commit(Lsn lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++stats_.commits;
+    lsn = std::min(lsn, next_lsn_ - 1);
+
+    ++waiting_;
+    joined_.notify_one();
+
+    while (durable_lsn_ < lsn) {
+        if (syncing_) {
+            // Another committer is leading a sync; it may or may not cover this lsn
+            synced_.wait(lock);
+            continue;
+        }
+
+        // Lead the group: give others up to commit_delay to join, then write and
+        // sync everything buffered so far on their behalf.
+        syncing_ = true;
+        if (options_.commit_delay.count() > 0) {
+            auto deadline = std::chrono::steady_clock::now() + options_.commit_delay;
+            joined_.wait_until(lock, deadline, [this] { return waiting_ >= options_.group_size; });
+        }
+
+        std::vector<uint8_t> batch;
+        batch.swap(buffer_);
+        uint64_t offset = log_end_;
+        log_end_ += batch.size();
+        Lsn target = next_lsn_ - 1;
+
+        lock.unlock();
+        try {
+            file_.write_exact(batch.data(), batch.size(), offset);
+            file_.sync_data();
+        } catch (const DatabaseException&) {
+            // Put the batch back so a later commit can retry it
+            lock.lock();
+            log_end_ = offset;
+            buffer_.insert(buffer_.begin(), batch.begin(), batch.end());
+            syncing_ = false;
+            --waiting_;
+            synced_.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        durable_lsn_ = target;
+        syncing_ = false;
+        ++stats_.syncs;
+        stats_.bytes_written += batch.size();
+        synced_.notify_all();
+    }
+
+    --waiting_;
+}
+
+void WriteAheadLog::commit() {
+    commit(last_lsn());
+}
+
+void WriteAheadLog::replay(uint64_t file_key,
+                           const std::function<void(uint64_t, const uint8_t*, uint32_t)>& write,
+                           const std::function<void(uint64_t)>& truncate) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    synced_.wait(lock, [this] { return !syncing_; });
+
+    // Buffered records are part of the file's history too; replaying without them
+    // would roll the file back to its last commit.
+    write_buffer_locked();
+
+    scan([&](const RecordHeader& record, const uint8_t* payload) {
+        if (record.file_key != file_key) {
+            return;
+        }
+        if (record.type == RECORD_WRITE) {
+            write(record.offset, payload, record.length);
+        } else {
+            truncate(record.offset);
+        }
+    });
+}
+
+void WriteAheadLog::checkpoint() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    synced_.wait(lock, [this] { return !syncing_; });
+
+    buffer_.clear();
+    file_.truncate(sizeof(LogHeader));
+    file_.sync_data();
+    log_end_ = sizeof(LogHeader);
+    durable_lsn_ = next_lsn_ - 1;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::last_lsn() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_lsn_ - 1;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::durable_lsn() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return durable_lsn_;
+}
+
+WriteAheadLog::Stats WriteAheadLog::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+uint64_t WriteAheadLog::scan(const std::function<void(const RecordHeader&, const uint8_t*)>& visit) const {
+    const uint64_t size = file_.size();
+    uint64_t pos = sizeof(LogHeader);
+    RecordHeader record;
+    std::vector<uint8_t> payload;
+
+    while (pos + sizeof(record) <= size) {
+        file_.read_exact(&record, sizeof(record), pos);
+        if ((record.type != RECORD_WRITE && record.type != RECORD_TRUNCATE) ||
+            pos + sizeof(record) + record.length > size) {
+            break;
+        }
+
+        payload.resize(record.length);
+        file_.read_exact(payload.data(), record.length, pos + sizeof(record));
+
+        const auto* header_bytes = reinterpret_cast<const uint8_t*>(&record);
+        uint32_t crc = crc32c(header_bytes + sizeof(record.checksum), sizeof(record) - sizeof(record.checksum));
+        if (crc32c(payload.data(), record.length, crc) != record.checksum) {
+            break;
+        }
+
+        visit(record, payload.data());
+        pos += sizeof(record) + record.length;
+    }
+
+    return pos;
+}
+
+void WriteAheadLog::write_buffer_locked() {
+    if (buffer_.empty()) {
+        return;
+    }
+    file_.write_exact(buffer_.data(), buffer_.size(), log_end_);
+    log_end_ += buffer_.size();
+    stats_.bytes_written += buffer_.size();
+    buffer_.clear();
+}
+
+} // namespace pentaledger
+
@@ -19,28 +19,40 @@
 
 #include <gtest/gtest.h>
 #include "pentaledger/btree_file.hpp"
+#include "pentaledger/btree_builder.hpp"
+#include "pentaledger/node_search.hpp"
+#include "pentaledger/metrics.hpp"
+#include <algorithm>
 #include <filesystem>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
 
 using namespace pentaledger;
 
-// Test helper class to access protected methods (if needed in future)
-// class TestableBTreeFile : public BTreeFile {
-// public:
-//     using BTreeFile::locate_offset;
-//     using BTreeFile::initialize;
-//     
-//     // Inherit move constructor and assignment
-//     TestableBTreeFile(TestableBTreeFile&&) = default;
-//     TestableBTreeFile& operator=(TestableBTreeFile&&) = default;
-//     
-//     // Use the static create method to construct
-//     static TestableBTreeFile create(const std::string& path, int key_length) {
-//         BTreeFile btf = BTreeFile::create(path, key_length);
-//         // Move the BTreeFile into TestableBTreeFile
-//         return std::move(*static_cast<TestableBTreeFile*>(&btf));
-//     }
-// };
+// Test helper class to access protected methods
+class TestableBTreeFile : public BTreeFile {
+public:
+    using BTreeFile::locate_offset;
+    using BTreeFile::initialize;
+    
+    // Inherit move constructor and assignment
+    TestableBTreeFile(TestableBTreeFile&&) = default;
+    TestableBTreeFile& operator=(TestableBTreeFile&&) = default;
+    
+    // Use the static create method to construct
+    static TestableBTreeFile create(const std::string& path, int key_length) {
+        BTreeFile btf = BTreeFile::create(path, key_length);
+        // Move the BTreeFile into TestableBTreeFile
+        return std::move(*static_cast<TestableBTreeFile*>(&btf));
+    }
+};
 
 class BTreeFileTest : public ::testing::Test {
 protected:
@@ -227,31 +239,31 @@ TEST_F(BTreeFileTest, MaxKeyPerNode) {
     }
 }
 
-// Test locate_offset protected method (commented out since locate_offset is not implemented)
-// TEST_F(BTreeFileTest, LocateOffset) {
-//     // Use TestableBTreeFile to access protected locate_offset method
-//     TestableBTreeFile testable_btf = TestableBTreeFile::create(test_file_, KEY_LENGTH);
-//     
-//     size_t header_size = sizeof(BTreeHeader);
-//     size_t node_size = sizeof(BTreeNode);
-//     
-//     // Test for node pointer 1
-//     RPTR node_1 = 1;
-//     size_t offset_1 = testable_btf.locate_offset(node_1);
-//     size_t expected_1 = header_size + ((node_1 - 1) * node_size);
-//     EXPECT_EQ(offset_1, expected_1) << "Node 1: offset calculation mismatch";
-//     
-//     // Test for node pointer 2
-//     RPTR node_2 = 2;
-//     size_t offset_2 = testable_btf.locate_offset(node_2);
-//     size_t expected_2 = header_size + ((node_2 - 1) * node_size);
-//     EXPECT_EQ(offset_2, expected_2) << "Node 2: offset calculation mismatch";
-//     
-//     // Verify that offset_2 is exactly node_size more than offset_1
-//     EXPECT_EQ(offset_2, offset_1 + node_size) << "Offsets should differ by node_size for consecutive node pointers";
-//     
-//     testable_btf.close();
-// }
+// Test locate_offset protected method
+TEST_F(BTreeFileTest, LocateOffset) {
+    // Use TestableBTreeFile to access protected locate_offset method
+    TestableBTreeFile testable_btf = TestableBTreeFile::create(test_file_, KEY_LENGTH);
+    
+    size_t header_size = BTREE_HEADER_SIZE;
+    size_t node_size = sizeof(BTreeNode);
+    
+    // Test for node pointer 1
+    RPTR node_1 = 1;
+    size_t offset_1 = testable_btf.locate_offset(node_1);
+    size_t expected_1 = header_size + ((node_1 - 1) * node_size);
+    EXPECT_EQ(offset_1, expected_1) << "Node 1: offset calculation mismatch";
+    
+    // Test for node pointer 2
+    RPTR node_2 = 2;
+    size_t offset_2 = testable_btf.locate_offset(node_2);
+    size_t expected_2 = header_size + ((node_2 - 1) * node_size);
+    EXPECT_EQ(offset_2, expected_2) << "Node 2: offset calculation mismatch";
+    
+    // Verify that offset_2 is exactly node_size more than offset_1
+    EXPECT_EQ(offset_2, offset_1 + node_size) << "Offsets should differ by node_size for consecutive node pointers";
+    
+    testable_btf.close();
+}
 
 // Test error handling for invalid file path
 TEST_F(BTreeFileTest, InvalidFilePath) {
@@ -290,3 +302,748 @@ TEST_F(BTreeFileTest, CreateOverwritesExisting) {
     }
 }
 
+// Test node write/read round trip and persistence
+TEST_F(BTreeFileTest, WriteAndReadNode) {
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+        
+        BTreeNode node;
+        std::memset(&node, 0, sizeof(node));
+        node.key_count = 3;
+        node.right_sibling = 7;
+        std::memcpy(node.keyspace, "abc", 3);
+        btf.write_node(1, node);
+        
+        // Nodes are allocated in order; skipping ahead is rejected
+        EXPECT_THROW(btf.write_node(3, node), DatabaseException);
+        EXPECT_THROW(btf.read_node(2, node), DatabaseException);
+        btf.close();
+    }
+    
+    BTreeFile btf = BTreeFile::open(test_file_);
+    BTreeNode node;
+    btf.read_node(1, node);
+    EXPECT_EQ(node.key_count, 3);
+    EXPECT_EQ(node.right_sibling, 7u);
+    EXPECT_EQ(std::memcmp(node.keyspace, "abc", 3), 0);
+    btf.close();
+}
+
+
+TEST_F(BTreeFileTest, OlderSingleHeaderFilesStillOpen) {
+    // A file from before header copies: one header, then the nodes
+    BTreeHeader header{};
+    header.key_length = KEY_LENGTH;
+    header.max_key_per_node = 10;
+    header.root_node = 1;
+    header.checksum = btree_header_checksum(header);
+    BTreeNode node{};
+    node.key_count = 3;
+    node.checksum = btree_node_checksum(node);
+    {
+        std::ofstream out(test_file_, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(&node), sizeof(node));
+    }
+
+    {
+        BTreeFile btf = BTreeFile::open(test_file_);
+        EXPECT_EQ(btf.root_node(), 1u);
+        EXPECT_EQ(btf.max_key_per_node(), 10);
+        BTreeNode read{};
+        btf.read_node(1, read);
+        EXPECT_EQ(read.key_count, 3);
+        read.key_count = 4;
+        btf.write_node(2, read);
+        btf.flush();
+    }
+
+    // It keeps its layout
+    EXPECT_EQ(std::filesystem::file_size(test_file_), sizeof(BTreeHeader) + 2 * sizeof(BTreeNode));
+    BTreeFile btf = BTreeFile::open(test_file_);
+    BTreeNode read{};
+    btf.read_node(2, read);
+    EXPECT_EQ(read.key_count, 4);
+}
+
+TEST_F(BTreeFileTest, GrowthExtentPreallocatesAndTrims) {
+    BTreeFileOptions options;
+    options.growth_extent = 64 * 1024;
+    BTreeNode node{};
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH, options);
+        for (int i = 1; i <= 10; ++i) {
+            node.key_count = i;
+            btf.write_node(static_cast<RPTR>(i), node);
+        }
+    }
+
+    // The file is a whole extent, but the header counts only the nodes written
+    EXPECT_EQ(std::filesystem::file_size(test_file_), options.growth_extent);
+    {
+        BTreeFile btf = BTreeFile::open(test_file_, options);
+        BTreeNode read{};
+        btf.read_node(10, read);
+        EXPECT_EQ(read.key_count, 10);
+        EXPECT_THROW(btf.read_node(11, read), DatabaseException);
+
+        // Appends continue in the allocated space, past which the file grows by an extent
+        for (int i = 11; i <= 200; ++i) {
+            node.key_count = i;
+            btf.write_node(static_cast<RPTR>(i), node);
+        }
+    }
+    EXPECT_EQ(std::filesystem::file_size(test_file_), 2 * options.growth_extent);
+
+    // Trimmed on close, the file ends with its last node
+    options.trim_on_close = true;
+    {
+        BTreeFile btf = BTreeFile::open(test_file_, options);
+        BTreeNode read{};
+        btf.read_node(200, read);
+        EXPECT_EQ(read.key_count, 200);
+    }
+    EXPECT_EQ(std::filesystem::file_size(test_file_), BTREE_HEADER_SIZE + 200 * sizeof(BTreeNode));
+}
+
+TEST_F(BTreeFileTest, BuildFromSortedKeys) {
+    // Even keys only, so that the odd ones between them are absent
+    const int count = 5000;
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    std::string keys;
+    std::vector<RPTR> records;
+    for (int i = 0; i < count; ++i) {
+        keys += make_key(2 * i);
+        records.push_back(static_cast<RPTR>(i + 100));
+    }
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+        btf.build(keys.data(), records);
+        EXPECT_EQ(btf.header().leftmost_node, 1u);
+        EXPECT_GT(btf.header().root_node, btf.header().rightmost_node);
+
+        // Only an empty tree can be built
+        EXPECT_THROW(btf.build(keys.data(), records), DatabaseException);
+    }
+
+    BTreeFile btf = BTreeFile::open(test_file_);
+    for (int i = 0; i < count; ++i) {
+        EXPECT_EQ(btf.locate(make_key(2 * i).c_str()), static_cast<RPTR>(i + 100)) << i;
+    }
+    EXPECT_EQ(btf.locate(make_key(1).c_str()), INVALID_RPTR);
+    EXPECT_EQ(btf.locate(make_key(2 * count).c_str()), INVALID_RPTR);
+    EXPECT_EQ(btf.locate(std::string(KEY_LENGTH, '\0').c_str()), INVALID_RPTR);
+
+    // The leaves are linked left to right
+    BTreeNode node{};
+    RPTR leaf = btf.header().leftmost_node;
+    int seen = 0;
+    while (leaf != 0) {
+        btf.read_node(leaf, node);
+        EXPECT_EQ(node.nonleaf, 0);
+        seen += node.key_count;
+        leaf = node.right_sibling;
+    }
+    EXPECT_EQ(seen, count);
+
+    // A built tree takes inserts and deletes like any other
+    btf.insert_key(make_key(1).c_str(), 1);
+    btf.delete_key(make_key(0).c_str());
+    EXPECT_EQ(btf.locate(make_key(1).c_str()), 1u);
+    EXPECT_EQ(btf.locate(make_key(0).c_str()), INVALID_RPTR);
+    EXPECT_EQ(btf.locate(make_key(2).c_str()), 101u);
+}
+
+TEST_F(BTreeFileTest, BuildKeepsEqualKeysFindable) {
+    // 40 equal keys between two others, across several leaves
+    std::string keys = std::string(KEY_LENGTH, 'a');
+    std::vector<RPTR> records = {1};
+    for (RPTR r = 10; r < 50; ++r) {
+        keys += std::string(KEY_LENGTH, 'm');
+        records.push_back(r);
+    }
+    keys += std::string(KEY_LENGTH, 'z');
+    records.push_back(2);
+    const std::string m(KEY_LENGTH, 'm');
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+        btf.build(keys.data(), records);
+        EXPECT_NE(btf.header_flags() & BTREE_DUPLICATE_KEYS, 0u);
+    }
+
+    BTreeFile btf = BTreeFile::open(test_file_);
+    for (RPTR r = 10; r < 50; ++r) {
+        ASSERT_EQ(btf.locate(m.c_str()), r);
+        btf.delete_key(m.c_str());
+    }
+    EXPECT_EQ(btf.locate(m.c_str()), INVALID_RPTR);
+    EXPECT_EQ(btf.locate(std::string(KEY_LENGTH, 'a').c_str()), 1u);
+    EXPECT_EQ(btf.locate(std::string(KEY_LENGTH, 'z').c_str()), 2u);
+}
+
+TEST_F(BTreeFileTest, BuildRejectsUnsortedKeys) {
+    std::string keys = std::string(KEY_LENGTH, 'b') + std::string(KEY_LENGTH, 'a');
+    std::vector<RPTR> records = {1, 2};
+    BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+    EXPECT_THROW(btf.build(keys.data(), records), DatabaseException);
+    EXPECT_EQ(btf.locate(std::string(KEY_LENGTH, 'a').c_str()), INVALID_RPTR);
+}
+
+namespace {
+
+// Walks the tree under node_ptr, checking key order, entry counts and parent links, and
+// appends its leaf entries to leaves
+void check_subtree(BTreeFile& btf, RPTR node_ptr, RPTR parent, const std::string* low, const std::string* high,
+                   std::vector<std::pair<std::string, RPTR>>& leaves) {
+    const size_t key_length = static_cast<size_t>(btf.key_length());
+    const size_t entry_size = key_length + sizeof(RPTR);
+    BTreeNode node{};
+    btf.read_node(node_ptr, node);
+    ASSERT_EQ(node.parent_node, parent) << "node " << node_ptr;
+    ASSERT_LE(node.key_count, btf.max_key_per_node());
+    if (parent != 0) {
+        ASSERT_GE(node.key_count, btf.max_key_per_node() / 2) << "node " << node_ptr;
+    }
+
+    std::vector<std::string> keys;
+    std::vector<RPTR> rptrs;
+    for (int i = 0; i < node.key_count; ++i) {
+        keys.emplace_back(node.keyspace + i * entry_size, key_length);
+        RPTR rptr;
+        std::memcpy(&rptr, node.keyspace + i * entry_size + key_length, sizeof(rptr));
+        rptrs.push_back(rptr);
+        ASSERT_TRUE(i == 0 || keys[i - 1] < keys[i]);
+        ASSERT_TRUE(low == nullptr || *low <= keys[i]);
+        ASSERT_TRUE(high == nullptr || keys[i] < *high);
+    }
+    if (!node.nonleaf) {
+        for (int i = 0; i < node.key_count; ++i) {
+            leaves.emplace_back(keys[i], rptrs[i]);
+        }
+        return;
+    }
+    check_subtree(btf, node.key0, node_ptr, low, node.key_count > 0 ? &keys[0] : high, leaves);
+    for (int i = 0; i < node.key_count; ++i) {
+        check_subtree(btf, rptrs[i], node_ptr, &keys[i], i + 1 < node.key_count ? &keys[i + 1] : high, leaves);
+    }
+}
+
+} // namespace
+
+TEST_F(BTreeFileTest, InsertAndDeleteKeepTheTreeBalanced) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    const int count = 4000;
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) {
+        order[i] = (i * 7919) % count;  // a permutation, so that splits happen all over
+    }
+    std::map<std::string, RPTR> expected;
+    auto check = [&](BTreeFile& btf) {
+        std::vector<std::pair<std::string, RPTR>> leaves;
+        if (btf.root_node() != 0) {
+            check_subtree(btf, btf.root_node(), 0, nullptr, nullptr, leaves);
+        }
+        EXPECT_EQ(leaves, (std::vector<std::pair<std::string, RPTR>>(expected.begin(), expected.end())));
+
+        // The leaf chain visits the same entries left to right
+        size_t chained = 0;
+        RPTR previous = 0;
+        for (RPTR leaf = btf.leftmost_node(); leaf != 0;) {
+            BTreeNode node{};
+            btf.read_node(leaf, node);
+            EXPECT_EQ(node.left_sibling, previous);
+            chained += node.key_count;
+            previous = leaf;
+            leaf = node.right_sibling;
+        }
+        EXPECT_EQ(previous, btf.rightmost_node());
+        EXPECT_EQ(chained, expected.size());
+    };
+
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+        EXPECT_EQ(btf.max_key_per_node(), static_cast<int>(sizeof(BTreeNode::keyspace) / (KEY_LENGTH + sizeof(RPTR))));
+        for (int n : order) {
+            btf.insert_key(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+            expected[make_key(n)] = static_cast<RPTR>(n + 1);
+        }
+        EXPECT_THROW(btf.insert_key(make_key(17).c_str(), 1), DatabaseException);
+        check(btf);
+    }
+
+    BTreeFile btf = BTreeFile::open(test_file_);
+    for (int n = 0; n < count; ++n) {
+        ASSERT_EQ(btf.locate(make_key(n).c_str()), static_cast<RPTR>(n + 1));
+    }
+
+    // Delete three quarters, in a different order, then put some back into the freed nodes
+    for (int i = 0; i < count; ++i) {
+        int n = order[(i * 13) % count];
+        if (n % 4 != 0) {
+            btf.delete_key(make_key(n).c_str());
+            expected.erase(make_key(n));
+        }
+    }
+    EXPECT_THROW(btf.delete_key(make_key(1).c_str()), DatabaseException);
+    check(btf);
+    EXPECT_NE(btf.header().raised_node, 0u);
+    EXPECT_EQ(btf.locate(make_key(1).c_str()), INVALID_RPTR);
+    EXPECT_EQ(btf.locate(make_key(8).c_str()), 9u);
+
+    const auto size = std::filesystem::file_size(test_file_);
+    for (int n = 1; n < count; n += 4) {
+        btf.insert_key(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+        expected[make_key(n)] = static_cast<RPTR>(n + 1);
+    }
+    check(btf);
+    EXPECT_EQ(std::filesystem::file_size(test_file_), size);
+
+    // Emptied, the tree has no nodes left in use
+    for (auto& [key, record] : std::map<std::string, RPTR>(expected)) {
+        btf.delete_key(key.c_str());
+        expected.erase(key);
+    }
+    check(btf);
+    EXPECT_EQ(btf.root_node(), 0u);
+    EXPECT_EQ(btf.locate(make_key(0).c_str()), INVALID_RPTR);
+    btf.insert_key(make_key(5).c_str(), 6);
+    EXPECT_EQ(btf.locate(make_key(5).c_str()), 6u);
+}
+
+TEST_F(BTreeFileTest, PinnedUpperLevelsLeaveOneReadPerLookup) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    const int count = 3000;
+    BTreeFileOptions options;
+    options.pin_upper_levels = true;
+    size_t pinned = 0;
+    {
+        BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH, options);
+        for (int i = 0; i < count; ++i) {
+            int n = (i * 7919) % count;
+            btf.insert_key(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+        }
+        pinned = btf.pinned_nodes();
+        EXPECT_GT(pinned, 1u);
+        EXPECT_GE(btf.pinned_memory(), pinned * static_cast<size_t>(btf.max_key_per_node()) * (KEY_LENGTH + sizeof(RPTR)));
+    }
+
+    // Reopened, the same non-leaf nodes are read back in
+    BTreeFile btf = BTreeFile::open(test_file_, options);
+    EXPECT_EQ(btf.pinned_nodes(), pinned);
+    metrics_reset();
+    for (int n = 0; n < count; n += 7) {
+        ASSERT_EQ(btf.locate(make_key(n).c_str()), static_cast<RPTR>(n + 1));
+    }
+    if (metrics_enabled()) {
+        EXPECT_EQ(metrics_snapshot()[Metric::NODE_READ].count, static_cast<uint64_t>((count + 6) / 7));
+    }
+
+    // Splits, merges and a collapsing root keep the pinned levels current
+    for (int n = 0; n < count; ++n) {
+        if (n % 10 != 0) {
+            btf.delete_key(make_key(n).c_str());
+        }
+    }
+    for (int n = count; n < count + 500; ++n) {
+        btf.insert_key(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+    }
+    for (int n = 0; n < count + 500; ++n) {
+        bool present = n >= count || n % 10 == 0;
+        ASSERT_EQ(btf.locate(make_key(n).c_str()), present ? static_cast<RPTR>(n + 1) : INVALID_RPTR) << n;
+    }
+    size_t now_pinned = btf.pinned_nodes();
+    btf.close();
+    BTreeFile reopened = BTreeFile::open(test_file_, options);
+    EXPECT_EQ(reopened.pinned_nodes(), now_pinned);
+    EXPECT_EQ(BTreeFile::open(test_file_).pinned_nodes(), 0u);
+}
+
+TEST_F(BTreeFileTest, CursorsWalkRangesBothWays) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    auto number = [](const char* key) { return std::atoi(key + 3); };
+    BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+
+    BTreeCursor cursor = btf.cursor();
+    EXPECT_FALSE(cursor.valid());
+    EXPECT_FALSE(cursor.first());
+    EXPECT_FALSE(cursor.last());
+    EXPECT_FALSE(cursor.lower_bound(make_key(1).c_str()));
+    EXPECT_FALSE(cursor.next());
+    EXPECT_FALSE(cursor.prev());
+
+    // Even keys only, so that odd ones fall between them; enough for a few hundred leaves
+    const int count = 2000;
+    for (int i = 0; i < count; ++i) {
+        int n = (i * 7919) % count * 2;
+        btf.insert_key(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+    }
+
+    int expected = 0;
+    for (bool more = cursor.first(); more; more = cursor.next()) {
+        ASSERT_EQ(number(cursor.key()), expected);
+        ASSERT_EQ(cursor.record(), static_cast<RPTR>(expected + 1));
+        expected += 2;
+    }
+    EXPECT_EQ(expected, 2 * count);
+    EXPECT_FALSE(cursor.next());
+    ASSERT_TRUE(cursor.prev());
+    EXPECT_EQ(number(cursor.key()), 2 * count - 2);
+
+    expected = 2 * count - 2;
+    for (bool more = cursor.last(); more; more = cursor.prev()) {
+        ASSERT_EQ(number(cursor.key()), expected);
+        expected -= 2;
+    }
+    EXPECT_EQ(expected, -2);
+    ASSERT_TRUE(cursor.next());
+    EXPECT_EQ(number(cursor.key()), 0);
+
+    EXPECT_TRUE(cursor.seek(make_key(502).c_str()));
+    EXPECT_EQ(cursor.record(), 503u);
+    EXPECT_FALSE(cursor.seek(make_key(501).c_str()));
+    EXPECT_EQ(number(cursor.key()), 502);
+    ASSERT_TRUE(cursor.upper_bound(make_key(502).c_str()));
+    EXPECT_EQ(number(cursor.key()), 504);
+    ASSERT_TRUE(cursor.upper_bound(make_key(503).c_str()));
+    EXPECT_EQ(number(cursor.key()), 504);
+    EXPECT_FALSE(cursor.lower_bound(make_key(2 * count).c_str()));
+    ASSERT_TRUE(cursor.prev());
+    EXPECT_EQ(number(cursor.key()), 2 * count - 2);
+
+    // A range [from, to) forwards, then backwards from its upper end
+    const std::string from = make_key(1001);
+    const std::string to = make_key(2001);
+    int forward = 0;
+    for (cursor.lower_bound(from.c_str()); cursor.valid() && std::memcmp(cursor.key(), to.c_str(), KEY_LENGTH) < 0; cursor.next()) {
+        ++forward;
+    }
+    int backward = 0;
+    cursor.lower_bound(to.c_str());
+    while (cursor.prev() && std::memcmp(cursor.key(), from.c_str(), KEY_LENGTH) >= 0) {
+        ++backward;
+    }
+    EXPECT_EQ(forward, 500);
+    EXPECT_EQ(backward, 500);
+
+    // Across the gap left by deleting a run of keys spanning many leaves
+    for (int n = 1000; n < 3000; n += 2) {
+        btf.delete_key(make_key(n).c_str());
+    }
+    ASSERT_TRUE(cursor.lower_bound(make_key(1000).c_str()));
+    EXPECT_EQ(number(cursor.key()), 3000);
+    ASSERT_TRUE(cursor.prev());
+    EXPECT_EQ(number(cursor.key()), 998);
+}
+
+TEST_F(BTreeFileTest, BuilderStreamsSortedInputIntoFilledLeaves) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+    const int max_keys = btf.max_key_per_node();
+
+    // Every count from an empty tree up to a few levels, so each level ends every way
+    for (int count : {0, 1, max_keys, max_keys + 1, 2 * max_keys + 1, 5000}) {
+        for (double fill : {1.0, 0.7}) {
+            BTreeBuildOptions options;
+            options.fill_factor = fill;
+            BTreeBuilder builder(btf, options);
+            for (int n = 0; n < count; ++n) {
+                builder.add(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+            }
+            EXPECT_EQ(builder.finish(), static_cast<uint64_t>(count));
+            EXPECT_EQ(builder.runs(), 0u);
+            EXPECT_THROW(builder.add(make_key(count).c_str(), 1), DatabaseException);
+
+            std::vector<std::pair<std::string, RPTR>> leaves;
+            if (count == 0) {
+                EXPECT_EQ(btf.root_node(), 0u);
+                continue;
+            }
+            check_subtree(btf, btf.root_node(), 0, nullptr, nullptr, leaves);
+            ASSERT_EQ(leaves.size(), static_cast<size_t>(count)) << count << " at " << fill;
+            for (int n = 0; n < count; ++n) {
+                ASSERT_EQ(leaves[n].second, static_cast<RPTR>(n + 1));
+            }
+
+            // Leaves are filled to the fill factor, and linked in order from leftmost_node
+            BTreeNode node{};
+            int seen = 0;
+            int full = 0;
+            for (RPTR leaf = btf.leftmost_node(); leaf != 0; leaf = node.right_sibling) {
+                btf.read_node(leaf, node);
+                EXPECT_EQ(node.nonleaf, 0);
+                full += node.key_count == static_cast<int>(std::lround(fill * max_keys)) ? 1 : 0;
+                seen += node.key_count;
+                if (node.right_sibling == 0) {
+                    EXPECT_EQ(leaf, btf.rightmost_node());
+                }
+            }
+            EXPECT_EQ(seen, count);
+            if (count == 5000) {
+                EXPECT_GT(full, count / max_keys / 2);
+            }
+
+            // Emptied again for the next build, which reuses its nodes
+            for (int n = 0; n < count; ++n) {
+                btf.delete_key(make_key(n).c_str());
+            }
+        }
+    }
+
+    // Only an empty tree can be built, with a sensible fill factor
+    btf.insert_key(make_key(1).c_str(), 1);
+    EXPECT_THROW(BTreeBuilder{btf}, DatabaseException);
+    btf.delete_key(make_key(1).c_str());
+    BTreeBuildOptions sparse;
+    sparse.fill_factor = 0.2;
+    EXPECT_THROW(BTreeBuilder(btf, sparse), DatabaseException);
+}
+
+TEST_F(BTreeFileTest, BuilderMergeSortsUnsortedInputInBoundedMemory) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    const int count = 6000;
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    // A sorted start long enough to reach the leaves before the first key out of order
+    std::shuffle(order.begin() + 1000, order.end(), std::mt19937(5));
+
+    BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+    BTreeBuildOptions options;
+    options.memory_limit = 8192;  // runs of about a hundred keys, merged two at a time
+    options.fill_factor = 0.8;
+    size_t runs = 0;
+    {
+        BTreeBuilder builder(btf, options);
+        for (int n : order) {
+            builder.add(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+        }
+        EXPECT_EQ(builder.finish(), static_cast<uint64_t>(count));
+        runs = builder.runs();
+    }
+    EXPECT_GT(runs, 50u);
+    for (const auto& entry : std::filesystem::directory_iterator(".")) {
+        EXPECT_EQ(entry.path().filename().string().find(test_file_ + ".run"), std::string::npos) << entry.path();
+    }
+
+    std::vector<std::pair<std::string, RPTR>> leaves;
+    check_subtree(btf, btf.root_node(), 0, nullptr, nullptr, leaves);
+    ASSERT_EQ(leaves.size(), static_cast<size_t>(count));
+    for (int n = 0; n < count; ++n) {
+        ASSERT_EQ(leaves[n].first, make_key(n));
+        ASSERT_EQ(leaves[n].second, static_cast<RPTR>(n + 1));
+    }
+
+    // The tree takes inserts and deletes like any other, and reopens the same
+    btf.insert_key(make_key(count).c_str(), count + 1);
+    btf.delete_key(make_key(0).c_str());
+    btf.close();
+    BTreeFile reopened = BTreeFile::open(test_file_);
+    EXPECT_EQ(reopened.locate(make_key(count).c_str()), static_cast<RPTR>(count + 1));
+    EXPECT_EQ(reopened.locate(make_key(0).c_str()), INVALID_RPTR);
+    EXPECT_EQ(reopened.locate(make_key(3333).c_str()), 3334u);
+}
+
+TEST_F(BTreeFileTest, CursorsLandOnTheFirstOfEqualKeys) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    // Keys 0 to 99, with key 50 forty times over: records 1000 to 1039
+    BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+    {
+        BTreeBuilder builder(btf);
+        for (int n = 0; n < 100; ++n) {
+            for (RPTR r = 1000; n == 50 && r < 1040; ++r) {
+                builder.add(make_key(n).c_str(), r);
+            }
+            if (n != 50) {
+                builder.add(make_key(n).c_str(), static_cast<RPTR>(n + 1));
+            }
+        }
+        builder.finish();
+    }
+    const std::string key50 = make_key(50);
+
+    // [50, 51) holds the whole run, forwards and backwards
+    BTreeCursor cursor = btf.cursor();
+    ASSERT_TRUE(cursor.seek(key50.c_str()));
+    std::vector<RPTR> run;
+    for (; cursor.valid() && std::memcmp(cursor.key(), key50.data(), KEY_LENGTH) == 0; cursor.next()) {
+        run.push_back(cursor.record());
+    }
+    ASSERT_EQ(run.size(), 40u);
+    for (RPTR r = 0; r < 40; ++r) {
+        EXPECT_EQ(run[r], 1000 + r);
+    }
+    ASSERT_TRUE(cursor.valid());
+    EXPECT_EQ(cursor.record(), 52u);
+
+    ASSERT_TRUE(cursor.upper_bound(make_key(49).c_str()));
+    EXPECT_EQ(cursor.record(), 1000u);
+    ASSERT_TRUE(cursor.prev());
+    EXPECT_EQ(cursor.record(), 50u);
+    ASSERT_TRUE(cursor.upper_bound(key50.c_str()));
+    EXPECT_EQ(cursor.record(), 52u);
+    int backward = 0;
+    while (cursor.prev() && std::memcmp(cursor.key(), key50.data(), KEY_LENGTH) == 0) {
+        EXPECT_EQ(cursor.record(), static_cast<RPTR>(1039 - backward));
+        ++backward;
+    }
+    EXPECT_EQ(backward, 40);
+    ASSERT_TRUE(cursor.lower_bound(make_key(49).c_str()));
+    EXPECT_EQ(cursor.record(), 50u);
+}
+
+TEST_F(BTreeFileTest, BuilderFindsTheFirstOfEqualKeysAcrossLeaves) {
+    auto make_key = [](int n) {
+        std::string key(KEY_LENGTH, '\0');
+        std::snprintf(key.data(), key.size(), "key%08d", n);
+        return key;
+    };
+    // Keys 0 to 59, with 40 of key 30: records 1000 to 1039, a run across several leaves
+    std::vector<std::pair<int, RPTR>> pairs;
+    for (int n = 0; n < 60; ++n) {
+        if (n == 30) {
+            for (RPTR r = 1000; r < 1040; ++r) {
+                pairs.emplace_back(n, r);
+            }
+        } else {
+            pairs.emplace_back(n, static_cast<RPTR>(n + 1));
+        }
+    }
+    const std::string key30 = make_key(30);
+
+    for (bool sorted : {true, false}) {
+        std::filesystem::remove(test_file_);
+        std::vector<std::pair<int, RPTR>> input = pairs;
+        if (!sorted) {
+            // Shuffled, but with the equal keys still in record order, which the sort keeps
+            std::shuffle(input.begin(), input.end(), std::mt19937(3));
+            std::vector<RPTR> run;
+            for (auto& [n, r] : input) {
+                if (n == 30) {
+                    run.push_back(r);
+                }
+            }
+            std::sort(run.begin(), run.end());
+            size_t next = 0;
+            for (auto& [n, r] : input) {
+                if (n == 30) {
+                    r = run[next++];
+                }
+            }
+        }
+        {
+            BTreeFile btf = BTreeFile::create(test_file_, KEY_LENGTH);
+            BTreeBuildOptions options;
+            options.memory_limit = 2048;
+            BTreeBuilder builder(btf, options);
+            for (auto [n, r] : input) {
+                builder.add(make_key(n).c_str(), r);
+            }
+            EXPECT_EQ(builder.finish(), pairs.size());
+            EXPECT_EQ(builder.runs() != 0, !sorted);
+        }
+
+        BTreeFile btf = BTreeFile::open(test_file_);
+        EXPECT_NE(btf.header_flags() & BTREE_DUPLICATE_KEYS, 0u);
+        BTreeNode node{};
+        std::vector<RPTR> run;
+        int leaves_with_run = 0;
+        for (RPTR leaf = btf.leftmost_node(); leaf != 0; leaf = node.right_sibling) {
+            btf.read_node(leaf, node);
+            bool has = false;
+            for (int i = 0; i < node.key_count; ++i) {
+                if (std::memcmp(node.keyspace + i * (KEY_LENGTH + sizeof(RPTR)), key30.data(), KEY_LENGTH) == 0) {
+                    RPTR r;
+                    std::memcpy(&r, node.keyspace + i * (KEY_LENGTH + sizeof(RPTR)) + KEY_LENGTH, sizeof(r));
+                    run.push_back(r);
+                    has = true;
+                }
+            }
+            leaves_with_run += has ? 1 : 0;
+        }
+        ASSERT_EQ(run.size(), 40u);
+        EXPECT_TRUE(std::is_sorted(run.begin(), run.end()));
+        EXPECT_GT(leaves_with_run, 2);
+
+        // The first of the run is found, and removed first
+        for (RPTR r = 1000; r < 1040; ++r) {
+            ASSERT_EQ(btf.locate(key30.c_str()), r);
+            EXPECT_THROW(btf.insert_key(key30.c_str(), 1), DatabaseException);
+            btf.delete_key(key30.c_str());
+        }
+        EXPECT_EQ(btf.locate(key30.c_str()), INVALID_RPTR);
+        EXPECT_THROW(btf.delete_key(key30.c_str()), DatabaseException);
+        btf.insert_key(key30.c_str(), 31);
+        for (int n = 0; n < 60; ++n) {
+            ASSERT_EQ(btf.locate(make_key(n).c_str()), static_cast<RPTR>(n + 1)) << n;
+        }
+        std::vector<std::pair<std::string, RPTR>> leaves;
+        check_subtree(btf, btf.root_node(), 0, nullptr, nullptr, leaves);
+        EXPECT_EQ(leaves.size(), 60u);
+    }
+}
+
+TEST(NodeSearchTest, KernelsMatchBinarySearch) {
+    std::mt19937_64 rng(7);
+    for (size_t key_length : {1, 3, 4, 5, 8, 16, 20, 80}) {
+        const size_t stride = key_length + sizeof(RPTR);
+        const int capacity = static_cast<int>(sizeof(BTreeNode::keyspace) / stride);
+        for (int count = 0; count <= capacity; ++count) {
+            // Sorted keys from a small alphabet, so that targets often fall between or on them
+            std::vector<std::string> keys(count);
+            for (std::string& key : keys) {
+                key.resize(key_length);
+                for (char& c : key) {
+                    c = static_cast<char>("\x00\x01\x7f\x80\xff"[rng() % 5]);
+                }
+            }
+            std::sort(keys.begin(), keys.end());
+            BTreeNode node{};
+            for (int i = 0; i < count; ++i) {
+                std::memcpy(node.keyspace + i * stride, keys[i].data(), key_length);
+                std::memset(node.keyspace + i * stride + key_length, 0xAB, sizeof(RPTR));
+            }
+
+            std::vector<std::string> targets = keys;
+            for (int t = 0; t < 8; ++t) {
+                std::string target(key_length, '\0');
+                for (char& c : target) {
+                    c = static_cast<char>(rng());
+                }
+                targets.push_back(target);
+            }
+            for (const std::string& target : targets) {
+                int expected = static_cast<int>(std::lower_bound(keys.begin(), keys.end(), target) - keys.begin());
+                ASSERT_EQ(node_lower_bound(node.keyspace, count, key_length, stride, target.data()), expected)
+                    << node_search_kernel() << ", key length " << key_length << ", " << count << " keys";
+                ASSERT_EQ(node_lower_bound_portable(node.keyspace, count, key_length, stride, target.data()), expected);
+            }
+        }
+    }
+}
@@ -0,0 +1,431 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include "pentaledger/buffer_pool.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/btree_file.hpp"
+#include "pentaledger/scrubber.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+
+class BufferPoolTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_buffer_pool.dat";
+        if (std::filesystem::exists(test_file_)) {
+            std::filesystem::remove(test_file_);
+        }
+    }
+    
+    void TearDown() override {
+        if (std::filesystem::exists(test_file_)) {
+            std::filesystem::remove(test_file_);
+        }
+    }
+    
+    // Open a scratch file of the given number of pages, page n filled with byte n
+    PosixFile make_file(int pages) {
+        PosixFile file;
+        EXPECT_TRUE(file.open(test_file_, O_RDWR | O_CREAT | O_TRUNC));
+        std::vector<uint8_t> page(PAGE_SIZE);
+        for (int i = 0; i < pages; ++i) {
+            std::memset(page.data(), i, PAGE_SIZE);
+            file.write_exact(page.data(), PAGE_SIZE, static_cast<uint64_t>(i) * PAGE_SIZE);
+        }
+        return file;
+    }
+    
+    std::string test_file_;
+};
+
+TEST_F(BufferPoolTest, HitAndMissCounters) {
+    PosixFile file = make_file(4);
+    BufferPool pool(8 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    {
+        PageHandle page = pool.fetch(id, 2);
+        EXPECT_EQ(page.data()[0], 2);
+        EXPECT_EQ(page.data()[PAGE_SIZE - 1], 2);
+    }
+    {
+        PageHandle page = pool.fetch(id, 2);
+        EXPECT_EQ(page.page(), 2u);
+    }
+    
+    BufferPool::Stats stats = pool.stats();
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.resident_pages, 1u);
+    EXPECT_EQ(stats.capacity_pages, 8u);
+    
+    pool.unregister_file(id);
+    EXPECT_EQ(pool.stats().resident_pages, 0u);
+}
+
+TEST_F(BufferPoolTest, EvictsWithinBudget) {
+    PosixFile file = make_file(16);
+    BufferPool pool(4 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    for (PageId p = 0; p < 16; ++p) {
+        PageHandle page = pool.fetch(id, p);
+        EXPECT_EQ(page.data()[17], static_cast<uint8_t>(p));
+    }
+    
+    BufferPool::Stats stats = pool.stats();
+    EXPECT_EQ(stats.resident_pages, 4u);
+    EXPECT_EQ(stats.evictions, 12u);
+    EXPECT_EQ(stats.misses, 16u);
+    
+    pool.unregister_file(id);
+}
+
+TEST_F(BufferPoolTest, PinnedPagesAreNotEvicted) {
+    PosixFile file = make_file(4);
+    BufferPool pool(2 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    PageHandle first = pool.fetch(id, 0);
+    PageHandle second = pool.fetch(id, 1);
+    EXPECT_THROW(pool.fetch(id, 2), DatabaseException);
+    
+    // Unpinning one frame makes room again
+    second.release();
+    PageHandle third = pool.fetch(id, 2);
+    EXPECT_EQ(third.data()[0], 2);
+    EXPECT_EQ(first.data()[0], 0);
+    
+    first.release();
+    third.release();
+    pool.unregister_file(id);
+}
+
+TEST_F(BufferPoolTest, DirtyPagesWrittenBackOnFlush) {
+    PosixFile file = make_file(2);
+    BufferPool pool(4 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    const char text[] = "buffered";
+    pool.write(id, PAGE_SIZE + 10, text, sizeof(text));
+    
+    // Not on disk until flushed
+    char on_disk[sizeof(text)] = {};
+    file.read_exact(on_disk, sizeof(text), PAGE_SIZE + 10);
+    EXPECT_NE(std::memcmp(on_disk, text, sizeof(text)), 0);
+    
+    pool.flush(id);
+    file.read_exact(on_disk, sizeof(text), PAGE_SIZE + 10);
+    EXPECT_EQ(std::memcmp(on_disk, text, sizeof(text)), 0);
+    EXPECT_EQ(pool.stats().write_backs, 1u);
+    
+    pool.unregister_file(id);
+}
+
+TEST_F(BufferPoolTest, WriteBackDoesNotPadFile) {
+    PosixFile file;
+    ASSERT_TRUE(file.open(test_file_, O_RDWR | O_CREAT | O_TRUNC));
+    BufferPool pool(4 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    std::vector<uint8_t> data(100, 0x7E);
+    pool.write(id, 0, data.data(), data.size());
+    EXPECT_EQ(pool.file_size(id), 100u);
+    
+    pool.unregister_file(id);
+    EXPECT_EQ(file.size(), 100u);
+}
+
+TEST_F(BufferPoolTest, ShrinkingCapacityEvicts) {
+    PosixFile file = make_file(8);
+    BufferPool pool(8 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    for (PageId p = 0; p < 8; ++p) {
+        pool.fetch(id, p);
+    }
+    EXPECT_EQ(pool.stats().resident_pages, 8u);
+    
+    pool.set_capacity(3 * PAGE_SIZE);
+    EXPECT_EQ(pool.capacity(), 3 * PAGE_SIZE);
+    EXPECT_LE(pool.stats().resident_pages, 3u);
+    
+    pool.unregister_file(id);
+}
+
+TEST_F(BufferPoolTest, ConcurrentMissesAndWriteBacks) {
+    // Eight times as many pages as frames, so loads and write-backs of dirty victims overlap
+    constexpr PageId pages = 64;
+    constexpr int threads = 4;
+    PosixFile file = make_file(pages);
+    BufferPool pool(8 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    // Threads missing on the same page load it once
+    {
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 8; ++t) {
+            readers.emplace_back([&] {
+                PageHandle page = pool.fetch(id, 5);
+                EXPECT_EQ(page.data()[PAGE_SIZE - 1], 5);
+            });
+        }
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        EXPECT_EQ(pool.stats().misses, 1u);
+    }
+    
+    // Each thread keeps its own word of every page, and checks the page's first bytes
+    std::vector<std::vector<uint64_t>> last(threads, std::vector<uint64_t>(pages, 0));
+    std::atomic<int> bad{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(static_cast<unsigned>(t));
+            for (uint64_t i = 1; i <= 3000; ++i) {
+                PageId p = rng() % pages;
+                if (rng() % 2 == 0) {
+                    uint64_t word = (static_cast<uint64_t>(p) << 32) | i;
+                    pool.write(id, static_cast<uint64_t>(p) * PAGE_SIZE + 512 + t * sizeof(word), &word, sizeof(word));
+                    last[t][p] = word;
+                } else {
+                    uint8_t head[512];
+                    pool.read(id, static_cast<uint64_t>(p) * PAGE_SIZE, head, sizeof(head));
+                    bad += std::count(head, head + sizeof(head), static_cast<uint8_t>(p)) != sizeof(head);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+    EXPECT_GT(pool.stats().write_backs, 0u);
+    
+    // Every thread's last word of every page reaches the file
+    pool.flush_all();
+    for (PageId p = 0; p < pages; ++p) {
+        for (int t = 0; t < threads; ++t) {
+            uint64_t word = 0;
+            file.read_exact(&word, sizeof(word), static_cast<uint64_t>(p) * PAGE_SIZE + 512 + t * sizeof(word));
+            EXPECT_EQ(word, last[t][p] != 0 ? last[t][p] : 0x0101010101010101ull * p) << "page " << p << ", thread " << t;
+        }
+    }
+    pool.unregister_file(id);
+}
+
+TEST_F(BufferPoolTest, DataFileThroughPool) {
+    BufferPool pool(16 * PAGE_SIZE);
+    DataFileOptions options;
+    options.buffer_pool = &pool;
+    
+    constexpr uint32_t record_length = 100;
+    {
+        DataFile df = DataFile::create(test_file_, record_length, options);
+        std::vector<uint8_t> data(record_length);
+        for (int i = 0; i < 200; ++i) {
+            std::memset(data.data(), i, record_length);
+            df.new_record(data.data());
+        }
+        
+        std::vector<uint8_t> read_buffer(record_length);
+        df.read_record(150, read_buffer.data());
+        EXPECT_EQ(read_buffer[0], 149);
+        EXPECT_GT(pool.stats().hits, 0u);
+        df.close();
+    }
+    
+    // Everything reached the file, with no page padding
+    EXPECT_EQ(std::filesystem::file_size(test_file_), PLDB_V3_HEADER_SIZE + 200 * record_length);
+    DataFile df = DataFile::open(test_file_);
+    std::vector<uint8_t> read_buffer(record_length);
+    df.read_record(200, read_buffer.data());
+    EXPECT_EQ(read_buffer[record_length - 1], 199);
+    df.close();
+    
+    DataFileOptions both;
+    both.buffer_pool = &pool;
+    both.memory_mapped = true;
+    EXPECT_THROW(DataFile::open(test_file_, both), DatabaseException);
+}
+
+TEST_F(BufferPoolTest, BTreeFileThroughPool) {
+    BufferPool pool(16 * PAGE_SIZE);
+    BTreeFileOptions options;
+    options.buffer_pool = &pool;
+    
+    BTreeFile btf = BTreeFile::create(test_file_, 16, options);
+    BTreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    for (int i = 1; i <= 20; ++i) {
+        node.key_count = i;
+        btf.write_node(static_cast<RPTR>(i), node);
+    }
+    
+    uint64_t misses = pool.stats().misses;
+    for (int i = 1; i <= 20; ++i) {
+        btf.read_node(static_cast<RPTR>(i), node);
+        EXPECT_EQ(node.key_count, i);
+    }
+    // The whole tree fits in the pool, so reading it back never touches the disk
+    EXPECT_EQ(pool.stats().misses, misses);
+    btf.close();
+    
+    EXPECT_EQ(std::filesystem::file_size(test_file_), BTREE_HEADER_SIZE + 20 * sizeof(BTreeNode));
+}
+
+
+TEST_F(BufferPoolTest, TruncateDropsPagesPastTheEnd) {
+    PosixFile file = make_file(4);
+    BufferPool pool(8 * PAGE_SIZE);
+    BufferPool::FileId id = pool.register_file(file.fd());
+    
+    for (PageId p = 0; p < 4; ++p) {
+        pool.fetch(id, p);
+    }
+    std::vector<uint8_t> data(PAGE_SIZE, 0x5A);
+    pool.write(id, 3 * PAGE_SIZE, data.data(), data.size());
+    
+    // Dirty pages past the new end are discarded, not written back over the shorter file
+    pool.truncate(id, PAGE_SIZE + 100);
+    EXPECT_EQ(pool.file_size(id), PAGE_SIZE + 100);
+    EXPECT_EQ(file.size(), PAGE_SIZE + 100);
+    EXPECT_EQ(pool.stats().resident_pages, 2u);
+    
+    // Growing the file again reads zeroes where the old tail was
+    uint8_t byte = 0xFF;
+    pool.write(id, 2 * PAGE_SIZE, &byte, 1);
+    std::vector<uint8_t> page(PAGE_SIZE);
+    pool.read(id, PAGE_SIZE, page.data(), PAGE_SIZE);
+    EXPECT_EQ(page[99], 1);
+    EXPECT_EQ(page[100], 0);
+    
+    pool.unregister_file(id);
+    EXPECT_EQ(file.size(), 2 * PAGE_SIZE + 1);
+}
+
+TEST_F(BufferPoolTest, DirectIoDataFileIsBlockAligned) {
+    BufferPool pool(16 * PAGE_SIZE);
+    DataFileOptions options;
+    options.buffer_pool = &pool;
+    options.direct_io = true;
+    options.record_checksums = true;
+    
+    // 104-byte slots: 39 to a block, then 40 bytes of padding
+    constexpr uint32_t record_length = 100;
+    constexpr uint32_t per_block = PLDB_BLOCK_SIZE / (record_length + 4);
+    std::optional<DataFile> created;
+    try {
+        created.emplace(DataFile::create(test_file_, record_length, options));
+    } catch (const DatabaseException& e) {
+        GTEST_SKIP() << "No direct I/O here: " << e.what();
+    }
+    DataFile df = std::move(*created);
+    
+    std::vector<uint8_t> data(record_length);
+    for (int i = 1; i <= 200; ++i) {
+        std::memset(data.data(), i, record_length);
+        df.new_record(data.data());
+    }
+    df.delete_record(per_block);
+    df.delete_record(per_block + 1);
+    
+    // A scan steps over the padding at the end of each block
+    uint64_t live = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        EXPECT_NE(record[0], per_block);
+        EXPECT_NE(record[0], per_block + 1);
+        ++live;
+    }
+    EXPECT_EQ(live, 198u);
+    df.close();
+    
+    // The header takes a block, and each full block of slots another
+    EXPECT_EQ(std::filesystem::file_size(test_file_),
+              PLDB_BLOCK_SIZE + 200 / per_block * PLDB_BLOCK_SIZE + 200 % per_block * (record_length + 4));
+    EXPECT_TRUE(Scrubber::scrub_data_file(test_file_).empty());
+    
+    // The layout is the file's, whichever way it is opened
+    df = DataFile::open(test_file_);
+    std::vector<uint8_t> read_buffer(record_length);
+    df.read_record(per_block + 2, read_buffer.data());
+    EXPECT_EQ(read_buffer[0], per_block + 2);
+    df.read_record(200, read_buffer.data());
+    EXPECT_EQ(read_buffer[record_length - 1], 200);
+    df.close();
+    
+    // Compaction moves the tail records into the holes and shrinks the file through the pool
+    df = DataFile::open(test_file_, options);
+    CompactionResult result = df.compact();
+    EXPECT_TRUE(result.complete);
+    EXPECT_EQ(df.next_record(), 199u);
+    df.close();
+    EXPECT_EQ(std::filesystem::file_size(test_file_),
+              PLDB_BLOCK_SIZE + 198 / per_block * PLDB_BLOCK_SIZE + 198 % per_block * (record_length + 4));
+    EXPECT_TRUE(Scrubber::scrub_data_file(test_file_).empty());
+    
+    options.memory_mapped = true;
+    EXPECT_THROW(DataFile::open(test_file_, options), DatabaseException);
+}
+
+TEST_F(BufferPoolTest, DirectIoBTreeFileIsBlockAligned) {
+    BufferPool pool(16 * PAGE_SIZE);
+    BTreeFileOptions options;
+    options.buffer_pool = &pool;
+    options.direct_io = true;
+    
+    constexpr RPTR per_block = BTREE_BLOCK_SIZE / sizeof(BTreeNode);
+    std::optional<BTreeFile> created;
+    try {
+        created.emplace(BTreeFile::create(test_file_, 16, options));
+    } catch (const DatabaseException& e) {
+        GTEST_SKIP() << "No direct I/O here: " << e.what();
+    }
+    BTreeFile btf = std::move(*created);
+    BTreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    for (int i = 1; i <= 25; ++i) {
+        node.key_count = i;
+        btf.write_node(static_cast<RPTR>(i), node);
+    }
+    btf.close();
+    
+    EXPECT_EQ(std::filesystem::file_size(test_file_), BTREE_BLOCK_SIZE + 25 / per_block * BTREE_BLOCK_SIZE + 25 % per_block * sizeof(BTreeNode));
+    EXPECT_TRUE(Scrubber::scrub_btree_file(test_file_).empty());
+    
+    // Reopened without direct I/O, the nodes are found where they were written
+    btf = BTreeFile::open(test_file_);
+    for (int i = 1; i <= 25; ++i) {
+        btf.read_node(static_cast<RPTR>(i), node);
+        EXPECT_EQ(node.key_count, i);
+    }
+    EXPECT_THROW(btf.read_node(26, node), DatabaseException);
+    btf.close();
+}
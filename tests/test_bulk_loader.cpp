@@ -0,0 +1,257 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/bulk_loader.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/btree_file.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+const char* TRIP_COLUMNS = "id:int64,miles:double,category:string:12";
+constexpr uint32_t TRIP_LENGTH = 8 + 8 + 12;
+
+struct Trip {
+    int64_t id;
+    double miles;
+    std::string category;
+};
+
+Trip read_trip(DataFile& df, RPTR record) {
+    std::vector<uint8_t> buffer(TRIP_LENGTH);
+    df.read_record(record, buffer.data());
+    Trip trip;
+    std::memcpy(&trip.id, buffer.data(), 8);
+    std::memcpy(&trip.miles, buffer.data() + 8, 8);
+    trip.category.assign(reinterpret_cast<const char*>(buffer.data() + 16), strnlen(reinterpret_cast<const char*>(buffer.data() + 16), 12));
+    return trip;
+}
+
+} // namespace
+
+class BulkLoaderTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        input_file_ = "test_bulk_loader.txt";
+        data_file_ = "test_bulk_loader.dat";
+        index_file_ = "test_bulk_loader.btree";
+        TearDown();
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(input_file_);
+        std::filesystem::remove(data_file_);
+        std::filesystem::remove(index_file_);
+    }
+
+    void write_input(const std::string& text) {
+        std::ofstream(input_file_, std::ios::binary) << text;
+    }
+
+    std::string input_file_;
+    std::string data_file_;
+    std::string index_file_;
+};
+
+TEST_F(BulkLoaderTest, ParsesColumnLists) {
+    std::vector<LoadColumn> columns = parse_load_columns(TRIP_COLUMNS);
+    ASSERT_EQ(columns.size(), 3u);
+    EXPECT_EQ(columns[0].name, "id");
+    EXPECT_EQ(columns[1].type, FieldType::DOUBLE);
+    EXPECT_EQ(columns[2].type, FieldType::STRING);
+    EXPECT_EQ(columns[2].width(), 12u);
+    EXPECT_EQ(BulkLoader(columns).record_length(), TRIP_LENGTH);
+
+    EXPECT_THROW(parse_load_columns("id"), DatabaseException);
+    EXPECT_THROW(parse_load_columns("id:int128"), DatabaseException);
+    EXPECT_THROW(parse_load_columns("name:string:0"), DatabaseException);
+    EXPECT_THROW(BulkLoader({}), DatabaseException);
+}
+
+TEST_F(BulkLoaderTest, LoadsCsvAcrossChunks) {
+    std::string text = "id,miles,category\r\n";
+    text += "1,12.5,\"a, \"\"quoted\"\"\"\r\n";
+    text += "\n";
+    for (int i = 2; i <= 1000; ++i) {
+        text += std::to_string(i) + "," + std::to_string(i) + ".25,trip " + std::to_string(i % 7) + "\n";
+    }
+    text += "-5,,";  // no final line break; empty fields are zero
+    write_input(text);
+
+    // Chunks far smaller than the input, so that several parse at once
+    BulkLoadOptions options;
+    options.chunk_size = 4096;
+    options.threads = 4;
+    BulkLoader loader(parse_load_columns(TRIP_COLUMNS), options);
+    DataFile df = DataFile::create(data_file_, loader.record_length());
+    BulkLoadResult result = loader.load(input_file_, df);
+    EXPECT_EQ(result.records, 1001u);
+    EXPECT_EQ(result.first_record, 1u);
+    EXPECT_EQ(result.bytes_read, text.size());
+    EXPECT_EQ(df.next_record(), 1002u);
+
+    Trip first = read_trip(df, 1);
+    EXPECT_EQ(first.id, 1);
+    EXPECT_DOUBLE_EQ(first.miles, 12.5);
+    EXPECT_EQ(first.category, "a, \"quoted\"");
+    for (int i : {2, 500, 1000}) {
+        Trip trip = read_trip(df, static_cast<RPTR>(i));
+        EXPECT_EQ(trip.id, i);
+        EXPECT_DOUBLE_EQ(trip.miles, i + 0.25);
+        EXPECT_EQ(trip.category, "trip " + std::to_string(i % 7));
+    }
+    Trip last = read_trip(df, 1001);
+    EXPECT_EQ(last.id, -5);
+    EXPECT_EQ(last.miles, 0.0);
+    EXPECT_EQ(last.category, "");
+}
+
+TEST_F(BulkLoaderTest, LoadsNdjsonByName) {
+    write_input("{\"category\": \"caf\\u00e9\", \"id\": 7, \"miles\": 1e2, \"extra\": true}\n"
+                "{\"id\":8,\"miles\":null}\n"
+                "{}\n");
+    BulkLoadOptions options;
+    options.format = LoadFormat::NDJSON;
+    BulkLoader loader(parse_load_columns(TRIP_COLUMNS), options);
+    DataFile df = DataFile::create(data_file_, loader.record_length());
+    EXPECT_EQ(loader.load(input_file_, df).records, 3u);
+
+    Trip trip = read_trip(df, 1);
+    EXPECT_EQ(trip.id, 7);
+    EXPECT_DOUBLE_EQ(trip.miles, 100.0);
+    EXPECT_EQ(trip.category, "caf\xc3\xa9");
+    trip = read_trip(df, 2);
+    EXPECT_EQ(trip.id, 8);
+    EXPECT_EQ(trip.miles, 0.0);
+}
+
+TEST_F(BulkLoaderTest, BuildsTheIndexFromTheKeyColumn) {
+    // Keys out of order and negative, to exercise the sort and the key encoding
+    std::string text = "id,miles,category\n";
+    const int count = 3000;
+    for (int i = 0; i < count; ++i) {
+        int id = (i * 7919) % count - count / 2;
+        text += std::to_string(id) + ",1.0,x\n";
+    }
+    write_input(text);
+
+    BulkLoadOptions options;
+    options.chunk_size = 8192;
+    options.key_column = 0;
+    BulkLoader loader(parse_load_columns(TRIP_COLUMNS), options);
+    DataFile df = DataFile::create(data_file_, loader.record_length());
+    BTreeFile index = BTreeFile::create(index_file_, 8);
+    EXPECT_EQ(loader.load(input_file_, df, &index).records, static_cast<uint64_t>(count));
+
+    for (int64_t id : {int64_t(-count / 2), int64_t(-1), int64_t(0), int64_t(42), int64_t(count / 2 - 1)}) {
+        uint8_t key[8];
+        encode_index_key(loader.columns()[0], reinterpret_cast<const uint8_t*>(&id), key);
+        RPTR record = index.locate(reinterpret_cast<const char*>(key));
+        ASSERT_NE(record, INVALID_RPTR) << id;
+        EXPECT_EQ(read_trip(df, record).id, id);
+    }
+    int64_t missing = count;
+    uint8_t key[8];
+    encode_index_key(loader.columns()[0], reinterpret_cast<const uint8_t*>(&missing), key);
+    EXPECT_EQ(index.locate(reinterpret_cast<const char*>(key)), INVALID_RPTR);
+
+    // The key length must match the key column
+    BTreeFile wrong = BTreeFile::create(index_file_ + "2", 4);
+    EXPECT_THROW(loader.load(input_file_, df, &wrong), DatabaseException);
+    wrong.close();
+    std::filesystem::remove(index_file_ + "2");
+}
+
+TEST_F(BulkLoaderTest, IndexesRepeatedKeys) {
+    // A category column: few values, each on many rows
+    std::string text = "id,miles,category\n";
+    const int count = 3000;
+    const int categories = 5;
+    for (int i = 0; i < count; ++i) {
+        text += std::to_string(i) + ",1.0,cat" + std::to_string((i * 7) % categories) + "\n";
+    }
+    write_input(text);
+
+    BulkLoadOptions options;
+    options.chunk_size = 8192;
+    options.key_column = 2;
+    options.index_build.memory_limit = 16 * 1024;  // sorted in several runs
+    BulkLoader loader(parse_load_columns(TRIP_COLUMNS), options);
+    DataFile df = DataFile::create(data_file_, loader.record_length());
+    BTreeFile index = BTreeFile::create(index_file_, 12);
+    loader.load(input_file_, df, &index);
+
+    // Every row of a category is found, in input order, as the ones before it are removed
+    for (int c = 0; c < categories; ++c) {
+        std::string category = "cat" + std::to_string(c);
+        uint8_t field[12] = {};
+        std::memcpy(field, category.data(), category.size());
+        uint8_t key[12];
+        encode_index_key(loader.columns()[2], field, key);
+        int found = 0;
+        RPTR last = 0;
+        for (RPTR record; (record = index.locate(reinterpret_cast<const char*>(key))) != INVALID_RPTR;) {
+            Trip trip = read_trip(df, record);
+            ASSERT_EQ(trip.category, category);
+            ASSERT_GT(record, last);
+            last = record;
+            ++found;
+            index.delete_key(reinterpret_cast<const char*>(key));
+        }
+        EXPECT_EQ(found, count / categories) << category;
+    }
+    EXPECT_EQ(index.root_node(), 0u);
+}
+
+TEST_F(BulkLoaderTest, ErrorsNameTheLine) {
+    std::string text = "id,miles,category\n";
+    for (int i = 1; i <= 500; ++i) {
+        text += i == 321 ? "321,abc,x\n" : std::to_string(i) + ",1,x\n";
+    }
+    write_input(text);
+
+    BulkLoadOptions options;
+    options.chunk_size = 4096;
+    BulkLoader loader(parse_load_columns(TRIP_COLUMNS), options);
+    DataFile df = DataFile::create(data_file_, loader.record_length());
+    try {
+        loader.load(input_file_, df);
+        FAIL() << "expected a parse error";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::INVALID_ARGUMENT);
+        EXPECT_NE(std::string(e.what()).find("line 322"), std::string::npos) << e.what();
+    }
+
+    write_input("id,miles,category\n1,2\n");
+    EXPECT_THROW(loader.load(input_file_, df), DatabaseException);
+    write_input("id,miles,category\n1,2,much too long for it\n");
+    EXPECT_THROW(loader.load(input_file_, df), DatabaseException);
+    EXPECT_THROW(loader.load("no_such_input.csv", df), DatabaseException);
+
+    DataFile narrow = DataFile::create(data_file_ + "2", 16);
+    EXPECT_THROW(loader.load(input_file_, narrow), DatabaseException);
+    narrow.close();
+    std::filesystem::remove(data_file_ + "2");
+}
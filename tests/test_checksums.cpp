@@ -0,0 +1,296 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/btree_file.hpp"
+#include "pentaledger/crc32c.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/scrubber.hpp"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+constexpr uint32_t LENGTH = 40;
+
+std::vector<uint8_t> make_record(uint64_t id) {
+    std::vector<uint8_t> record(LENGTH, 0);
+    std::memcpy(record.data(), &id, sizeof(id));
+    std::snprintf(reinterpret_cast<char*>(record.data() + 8), LENGTH - 8, "record %llu", static_cast<unsigned long long>(id));
+    return record;
+}
+
+// Invert one byte of a file in place
+void flip_byte(const std::string& path, uint64_t offset) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(offset));
+    char byte = 0;
+    file.read(&byte, 1);
+    byte = static_cast<char>(~byte);
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(&byte, 1);
+}
+
+ErrorCode error_of(const std::function<void()>& action) {
+    try {
+        action();
+    } catch (const DatabaseException& e) {
+        return e.code();
+    }
+    return ErrorCode::SUCCESS;
+}
+
+} // namespace
+
+class ChecksumTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_checksums.dat";
+        btree_file_ = "test_checksums.btree";
+        std::filesystem::remove(test_file_);
+        std::filesystem::remove(btree_file_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+        std::filesystem::remove(btree_file_);
+    }
+
+    static DataFileOptions checksummed() {
+        DataFileOptions options;
+        options.record_checksums = true;
+        return options;
+    }
+
+    // File offset of a record of a checksummed file created by write_records()
+    static uint64_t record_offset(RPTR record) {
+        return PLDB_V3_HEADER_SIZE + (record - 1) * (LENGTH + sizeof(uint32_t));
+    }
+
+    void write_records(uint64_t count, DataFileOptions options = checksummed()) {
+        DataFile df = DataFile::create(test_file_, LENGTH, options);
+        for (uint64_t id = 1; id <= count; ++id) {
+            auto record = make_record(id);
+            df.new_record(record.data());
+        }
+    }
+
+    std::string test_file_;
+    std::string btree_file_;
+};
+
+TEST_F(ChecksumTest, HardwareAndPortableAgree) {
+    const char* check = "123456789";
+    EXPECT_EQ(crc32c(check, 9), 0xE3069283u);
+    EXPECT_EQ(crc32c_portable(check, 9), 0xE3069283u);
+
+    // Every alignment and tail length, and checksums continued across buffers
+    std::mt19937 rng(3);
+    std::vector<uint8_t> data(4096);
+    for (uint8_t& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    for (size_t start = 0; start < 16; ++start) {
+        for (size_t length : {size_t{0}, size_t{1}, size_t{7}, size_t{8}, size_t{63}, size_t{1000}, size_t{4000}}) {
+            EXPECT_EQ(crc32c(data.data() + start, length), crc32c_portable(data.data() + start, length));
+        }
+    }
+    // Interleaved checksums of strided buffers match one call per buffer
+    for (size_t length : {size_t{4}, size_t{13}, size_t{40}, size_t{129}}) {
+        uint32_t crcs[7];
+        crc32c_many(data.data() + 1, length, length + 3, 7, crcs);
+        for (size_t i = 0; i < 7; ++i) {
+            EXPECT_EQ(crcs[i], crc32c_portable(data.data() + 1 + i * (length + 3), length));
+        }
+    }
+
+    uint32_t whole = crc32c(data.data(), data.size());
+    EXPECT_EQ(crc32c(data.data() + 100, data.size() - 100, crc32c(data.data(), 100)), whole);
+}
+
+TEST_F(ChecksumTest, CorruptRecordIsDetected) {
+    write_records(100);
+
+    DataFile df = DataFile::open(test_file_);
+    EXPECT_TRUE(df.has_record_checksums());
+    std::vector<uint8_t> buffer(LENGTH);
+    df.read_record(42, buffer.data());
+    EXPECT_EQ(buffer, make_record(42));
+    df.close();
+
+    flip_byte(test_file_, record_offset(42) + 9);
+
+    df = DataFile::open(test_file_);
+    EXPECT_EQ(error_of([&] { df.read_record(42, buffer.data()); }), ErrorCode::FILE_CORRUPTED);
+    df.read_record(41, buffer.data());
+    EXPECT_EQ(buffer, make_record(41));
+
+    // Batch reads report the record alone; scans stop at it
+    const std::vector<RPTR> batch = {41, 42, 43};
+    std::vector<uint8_t> records(batch.size() * LENGTH);
+    std::vector<ErrorCode> status(batch.size());
+    EXPECT_EQ(df.read_records(batch, records.data(), status), 2u);
+    EXPECT_EQ(status[1], ErrorCode::FILE_CORRUPTED);
+    EXPECT_EQ(error_of([&] { for (auto record : df.scan()) { (void)record; } }), ErrorCode::FILE_CORRUPTED);
+
+    // Rewriting the record repairs it
+    auto replacement = make_record(4242);
+    df.write_record(42, replacement.data());
+    df.read_record(42, buffer.data());
+    EXPECT_EQ(buffer, replacement);
+    df.close();
+
+    // Verification can be turned off
+    flip_byte(test_file_, record_offset(7));
+    DataFileOptions unverified;
+    unverified.verify_checksums = false;
+    df = DataFile::open(test_file_, unverified);
+    df.read_record(7, buffer.data());
+    EXPECT_NE(buffer, make_record(7));
+}
+
+TEST_F(ChecksumTest, CorruptHeadersAreDetected) {
+    // One damaged header copy leaves the other; both make the file unreadable
+    write_records(10);
+    flip_byte(test_file_, offsetof(DataFileHeader, next_record));
+    EXPECT_EQ(DataFile::open(test_file_).next_record(), 11u);
+    flip_byte(test_file_, sizeof(DataFileHeader) + offsetof(DataFileHeader, next_record));
+    EXPECT_EQ(error_of([&] { DataFile::open(test_file_); }), ErrorCode::FILE_CORRUPTED);
+
+    {
+        BTreeFile btf = BTreeFile::create(btree_file_, 16);
+        BTreeNode node{};
+        node.key_count = 1;
+        btf.write_node(1, node);
+    }
+    {
+        BTreeFile btf = BTreeFile::open(btree_file_);
+        BTreeNode node{};
+        btf.read_node(1, node);
+        EXPECT_EQ(node.key_count, 1);
+        EXPECT_NE(node.checksum, 0u);
+    }
+
+    flip_byte(btree_file_, BTREE_HEADER_SIZE + offsetof(BTreeNode, keyspace) + 5);
+    {
+        BTreeFile btf = BTreeFile::open(btree_file_);
+        BTreeNode node{};
+        EXPECT_EQ(error_of([&] { btf.read_node(1, node); }), ErrorCode::FILE_CORRUPTED);
+
+        BTreeFileOptions unverified;
+        unverified.verify_checksums = false;
+        BTreeFile unchecked = BTreeFile::open(btree_file_, unverified);
+        unchecked.read_node(1, node);
+    }
+
+    flip_byte(btree_file_, offsetof(BTreeHeader, max_key_per_node));
+    EXPECT_EQ(BTreeFile::open(btree_file_).key_length(), 16);
+    flip_byte(btree_file_, sizeof(BTreeHeaderCopy) + offsetof(BTreeHeader, max_key_per_node));
+    EXPECT_EQ(error_of([&] { BTreeFile::open(btree_file_); }), ErrorCode::FILE_CORRUPTED);
+}
+
+TEST_F(ChecksumTest, ScrubberFindsDamage) {
+    write_records(5000);
+    {
+        BTreeFile btf = BTreeFile::create(btree_file_, 16);
+        BTreeNode node{};
+        for (RPTR n = 1; n <= 20; ++n) {
+            node.key_count = static_cast<int>(n);
+            btf.write_node(n, node);
+        }
+    }
+    EXPECT_TRUE(Scrubber::scrub_data_file(test_file_).empty());
+    EXPECT_TRUE(Scrubber::scrub_btree_file(btree_file_).empty());
+
+    flip_byte(test_file_, record_offset(3210) + 1);
+    flip_byte(btree_file_, BTREE_HEADER_SIZE + 11 * sizeof(BTreeNode) + 100);
+
+    auto errors = Scrubber::scrub_data_file(test_file_);
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0].offset, record_offset(3210));
+    errors = Scrubber::scrub_btree_file(btree_file_);
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0].offset, BTREE_HEADER_SIZE + 11 * sizeof(BTreeNode));
+
+    // The background thread reports the same damage through the callback
+    std::atomic<int> reported{0};
+    ScrubberOptions options;
+    options.bytes_per_second = 0;
+    options.pass_interval = std::chrono::milliseconds(10);
+    options.on_error = [&](const ScrubError&) { ++reported; };
+    Scrubber scrubber(options);
+    scrubber.add_data_file(test_file_);
+    scrubber.add_btree_file(btree_file_);
+    scrubber.start();
+    EXPECT_TRUE(scrubber.running());
+    while (scrubber.stats().passes < 2) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    scrubber.stop();
+    EXPECT_FALSE(scrubber.running());
+
+    ScrubStats stats = scrubber.stats();
+    EXPECT_GE(stats.files, 4u);
+    EXPECT_GE(stats.bytes, 2 * std::filesystem::file_size(test_file_) - 2 * PLDB_V3_HEADER_SIZE);
+    EXPECT_EQ(stats.errors, static_cast<uint64_t>(reported.load()));
+    EXPECT_GE(reported.load(), 4);
+}
+
+TEST_F(ChecksumTest, ScrubberVerifiesCompressedExtents) {
+    DataFileOptions options = checksummed();
+    options.compressed = true;
+    options.compressed_page_size = 16 * 1024;
+    write_records(5000, options);
+    EXPECT_TRUE(Scrubber::scrub_data_file(test_file_).empty());
+
+    // Damage the middle of the stored file, which lands in some page's extent
+    flip_byte(test_file_, std::filesystem::file_size(test_file_) / 2);
+    auto errors = Scrubber::scrub_data_file(test_file_);
+    EXPECT_FALSE(errors.empty());
+
+    DataFile df = DataFile::open(test_file_);
+    EXPECT_EQ(error_of([&] { for (auto record : df.scan()) { (void)record; } }), ErrorCode::FILE_CORRUPTED);
+}
+
+TEST_F(ChecksumTest, ScrubberIsRateLimited) {
+    write_records(20000, {});
+    const uint64_t size = std::filesystem::file_size(test_file_);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(Scrubber::scrub_data_file(test_file_, size * 4).empty());
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(150));
+
+    // stop() interrupts a pass that is waiting on the rate
+    ScrubberOptions slow;
+    slow.bytes_per_second = 1024;
+    Scrubber scrubber(slow);
+    scrubber.add_data_file(test_file_);
+    scrubber.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    start = std::chrono::steady_clock::now();
+    scrubber.stop();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_EQ(scrubber.stats().passes, 0u);
+}
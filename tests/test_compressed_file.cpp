@@ -0,0 +1,201 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/lz_codec.hpp"
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+constexpr uint32_t LENGTH = 64;
+
+// Mostly zeros, with a sequence number and one of a few category codes
+std::vector<uint8_t> make_record(uint64_t id) {
+    static const char* categories[] = {"FUEL", "TOLL", "MEAL", "LODGING"};
+    std::vector<uint8_t> record(LENGTH, 0);
+    std::memcpy(record.data(), &id, sizeof(id));
+    std::strcpy(reinterpret_cast<char*>(record.data() + 16), categories[id % 4]);
+    return record;
+}
+
+std::vector<uint8_t> round_trip(const std::vector<uint8_t>& input) {
+    std::vector<uint8_t> compressed(lz_compress_bound(input.size()));
+    size_t length = lz_compress(input.data(), input.size(), compressed.data(), compressed.size());
+    EXPECT_GT(length, 0u);
+    std::vector<uint8_t> output(input.size());
+    EXPECT_EQ(lz_decompress(compressed.data(), length, output.data(), output.size()), input.size());
+    return output;
+}
+
+} // namespace
+
+class CompressedFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_compressed_file.dat";
+        log_file_ = "test_compressed_file.wal";
+        std::filesystem::remove(test_file_);
+        std::filesystem::remove(log_file_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+        std::filesystem::remove(log_file_);
+    }
+
+    static DataFileOptions compressed() {
+        DataFileOptions options;
+        options.compressed = true;
+        options.compressed_page_size = 16 * 1024;
+        options.compressed_cache_pages = 4;
+        return options;
+    }
+
+    std::string test_file_;
+    std::string log_file_;
+};
+
+TEST_F(CompressedFileTest, CodecRoundTrips) {
+    std::mt19937 rng(7);
+    std::vector<uint8_t> random(100000);
+    for (uint8_t& byte : random) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    EXPECT_EQ(round_trip(random), random);
+
+    // Short inputs are stored as literals
+    for (size_t n = 0; n < 20; ++n) {
+        std::vector<uint8_t> small(random.begin(), random.begin() + static_cast<std::ptrdiff_t>(n));
+        EXPECT_EQ(round_trip(small), small);
+    }
+
+    std::vector<uint8_t> zeros(65536, 0);
+    std::vector<uint8_t> compressed(lz_compress_bound(zeros.size()));
+    size_t length = lz_compress(zeros.data(), zeros.size(), compressed.data(), compressed.size());
+    EXPECT_LT(length, 300u);
+    EXPECT_EQ(round_trip(zeros), zeros);
+
+    // Incompressible data does not fit in less than its own size
+    EXPECT_EQ(lz_compress(random.data(), random.size(), compressed.data(), random.size() - 1), 0u);
+}
+
+TEST_F(CompressedFileTest, CodecRejectsCorruptInput) {
+    std::vector<uint8_t> input;
+    for (uint64_t id = 0; id < 200; ++id) {
+        auto record = make_record(id);
+        input.insert(input.end(), record.begin(), record.end());
+    }
+    std::vector<uint8_t> compressed(lz_compress_bound(input.size()));
+    size_t length = lz_compress(input.data(), input.size(), compressed.data(), compressed.size());
+    ASSERT_GT(length, 0u);
+
+    std::vector<uint8_t> output(input.size());
+    EXPECT_THROW(lz_decompress(compressed.data(), length, output.data(), output.size() / 2), DatabaseException);
+    EXPECT_THROW(lz_decompress(compressed.data(), length - 1, output.data(), output.size()), DatabaseException);
+
+    // An offset reaching back before the start of the output
+    const uint8_t bad[] = {0x10, 'a', 0x10, 0x00};
+    EXPECT_THROW(lz_decompress(bad, sizeof(bad), output.data(), output.size()), DatabaseException);
+}
+
+TEST_F(CompressedFileTest, RecordsRoundTripAndShrink) {
+    const uint64_t count = 20000;
+    {
+        DataFile df = DataFile::create(test_file_, LENGTH, compressed());
+        EXPECT_TRUE(df.is_compressed());
+        for (uint64_t id = 1; id <= count; ++id) {
+            auto record = make_record(id);
+            EXPECT_EQ(df.new_record(record.data()), id);
+        }
+        df.delete_record(10);
+        df.delete_record(15000);
+    }
+
+    // The file is a fraction of the records it holds
+    EXPECT_LT(std::filesystem::file_size(test_file_) * 3, count * LENGTH);
+
+    DataFile df = DataFile::open(test_file_);
+    EXPECT_TRUE(df.is_compressed());
+    EXPECT_EQ(df.next_record(), count + 1);
+    EXPECT_EQ(df.first_record(), 15000u);
+
+    std::vector<uint8_t> buffer(LENGTH);
+    for (uint64_t id : {uint64_t{1}, uint64_t{256}, uint64_t{257}, uint64_t{9999}, count}) {
+        df.read_record(id, buffer.data());
+        EXPECT_EQ(buffer, make_record(id)) << "record " << id;
+    }
+
+    auto replacement = make_record(123456);
+    EXPECT_EQ(df.new_record(replacement.data()), 15000u);
+    df.write_record(2, replacement.data());
+    df.flush();
+    df.read_record(2, buffer.data());
+    EXPECT_EQ(buffer, replacement);
+
+    const std::vector<RPTR> batch = {count, 3, 15000};
+    std::vector<uint8_t> records(batch.size() * LENGTH);
+    std::vector<ErrorCode> status(batch.size());
+    EXPECT_EQ(df.read_records(batch, records.data(), status), batch.size());
+    EXPECT_TRUE(std::equal(replacement.begin(), replacement.end(), records.begin() + 2 * LENGTH));
+}
+
+TEST_F(CompressedFileTest, ScanDecompressesPages) {
+    const uint64_t count = 5000;
+    {
+        DataFile df = DataFile::create(test_file_, LENGTH, compressed());
+        for (uint64_t id = 1; id <= count; ++id) {
+            auto record = make_record(id);
+            df.new_record(record.data());
+        }
+        df.delete_record(4000);
+    }
+
+    DataFile df = DataFile::open(test_file_);
+    ScanOptions options;
+    options.block_size = 8192;
+    uint64_t seen = 0;
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : df.scan(options)) {
+        uint64_t id = 0;
+        std::memcpy(&id, record.data(), sizeof(id));
+        sum += id;
+        ++seen;
+    }
+    EXPECT_EQ(seen, count - 1);
+    EXPECT_EQ(sum, count * (count + 1) / 2 - 4000);
+}
+
+TEST_F(CompressedFileTest, IncompatibleModesAreRejected) {
+    DataFileOptions options = compressed();
+    options.memory_mapped = true;
+    EXPECT_THROW(DataFile::create(test_file_, LENGTH, options), DatabaseException);
+
+    {
+        DataFile df = DataFile::create(test_file_, LENGTH, compressed());
+    }
+    WriteAheadLog wal(log_file_);
+    DataFileOptions logged;
+    logged.wal = &wal;
+    EXPECT_THROW(DataFile::open(test_file_, logged), DatabaseException);
+}
@@ -19,9 +19,20 @@
 
 #include <gtest/gtest.h>
 #include "pentaledger/data_file.hpp"
+#include "pentaledger/metrics.hpp"
 #include <filesystem>
+#include <fstream>
 #include <cstring>
 #include <array>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace pentaledger;
 
@@ -60,6 +71,19 @@ protected:
         }
     }
     
+    // Change both header copies of the closed test file, keeping their checksums valid
+    void patch_headers(const std::function<void(DataFileHeader&)>& change) {
+        std::fstream file(test_file_, std::ios::in | std::ios::out | std::ios::binary);
+        std::array<DataFileHeader, PLDB_HEADER_COPIES> copies{};
+        file.read(reinterpret_cast<char*>(copies.data()), sizeof(copies));
+        for (DataFileHeader& copy : copies) {
+            change(copy);
+            copy.checksum = data_file_header_checksum(copy);
+        }
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(copies.data()), sizeof(copies));
+    }
+    
     std::string test_file_;
     static constexpr uint32_t RECORD_LENGTH = 256;
 };
@@ -186,7 +210,7 @@ TEST_F(DataFileTest, LocateOffset) {
     
     // The function calculates: (record_number - 1 * record_length) + HEADER_SIZE
     // Due to operator precedence: record_number - record_length + HEADER_SIZE
-    size_t header_size = sizeof(DataFileHeader);
+    size_t header_size = PLDB_V3_HEADER_SIZE;
     
        // Test for record number 1
     RPTR record_1 = 1;
@@ -198,3 +222,1032 @@ TEST_F(DataFileTest, LocateOffset) {
     testable_df.close();
 }
 
+TEST_F(DataFileTest, MemoryMappedReadWrite) {
+    DataFileOptions options;
+    options.memory_mapped = true;
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+    EXPECT_TRUE(df.is_memory_mapped());
+    
+    std::array<uint8_t, RECORD_LENGTH> buffer{};
+    std::memset(buffer.data(), 0x31, RECORD_LENGTH);
+    RPTR first = df.new_record(buffer.data());
+    std::memset(buffer.data(), 0x32, RECORD_LENGTH);
+    RPTR second = df.new_record(buffer.data());
+    
+    std::span<const uint8_t> view = df.view_record(first);
+    ASSERT_EQ(view.size(), RECORD_LENGTH);
+    EXPECT_EQ(view[0], 0x31);
+    EXPECT_EQ(view[RECORD_LENGTH - 1], 0x31);
+    EXPECT_EQ(df.view_record(second)[0], 0x32);
+    
+    std::array<uint8_t, RECORD_LENGTH> read_buffer{};
+    df.read_record(second, read_buffer.data());
+    EXPECT_EQ(read_buffer[0], 0x32);
+    
+    EXPECT_THROW(df.view_record(0), DatabaseException);
+    EXPECT_THROW(df.view_record(df.next_record()), DatabaseException);
+    
+    EXPECT_NO_THROW(df.flush());
+    df.close();
+    
+    // The growth slack of the mapping is trimmed on close
+    EXPECT_EQ(std::filesystem::file_size(test_file_), PLDB_V3_HEADER_SIZE + 2 * RECORD_LENGTH);
+}
+
+TEST_F(DataFileTest, MemoryMappedRemapOnGrowth) {
+    DataFileOptions options;
+    options.memory_mapped = true;
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+    
+    // Enough records to outgrow the initial mapping several times over
+    constexpr int count = 20000;
+    std::array<uint8_t, RECORD_LENGTH> buffer{};
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(buffer.data(), &i, sizeof(i));
+        df.new_record(buffer.data());
+    }
+    
+    for (int i = 0; i < count; i += 997) {
+        int value = -1;
+        std::memcpy(&value, df.view_record(static_cast<RPTR>(i) + 1).data(), sizeof(value));
+        EXPECT_EQ(value, i);
+    }
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, MemoryMappedOpensStreamFile) {
+    {
+        DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+        std::vector<uint8_t> data(RECORD_LENGTH, 0x5A);
+        df.new_record(data.data());
+        df.close();
+    }
+    
+    DataFileOptions options;
+    options.memory_mapped = true;
+    {
+        DataFile df = DataFile::open(test_file_, options);
+        EXPECT_EQ(df.next_record(), 2);
+        EXPECT_EQ(df.view_record(1)[0], 0x5A);
+        
+        std::vector<uint8_t> data(RECORD_LENGTH, 0x6B);
+        df.new_record(data.data());
+        df.close();
+    }
+    
+    // And back again in stream mode
+    DataFile df = DataFile::open(test_file_);
+    std::vector<uint8_t> read_buffer(RECORD_LENGTH);
+    df.read_record(2, read_buffer.data());
+    EXPECT_EQ(read_buffer[0], 0x6B);
+    EXPECT_THROW(df.view_record(1), DatabaseException);
+    df.close();
+}
+
+TEST_F(DataFileTest, BatchWriteAndRead) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    std::vector<uint8_t> blank(RECORD_LENGTH, 0);
+    for (int i = 0; i < 16; ++i) {
+        df.new_record(blank.data());
+    }
+    
+    // Out of order, with two adjacent runs (3..6 and 10..11) and a lone record
+    std::vector<RPTR> records = {5, 10, 3, 14, 4, 11, 6};
+    std::vector<uint8_t> out(records.size() * RECORD_LENGTH);
+    for (size_t i = 0; i < records.size(); ++i) {
+        std::memset(out.data() + i * RECORD_LENGTH, static_cast<int>(records[i]), RECORD_LENGTH);
+    }
+    std::vector<ErrorCode> status(records.size(), ErrorCode::IO_ERROR);
+    EXPECT_EQ(df.write_records(records, out.data(), status), records.size());
+    for (ErrorCode code : status) {
+        EXPECT_EQ(code, ErrorCode::SUCCESS);
+    }
+    
+    // Read back in a different order
+    std::vector<RPTR> reads = {14, 3, 4, 5, 6, 11, 10, 1};
+    std::vector<uint8_t> in(reads.size() * RECORD_LENGTH, 0xFF);
+    std::vector<ErrorCode> read_status(reads.size(), ErrorCode::IO_ERROR);
+    EXPECT_EQ(df.read_records(reads, in.data(), read_status), reads.size());
+    for (size_t i = 0; i < reads.size(); ++i) {
+        EXPECT_EQ(read_status[i], ErrorCode::SUCCESS);
+        uint8_t expected = reads[i] == 1 ? 0 : static_cast<uint8_t>(reads[i]);
+        EXPECT_EQ(in[i * RECORD_LENGTH], expected);
+        EXPECT_EQ(in[i * RECORD_LENGTH + RECORD_LENGTH - 1], expected);
+    }
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, BatchReportsPerRecordErrors) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x11);
+    df.new_record(data.data());
+    df.new_record(data.data());
+    
+    // Record 0 and records past next_record are invalid; next_record itself is
+    // readable only once written.
+    std::vector<RPTR> reads = {1, 0, 2, 3, 1000};
+    std::vector<uint8_t> in(reads.size() * RECORD_LENGTH);
+    std::vector<ErrorCode> status(reads.size(), ErrorCode::SUCCESS);
+    EXPECT_EQ(df.read_records(reads, in.data(), status), 2u);
+    EXPECT_EQ(status[0], ErrorCode::SUCCESS);
+    EXPECT_EQ(status[1], ErrorCode::IO_ERROR);
+    EXPECT_EQ(status[2], ErrorCode::SUCCESS);
+    EXPECT_EQ(status[3], ErrorCode::IO_ERROR);
+    EXPECT_EQ(status[4], ErrorCode::IO_ERROR);
+    EXPECT_EQ(in[0], 0x11);
+    EXPECT_EQ(in[2 * RECORD_LENGTH], 0x11);
+    
+    std::vector<ErrorCode> short_status(1);
+    EXPECT_THROW(df.read_records(reads, in.data(), short_status), DatabaseException);
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, BatchMemoryMapped) {
+    DataFileOptions options;
+    options.memory_mapped = true;
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+    
+    std::vector<uint8_t> blank(RECORD_LENGTH, 0);
+    for (int i = 0; i < 4; ++i) {
+        df.new_record(blank.data());
+    }
+    
+    std::vector<RPTR> records = {4, 2};
+    std::vector<uint8_t> out(2 * RECORD_LENGTH);
+    std::memset(out.data(), 0x44, RECORD_LENGTH);
+    std::memset(out.data() + RECORD_LENGTH, 0x22, RECORD_LENGTH);
+    std::vector<ErrorCode> status(records.size());
+    EXPECT_EQ(df.write_records(records, out.data(), status), 2u);
+    
+    EXPECT_EQ(df.view_record(2)[0], 0x22);
+    EXPECT_EQ(df.view_record(4)[0], 0x44);
+    
+    df.close();
+}
+
+
+TEST_F(DataFileTest, DeletedRecordsAreReused) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x5A);
+    for (int i = 0; i < 5; ++i) {
+        df.new_record(data.data());
+    }
+    
+    EXPECT_EQ(df.delete_record(2), 0);
+    EXPECT_EQ(df.delete_record(4), 0);
+    EXPECT_EQ(df.first_record(), 4);
+    
+    // A deleted slot reads back as its free-list link followed by zeros
+    std::vector<uint8_t> in(RECORD_LENGTH, 0xFF);
+    df.read_record(4, in.data());
+    RPTR link = 0;
+    std::memcpy(&link, in.data(), sizeof(link));
+    EXPECT_EQ(link, 2u);
+    EXPECT_EQ(in[sizeof(RPTR)], 0);
+    EXPECT_EQ(in[RECORD_LENGTH - 1], 0);
+    
+    // Most recently deleted first, then the end of the file
+    EXPECT_EQ(df.new_record(data.data()), 4u);
+    EXPECT_EQ(df.new_record(data.data()), 2u);
+    EXPECT_EQ(df.first_record(), 0);
+    EXPECT_EQ(df.new_record(data.data()), 6u);
+    
+    df.read_record(2, in.data());
+    EXPECT_EQ(in[0], 0x5A);
+    
+    EXPECT_THROW(df.delete_record(0), DatabaseException);
+    EXPECT_THROW(df.delete_record(7), DatabaseException);
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, DeletingAFreeRecordThrows) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    // Record 3 is all zeros, as a free slot would be, but live
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x5A);
+    std::vector<uint8_t> blank(RECORD_LENGTH, 0);
+    for (int i = 1; i <= 5; ++i) {
+        df.new_record(i == 3 ? blank.data() : data.data());
+    }
+    
+    // Both at the head of the free list and further down it
+    EXPECT_EQ(df.delete_record(2), 0);
+    EXPECT_THROW(df.delete_record(2), DatabaseException);
+    EXPECT_EQ(df.delete_record(4), 0);
+    EXPECT_THROW(df.delete_record(2), DatabaseException);
+    EXPECT_THROW(df.delete_record(4), DatabaseException);
+    EXPECT_EQ(df.delete_record(3), 0);
+    EXPECT_THROW(df.delete_record(3), DatabaseException);
+    EXPECT_EQ(df.first_record(), 3);
+    
+    // The free list is intact: each slot is handed out once
+    EXPECT_EQ(df.new_record(data.data()), 3u);
+    EXPECT_EQ(df.new_record(data.data()), 4u);
+    EXPECT_EQ(df.new_record(data.data()), 2u);
+    EXPECT_EQ(df.new_record(data.data()), 6u);
+    
+    // And during a compaction: 6 moves to 1 and 5 is cut off, leaving 2 free
+    EXPECT_EQ(df.delete_record(1), 0);
+    EXPECT_EQ(df.delete_record(2), 0);
+    EXPECT_EQ(df.delete_record(5), 0);
+    CompactionOptions slice;
+    slice.max_moves = 1;
+    CompactionResult result = df.compact(slice);
+    ASSERT_FALSE(result.complete);
+    EXPECT_EQ(df.next_record(), 5);
+    EXPECT_THROW(df.delete_record(2), DatabaseException);
+    EXPECT_EQ(df.delete_record(3), 0);
+    EXPECT_THROW(df.delete_record(3), DatabaseException);
+    EXPECT_EQ(df.first_record(), 2);
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, RacingDeletesFreeARecordOnce) {
+    constexpr RPTR records = 200;
+    DataFileOptions options;
+    options.concurrent = true;
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x5A);
+    for (RPTR n = 1; n <= records; ++n) {
+        df.new_record(data.data());
+    }
+    
+    // Every thread deletes every record; one delete of each succeeds
+    std::atomic<int> deleted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (RPTR n = 1; n <= records; ++n) {
+                try {
+                    deleted += df.delete_record(n) == 0;
+                } catch (const DatabaseException& e) {
+                    EXPECT_EQ(e.code(), ErrorCode::INVALID_ARGUMENT);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(deleted.load(), static_cast<int>(records));
+    
+    // Each slot is handed out once before the file grows
+    std::vector<RPTR> reused;
+    for (RPTR n = 1; n <= records; ++n) {
+        reused.push_back(df.new_record(data.data()));
+    }
+    std::sort(reused.begin(), reused.end());
+    for (RPTR n = 1; n <= records; ++n) {
+        EXPECT_EQ(reused[n - 1], n);
+    }
+    EXPECT_EQ(df.new_record(data.data()), records + 1);
+    df.close();
+}
+
+TEST_F(DataFileTest, FreeListPersists) {
+    {
+        DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+        std::vector<uint8_t> data(RECORD_LENGTH, 1);
+        for (int i = 0; i < 3; ++i) {
+            df.new_record(data.data());
+        }
+        df.delete_record(1);
+        df.delete_record(3);
+        df.close();
+    }
+    
+    DataFile df = DataFile::open(test_file_);
+    EXPECT_EQ(df.first_record(), 3);
+    std::vector<uint8_t> data(RECORD_LENGTH, 2);
+    EXPECT_EQ(df.new_record(data.data()), 3u);
+    EXPECT_EQ(df.new_record(data.data()), 1u);
+    EXPECT_EQ(df.new_record(data.data()), 4u);
+    df.close();
+}
+
+TEST_F(DataFileTest, NewRecordsMixesFreeAndFreshSlots) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    std::vector<uint8_t> blank(RECORD_LENGTH, 0);
+    for (int i = 0; i < 4; ++i) {
+        df.new_record(blank.data());
+    }
+    df.delete_record(3);
+    
+    std::vector<RPTR> records(4);
+    std::vector<uint8_t> data(records.size() * RECORD_LENGTH);
+    for (size_t i = 0; i < records.size(); ++i) {
+        std::memset(data.data() + i * RECORD_LENGTH, static_cast<int>(0x10 + i), RECORD_LENGTH);
+    }
+    df.new_records(records, data.data());
+    
+    EXPECT_EQ(records, (std::vector<RPTR>{3, 5, 6, 7}));
+    EXPECT_EQ(df.first_record(), 0);
+    EXPECT_EQ(df.next_record(), 8);
+    
+    std::vector<uint8_t> in(RECORD_LENGTH);
+    for (size_t i = 0; i < records.size(); ++i) {
+        df.read_record(records[i], in.data());
+        EXPECT_EQ(in[0], 0x10 + i);
+        EXPECT_EQ(in[RECORD_LENGTH - 1], 0x10 + i);
+    }
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, RecordTooShortForFreeList) {
+    EXPECT_THROW(DataFile::create(test_file_, sizeof(RPTR) - 1), DatabaseException);
+}
+
+TEST_F(DataFileTest, OpenRejectsRecordsTooShortForFreeList) {
+    DataFile::create(test_file_, RECORD_LENGTH).close();
+    patch_headers([](DataFileHeader& header) { header.record_length = sizeof(RPTR) - 1; });
+    try {
+        DataFile::open(test_file_);
+        FAIL() << "Opened a file with records too short for the free-list link";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::FILE_CORRUPTED);
+    }
+}
+
+TEST_F(DataFileTest, OpenRejectsZeroRecordLength) {
+    // The block-aligned layout divides by the slot length as the file is opened
+    DataFile::create(test_file_, RECORD_LENGTH).close();
+    patch_headers([](DataFileHeader& header) {
+        header.record_length = 0;
+        header.flags |= PLDB_BLOCK_ALIGNED;
+    });
+    try {
+        DataFile::open(test_file_);
+        FAIL() << "Opened a file with zero-length records";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::FILE_CORRUPTED);
+    }
+}
+
+TEST_F(DataFileTest, ScanSkipsDeletedRecords) {
+    // 100-byte records straddle the 4 KiB blocks used here
+    constexpr uint32_t length = 100;
+    DataFile df = DataFile::create(test_file_, length);
+    
+    std::vector<uint8_t> data(length);
+    for (int i = 1; i <= 200; ++i) {
+        std::memset(data.data(), 0, length);
+        std::memcpy(data.data(), &i, sizeof(i));
+        data[length - 1] = 0xEE;
+        df.new_record(data.data());
+    }
+    df.delete_record(5);
+    df.delete_record(41);
+    df.delete_record(200);
+    
+    // A slot zeroed by hand counts as deleted too
+    std::vector<uint8_t> zeros(length, 0);
+    df.write_record(77, zeros.data());
+    
+    ScanOptions options;
+    options.block_size = 4096;
+    std::vector<RPTR> seen;
+    RecordScan scan = df.scan(options);
+    for (auto it = scan.begin(); it != scan.end(); ++it) {
+        std::span<const uint8_t> record = *it;
+        ASSERT_EQ(record.size(), length);
+        int value = 0;
+        std::memcpy(&value, record.data(), sizeof(value));
+        EXPECT_EQ(static_cast<RPTR>(value), it.record_number());
+        EXPECT_EQ(record[length - 1], 0xEE);
+        seen.push_back(it.record_number());
+    }
+    
+    EXPECT_EQ(seen.size(), 196u);
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), 5u), 0);
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), 41u), 0);
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), 77u), 0);
+    EXPECT_EQ(seen.back(), 199u);
+    
+    // Without skipping, every slot is visited
+    options.skip_deleted = false;
+    size_t all = 0;
+    for (std::span<const uint8_t> record : df.scan(options)) {
+        (void)record;
+        ++all;
+    }
+    EXPECT_EQ(all, 200u);
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, ScanRange) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    
+    std::vector<uint8_t> data(RECORD_LENGTH);
+    for (int i = 1; i <= 50; ++i) {
+        std::memset(data.data(), i, RECORD_LENGTH);
+        df.new_record(data.data());
+    }
+    
+    ScanOptions options;
+    options.first_record = 10;
+    options.last_record = 19;
+    uint8_t expected = 10;
+    for (std::span<const uint8_t> record : df.scan(options)) {
+        EXPECT_EQ(record[0], expected);
+        EXPECT_EQ(record[RECORD_LENGTH - 1], expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 20);
+    
+    options.first_record = 51;
+    options.last_record = 0;
+    RecordScan empty = df.scan(options);
+    EXPECT_TRUE(empty.begin() == empty.end());
+    
+    df.close();
+}
+
+TEST_F(DataFileTest, ScanMemoryMappedAndPooled) {
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x33);
+    {
+        DataFileOptions options;
+        options.memory_mapped = true;
+        DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+        for (int i = 0; i < 20; ++i) {
+            df.new_record(data.data());
+        }
+        df.delete_record(3);
+        
+        size_t count = 0;
+        for (std::span<const uint8_t> record : df.scan()) {
+            EXPECT_EQ(record[0], 0x33);
+            ++count;
+        }
+        EXPECT_EQ(count, 19u);
+        df.close();
+    }
+    
+    BufferPool pool(64 * 1024);
+    DataFileOptions options;
+    options.buffer_pool = &pool;
+    DataFile df = DataFile::open(test_file_, options);
+    data[0] = 0x44;
+    df.new_record(data.data());     // reuses slot 3, still only in the pool
+    
+    size_t count = 0;
+    size_t updated = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        updated += record[0] == 0x44;
+        ++count;
+    }
+    EXPECT_EQ(count, 20u);
+    EXPECT_EQ(updated, 1u);
+    df.close();
+}
+
+TEST_F(DataFileTest, ConcurrentReadersWritersAndAllocators) {
+    constexpr uint32_t length = 64;
+    constexpr RPTR initial = 2000;
+    DataFileOptions options;
+    options.concurrent = true;
+    options.record_checksums = true;
+    DataFile df = DataFile::create(test_file_, length, options);
+
+    // Every record holds its number in each 8-byte word, so torn or misplaced data shows
+    auto fill = [](RPTR value) {
+        std::array<RPTR, length / sizeof(RPTR)> words;
+        words.fill(value);
+        return words;
+    };
+    for (RPTR n = 1; n <= initial; ++n) {
+        auto words = fill(n);
+        df.new_record(words.data());
+    }
+
+    std::atomic<int> bad{0};
+    std::vector<std::thread> threads;
+    std::vector<std::vector<RPTR>> allocated(2);
+
+    // Readers of the initial records, which nobody deletes
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(static_cast<unsigned>(t));
+            std::array<RPTR, length / sizeof(RPTR)> words;
+            for (int i = 0; i < 5000; ++i) {
+                RPTR n = rng() % (initial / 2) + 1;
+                df.read_record(n, reinterpret_cast<uint8_t*>(words.data()));
+                bad += words != fill(n);
+            }
+        });
+    }
+    // Writers rewriting the upper half, each its own records, with unchanged contents
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([&, t] {
+            for (RPTR n = initial / 2 + 1 + static_cast<RPTR>(t); n <= initial; n += 2) {
+                auto words = fill(n);
+                df.write_record(n, reinterpret_cast<const uint8_t*>(words.data()));
+            }
+        });
+    }
+    // Allocators appending and deleting records of their own
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 500; ++i) {
+                auto words = fill(~RPTR{0});
+                RPTR n = df.new_record(words.data());
+                allocated[t].push_back(n);
+                if (i % 5 == 4) {
+                    df.delete_record(allocated[t][allocated[t].size() - 2]);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+
+    // No slot was handed to both allocators at once
+    std::set<RPTR> seen;
+    size_t handed_out = 0;
+    for (const auto& numbers : allocated) {
+        handed_out += numbers.size();
+        seen.insert(numbers.begin(), numbers.end());
+    }
+    EXPECT_EQ(handed_out, 1000u);
+    EXPECT_GT(seen.size(), 800u);
+    EXPECT_EQ(*seen.begin(), initial + 1);
+    EXPECT_LE(df.next_record(), initial + 1000 + 1);
+
+    df.flush();
+    size_t live = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        (void)record;
+        ++live;
+    }
+    EXPECT_EQ(live, initial + 1000 - 200);
+    df.close();
+
+    options.memory_mapped = true;
+    EXPECT_THROW(DataFile::open(test_file_, options), DatabaseException);
+}
+
+TEST_F(DataFileTest, CompactionMovesTailRecordsAndShrinks) {
+    constexpr uint32_t length = 64;
+    DataFileOptions options;
+    options.record_checksums = true;
+    DataFile df = DataFile::create(test_file_, length, options);
+
+    // Each record holds its original number, so moved records can be followed
+    std::array<RPTR, length / sizeof(RPTR)> words{};
+    for (RPTR n = 1; n <= 100; ++n) {
+        words.fill(n);
+        df.new_record(words.data());
+    }
+    // Delete 40 records, newest free slot first in the list, and the last 5 among them
+    std::set<RPTR> deleted;
+    for (RPTR n = 2; n <= 80; n += 2) {
+        deleted.insert(n);
+    }
+    for (RPTR n = 96; n <= 100; ++n) {
+        deleted.insert(n);
+    }
+    for (RPTR n : deleted) {
+        df.delete_record(n);
+    }
+    const uint64_t before = std::filesystem::file_size(test_file_);
+
+    CompactionResult result = df.compact();
+    EXPECT_TRUE(result.complete);
+    EXPECT_EQ(df.next_record(), 100 - deleted.size() + 1);
+    EXPECT_EQ(df.first_record(), 0);
+    EXPECT_EQ(result.slots_released, deleted.size());
+
+    // Tail records move into the lowest free slots, the last one first
+    std::vector<RPTR> location(101);
+    for (RPTR n = 1; n <= 100; ++n) {
+        location[n] = deleted.count(n) ? 0 : n;
+    }
+    RPTR expected_to = 2;
+    for (RecordMove move : result.moves) {
+        EXPECT_EQ(move.to, expected_to);
+        expected_to += 2;
+        EXPECT_GT(move.from, move.to);
+        location[move.from] = move.to;
+    }
+    EXPECT_EQ(result.moves.front().from, 95u);
+    for (RPTR n = 1; n <= 100; ++n) {
+        if (location[n] != 0) {
+            df.read_record(location[n], reinterpret_cast<uint8_t*>(words.data()));
+            EXPECT_EQ(words[0], n);
+            EXPECT_LT(location[n], df.next_record());
+        }
+    }
+    df.flush();
+    size_t live = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        (void)record;
+        ++live;
+    }
+    EXPECT_EQ(live, 100 - deleted.size());
+    EXPECT_EQ(before - std::filesystem::file_size(test_file_), deleted.size() * (length + sizeof(uint32_t)));
+
+    // Nothing more to do; the file still reopens and grows as usual
+    result = df.compact();
+    EXPECT_TRUE(result.complete);
+    EXPECT_TRUE(result.moves.empty());
+    df.close();
+    df = DataFile::open(test_file_);
+    EXPECT_EQ(df.next_record(), 56u);
+    words.fill(7);
+    EXPECT_EQ(df.new_record(words.data()), 56u);
+    df.close();
+
+    options.memory_mapped = true;
+    df = DataFile::open(test_file_, options);
+    EXPECT_THROW(df.compact(), DatabaseException);
+}
+
+TEST_F(DataFileTest, CompactionRunsInSlices) {
+    constexpr uint32_t length = 32;
+    DataFile df = DataFile::create(test_file_, length);
+    std::array<RPTR, length / sizeof(RPTR)> words{};
+    for (RPTR n = 1; n <= 60; ++n) {
+        words.fill(n);
+        df.new_record(words.data());
+    }
+    for (RPTR n = 1; n <= 30; n += 3) {
+        df.delete_record(n);
+    }
+
+    CompactionOptions slice;
+    slice.max_moves = 3;
+    CompactionResult result = df.compact(slice);
+    EXPECT_FALSE(result.complete);
+    ASSERT_EQ(result.moves.size(), 3u);
+    EXPECT_EQ(result.moves[0].to, 1u);
+    EXPECT_EQ(result.moves[2].to, 7u);
+    EXPECT_EQ(df.next_record(), 58u);
+
+    // Between slices the file is usable; frees and allocations keep the list in order
+    df.delete_record(5);
+    df.delete_record(40);
+    EXPECT_EQ(df.new_record(words.data()), 5u);
+    df.delete_record(5);
+
+    std::vector<RecordMove> moves = result.moves;
+    while (!result.complete) {
+        result = df.compact(slice);
+        EXPECT_LE(result.moves.size(), 3u);
+        moves.insert(moves.end(), result.moves.begin(), result.moves.end());
+    }
+    EXPECT_EQ(df.next_record(), 60 - 10 - 2 + 1);
+    EXPECT_EQ(df.first_record(), 0);
+
+    std::map<RPTR, RPTR> location;
+    for (RPTR n = 1; n <= 60; ++n) {
+        if (!(n <= 30 && n % 3 == 1) && n != 5 && n != 40) {
+            location[n] = n;
+        }
+    }
+    for (RecordMove move : moves) {
+        location[move.from] = move.to;
+    }
+    for (auto [original, current] : location) {
+        df.read_record(current, reinterpret_cast<uint8_t*>(words.data()));
+        EXPECT_EQ(words[0], original);
+        EXPECT_LT(current, df.next_record());
+    }
+    df.close();
+}
+
+TEST_F(DataFileTest, CompactionWithConcurrentReaders) {
+    constexpr uint32_t length = 64;
+    constexpr RPTR initial = 4000;
+    DataFileOptions options;
+    options.concurrent = true;
+    options.record_checksums = true;
+    DataFile df = DataFile::create(test_file_, length, options);
+    std::array<RPTR, length / sizeof(RPTR)> words{};
+    for (RPTR n = 1; n <= initial; ++n) {
+        words.fill(n);
+        df.new_record(words.data());
+    }
+    for (RPTR n = initial / 2 + 1; n <= initial; n += 2) {
+        df.delete_record(n);
+    }
+
+    // Readers of the lower half, which compaction leaves where it is
+    std::atomic<bool> done{false};
+    std::atomic<int> bad{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&, t] {
+            std::mt19937 rng(static_cast<unsigned>(t));
+            std::array<RPTR, length / sizeof(RPTR)> in;
+            while (!done) {
+                RPTR n = rng() % (initial / 2) + 1;
+                df.read_record(n, reinterpret_cast<uint8_t*>(in.data()));
+                bad += in[0] != n || in.back() != n;
+            }
+        });
+    }
+    CompactionOptions slice;
+    slice.time_budget = std::chrono::microseconds(200);
+    uint64_t moved = 0;
+    for (CompactionResult result; !result.complete; ) {
+        result = df.compact(slice);
+        moved += result.moves.size();
+    }
+    done = true;
+    for (std::thread& thread : readers) {
+        thread.join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+    EXPECT_EQ(df.next_record(), initial * 3 / 4 + 1);
+    EXPECT_EQ(moved, initial / 4 - initial / 8);
+    df.close();
+}
+
+TEST_F(DataFileTest, CompactionReturnsTheSlotWhenACopyFails) {
+    DataFileOptions options;
+    options.record_checksums = true;
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x33);
+    {
+        DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+        for (int i = 0; i < 10; ++i) {
+            df.new_record(data.data());
+        }
+        df.delete_record(2);
+        df.delete_record(3);
+        df.close();
+    }
+    
+    // Damage the last record, which the compaction moves first
+    {
+        uintmax_t size = std::filesystem::file_size(test_file_);
+        std::fstream file(test_file_, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(size - 10));
+        file.put(0x7F);
+    }
+    
+    DataFile df = DataFile::open(test_file_, options);
+    try {
+        df.compact();
+        FAIL() << "Moved a damaged record";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::FILE_CORRUPTED);
+    }
+    
+    // Both free slots are still handed out
+    EXPECT_EQ(df.first_record(), 2);
+    EXPECT_EQ(df.new_record(data.data()), 2u);
+    EXPECT_EQ(df.new_record(data.data()), 3u);
+    EXPECT_EQ(df.new_record(data.data()), 11u);
+    df.close();
+}
+
+namespace {
+DataFile* delete_during_move = nullptr;
+RPTR deleted_during_move = 0;
+void delete_on_move(Metric metric, uint64_t, uint64_t, uint64_t) {
+    // Runs once the record is copied, before compact() takes the lock again
+    if (metric == Metric::RECORD_MOVE && delete_during_move != nullptr) {
+        std::exchange(delete_during_move, nullptr)->delete_record(deleted_during_move);
+    }
+}
+} // namespace
+
+TEST_F(DataFileTest, CompactionSkipsARecordDeletedDuringTheCopy) {
+    if (!metrics_enabled()) {
+        GTEST_SKIP() << "The delete is injected through the metrics trace hook";
+    }
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    std::vector<uint8_t> data(RECORD_LENGTH);
+    for (int i = 1; i <= 10; ++i) {
+        std::fill(data.begin(), data.end(), static_cast<uint8_t>(i));
+        df.new_record(data.data());
+    }
+    df.delete_record(2);
+    
+    // Record 10 is deleted while it is copied to slot 2, so 9 moves there instead
+    delete_during_move = &df;
+    deleted_during_move = 10;
+    set_trace_hook(delete_on_move);
+    CompactionResult result = df.compact();
+    set_trace_hook(nullptr);
+    EXPECT_EQ(delete_during_move, nullptr);
+    
+    EXPECT_TRUE(result.complete);
+    ASSERT_EQ(result.moves.size(), 1u);
+    EXPECT_EQ(result.moves[0].from, 9u);
+    EXPECT_EQ(result.moves[0].to, 2u);
+    EXPECT_EQ(result.slots_released, 2u);
+    EXPECT_EQ(df.next_record(), 9);
+    EXPECT_EQ(df.first_record(), 0);
+    df.read_record(2, data.data());
+    EXPECT_EQ(data[0], 9);
+    EXPECT_EQ(data[RECORD_LENGTH - 1], 9);
+    EXPECT_EQ(df.new_record(data.data()), 9u);
+    df.close();
+}
+
+TEST_F(DataFileTest, CompactionWithConcurrentAllocators) {
+    constexpr uint32_t length = 64;
+    constexpr RPTR initial = 4000;
+    constexpr RPTR allocations = 300;
+    DataFileOptions options;
+    options.concurrent = true;
+    DataFile df = DataFile::create(test_file_, length, options);
+    std::array<RPTR, length / sizeof(RPTR)> words{};
+    for (RPTR n = 1; n <= initial; ++n) {
+        words.fill(n);
+        df.new_record(words.data());
+    }
+    for (RPTR n = initial / 2 + 2; n <= initial; n += 2) {
+        df.delete_record(n);
+    }
+
+    // Once the first slice has ordered the free list, new records take the lowest free
+    // slots, well below the records being moved.  Slices stop short of using up the free
+    // list while allocations run, as new records would then go to the end of the file.
+    CompactionOptions slice;
+    slice.max_moves = 8;
+    CompactionResult result = df.compact(slice);
+    std::vector<RecordMove> moves(result.moves.begin(), result.moves.end());
+    std::vector<RPTR> allocated;
+    std::atomic<bool> allocating{true};
+    std::thread allocator([&] {
+        std::array<RPTR, length / sizeof(RPTR)> out;
+        for (RPTR i = 0; i < allocations; ++i) {
+            out.fill(initial + 1 + i);
+            allocated.push_back(df.new_record(out.data()));
+        }
+        allocating = false;
+    });
+    while (allocating && moves.size() < initial / 16) {
+        result = df.compact(slice);
+        moves.insert(moves.end(), result.moves.begin(), result.moves.end());
+    }
+    allocator.join();
+    while (!result.complete) {
+        result = df.compact(slice);
+        moves.insert(moves.end(), result.moves.begin(), result.moves.end());
+    }
+
+    // Every slot left holds a live record, where the moves say it is
+    std::vector<RPTR> expected(initial + 1, 0);
+    for (RPTR n = 1; n <= initial; ++n) {
+        expected[n] = n <= initial / 2 || n % 2 == 1 ? n : 0;
+    }
+    for (RecordMove move : moves) {
+        expected[move.to] = expected[move.from];
+        expected[move.from] = 0;
+    }
+    for (RPTR i = 0; i < allocations; ++i) {
+        EXPECT_EQ(expected[allocated[i]], 0u);
+        expected[allocated[i]] = initial + 1 + i;
+    }
+    EXPECT_EQ(df.first_record(), 0);
+    ASSERT_EQ(df.next_record(), initial - initial / 4 + allocations + 1);
+    std::array<RPTR, length / sizeof(RPTR)> in;
+    for (RPTR n = 1; n < df.next_record(); ++n) {
+        df.read_record(n, reinterpret_cast<uint8_t*>(in.data()));
+        ASSERT_EQ(in[0], expected[n]) << "record " << n;
+        EXPECT_EQ(in.back(), expected[n]);
+    }
+    df.close();
+}
+
+TEST_F(DataFileTest, HeaderCopiesAlternateAndSurviveATornWrite) {
+    auto read_copies = [&] {
+        std::array<DataFileHeader, PLDB_HEADER_COPIES> copies{};
+        std::ifstream in(test_file_, std::ios::binary);
+        in.read(reinterpret_cast<char*>(copies.data()), sizeof(copies));
+        return copies;
+    };
+
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    std::vector<uint8_t> data(RECORD_LENGTH, 0x42);
+    for (int i = 0; i < 5; ++i) {
+        df.new_record(data.data());
+    }
+    df.flush();
+    for (int i = 0; i < 5; ++i) {
+        df.new_record(data.data());
+    }
+    df.flush();
+
+    // The copies hold the last two flushed states, a sequence number apart
+    auto copies = read_copies();
+    size_t newest = copies[1].sequence > copies[0].sequence ? 1 : 0;
+    EXPECT_EQ(copies[newest].sequence, copies[1 - newest].sequence + 1);
+    EXPECT_EQ(copies[newest].next_record, 11u);
+    EXPECT_EQ(copies[1 - newest].next_record, 6u);
+    EXPECT_EQ(current_data_file_header(copies.data(), sizeof(copies)), static_cast<int>(newest));
+
+    // An unchanged header is not written again
+    df.write_record(3, data.data());
+    df.flush();
+    df.close();
+    auto after = read_copies();
+    EXPECT_EQ(std::memcmp(after.data(), copies.data(), sizeof(copies)), 0);
+
+    // A torn write of the newest copy falls back to the one before
+    {
+        std::fstream file(test_file_, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(newest * sizeof(DataFileHeader) + offsetof(DataFileHeader, next_record)));
+        file.put(0x7F);
+    }
+    df = DataFile::open(test_file_);
+    EXPECT_EQ(df.next_record(), 6u);
+    EXPECT_EQ(df.new_record(data.data()), 6u);
+    df.close();
+
+    // The next write replaced the damaged copy
+    copies = read_copies();
+    EXPECT_EQ(current_data_file_header(copies.data(), sizeof(copies)), static_cast<int>(newest));
+    EXPECT_EQ(copies[newest].next_record, 7u);
+}
+
+TEST_F(DataFileTest, GrowthExtentPreallocatesAndTrims) {
+    DataFileOptions options;
+    options.growth_extent = 64 * 1024;
+    std::vector<uint8_t> data(RECORD_LENGTH);
+    {
+        DataFile df = DataFile::create(test_file_, RECORD_LENGTH, options);
+        for (int i = 1; i <= 100; ++i) {
+            std::memset(data.data(), i, RECORD_LENGTH);
+            df.new_record(data.data());
+        }
+    }
+
+    // The file is a whole extent; the records end where next_record says
+    EXPECT_EQ(std::filesystem::file_size(test_file_), options.growth_extent);
+    {
+        DataFile df = DataFile::open(test_file_, options);
+        EXPECT_EQ(df.next_record(), 101u);
+        std::vector<uint8_t> read_buffer(RECORD_LENGTH);
+        df.read_record(100, read_buffer.data());
+        EXPECT_EQ(read_buffer[0], 100);
+        uint64_t live = 0;
+        for (std::span<const uint8_t> record : df.scan()) {
+            EXPECT_NE(record[0], 0);
+            ++live;
+        }
+        EXPECT_EQ(live, 100u);
+
+        // Appends continue in the allocated space, past which the file grows by an extent
+        std::vector<RPTR> numbers(300);
+        std::vector<uint8_t> batch(numbers.size() * RECORD_LENGTH, 0x5A);
+        df.new_records(numbers, batch.data());
+        EXPECT_EQ(numbers.back(), 400u);
+    }
+    EXPECT_EQ(std::filesystem::file_size(test_file_), 2 * options.growth_extent);
+
+    // Trimmed on close, the file ends with its last record
+    options.trim_on_close = true;
+    {
+        DataFile df = DataFile::open(test_file_, options);
+        std::vector<uint8_t> read_buffer(RECORD_LENGTH);
+        df.read_record(400, read_buffer.data());
+        EXPECT_EQ(read_buffer[0], 0x5A);
+    }
+    EXPECT_EQ(std::filesystem::file_size(test_file_), PLDB_V3_HEADER_SIZE + 400 * RECORD_LENGTH);
+
+    // A memory-mapped file grows its mapping by whole extents and is trimmed as always
+    options.memory_mapped = true;
+    {
+        DataFile df = DataFile::open(test_file_, options);
+        df.new_record(data.data());
+    }
+    EXPECT_EQ(std::filesystem::file_size(test_file_), PLDB_V3_HEADER_SIZE + 401 * RECORD_LENGTH);
+}
+
+TEST_F(DataFileTest, AppendRecordsLeaveTheFreeListAlone) {
+    DataFile df = DataFile::create(test_file_, RECORD_LENGTH);
+    std::vector<uint8_t> data(10 * RECORD_LENGTH);
+    for (size_t i = 0; i < 10; ++i) {
+        std::memset(data.data() + i * RECORD_LENGTH, static_cast<int>(i + 1), RECORD_LENGTH);
+    }
+    EXPECT_EQ(df.append_records(data.data(), 10), 1u);
+    df.delete_record(4);
+
+    // Appended past the end, not into the deleted record
+    EXPECT_EQ(df.append_records(data.data(), 3), 11u);
+    EXPECT_EQ(df.next_record(), 14u);
+    EXPECT_EQ(df.first_record(), 4u);
+
+    std::array<uint8_t, RECORD_LENGTH> buffer{};
+    df.read_record(13, buffer.data());
+    EXPECT_EQ(buffer[0], 3);
+    df.read_record(10, buffer.data());
+    EXPECT_EQ(buffer[RECORD_LENGTH - 1], 10);
+    EXPECT_THROW(df.append_records(nullptr, 1), DatabaseException);
+}
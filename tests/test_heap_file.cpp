@@ -0,0 +1,266 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/heap_file.hpp"
+#include "pentaledger/types.hpp"
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+// length bytes that depend on seed, so that records cannot be confused
+std::vector<uint8_t> make_record(uint32_t seed, uint32_t length) {
+    std::vector<uint8_t> record(length);
+    for (uint32_t i = 0; i < length; ++i) {
+        record[i] = static_cast<uint8_t>(seed * 31 + i * 7);
+    }
+    return record;
+}
+
+} // namespace
+
+class HeapFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_heap_file.dat";
+        std::filesystem::remove(test_file_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+    }
+
+    // Small pages, so that a few hundred records span several of them
+    static HeapFileOptions small_pages() {
+        HeapFileOptions options;
+        options.page_size = PAGE_SIZE;
+        return options;
+    }
+
+    std::string test_file_;
+};
+
+TEST_F(HeapFileTest, VariableLengthRecordsRoundTrip) {
+    std::map<RPTR, std::vector<uint8_t>> expected;
+    uint64_t bytes = 0;
+    {
+        HeapFile hf = HeapFile::create(test_file_, small_pages());
+        for (uint32_t i = 0; i < 500; ++i) {
+            auto record = make_record(i, (i * 37) % 600);
+            RPTR n = hf.new_record(record.data(), static_cast<uint32_t>(record.size()));
+            EXPECT_TRUE(expected.emplace(n, record).second);
+            bytes += record.size();
+        }
+        EXPECT_EQ(hf.record_count(), 500u);
+        EXPECT_EQ(hf.record_bytes(), bytes);
+    }
+
+    HeapFile hf = HeapFile::open(test_file_);
+    EXPECT_EQ(hf.page_size(), PAGE_SIZE);
+    EXPECT_EQ(hf.record_count(), 500u);
+
+    // Little more than the data itself, where padding to the longest record would double it
+    EXPECT_LT(hf.file_size(), bytes * 5 / 4);
+    EXPECT_GT(599u * 500u, hf.file_size() * 3 / 2);
+
+    std::vector<uint8_t> record;
+    for (const auto& [n, data] : expected) {
+        hf.read_record(n, record);
+        EXPECT_EQ(record, data) << "record " << n;
+        EXPECT_EQ(hf.record_size(n), data.size());
+    }
+
+    // A scan visits each record once, under its number
+    size_t visited = 0;
+    HeapScan scan = hf.scan();
+    for (auto it = scan.begin(); it != scan.end(); ++it) {
+        ASSERT_TRUE(expected.count(it.record_number()));
+        std::span<const uint8_t> view = *it;
+        EXPECT_EQ(std::vector<uint8_t>(view.begin(), view.end()), expected[it.record_number()]);
+        ++visited;
+    }
+    EXPECT_EQ(visited, expected.size());
+
+    EXPECT_THROW(hf.read_record(0, record), DatabaseException);
+    EXPECT_THROW(hf.read_record(RPTR{1} << 16, record), DatabaseException);
+    EXPECT_THROW(hf.read_record(expected.rbegin()->first + 1, record), DatabaseException);
+}
+
+TEST_F(HeapFileTest, RecordsThatOutgrowTheirPageKeepTheirNumbers) {
+    HeapFile hf = HeapFile::create(test_file_, small_pages());
+
+    // Fill one page with 100-byte records
+    std::vector<RPTR> numbers;
+    for (uint32_t i = 0; i < 36; ++i) {
+        auto record = make_record(i, 100);
+        numbers.push_back(hf.new_record(record.data(), 100));
+    }
+    ASSERT_EQ(numbers.front() >> 16, numbers.back() >> 16);
+    const uint64_t pages = hf.page_count();
+
+    // Growing one record past the page's room moves it, and its number still reads it
+    RPTR grown = numbers[5];
+    auto large = make_record(1000, 2000);
+    hf.write_record(grown, large.data(), 2000);
+    EXPECT_GT(hf.page_count(), pages);
+    std::vector<uint8_t> record;
+    hf.read_record(grown, record);
+    EXPECT_EQ(record, large);
+
+    // Growing it again rewrites it where it moved to, still through one link
+    auto larger = make_record(1001, 3000);
+    hf.write_record(grown, larger.data(), 3000);
+    hf.read_record(grown, record);
+    EXPECT_EQ(record, larger);
+
+    // Shrunk, it fits back in its home page
+    auto small = make_record(1002, 50);
+    hf.write_record(grown, small.data(), 50);
+    hf.read_record(grown, record);
+    EXPECT_EQ(record, small);
+
+    // Neighbours are untouched, and the scan sees the moved record once
+    for (uint32_t i = 0; i < numbers.size(); ++i) {
+        if (numbers[i] != grown) {
+            hf.read_record(numbers[i], record);
+            EXPECT_EQ(record, make_record(i, 100));
+        }
+    }
+    size_t visited = 0;
+    for (std::span<const uint8_t> view : hf.scan()) {
+        (void)view;
+        ++visited;
+    }
+    EXPECT_EQ(visited, numbers.size());
+    EXPECT_EQ(hf.record_bytes(), 35u * 100u + 50u);
+
+    // Moved and then deleted, it frees both slots
+    hf.write_record(numbers[6], larger.data(), 3000);
+    EXPECT_EQ(hf.delete_record(numbers[6]), 0);
+    EXPECT_THROW(hf.read_record(numbers[6], record), DatabaseException);
+    EXPECT_EQ(hf.record_count(), numbers.size() - 1);
+}
+
+TEST_F(HeapFileTest, LargeRecordsUseOverflowChains) {
+    auto blob = make_record(7, 100'000);
+    RPTR small_before;
+    RPTR big;
+    RPTR small_after;
+    {
+        HeapFile hf = HeapFile::create(test_file_, small_pages());
+        auto small = make_record(1, 10);
+        small_before = hf.new_record(small.data(), 10);
+        big = hf.new_record(blob.data(), static_cast<uint32_t>(blob.size()));
+        small_after = hf.new_record(small.data(), 10);
+
+        // The descriptor stays in the data page with the small records
+        EXPECT_EQ(big >> 16, small_before >> 16);
+        EXPECT_EQ(small_after >> 16, small_before >> 16);
+    }
+
+    HeapFile hf = HeapFile::open(test_file_);
+    std::vector<uint8_t> record;
+    hf.read_record(big, record);
+    EXPECT_EQ(record, blob);
+    EXPECT_EQ(hf.record_size(big), blob.size());
+
+    // Rewriting it shorter gives pages back, and later chains take them first
+    const uint64_t pages = hf.page_count();
+    auto shorter = make_record(8, 30'000);
+    hf.write_record(big, shorter.data(), static_cast<uint32_t>(shorter.size()));
+    hf.read_record(big, record);
+    EXPECT_EQ(record, shorter);
+    auto other = make_record(9, 60'000);
+    RPTR second = hf.new_record(other.data(), static_cast<uint32_t>(other.size()));
+    EXPECT_EQ(hf.page_count(), pages);
+    hf.read_record(second, record);
+    EXPECT_EQ(record, other);
+
+    hf.delete_record(big);
+    hf.delete_record(second);
+    hf.new_record(blob.data(), static_cast<uint32_t>(blob.size()));
+    EXPECT_EQ(hf.page_count(), pages);
+
+    size_t visited = 0;
+    uint64_t bytes = 0;
+    for (std::span<const uint8_t> view : hf.scan()) {
+        ++visited;
+        bytes += view.size();
+    }
+    EXPECT_EQ(visited, 3u);
+    EXPECT_EQ(bytes, blob.size() + 20);
+    EXPECT_EQ(hf.record_bytes(), bytes);
+}
+
+TEST_F(HeapFileTest, FreedSpaceIsReused) {
+    std::vector<RPTR> numbers;
+    {
+        HeapFile hf = HeapFile::create(test_file_, small_pages());
+        for (uint32_t i = 0; i < 400; ++i) {
+            auto record = make_record(i, 200);
+            numbers.push_back(hf.new_record(record.data(), 200));
+        }
+        // Free space in every page
+        for (size_t i = 0; i < numbers.size(); i += 2) {
+            hf.delete_record(numbers[i]);
+        }
+    }
+
+    // The free-space map, read back, steers new records into the holes
+    HeapFile hf = HeapFile::open(test_file_);
+    const uint64_t pages = hf.page_count();
+    EXPECT_EQ(hf.record_count(), 200u);
+    std::vector<uint8_t> record;
+    for (uint32_t i = 0; i < 200; ++i) {
+        auto data = make_record(1000 + i, 150 + i % 50);
+        RPTR n = hf.new_record(data.data(), static_cast<uint32_t>(data.size()));
+        hf.read_record(n, record);
+        EXPECT_EQ(record, data);
+    }
+    EXPECT_EQ(hf.page_count(), pages);
+
+    for (size_t i = 1; i < numbers.size(); i += 2) {
+        hf.read_record(numbers[i], record);
+        EXPECT_EQ(record, make_record(static_cast<uint32_t>(i), 200));
+    }
+}
+
+TEST_F(HeapFileTest, InvalidFilesAndOptionsAreRejected) {
+    HeapFileOptions odd;
+    odd.page_size = 5000;
+    EXPECT_THROW(HeapFile::create(test_file_, odd), DatabaseException);
+    HeapFileOptions huge;
+    huge.page_size = HeapFile::MAX_PAGE_SIZE * 2;
+    EXPECT_THROW(HeapFile::create(test_file_, huge), DatabaseException);
+
+    {
+        HeapFile hf = HeapFile::create(test_file_);
+        auto record = make_record(1, 10);
+        hf.new_record(record.data(), 10);
+    }
+    std::filesystem::resize_file(test_file_, 8192 * 2);
+    EXPECT_THROW(HeapFile::open(test_file_), DatabaseException);
+    EXPECT_EQ(std::filesystem::file_size(test_file_), 8192u * 2);
+
+    EXPECT_THROW(HeapFile::open("no_such_heap_file.dat"), DatabaseException);
+}
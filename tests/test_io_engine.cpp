@@ -0,0 +1,249 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/io_engine.hpp"
+#include "pentaledger/data_file.hpp"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <latch>
+#include <vector>
+#include <fcntl.h>
+
+using namespace pentaledger;
+
+namespace {
+
+// Fire-and-forget coroutine for driving the awaitables
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+} // namespace
+
+// Runs each test against io_uring (when the kernel offers it) and the thread pool
+class IoEngineTest : public ::testing::TestWithParam<bool> {
+protected:
+    void SetUp() override {
+        test_file_ = "test_io_engine.dat";
+        std::filesystem::remove(test_file_);
+        
+        IoEngineOptions options;
+        options.force_thread_pool = GetParam();
+        engine_ = IoEngine::create(options);
+        if (!GetParam() && std::string(engine_->name()) != "io_uring") {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+    }
+    
+    void TearDown() override {
+        engine_.reset();
+        std::filesystem::remove(test_file_);
+    }
+    
+    std::string test_file_;
+    std::unique_ptr<IoEngine> engine_;
+};
+
+TEST_P(IoEngineTest, RequestsWithCallbacks) {
+    PosixFile file;
+    ASSERT_TRUE(file.open(test_file_, O_RDWR | O_CREAT | O_TRUNC));
+    
+    constexpr size_t count = 64;
+    constexpr size_t length = 512;
+    std::vector<uint8_t> out(count * length);
+    std::vector<IoRequest> requests(count);
+    std::vector<IoRequest*> batch;
+    std::latch written(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::memset(out.data() + i * length, static_cast<int>(i), length);
+        IoRequest& r = requests[i];
+        r.fd = file.fd();
+        r.buffer = out.data() + i * length;
+        r.length = length;
+        r.offset = i * length;
+        r.write = true;
+        r.user_data = &written;
+        r.callback = [](IoRequest& done) { static_cast<std::latch*>(done.user_data)->count_down(); };
+        batch.push_back(&r);
+    }
+    engine_->submit(batch);
+    written.wait();
+    for (const IoRequest& r : requests) {
+        EXPECT_EQ(r.result, static_cast<ssize_t>(length));
+    }
+    
+    // Read back, plus one read that runs into the end of the file
+    std::vector<uint8_t> in(count * length + length, 0xFF);
+    std::latch read(count + 1);
+    for (size_t i = 0; i <= count; ++i) {
+        IoRequest& r = i < count ? requests[i] : requests.emplace_back();
+        r = IoRequest{};
+        r.fd = file.fd();
+        r.buffer = in.data() + i * length;
+        r.length = length;
+        r.offset = i * length - (i == count ? length / 2 : 0);
+        r.user_data = &read;
+        r.callback = [](IoRequest& done) { static_cast<std::latch*>(done.user_data)->count_down(); };
+    }
+    {
+        IoEngine::Batch submit_together(*engine_);
+        for (IoRequest& r : requests) {
+            engine_->submit(r);
+        }
+    }
+    read.wait();
+    
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(requests[i].result, static_cast<ssize_t>(length));
+        EXPECT_EQ(in[i * length], static_cast<uint8_t>(i));
+        EXPECT_EQ(in[i * length + length - 1], static_cast<uint8_t>(i));
+    }
+    EXPECT_EQ(requests[count].result, static_cast<ssize_t>(length / 2));
+}
+
+TEST_P(IoEngineTest, CoroutinesOverDataFile) {
+    constexpr uint32_t length = 128;
+    constexpr int records = 200;
+    DataFileOptions options;
+    options.io_engine = engine_.get();
+    DataFile df = DataFile::create(test_file_, length, options);
+    
+    std::vector<uint8_t> blank(length, 0);
+    for (int i = 0; i < records; ++i) {
+        df.new_record(blank.data());
+    }
+    
+    // Write every record from its own coroutine, all submitted together
+    std::vector<std::vector<uint8_t>> data(records, std::vector<uint8_t>(length));
+    std::latch written(records);
+    auto writer = [&](RPTR record) -> Task {
+        std::memset(data[record - 1].data(), static_cast<int>(record), length);
+        co_await df.async_write_record(record, data[record - 1].data());
+        written.count_down();
+    };
+    {
+        IoEngine::Batch batch(*engine_);
+        for (int i = 1; i <= records; ++i) {
+            writer(i);
+        }
+    }
+    written.wait();
+    
+    // Each reader reads two records in turn
+    std::vector<std::vector<uint8_t>> in(records, std::vector<uint8_t>(length, 0));
+    std::atomic<int> mismatches{0};
+    std::latch read(records / 2);
+    auto reader = [&](RPTR first) -> Task {
+        for (RPTR record : {first, first + 1}) {
+            co_await df.async_read_record(record, in[record - 1].data());
+            if (in[record - 1][0] != static_cast<uint8_t>(record) || in[record - 1][length - 1] != static_cast<uint8_t>(record)) {
+                ++mismatches;
+            }
+        }
+        read.count_down();
+    };
+    for (int i = 1; i <= records; i += 2) {
+        reader(i);
+    }
+    read.wait();
+    EXPECT_EQ(mismatches.load(), 0);
+    
+    // And the synchronous API sees the same data
+    std::vector<uint8_t> buffer(length);
+    df.read_record(records, buffer.data());
+    EXPECT_EQ(buffer[0], static_cast<uint8_t>(records));
+    
+    EXPECT_THROW(df.async_read_record(0, buffer.data()), DatabaseException);
+    EXPECT_THROW(df.async_read_record(records + 1, buffer.data()), DatabaseException);
+    df.close();
+}
+
+TEST_P(IoEngineTest, RegisteredBuffers) {
+    constexpr uint32_t length = 256;
+    DataFileOptions options;
+    options.io_engine = engine_.get();
+    DataFile df = DataFile::create(test_file_, length, options);
+    
+    std::vector<uint8_t> data(length, 0x7C);
+    for (int i = 0; i < 8; ++i) {
+        df.new_record(data.data());
+    }
+    
+    std::vector<uint8_t> arena(8 * length, 0);
+    struct iovec iov = {arena.data(), arena.size()};
+    EXPECT_TRUE(engine_->register_buffers(std::span<const struct iovec>(&iov, 1)));
+    
+    std::latch done(8);
+    std::atomic<int> failures{0};
+    auto reader = [&](RPTR record) -> Task {
+        try {
+            co_await df.async_read_record(record, arena.data() + (record - 1) * length, 0);
+        } catch (const DatabaseException&) {
+            ++failures;
+        }
+        done.count_down();
+    };
+    for (int i = 1; i <= 8; ++i) {
+        reader(i);
+    }
+    done.wait();
+    
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(arena[0], 0x7C);
+    EXPECT_EQ(arena[arena.size() - 1], 0x7C);
+    EXPECT_TRUE(engine_->register_buffers({}));
+    df.close();
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, IoEngineTest, ::testing::Values(false, true),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                             return info.param ? "ThreadPool" : "IoUring";
+                         });
+
+TEST(IoEngine, MemoryMappedCompletesImmediately) {
+    const std::string path = "test_io_engine_mapped.dat";
+    DataFileOptions options;
+    options.memory_mapped = true;
+    DataFile df = DataFile::create(path, 64, options);
+    
+    std::vector<uint8_t> data(64, 0x21);
+    df.new_record(data.data());
+    
+    bool finished = false;
+    std::vector<uint8_t> in(64, 0);
+    auto task = [&]() -> Task {
+        co_await df.async_write_record(1, data.data());
+        co_await df.async_read_record(1, in.data());
+        finished = true;
+    };
+    task();
+    
+    // No engine thread was involved, so the coroutine ran to completion inline
+    EXPECT_TRUE(finished);
+    EXPECT_EQ(in[0], 0x21);
+    df.close();
+    std::filesystem::remove(path);
+}
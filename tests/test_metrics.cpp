@@ -0,0 +1,146 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/metrics.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/btree_file.hpp"
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+
+class MetricsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        if (!metrics_enabled()) {
+            GTEST_SKIP() << "Built with PENTALEDGER_ENABLE_METRICS=OFF";
+        }
+        test_file_ = "test_metrics.dat";
+        std::filesystem::remove(test_file_);
+        metrics_reset();
+    }
+    
+    void TearDown() override {
+        set_trace_hook(nullptr);
+        std::filesystem::remove(test_file_);
+    }
+    
+    std::string test_file_;
+};
+
+TEST_F(MetricsTest, BucketsCoverValues) {
+    // Every value lies within its bucket, and buckets are ordered
+    uint64_t previous_bound = 0;
+    for (uint64_t v : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 1000ULL, 123456789ULL, 1ULL << 40}) {
+        size_t bucket = LatencyBuckets::index(v);
+        EXPECT_LT(bucket, LatencyBuckets::COUNT);
+        EXPECT_GE(LatencyBuckets::upper_bound(bucket), v);
+        EXPECT_GE(LatencyBuckets::upper_bound(bucket), previous_bound);
+        if (bucket > 0) {
+            EXPECT_LT(LatencyBuckets::upper_bound(bucket - 1), v);
+        }
+        previous_bound = LatencyBuckets::upper_bound(bucket);
+    }
+    EXPECT_EQ(LatencyBuckets::index(~0ULL), LatencyBuckets::COUNT - 1);
+}
+
+TEST_F(MetricsTest, Percentiles) {
+    for (uint64_t i = 1; i <= 100; ++i) {
+        metrics_record(Metric::RECORD_READ, 0, i * 1000, 8);
+    }
+    
+    MetricSnapshot m = metrics_snapshot()[Metric::RECORD_READ];
+    EXPECT_EQ(m.count, 100u);
+    EXPECT_EQ(m.bytes, 800u);
+    EXPECT_EQ(m.max_ns, 100000u);
+    EXPECT_EQ(m.mean_ns(), 50500u);
+    
+    // Within the 6.25% bucket width
+    EXPECT_NEAR(static_cast<double>(m.percentile_ns(0.5)), 50000.0, 50000.0 * 0.0625);
+    EXPECT_NEAR(static_cast<double>(m.percentile_ns(0.99)), 99000.0, 99000.0 * 0.0625);
+    EXPECT_EQ(m.percentile_ns(1.0), 100000u);
+}
+
+TEST_F(MetricsTest, StorageOperationsAreCounted) {
+    {
+        DataFile df = DataFile::create(test_file_, 64);
+        std::vector<uint8_t> data(64, 7);
+        RPTR record = df.new_record(data.data());
+        df.read_record(record, data.data());
+        df.flush();
+        df.close();
+    }
+    
+    MetricsSnapshot snapshot = metrics_snapshot();
+    EXPECT_EQ(snapshot[Metric::RECORD_ALLOCATE].count, 1u);
+    EXPECT_EQ(snapshot[Metric::RECORD_WRITE].count, 1u);
+    EXPECT_EQ(snapshot[Metric::RECORD_WRITE].bytes, 64u);
+    EXPECT_EQ(snapshot[Metric::RECORD_READ].count, 1u);
+    EXPECT_EQ(snapshot[Metric::FLUSH].count, 1u);
+    EXPECT_GE(snapshot[Metric::HEADER_WRITE].count, 2u);
+    
+    std::string json = snapshot.to_json();
+    EXPECT_NE(json.find("\"enabled\":true"), std::string::npos);
+    EXPECT_NE(json.find("\"record_write\":{\"count\":1,\"bytes\":64"), std::string::npos);
+    EXPECT_NE(json.find("\"node_read\""), std::string::npos);
+}
+
+TEST_F(MetricsTest, ExitedThreadsAreKept) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 1000; ++i) {
+                metrics_record(Metric::NODE_READ, 0, 100, 1);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    EXPECT_EQ(metrics_snapshot()[Metric::NODE_READ].count, 4000u);
+    metrics_reset();
+    EXPECT_EQ(metrics_snapshot()[Metric::NODE_READ].count, 0u);
+}
+
+namespace {
+int traced = 0;
+void count_trace(Metric metric, uint64_t, uint64_t, uint64_t) {
+    if (metric == Metric::RECORD_WRITE) {
+        ++traced;
+    }
+}
+} // namespace
+
+TEST_F(MetricsTest, TraceHook) {
+    traced = 0;
+    set_trace_hook(count_trace);
+    
+    DataFile df = DataFile::create(test_file_, 64);
+    std::vector<uint8_t> data(64, 1);
+    df.new_record(data.data());
+    df.new_record(data.data());
+    
+    set_trace_hook(nullptr);
+    df.new_record(data.data());
+    df.close();
+    
+    EXPECT_EQ(traced, 2);
+}
@@ -0,0 +1,233 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/pax_file.hpp"
+#include "pentaledger/types.hpp"
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+// id (8 bytes), quantity (4), price (8), note (12)
+constexpr std::array<uint32_t, 4> COLUMNS = {8, 4, 8, 12};
+constexpr uint32_t LENGTH = 32;
+
+std::array<uint8_t, LENGTH> make_row(uint64_t id) {
+    std::array<uint8_t, LENGTH> row{};
+    uint32_t quantity = static_cast<uint32_t>(id * 3);
+    double price = static_cast<double>(id) / 4.0;
+    std::memcpy(row.data(), &id, 8);
+    std::memcpy(row.data() + 8, &quantity, 4);
+    std::memcpy(row.data() + 12, &price, 8);
+    std::snprintf(reinterpret_cast<char*>(row.data() + 20), 12, "note %llu", static_cast<unsigned long long>(id));
+    return row;
+}
+
+} // namespace
+
+class PaxFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_pax_file.dat";
+        std::filesystem::remove(test_file_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+    }
+
+    // Small pages, so that a few hundred records span several of them
+    static PaxFileOptions small_pages() {
+        PaxFileOptions options;
+        options.page_size = PAGE_SIZE;
+        return options;
+    }
+
+    std::string test_file_;
+};
+
+TEST_F(PaxFileTest, RecordsRoundTripAcrossPages) {
+    std::vector<RPTR> records;
+    {
+        PaxFile pf = PaxFile::create(test_file_, COLUMNS, small_pages());
+        EXPECT_EQ(pf.record_length(), LENGTH);
+        EXPECT_EQ(pf.records_per_page(), PAGE_SIZE / LENGTH);
+
+        for (uint64_t id = 1; id <= 1000; ++id) {
+            auto row = make_row(id);
+            records.push_back(pf.new_record(row.data()));
+        }
+        EXPECT_EQ(records.back(), 1000u);
+    }
+
+    PaxFile pf = PaxFile::open(test_file_);
+    EXPECT_EQ(pf.column_count(), COLUMNS.size());
+    EXPECT_EQ(pf.column_size(3), 12u);
+    EXPECT_EQ(pf.next_record(), 1001u);
+
+    std::array<uint8_t, LENGTH> row{};
+    for (uint64_t id : {1ull, 128ull, 129ull, 1000ull}) {
+        pf.read_record(records[id - 1], row.data());
+        EXPECT_EQ(row, make_row(id)) << "record " << id;
+    }
+
+    double price = 0;
+    pf.read_field(500, 2, reinterpret_cast<uint8_t*>(&price));
+    EXPECT_DOUBLE_EQ(price, 125.0);
+
+    auto updated = make_row(9999);
+    pf.write_record(500, updated.data());
+    pf.read_record(500, row.data());
+    EXPECT_EQ(row, updated);
+
+    EXPECT_THROW(pf.read_record(0, row.data()), DatabaseException);
+    EXPECT_THROW(pf.read_record(1001, row.data()), DatabaseException);
+    EXPECT_THROW(pf.read_field(1, 4, row.data()), DatabaseException);
+}
+
+TEST_F(PaxFileTest, DeletedRecordsAreReused) {
+    PaxFile pf = PaxFile::create(test_file_, COLUMNS, small_pages());
+    for (uint64_t id = 1; id <= 10; ++id) {
+        auto row = make_row(id);
+        pf.new_record(row.data());
+    }
+
+    pf.delete_record(3);
+    pf.delete_record(7);
+    EXPECT_EQ(pf.first_record(), 7u);
+
+    // A deleted record is zero apart from the free-list link
+    std::array<uint8_t, LENGTH> row{};
+    pf.read_record(7, row.data());
+    RPTR link = 0;
+    std::memcpy(&link, row.data(), sizeof(link));
+    EXPECT_EQ(link, 3u);
+
+    auto row_a = make_row(100);
+    auto row_b = make_row(200);
+    auto row_c = make_row(300);
+    EXPECT_EQ(pf.new_record(row_a.data()), 7u);
+    EXPECT_EQ(pf.new_record(row_b.data()), 3u);
+    EXPECT_EQ(pf.new_record(row_c.data()), 11u);
+
+    pf.read_record(3, row.data());
+    EXPECT_EQ(row, row_b);
+}
+
+TEST_F(PaxFileTest, DeletingAFreeRecordThrows) {
+    PaxFile pf = PaxFile::create(test_file_, COLUMNS, small_pages());
+    for (uint64_t id = 1; id <= 10; ++id) {
+        auto row = make_row(id);
+        pf.new_record(row.data());
+    }
+
+    // Both at the head of the free list and further down it, and after reopening
+    pf.delete_record(3);
+    EXPECT_THROW(pf.delete_record(3), DatabaseException);
+    pf.delete_record(7);
+    EXPECT_THROW(pf.delete_record(3), DatabaseException);
+    EXPECT_THROW(pf.delete_record(7), DatabaseException);
+    pf.close();
+    pf = PaxFile::open(test_file_);
+    try {
+        pf.delete_record(7);
+        FAIL() << "Deleted a free record";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::INVALID_ARGUMENT);
+    }
+
+    // The free list is intact: each record is handed out once
+    auto row = make_row(100);
+    EXPECT_EQ(pf.new_record(row.data()), 7u);
+    EXPECT_EQ(pf.new_record(row.data()), 3u);
+    EXPECT_EQ(pf.new_record(row.data()), 11u);
+    pf.delete_record(7);
+    EXPECT_EQ(pf.new_record(row.data()), 7u);
+}
+
+TEST_F(PaxFileTest, ColumnScanReadsProjectedLiveValues) {
+    const uint64_t count = 300;
+    {
+        PaxFile pf = PaxFile::create(test_file_, COLUMNS, small_pages());
+        for (uint64_t id = 1; id <= count; ++id) {
+            auto row = make_row(id);
+            pf.new_record(row.data());
+        }
+        pf.delete_record(2);
+        pf.delete_record(200);
+    }
+
+    PaxFile pf = PaxFile::open(test_file_);
+    const std::array<uint32_t, 2> projection = {2, 1};
+
+    uint64_t rows = 0;
+    uint64_t quantity_sum = 0;
+    double price_sum = 0;
+    RPTR expected_first = 1;
+    for (const PaxBatch& batch : pf.scan_columns(projection)) {
+        EXPECT_EQ(batch.first_record(), expected_first);
+        for (uint32_t row = 0; row < batch.size(); ++row) {
+            if (!batch.live(row)) {
+                continue;
+            }
+            ++rows;
+            price_sum += batch.value<double>(0, row);
+            quantity_sum += batch.value<uint32_t>(1, row);
+        }
+        expected_first += batch.size();
+    }
+    EXPECT_EQ(expected_first, count + 1);
+
+    uint64_t expected_quantity = 0;
+    double expected_price = 0;
+    for (uint64_t id = 1; id <= count; ++id) {
+        if (id != 2 && id != 200) {
+            expected_quantity += id * 3;
+            expected_price += static_cast<double>(id) / 4.0;
+        }
+    }
+    EXPECT_EQ(rows, count - 2);
+    EXPECT_EQ(quantity_sum, expected_quantity);
+    EXPECT_DOUBLE_EQ(price_sum, expected_price);
+
+    const std::array<uint32_t, 1> bad = {4};
+    EXPECT_THROW(pf.scan_columns(bad), DatabaseException);
+}
+
+TEST_F(PaxFileTest, InvalidLayoutsAreRejected) {
+    const std::array<uint32_t, 2> narrow = {2, 4};
+    EXPECT_THROW(PaxFile::create(test_file_, narrow), DatabaseException);
+
+    const std::array<uint32_t, 2> empty_column = {8, 0};
+    EXPECT_THROW(PaxFile::create(test_file_, empty_column), DatabaseException);
+
+    const std::array<uint32_t, 1> wide = {PAGE_SIZE + 1};
+    EXPECT_THROW(PaxFile::create(test_file_, wide, small_pages()), DatabaseException);
+
+    // So is a file too short to hold its header
+    {
+        PaxFile pf = PaxFile::create(test_file_, COLUMNS);
+    }
+    std::filesystem::resize_file(test_file_, 16);
+    EXPECT_THROW(PaxFile::open(test_file_), DatabaseException);
+}
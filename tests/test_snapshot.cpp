@@ -0,0 +1,257 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/types.hpp"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+
+namespace {
+
+constexpr uint32_t LENGTH = 32;
+
+// A record whose every word is value, so that a torn read shows as mixed words
+std::vector<uint8_t> make_record(uint64_t value) {
+    std::vector<uint8_t> record(LENGTH);
+    for (uint32_t i = 0; i < LENGTH; i += sizeof(value)) {
+        std::memcpy(record.data() + i, &value, sizeof(value));
+    }
+    return record;
+}
+
+uint64_t value_of(const uint8_t* record) {
+    uint64_t value;
+    std::memcpy(&value, record, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+class SnapshotTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_snapshot.dat";
+        std::filesystem::remove(test_file_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+    }
+
+    static DataFileOptions versioned(bool checksums = false) {
+        DataFileOptions options;
+        options.versioned = true;
+        options.concurrent = true;
+        options.record_checksums = checksums;
+        return options;
+    }
+
+    std::string test_file_;
+};
+
+TEST_F(SnapshotTest, ReadsSeeThePointInTime) {
+    DataFile df = DataFile::create(test_file_, LENGTH, versioned());
+    for (uint64_t i = 1; i <= 10; ++i) {
+        df.new_record(make_record(i).data());
+    }
+
+    Snapshot snap = df.snapshot();
+    EXPECT_EQ(snap.next_record(), 11u);
+
+    df.write_record(3, make_record(300).data());
+    df.write_record(3, make_record(301).data());
+    df.delete_record(5);
+    RPTR reused = df.new_record(make_record(500).data());
+    EXPECT_EQ(reused, 5u);
+    RPTR added = df.new_record(make_record(11).data());
+
+    std::vector<uint8_t> record(LENGTH);
+    for (RPTR n = 1; n <= 10; ++n) {
+        snap.read_record(n, record.data());
+        EXPECT_EQ(record, make_record(n)) << "record " << n;
+    }
+    EXPECT_THROW(snap.read_record(added, record.data()), DatabaseException);
+
+    // The file itself moves on
+    df.read_record(3, record.data());
+    EXPECT_EQ(value_of(record.data()), 301u);
+    df.read_record(5, record.data());
+    EXPECT_EQ(value_of(record.data()), 500u);
+
+    // A later snapshot sees the later writes
+    Snapshot later = df.snapshot();
+    EXPECT_GT(later.sequence(), snap.sequence());
+    later.read_record(3, record.data());
+    EXPECT_EQ(value_of(record.data()), 301u);
+}
+
+TEST_F(SnapshotTest, ScanSeesThePointInTime) {
+    DataFile df = DataFile::create(test_file_, LENGTH, versioned(true));
+    for (uint64_t i = 1; i <= 100; ++i) {
+        df.new_record(make_record(i).data());
+    }
+    df.delete_record(10);
+
+    Snapshot snap = df.snapshot();
+    df.delete_record(20);
+    RPTR reused = df.new_record(make_record(1000).data());
+    EXPECT_EQ(reused, 20u);
+    df.new_record(make_record(1001).data());
+    df.write_record(30, make_record(3000).data());
+    std::vector<RPTR> batch = {40, 41};
+    std::vector<ErrorCode> status(batch.size());
+    std::vector<uint8_t> data(batch.size() * LENGTH, 0xAB);
+    EXPECT_EQ(df.write_records(batch, data.data(), status), batch.size());
+
+    // Record 10 was already deleted, 20 was live, and 102 did not exist yet
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (std::span<const uint8_t> record : snap.scan()) {
+        ++count;
+        sum += value_of(record.data());
+    }
+    EXPECT_EQ(count, 99u);
+    EXPECT_EQ(sum, 100u * 101u / 2u - 10u);
+
+    count = 0;
+    for (std::span<const uint8_t> record : df.scan()) {
+        (void)record;
+        ++count;
+    }
+    EXPECT_EQ(count, 100u);
+}
+
+TEST_F(SnapshotTest, VersionsAreCollectedWhenSnapshotsClose) {
+    DataFile df = DataFile::create(test_file_, LENGTH, versioned());
+    for (uint64_t i = 1; i <= 10; ++i) {
+        df.new_record(make_record(i).data());
+    }
+
+    // Nothing is kept while no snapshot is open
+    df.write_record(1, make_record(100).data());
+    EXPECT_EQ(df.version_stats().versions, 0u);
+
+    Snapshot first = df.snapshot();
+    df.write_record(1, make_record(101).data());
+    Snapshot second = df.snapshot();
+    df.write_record(1, make_record(102).data());
+    df.write_record(2, make_record(200).data());
+
+    VersionStats stats = df.version_stats();
+    EXPECT_EQ(stats.snapshots, 2u);
+    EXPECT_EQ(stats.versions, 3u);
+    EXPECT_EQ(stats.bytes, 3u * LENGTH);
+
+    std::vector<uint8_t> record(LENGTH);
+    first.read_record(1, record.data());
+    EXPECT_EQ(value_of(record.data()), 100u);
+    second.read_record(1, record.data());
+    EXPECT_EQ(value_of(record.data()), 101u);
+
+    // Only the second snapshot needs the versions superseded after it
+    first.release();
+    EXPECT_FALSE(first.is_open());
+    EXPECT_EQ(df.version_stats().versions, 2u);
+    second.read_record(1, record.data());
+    EXPECT_EQ(value_of(record.data()), 101u);
+
+    Snapshot moved = std::move(second);
+    EXPECT_FALSE(second.is_open());
+    moved.release();
+    stats = df.version_stats();
+    EXPECT_EQ(stats.snapshots, 0u);
+    EXPECT_EQ(stats.versions, 0u);
+    EXPECT_EQ(stats.bytes, 0u);
+
+    // A record rewritten under one snapshot keeps the image the snapshot reads and the
+    // latest one, which a snapshot opened next might read
+    Snapshot third = df.snapshot();
+    for (uint64_t i = 0; i < 100; ++i) {
+        df.write_record(4, make_record(400 + i).data());
+    }
+    EXPECT_EQ(df.version_stats().versions, 2u);
+    third.read_record(4, record.data());
+    EXPECT_EQ(value_of(record.data()), 4u);
+    third.release();
+    EXPECT_EQ(df.version_stats().versions, 0u);
+
+    // Snapshots need a versioned file
+    DataFile plain = DataFile::create(test_file_ + ".plain", LENGTH);
+    EXPECT_THROW(plain.snapshot(), DatabaseException);
+    plain.close();
+    std::filesystem::remove(test_file_ + ".plain");
+}
+
+TEST_F(SnapshotTest, ConcurrentWritersDoNotDisturbSnapshotReaders) {
+    const RPTR records = 256;
+    DataFile df = DataFile::create(test_file_, LENGTH, versioned(true));
+    for (RPTR i = 1; i <= records; ++i) {
+        df.new_record(make_record(1).data());
+    }
+
+    // Writers bump every record through increasing generations.  Each snapshot must see
+    // whole records, the same through a scan as through reads, and never older than the
+    // snapshot before it saw.
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w] {
+            for (uint64_t generation = 2; !stop.load(); ++generation) {
+                for (RPTR n = 1 + w; n <= records; n += 2) {
+                    df.write_record(n, make_record(generation).data());
+                }
+            }
+        });
+    }
+
+    uint64_t snapshots = 0;
+    std::vector<uint8_t> record(LENGTH);
+    std::vector<uint64_t> seen(records + 1, 0);
+    while (snapshots < 50) {
+        Snapshot snap = df.snapshot();
+        std::vector<uint64_t> first(records + 1, 0);
+        RecordScan scan = snap.scan();
+        for (auto it = scan.begin(); it != scan.end(); ++it) {
+            std::span<const uint8_t> view = *it;
+            ASSERT_EQ(std::vector<uint8_t>(view.begin(), view.end()), make_record(value_of(view.data())));
+            first[it.record_number()] = value_of(view.data());
+        }
+
+        // Reading again, record by record, gives the same view
+        for (RPTR n = 1; n <= records; ++n) {
+            snap.read_record(n, record.data());
+            ASSERT_EQ(value_of(record.data()), first[n]) << "record " << n;
+            ASSERT_GE(first[n], seen[n]);
+            seen[n] = first[n];
+        }
+        ++snapshots;
+    }
+
+    stop = true;
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    EXPECT_EQ(df.version_stats().versions, 0u);
+}
+
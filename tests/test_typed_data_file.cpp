@@ -0,0 +1,142 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <gtest/gtest.h>
+#include "pentaledger/typed_data_file.hpp"
+#include <filesystem>
+#include <map>
+
+using namespace pentaledger;
+
+namespace {
+
+using TripSchema = Schema<Field<FieldType::INT64>,          // TRIP_ID
+                          Field<FieldType::INT32>,          // YEAR
+                          Field<FieldType::DOUBLE>,         // MILES
+                          Field<FieldType::FLOAT>,          // GALLONS
+                          Field<FieldType::STRING, 12>,     // CATEGORY
+                          Field<FieldType::BLOB, 4>>;       // FLAGS
+enum TripField { TRIP_ID, YEAR, MILES, GALLONS, CATEGORY, FLAGS };
+
+// Layout is fixed at compile time
+static_assert(TripSchema::record_length == 8 + 4 + 8 + 4 + 12 + 4);
+static_assert(TripSchema::offsets[MILES] == 12);
+static_assert(TripSchema::offsets[CATEGORY] == 24);
+static_assert(std::is_same_v<TripSchema::value_type<CATEGORY>, std::string_view>);
+
+// Records are never shorter than a free-list link
+static_assert(Schema<Field<FieldType::INT32>>::record_length == sizeof(RPTR));
+
+TypedRecord<TripSchema> make_trip(int64_t id, int32_t year, double miles, const char* category) {
+    TypedRecord<TripSchema> trip;
+    trip.set<TRIP_ID>(id);
+    trip.set<YEAR>(year);
+    trip.set<MILES>(miles);
+    trip.set<GALLONS>(miles / 25.0);
+    trip.set<CATEGORY>(category);
+    return trip;
+}
+
+} // namespace
+
+class TypedDataFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_file_ = "test_typed_data_file.dat";
+        std::filesystem::remove(test_file_);
+    }
+    
+    void TearDown() override {
+        std::filesystem::remove(test_file_);
+    }
+    
+    std::string test_file_;
+};
+
+TEST_F(TypedDataFileTest, FieldsRoundTrip) {
+    auto trips = TypedDataFile<TripSchema>::create(test_file_);
+    
+    TypedRecord<TripSchema> trip = make_trip(7, 2024, 312.5, "business");
+    std::vector<uint8_t> flags = {1, 2, 3, 4, 5};
+    trip.set<FLAGS>(flags);
+    RPTR record = trips.insert(trip);
+    
+    TypedRecord<TripSchema> read = trips.read(record);
+    EXPECT_EQ(read.get<TRIP_ID>(), 7);
+    EXPECT_EQ(read.get<YEAR>(), 2024);
+    EXPECT_DOUBLE_EQ(read.get<MILES>(), 312.5);
+    EXPECT_FLOAT_EQ(read.get<GALLONS>(), 12.5f);
+    EXPECT_EQ(read.get<CATEGORY>(), "business");
+    std::span<const uint8_t> stored = read.get<FLAGS>();
+    EXPECT_EQ(stored.size(), 4u);
+    EXPECT_EQ(stored[3], 4);
+    
+    // Strings longer than the field are truncated
+    read.set<CATEGORY>("a very long category name");
+    EXPECT_EQ(read.get<CATEGORY>(), "a very long ");
+    trips.write(record, read);
+    EXPECT_EQ(trips.read(record).get<CATEGORY>(), "a very long ");
+    
+    trips.close();
+}
+
+TEST_F(TypedDataFileTest, OpenChecksRecordLength) {
+    {
+        DataFile df = DataFile::create(test_file_, TripSchema::record_length + 1);
+        df.close();
+    }
+    try {
+        TypedDataFile<TripSchema>::open(test_file_);
+        FAIL() << "Expected a schema mismatch";
+    } catch (const DatabaseException& e) {
+        EXPECT_EQ(e.code(), ErrorCode::INVALID_SCHEMA);
+    }
+    
+    {
+        auto trips = TypedDataFile<TripSchema>::create(test_file_);
+        trips.insert(make_trip(1, 2023, 10.0, "personal"));
+        trips.close();
+    }
+    auto trips = TypedDataFile<TripSchema>::open(test_file_);
+    EXPECT_EQ(trips.read(1).get<CATEGORY>(), "personal");
+    trips.close();
+}
+
+TEST_F(TypedDataFileTest, ScanAggregatesInPlace) {
+    DataFileOptions options;
+    options.memory_mapped = true;
+    auto trips = TypedDataFile<TripSchema>::create(test_file_, options);
+    
+    const char* categories[] = {"business", "personal", "medical"};
+    for (int i = 0; i < 300; ++i) {
+        trips.insert(make_trip(i + 1, 2020 + i % 3, 10.0, categories[i % 3]));
+    }
+    trips.remove(1);
+    
+    // Per-category yearly mileage, straight from the mapping
+    std::map<std::pair<std::string, int32_t>, double> totals;
+    for (RecordView<TripSchema> trip : trips.scan()) {
+        totals[{std::string(trip.get<CATEGORY>()), trip.get<YEAR>()}] += trip.get<MILES>();
+    }
+    EXPECT_EQ(totals.size(), 3u);
+    EXPECT_DOUBLE_EQ((totals[{"business", 2020}]), 990.0);
+    EXPECT_DOUBLE_EQ((totals[{"personal", 2021}]), 1000.0);
+    
+    EXPECT_EQ(trips.view(2).get<TRIP_ID>(), 2);
+    trips.close();
+}
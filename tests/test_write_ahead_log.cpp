@@ -0,0 +1,230 @@
+/*
+ * PentaLedger
+ * Copyright (C) 2025  Joe Turner <joe@agavemountain.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include "pentaledger/write_ahead_log.hpp"
+#include "pentaledger/data_file.hpp"
+#include "pentaledger/btree_file.hpp"
+#include <filesystem>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace pentaledger;
+
+class WriteAheadLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        log_file_ = "test_wal.log";
+        data_file_ = "test_wal.dat";
+        remove_files();
+    }
+    
+    void TearDown() override {
+        remove_files();
+    }
+    
+    void remove_files() {
+        for (const std::string& path : {log_file_, data_file_}) {
+            if (std::filesystem::exists(path)) {
+                std::filesystem::remove(path);
+            }
+        }
+    }
+    
+    std::string log_file_;
+    std::string data_file_;
+    static constexpr uint32_t RECORD_LENGTH = 64;
+};
+
+TEST_F(WriteAheadLogTest, AppendCommitReplay) {
+    const uint64_t key = WriteAheadLog::file_key(data_file_);
+    {
+        WriteAheadLog wal(log_file_);
+        wal.append_write(key, 100, "alpha", 5);
+        wal.append_write(WriteAheadLog::file_key("other.dat"), 0, "xx", 2);
+        WriteAheadLog::Lsn lsn = wal.append_write(key, 200, "beta", 4);
+        wal.commit(lsn);
+        EXPECT_EQ(wal.durable_lsn(), lsn);
+        EXPECT_EQ(wal.stats().syncs, 1u);
+    }
+    
+    WriteAheadLog wal(log_file_);
+    EXPECT_EQ(wal.last_lsn(), 3u);
+    
+    std::map<uint64_t, std::string> writes;
+    wal.replay(key,
+        [&](uint64_t offset, const uint8_t* data, uint32_t length) {
+            writes[offset] = std::string(reinterpret_cast<const char*>(data), length);
+        },
+        [](uint64_t) {});
+    ASSERT_EQ(writes.size(), 2u);
+    EXPECT_EQ(writes[100], "alpha");
+    EXPECT_EQ(writes[200], "beta");
+}
+
+TEST_F(WriteAheadLogTest, TornTailIsDiscarded) {
+    const uint64_t key = WriteAheadLog::file_key(data_file_);
+    {
+        WriteAheadLog wal(log_file_);
+        wal.append_write(key, 0, "committed", 9);
+        wal.commit();
+    }
+    uintmax_t good_size = std::filesystem::file_size(log_file_);
+    
+    // Simulate a crash in the middle of a log write
+    {
+        std::ofstream out(log_file_, std::ios::binary | std::ios::app);
+        const char garbage[24] = {2, 0, 0, 0, 1, 0};
+        out.write(garbage, sizeof(garbage));
+    }
+    
+    WriteAheadLog wal(log_file_);
+    EXPECT_EQ(std::filesystem::file_size(log_file_), good_size);
+    
+    int count = 0;
+    wal.replay(key, [&](uint64_t, const uint8_t*, uint32_t) { ++count; }, [](uint64_t) {});
+    EXPECT_EQ(count, 1);
+    
+    // New records follow the valid ones
+    wal.append_write(key, 9, "next", 4);
+    wal.commit();
+    count = 0;
+    wal.replay(key, [&](uint64_t, const uint8_t*, uint32_t) { ++count; }, [](uint64_t) {});
+    EXPECT_EQ(count, 2);
+}
+
+TEST_F(WriteAheadLogTest, GroupCommitSharesSyncs) {
+    WriteAheadLogOptions options;
+    options.commit_delay = std::chrono::milliseconds(20);
+    options.group_size = 8;
+    WriteAheadLog wal(log_file_, options);
+    
+    std::vector<std::thread> committers;
+    for (int t = 0; t < 8; ++t) {
+        committers.emplace_back([&wal, t] {
+            WriteAheadLog::Lsn lsn = wal.append_write(static_cast<uint64_t>(t), 0, &t, sizeof(t));
+            wal.commit(lsn);
+        });
+    }
+    for (std::thread& t : committers) {
+        t.join();
+    }
+    
+    WriteAheadLog::Stats stats = wal.stats();
+    EXPECT_EQ(stats.commits, 8u);
+    EXPECT_LT(stats.syncs, 8u);
+    EXPECT_EQ(wal.durable_lsn(), 8u);
+}
+
+TEST_F(WriteAheadLogTest, DataFileRecoversFromLog) {
+    {
+        WriteAheadLog wal(log_file_);
+        DataFileOptions options;
+        options.wal = &wal;
+        DataFile df = DataFile::create(data_file_, RECORD_LENGTH, options);
+        std::vector<uint8_t> data(RECORD_LENGTH);
+        for (int i = 1; i <= 10; ++i) {
+            std::memset(data.data(), i, RECORD_LENGTH);
+            df.new_record(data.data());
+        }
+        df.commit();
+        df.close();
+    }
+    
+    // Lose everything but the original header, as if the data pages never reached disk
+    std::filesystem::resize_file(data_file_, PLDB_V3_HEADER_SIZE);
+    
+    WriteAheadLog wal(log_file_);
+    DataFileOptions options;
+    options.wal = &wal;
+    DataFile df = DataFile::open(data_file_, options);
+    EXPECT_EQ(df.next_record(), 11u);
+    std::vector<uint8_t> read_buffer(RECORD_LENGTH);
+    df.read_record(7, read_buffer.data());
+    EXPECT_EQ(read_buffer[0], 7);
+    df.close();
+}
+
+TEST_F(WriteAheadLogTest, CreateDiscardsEarlierHistory) {
+    WriteAheadLog wal(log_file_);
+    DataFileOptions options;
+    options.wal = &wal;
+    {
+        DataFile df = DataFile::create(data_file_, RECORD_LENGTH, options);
+        std::vector<uint8_t> data(RECORD_LENGTH, 0x33);
+        df.new_record(data.data());
+        df.new_record(data.data());
+        df.commit();
+        df.close();
+    }
+    {
+        DataFile df = DataFile::create(data_file_, RECORD_LENGTH, options);
+        df.commit();
+        df.close();
+    }
+    
+    DataFile df = DataFile::open(data_file_, options);
+    EXPECT_EQ(df.next_record(), 1u);
+    EXPECT_EQ(std::filesystem::file_size(data_file_), PLDB_V3_HEADER_SIZE);
+    df.close();
+}
+
+TEST_F(WriteAheadLogTest, BTreeFileRecoversFromLog) {
+    {
+        WriteAheadLog wal(log_file_);
+        BTreeFileOptions options;
+        options.wal = &wal;
+        BTreeFile btf = BTreeFile::create(data_file_, 16, options);
+        BTreeNode node;
+        std::memset(&node, 0, sizeof(node));
+        node.key_count = 5;
+        btf.write_node(1, node);
+        btf.commit();
+        btf.close();
+    }
+    
+    std::filesystem::resize_file(data_file_, BTREE_HEADER_SIZE);
+    
+    WriteAheadLog wal(log_file_);
+    BTreeFileOptions options;
+    options.wal = &wal;
+    BTreeFile btf = BTreeFile::open(data_file_, options);
+    BTreeNode node;
+    btf.read_node(1, node);
+    EXPECT_EQ(node.key_count, 5);
+    btf.close();
+}
+
+TEST_F(WriteAheadLogTest, CheckpointEmptiesLog) {
+    WriteAheadLog wal(log_file_);
+    wal.append_write(1, 0, "abc", 3);
+    wal.commit();
+    EXPECT_GT(std::filesystem::file_size(log_file_), 16u);
+    
+    wal.checkpoint();
+    EXPECT_EQ(std::filesystem::file_size(log_file_), 16u);
+    
+    int count = 0;
+    wal.replay(1, [&](uint64_t, const uint8_t*, uint32_t) { ++count; }, [](uint64_t) {});
+    EXPECT_EQ(count, 0);
+}
+